@@ -0,0 +1,39 @@
+#!/bin/bash
+# --verifycachefile: an unchanged file reuses its results; anything
+# else is checked again.
+. "$(dirname "$0")/lib.sh"
+
+"$SEAL" "${SIGN[@]}" -o "./%b-seal%e" "$REG"/test-unsigned.png >/dev/null 2>&1 </dev/null
+# hits ARGS...: the number of cached results used
+hits() { "$SEAL" "${VERIFY[@]}" --verifycachefile results.cache --stats "$@" 2>&1 | sed -n 's/.*"result_cache_hits":[[:space:]]*\([0-9]*\).*/\1/p' | head -1; }
+
+cp test-unsigned-seal.png cache.png
+Out=$("$SEAL" "${VERIFY[@]}" --verifycachefile results.cache cache.png 2>&1)
+expect "cache: first run" "$Out" "is valid"
+Ref="$Out"
+Out=$("$SEAL" "${VERIFY[@]}" --verifycachefile results.cache --stats cache.png 2>/dev/null)
+if [ "$Out" == "$Ref" ]; then pass "cache: same results"; else fail "cache: same results"; echo "$Out" | sed 's/^/  | /'; fi
+expect "cache: reused" "$(hits cache.png)" "^1$"
+expect "cache: reused by parallel jobs" "$(hits -j 2 cache.png test-unsigned-seal.png)" "^1$"
+
+# A new modification time is a different file
+touch -d '2001-01-01' cache.png
+expect "cache: touched file is checked" "$(hits cache.png)" "^0$"
+expect "cache: touched file is cached again" "$(hits cache.png)" "^1$"
+
+# Expired entries are checked again (the TTL applies when stored)
+touch -d '2002-02-02' cache.png
+"$SEAL" "${VERIFY[@]}" --verifycachefile results.cache --verifyttl 0 cache.png >/dev/null 2>&1
+sleep 1
+expect "cache: expired" "$(hits cache.png)" "^0$"
+
+# Same size, one byte of pixel data changed
+Size=$(stat -c %s cache.png)
+printf 'X' | dd of=cache.png bs=1 seek=$((Size/2)) conv=notrunc status=none
+Out=$("$SEAL" "${VERIFY[@]}" --verifycachefile results.cache --stats cache.png 2>&1)
+expect "cache: changed file is checked" "$Out" "is invalid"
+expect "cache: changed file is not a hit" "$Out" '"result_cache_hits":[[:space:]]*0'
+
+Out=$("$SEAL" "${VERIFY[@]}" --verifycachefile results.cache --verifyttl -5 cache.png 2>&1)
+expect "cache: bad TTL" "$Out" "ERROR: Invalid verification cache TTL (-5)"
+finish
@@ -0,0 +1,40 @@
+#!/bin/bash
+# --crc: PNG chunks with bad checksums are reported.
+. "$(dirname "$0")/lib.sh"
+
+"$SEAL" "${SIGN[@]}" -o "./%b-seal%e" "$REG"/test-unsigned.png >/dev/null 2>&1 </dev/null
+Out=$("$SEAL" "${VERIFY[@]}" --crc test-unsigned-seal.png 2>&1)
+expect "crc: signed file" "$Out" "SEAL record #1 is valid"
+reject "crc: signed chunk has a good CRC" "$Out" "WARNING"
+
+if ! $HavePython; then
+  skip "crc: chunk checksums" "needs python3"
+  finish
+fi
+
+# Private chunks of many lengths (every tail size, and a long one),
+# with checksums from Python's zlib
+python3 - test-unsigned-seal.png sizes.png <<'EOF'
+import os,struct,sys,zlib
+d=open(sys.argv[1],'rb').read(); i=d.rindex(b'IEND')-4; add=b''
+for n in list(range(20))+[100003]:
+  c=b'teSt'+os.urandom(n)
+  add+=struct.pack('>I',n)+c+struct.pack('>I',zlib.crc32(c))
+open(sys.argv[2],'wb').write(d[:i]+add+d[i:])
+EOF
+Out=$("$SEAL" "${VERIFY[@]}" --crc sizes.png 2>&1)
+reject "crc: every length matches zlib" "$Out" "WARNING"
+
+# One changed byte of pixel data
+python3 - test-unsigned-seal.png bad.png <<'EOF'
+import sys
+d=bytearray(open(sys.argv[1],'rb').read()); i=d.index(b'IDAT')
+d[i+8]^=0xff
+open(sys.argv[2],'wb').write(d)
+EOF
+Out=$("$SEAL" "${VERIFY[@]}" --crc bad.png 2>&1)
+expect "crc: bad chunk reported" "$Out" "WARNING: PNG chunk 'IDAT' at offset [0-9]* has a bad CRC"
+expect "crc: record still checked" "$Out" "SEAL record #1 is invalid"
+Out=$("$SEAL" "${VERIFY[@]}" bad.png 2>&1)
+reject "crc: not checked without --crc" "$Out" "bad CRC"
+finish
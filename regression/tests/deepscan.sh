@@ -0,0 +1,60 @@
+#!/bin/bash
+# --deepscan: JPEG records in MPF images and after the image
+. "$(dirname "$0")/lib.sh"
+
+if ! $HavePython; then skip "deepscan" "needs python3"; finish; fi
+
+###############################
+# Records that sealtool never writes, signed with openssl
+###############################
+HaveOpenssl=false
+command -v openssl >/dev/null && HaveOpenssl=true
+python3 - rsa.key "$REG"/test-unsigned.jpg $HaveOpenssl <<'EOF'
+import struct,subprocess,sys
+key,jpg,signed=sys.argv[1],open(sys.argv[2],'rb').read(),(sys.argv[3]=='true')
+PAD=b'@'*512 # hex RSA-2048 signature
+Rec=b'<seal seal="1" kv="1" ka="rsa" da="sha256" sf="hex" d="example.com" b="F~S,s~f" s="'+PAD+b'"/>'
+def sign(d):
+  i=d.index(PAD)
+  sig=subprocess.run(['openssl','dgst','-sha256','-sign',key],input=d[:i]+d[i+len(PAD):],
+                     capture_output=True,check=True).stdout
+  return d[:i]+sig.hex().encode()+d[i+len(PAD):]
+def app(t,body): return struct.pack('>HH',t,len(body)+2)+body
+def mpf(off,size): # MP index for two images; offsets are from the "II*" header
+  ifd=struct.pack('<H',3)+struct.pack('<HHI4s',0xb000,7,4,b'0100')
+  ifd+=struct.pack('<HHII',0xb001,4,1,2)+struct.pack('<HHII',0xb002,7,32,8+2+3*12+4)+struct.pack('<I',0)
+  ent=struct.pack('<IIIHH',0x20030000,0,0,0,0)+struct.pack('<IIIHH',0,size,off,0,0)
+  return app(0xffe2,b'MPF\0II*\0'+struct.pack('<I',8)+ifd+ent)
+if signed:
+  open('trailer.jpg','wb').write(sign(jpg+Rec))
+  # Secondary image with its own APP8 record, after the primary's ffd9
+  second=jpg[:2]+app(0xffe8,b'SEAL\0\0'+Rec)+jpg[2:]
+  primary=jpg[:20]+mpf(0,0)+jpg[20:] # MPF goes after APP0
+  primary=jpg[:20]+mpf(len(primary)-28,len(second))+jpg[20:]
+  open('mpf.jpg','wb').write(sign(primary+second))
+open('nob.jpg','wb').write(jpg+b'<seal seal="1" d="x.invalid" s="AAAA"/>')
+open('nos.jpg','wb').write(jpg+b'<seal seal="1" d="x.invalid" b="F~S,s~f"/>')
+EOF
+
+if $HaveOpenssl; then
+  Out=$("$SEAL" "${VERIFY[@]}" --deepscan trailer.jpg 2>&1)
+  expect "deepscan: trailer record" "$Out" "SEAL record #1 is valid"
+  Out=$("$SEAL" "${VERIFY[@]}" trailer.jpg 2>&1)
+  expect "deepscan: trailer needs --deepscan" "$Out" "No SEAL signatures found"
+  Out=$("$SEAL" "${VERIFY[@]}" --deepscan mpf.jpg 2>&1)
+  expect "deepscan: MPF image record" "$Out" "SEAL record #1 is valid"
+  Out=$("$SEAL" "${VERIFY[@]}" mpf.jpg 2>&1)
+  expect "deepscan: MPF needs --deepscan" "$Out" "No SEAL signatures found"
+else
+  skip "deepscan: signed trailer and MPF records" "needs openssl"
+fi
+
+###############################
+# Malformed records are reported (or ignored), never verified blindly
+###############################
+Out=$("$SEAL" "${VERIFY[@]}" --deepscan nob.jpg 2>&1)
+expect "deepscan: record without b=" "$Out" "SEAL record #1 is invalid: no byte range (b=)"
+Out=$("$SEAL" "${VERIFY[@]}" --deepscan nos.jpg 2>&1)
+expect "deepscan: text without s= is not a record" "$Out" "No SEAL signatures found"
+reject "deepscan: no record count warning" "$Out" "WARNING"
+finish
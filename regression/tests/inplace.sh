@@ -0,0 +1,67 @@
+#!/bin/bash
+# -O inplace: sign the original file, and undo an interrupted attempt.
+. "$(dirname "$0")/lib.sh"
+
+###############################
+# Same bytes as a new output, without a new file
+###############################
+for f in test-unsigned.png test-unsigned.wav test-unsigned.webp test-unsigned.mka test-unsigned-live.mkv; do
+  cp "$REG/$f" "in-$f"
+  Inode=$(stat -c %i "in-$f")
+  Out=$("$SEAL" "${SIGN[@]}" -O inplace "in-$f" 2>&1 </dev/null)
+  expect "inplace $f: sign" "$Out" "added: in-$f"
+  reject "inplace $f: no warning" "$Out" "WARNING"
+  if [ "$(stat -c %i "in-$f")" == "$Inode" ]; then pass "inplace $f: same file"; else fail "inplace $f: same file"; fi
+  "$SEAL" "${SIGN[@]}" -o "./out-$f" "$REG/$f" >/dev/null 2>&1 </dev/null
+  check "inplace $f: same as a new output" cmp -s "in-$f" "out-$f"
+  Out=$("$SEAL" "${VERIFY[@]}" "in-$f" 2>&1)
+  expect "inplace $f: verify" "$Out" "SEAL record #1 is valid"
+  if ls "in-$f.sealjournal" >/dev/null 2>&1; then fail "inplace $f: no journal left"; else pass "inplace $f: no journal left"; fi
+done
+
+# JPEG records go near the start, so a new file is written
+cp "$REG"/test-unsigned.jpg in.jpg
+Out=$("$SEAL" "${SIGN[@]}" -O inplace in.jpg 2>&1 </dev/null)
+expect "inplace jpg: new file" "$Out" "WARNING: Cannot sign this file in place; writing './in-seal.jpg'"
+check "inplace jpg: original unchanged" cmp -s in.jpg "$REG"/test-unsigned.jpg
+Out=$("$SEAL" "${VERIFY[@]}" in-seal.jpg 2>&1)
+expect "inplace jpg: verify" "$Out" "SEAL record #1 is valid"
+
+###############################
+# Interrupted attempts
+###############################
+if $HavePython; then
+  # Simulate a crash after step 2: the file grew and its RIFF size changed,
+  # and the journal holds the original size and header.
+  cp "$REG"/test-unsigned.wav crash.wav
+  python3 - crash.wav <<'EOF'
+import os,struct,sys
+f=sys.argv[1]; st=os.stat(f); size=st.st_size
+orig=open(f,'rb').read()
+j=b'SEALJRN1'+struct.pack('<7Q',st.st_dev,st.st_ino,size,4,4,size,0)+orig[4:8]+b'SEALDONE'
+open(f+'.sealjournal','wb').write(j)
+with open(f,'r+b') as fp:
+  fp.seek(4); fp.write(b'\xff\xff\xff\x7f')
+  fp.seek(0,2); fp.write(b'JUNK'*64)
+EOF
+  Out=$("$SEAL" "${SIGN[@]}" -O inplace crash.wav 2>&1 </dev/null)
+  expect "inplace: journal recovery" "$Out" "Restored 'crash.wav'"
+  expect "inplace: sign after recovery" "$Out" "added: crash.wav"
+  if [ -e crash.wav.sealjournal ]; then fail "inplace: journal removed"; else pass "inplace: journal removed"; fi
+  Out=$("$SEAL" "${VERIFY[@]}" crash.wav 2>&1)
+  expect "inplace: verify after recovery" "$Out" "SEAL record #1 is valid"
+  reject "inplace: no leftover data" "$Out" "record #2"
+  check "inplace: same as a new output after recovery" cmp -s crash.wav out-test-unsigned.wav
+
+  # An unfinished journal means the file was never changed
+  cp "$REG"/test-unsigned.wav partial.wav
+  printf 'SEALJRN1' > partial.wav.sealjournal
+  Out=$("$SEAL" "${SIGN[@]}" -O inplace partial.wav 2>&1 </dev/null)
+  reject "inplace: unfinished journal ignored" "$Out" "Restored"
+  expect "inplace: sign with unfinished journal" "$Out" "added: partial.wav"
+  if [ -e partial.wav.sealjournal ]; then fail "inplace: unfinished journal removed"; else pass "inplace: unfinished journal removed"; fi
+else
+  skip "inplace: journal recovery" "needs python3"
+fi
+
+finish
@@ -0,0 +1,60 @@
+#!/bin/bash
+# --files-from and --recursive: more files for one process.
+. "$(dirname "$0")/lib.sh"
+
+"$SEAL" "${SIGN[@]}" -o "./%b-seal%e" "$REG"/test-unsigned.{jpg,png,wav} >/dev/null 2>&1 </dev/null
+# names TEXT: the processed files, in order
+names() { sed -n 's/^\[\(.*\)\]$/\1/p' <<< "$1" | tr '\n' ' '; }
+
+###############################
+# --files-from: after the command line, newline or NUL separated
+###############################
+printf 'test-unsigned-seal.png\ntest-unsigned-seal.wav\n' > list
+Out=$("$SEAL" "${VERIFY[@]}" test-unsigned-seal.jpg --files-from list 2>&1)
+expect "files-from: command line first" "$(names "$Out")" "^test-unsigned-seal.jpg test-unsigned-seal.png test-unsigned-seal.wav $"
+if [ $(grep -c "is valid" <<< "$Out") == 3 ]; then pass "files-from: verify"; else fail "files-from: verify"; echo "$Out" | sed 's/^/  | /'; fi
+
+Out=$("$SEAL" "${VERIFY[@]}" --files-from - < list 2>&1)
+expect "files-from: stdin" "$(names "$Out")" "^test-unsigned-seal.png test-unsigned-seal.wav $"
+
+# NUL-separated: a newline is part of the name
+cp test-unsigned-seal.png "new
+line.png"
+printf 'new\nline.png\0test-unsigned-seal.wav\0' > list0
+Out=$("$SEAL" "${VERIFY[@]}" --files-from list0 2>&1)
+if [ $(grep -c "is valid" <<< "$Out") == 2 ]; then pass "files-from: NUL separated"; else fail "files-from: NUL separated"; echo "$Out" | sed 's/^/  | /'; fi
+
+# Newline lists longer than PATH_MAX; CRLF, blank lines, and no final newline
+for i in $(seq 300); do echo test-unsigned-seal.jpg; done > long.list
+Out=$("$SEAL" "${VERIFY[@]}" --files-from long.list 2>&1)
+expect "files-from: long list" "$(grep -c 'is valid' <<< "$Out")" "^300$"
+printf 'test-unsigned-seal.png\r\n\r\n\ntest-unsigned-seal.wav' > crlf.list
+Out=$("$SEAL" "${VERIFY[@]}" --files-from crlf.list 2>&1)
+expect "files-from: CRLF and blank lines" "$(names "$Out")" "^test-unsigned-seal.png test-unsigned-seal.wav $"
+
+Out=$("$SEAL" "${VERIFY[@]}" -j 2 test-unsigned-seal.jpg --files-from list 2>&1)
+expect "files-from -j 2: same order" "$(names "$Out")" "^test-unsigned-seal.jpg test-unsigned-seal.png test-unsigned-seal.wav $"
+
+Out=$("$SEAL" "${VERIFY[@]}" --files-from missing.list 2>&1)
+expect "files-from: missing list" "$Out" "ERROR: Cannot open file list (missing.list)"
+
+###############################
+# --recursive: every file below, without following directory links
+###############################
+mkdir -p tree/a/b other
+cp test-unsigned-seal.jpg tree/
+cp test-unsigned-seal.png tree/a/
+cp test-unsigned-seal.wav tree/a/b/
+cp test-unsigned-seal.png other/
+ln -s ../test-unsigned-seal.jpg tree/a/link.jpg
+ln -s ../other tree/other
+Want="tree/a/b/test-unsigned-seal.wav tree/a/link.jpg tree/a/test-unsigned-seal.png tree/test-unsigned-seal.jpg "
+for j in 1 3; do
+  Out=$("$SEAL" "${VERIFY[@]}" -j $j --recursive tree 2>&1)
+  expect "recursive -j $j: every file" "$(names "$Out" | tr ' ' '\n' | sort | tr '\n' ' ')" "^$Want$"
+  if [ $(grep -c "is valid" <<< "$Out") == 4 ]; then pass "recursive -j $j: verify"; else fail "recursive -j $j: verify"; echo "$Out" | sed 's/^/  | /'; fi
+done
+
+Out=$("$SEAL" "${VERIFY[@]}" --recursive missing 2>&1)
+expect "recursive: missing directory" "$Out" "ERROR: Cannot read directory (missing)"
+finish
@@ -0,0 +1,21 @@
+#!/bin/bash
+# -j: parallel output is the same as serial, in command-line order.
+. "$(dirname "$0")/lib.sh"
+
+for f in "$REG"/test-unsigned*; do
+  "$SEAL" "${SIGN[@]}" -o "./%b-seal%e" "$f" >/dev/null 2>&1 </dev/null
+done
+Files=()
+for i in 1 2 3; do Files+=(./*-seal.* "$REG"/test-badsig* "$REG"/test-unsigned*); done
+Serial=$("$SEAL" "${VERIFY[@]}" -j 1 "${Files[@]}" 2>&1)
+Parallel=$("$SEAL" "${VERIFY[@]}" -j 8 "${Files[@]}" 2>&1)
+if [ "$Serial" == "$Parallel" ]; then pass "-j verify order"; else fail "-j verify order"; diff <(echo "$Serial") <(echo "$Parallel") | head -20; fi
+
+# Signing in parallel: same results, same order
+mkdir -p j1 j4
+Serial=$("$SEAL" "${SIGN[@]}" -j 1 -o "j1/%b%e" "$REG"/test-unsigned* 2>&1 </dev/null | sed 's/j1\///')
+Parallel=$("$SEAL" "${SIGN[@]}" -j 4 -o "j4/%b%e" "$REG"/test-unsigned* 2>&1 </dev/null | sed 's/j4\///')
+if [ "$Serial" == "$Parallel" ]; then pass "-j sign order"; else fail "-j sign order"; diff <(echo "$Serial") <(echo "$Parallel") | head -20; fi
+Out=$("$SEAL" "${VERIFY[@]}" -j 4 j4/* 2>&1)
+reject "-j signed files verify" "$Out" "invalid\|No SEAL"
+finish
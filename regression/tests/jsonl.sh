@@ -0,0 +1,25 @@
+#!/bin/bash
+# --output jsonl: one JSON object per file, in command-line order.
+. "$(dirname "$0")/lib.sh"
+
+cp "$REG"/test-unsigned.{jpg,png,wav} "$REG"/test-badsig-Ff.png .
+Out=$("$SEAL" "${SIGN[@]}" --output jsonl -o "./%b-seal%e" test-unsigned.png test-unsigned.jpg 2>/dev/null </dev/null)
+expect "jsonl: signed" "$(echo "$Out" | sed -n 1p)" '^{"file":"test-unsigned.png","signed":\[{"record":1,"output":"./test-unsigned-seal.png"}\]}$'
+expect "jsonl: one line per signed file" "$(echo "$Out" | wc -l)" "^2$"
+
+Files=(test-unsigned-seal.png test-badsig-Ff.png test-unsigned.wav missing.png test-unsigned-seal.jpg)
+Ref=$("$SEAL" "${VERIFY[@]}" --output jsonl "${Files[@]}" 2>/dev/null)
+expect "jsonl: one line per file" "$(echo "$Ref" | wc -l)" "^5$"
+expect "jsonl: valid record" "$(echo "$Ref" | sed -n 1p)" '"records":\[{"record":1,"valid":true,"signed_bytes":\[\[0,[0-9]*\]'
+expect "jsonl: invalid record" "$(echo "$Ref" | sed -n 2p)" '"valid":false,"error":"signature date does not match'
+expect "jsonl: no records" "$(echo "$Ref" | sed -n 3p)" '"messages":\["No SEAL signatures found."\]'
+expect "jsonl: missing file" "$(echo "$Ref" | sed -n 4p)" '^{"file":"missing.png","messages":\["ERROR: Cannot open file (missing.png)"\]}$'
+reject "jsonl: no text results" "$Ref" "^\[\|^SEAL record"
+
+Out=$("$SEAL" "${VERIFY[@]}" --output jsonl -j 3 "${Files[@]}" 2>/dev/null)
+if [ "$Out" == "$Ref" ]; then pass "jsonl -j 3: same output"; else fail "jsonl -j 3: same output"; diff <(echo "$Ref") <(echo "$Out") | sed 's/^/  | /'; fi
+
+if $HavePython; then
+  check "jsonl: every line parses" python3 -c 'import json,sys; [json.loads(l) for l in sys.stdin]' <<< "$Ref"
+fi
+finish
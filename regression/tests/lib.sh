@@ -0,0 +1,56 @@
+####################################################################
+# SEAL regression tests: shared setup
+# See LICENSE.md
+#
+# Sourced by each test (regression/tests/*.sh).
+# Each test runs in its own temporary directory with its own keys,
+# so no DNS is needed.  Call finish at the end.
+####################################################################
+SEAL=${SEAL:-bin/sealtool}
+REG=${REG:-regression}
+case "$SEAL" in /*) ;; *) SEAL="$PWD/$SEAL" ;; esac
+case "$REG" in /*) ;; *) REG="$PWD/$REG" ;; esac
+TESTS="$REG/tests"
+BIN=$(dirname "$SEAL")
+
+T=$(mktemp -d /tmp/seal-regress.XXXXXX) || exit 1
+Pids= # background processes to stop (e.g., servers)
+trap 'for p in $Pids; do kill $p 2>/dev/null; done; rm -rf "$T"' EXIT
+export HOME="$T" # no user config file
+cd "$T" || exit 1
+
+Fail=0
+# pass/fail NAME
+pass() { echo "PASS $1"; }
+fail() { echo "FAIL $1"; Fail=$((Fail+1)); }
+# expect NAME TEXT PATTERN: TEXT must match the grep pattern
+expect() { if grep -q -- "$3" <<< "$2"; then pass "$1"; else fail "$1"; echo "$2" | sed 's/^/  | /'; fi; }
+# reject NAME TEXT PATTERN: TEXT must not match the grep pattern
+reject() { if grep -q -- "$3" <<< "$2"; then fail "$1"; echo "$2" | sed 's/^/  | /'; else pass "$1"; fi; }
+# check NAME COMMAND...: the command must succeed
+check() { local n="$1"; shift; if "$@"; then pass "$n"; else fail "$n"; fi; }
+# skip NAME WHY
+skip() { echo "SKIP $1 ($2)"; }
+# finish: report and exit with the number of failures
+finish() { exit $Fail; }
+
+HavePython=false
+command -v python3 >/dev/null && HavePython=true
+
+if [ ! -x "$SEAL" ] ; then echo "Missing $SEAL; run make first."; exit 1; fi
+"$SEAL" -g -K rsa -k rsa.key -D rsa.dns </dev/null >/dev/null 2>&1 || { echo "FAIL keygen"; exit 1; }
+SIGN=(-s -d example.com -K rsa -k rsa.key)
+VERIFY=(--pubkeyfile rsa.dns)
+
+# pngtext IN OUT TEXT: copy a PNG and add a tEXt chunk holding TEXT
+# (for records that the signer would never write)
+pngtext() {
+  python3 - "$@" <<'PYEOF'
+import struct,sys,zlib
+d=open(sys.argv[1],'rb').read()
+body=b'seal\0'+sys.argv[3].encode()
+c=b'tEXt'+body
+i=d.rindex(b'IEND')-4
+open(sys.argv[2],'wb').write(d[:i]+struct.pack('>I',len(body))+c+struct.pack('>I',zlib.crc32(c))+d[i:])
+PYEOF
+}
@@ -0,0 +1,82 @@
+/************************************************
+ SEAL regression test: a libseal caller.
+ See LICENSE
+
+ Used by libseal.sh:
+   libseal verify PUBKEYFILE FILE
+   libseal sign KEYFILE PUBKEYFILE FILE OUTFILE
+ Prints the status and counts, then the results text.
+ ************************************************/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "libseal.hpp"
+
+/**************************************
+ ReadFile(): Load a whole file.
+ Returns: buffer (caller frees) or NULL.
+ **************************************/
+unsigned char *	ReadFile	(const char *Filename, size_t *Len)
+{
+  FILE *fp;
+  unsigned char *Data;
+  long Size;
+
+  fp = fopen(Filename,"rb");
+  if (!fp) { return(NULL); }
+  fseek(fp,0,SEEK_END);
+  Size = ftell(fp);
+  fseek(fp,0,SEEK_SET);
+  Data = (unsigned char*)malloc(Size > 0 ? Size : 1);
+  if (Data && (fread(Data,1,Size,fp) != (size_t)Size)) { free(Data); Data=NULL; }
+  fclose(fp);
+  *Len = Size;
+  return(Data);
+} /* ReadFile() */
+
+int	main	(int argc, char *argv[])
+{
+  sealctx *Ctx;
+  sealresult Result;
+  unsigned char *Data;
+  size_t Len;
+  bool Sign;
+  FILE *fp;
+  int Rc;
+
+  Sign = (argc == 6) && !strcmp(argv[1],"sign");
+  if (!Sign && ((argc != 4) || strcmp(argv[1],"verify")))
+    {
+    fprintf(stderr,"Usage: %s verify PUBKEYFILE FILE\n",argv[0]);
+    fprintf(stderr,"       %s sign KEYFILE PUBKEYFILE FILE OUTFILE\n",argv[0]);
+    return(1);
+    }
+  Data = ReadFile(argv[Sign ? 4 : 3],&Len);
+  if (!Data) { fprintf(stderr,"Cannot read %s\n",argv[Sign ? 4 : 3]); return(1); }
+
+  Ctx = SealCtxNew();
+  SealCtxSet(Ctx,"domain","example.com");
+  SealCtxSet(Ctx,"keyalg","rsa");
+  SealCtxSet(Ctx,"pubkeyfile",argv[Sign ? 3 : 2]);
+  if (Sign)
+    {
+    SealCtxSet(Ctx,"keyfile",argv[2]);
+    Rc = SealSignBuffer(Ctx,Len,Data,&Result);
+    }
+  else { Rc = SealVerifyBuffer(Ctx,Len,Data,&Result); }
+
+  printf("status=%d records=%ld valid=%ld invalid=%ld\n",Rc,Result.Records,Result.Valid,Result.Invalid);
+  if (Result.Text) { fwrite(Result.Text,1,Result.TextLen,stdout); }
+  if (Sign && Result.Data)
+    {
+    fp = fopen(argv[5],"wb");
+    if (fp) { fwrite(Result.Data,1,Result.DataLen,fp); fclose(fp); }
+    }
+
+  SealResultFree(&Result);
+  SealCtxFree(Ctx);
+  SealLibFree();
+  free(Data);
+  return(0);
+} /* main() */
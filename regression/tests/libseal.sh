@@ -0,0 +1,42 @@
+#!/bin/bash
+# libseal: sign and verify in-process (bin/libseal.a, from "make lib")
+. "$(dirname "$0")/lib.sh"
+
+if [ ! -f "$BIN/libseal.a" ]; then skip "libseal" "run make lib"; finish; fi
+if ! ${CXX:-g++} -O2 -I"$REG/../src" -o libseal "$TESTS/libseal.c" "$BIN/libseal.a" \
+     -lresolv -lcrypto -lssl -lcurl -lpthread 2>libseal.err; then
+  fail "libseal: build test program"; sed 's/^/  | /' libseal.err; finish
+fi
+
+###############################
+# Sign and verify buffers
+###############################
+for f in jpg png wav; do
+  Out=$(./libseal sign rsa.key rsa.dns "$REG"/test-unsigned.$f signed.$f 2>&1)
+  expect "libseal: sign $f" "$Out" "^status=0 "
+  expect "libseal: sign $f text" "$Out" "Signature record #1 added$"
+  reject "libseal: no internal path ($f)" "$Out" "/proc/"
+  Out=$(./libseal verify rsa.dns signed.$f 2>&1)
+  expect "libseal: verify $f" "$Out" "^status=0 records=1 valid=1 invalid=0"
+  Out=$("$SEAL" "${VERIFY[@]}" signed.$f 2>&1)
+  expect "libseal: sealtool agrees ($f)" "$Out" "SEAL record #1 is valid"
+done
+
+Out=$(./libseal verify rsa.dns "$REG"/test-unsigned.png 2>&1)
+expect "libseal: unsigned" "$Out" "^status=3 "
+
+###############################
+# Malformed records are invalid, not fatal to the caller
+###############################
+if $HavePython; then
+  pngtext "$REG"/test-unsigned.png nob.png '<seal seal="1" d="x.invalid" s="AAAA"/>'
+  Out=$(./libseal verify rsa.dns nob.png 2>&1)
+  expect "libseal: record without b=" "$Out" "^status=4 records=1 valid=0 invalid=1"
+  expect "libseal: record without b= text" "$Out" "no byte range (b=)"
+  pngtext "$REG"/test-unsigned.png nosf.png '<seal seal="1" d="example.com" b="F~S,s~f" s="AAAA"/>'
+  Out=$(./libseal verify rsa.dns nosf.png 2>&1)
+  expect "libseal: record without sf=" "$Out" "^status=4 "
+else
+  skip "libseal: malformed records" "needs python3"
+fi
+finish
@@ -0,0 +1,52 @@
+#!/bin/bash
+# Matroska: Clusters are skipped by their size; SeekHead only finds targets.
+. "$(dirname "$0")/lib.sh"
+
+# Signed files from the regression directory
+Out=$("$SEAL" "${SIGN[@]}" -o "./%b-seal%e" "$REG"/test-unsigned-live.mkv 2>&1 </dev/null)
+expect "matroska: sign a live recording" "$Out" "Signature record #1 added"
+Out=$("$SEAL" "${VERIFY[@]}" test-unsigned-live-seal.mkv 2>&1)
+expect "matroska: verify a live recording" "$Out" "SEAL record #1 is valid"
+
+if ! $HavePython || ! command -v openssl >/dev/null; then
+  skip "matroska: records between elements" "needs python3 and openssl"
+  finish
+fi
+
+###############################
+# Records that sealtool never writes, signed with openssl
+###############################
+python3 - rsa.key <<'EOF'
+import struct,subprocess,sys
+key=sys.argv[1]
+PAD=b'@'*512 # hex RSA-2048 signature
+Rec=b'<seal seal="1" kv="1" ka="rsa" da="sha256" sf="hex" d="example.com" b="F~S,s~f" s="'+PAD+b'"/>'
+def sign(d):
+  i=d.index(PAD)
+  sig=subprocess.run(['openssl','dgst','-sha256','-sign',key],input=d[:i]+d[i+len(PAD):],
+                     capture_output=True,check=True).stdout
+  return d[:i]+sig.hex().encode()+d[i+len(PAD):]
+def el(id,body): return id+b'\x01'+struct.pack('>Q',len(body))[1:]+body
+def uint(v): return struct.pack('>Q',v)
+EBML=el(b'\x1a\x45\xdf\xa3',el(b'\x42\x82',b'matroska'))
+SEAL=b'\x08\x53\x45\x41\x4c'
+def seekhead(target,pos): # one entry; fixed size so positions do not move
+  return el(b'\x11\x4d\x9b\x74',el(b'\x4d\xbb',el(b'\x53\xab',target)+el(b'\x53\xac',uint(pos))))
+def segment(target,middle,tail):
+  info=el(b'\x15\x49\xa9\x66',el(b'\x2a\xd7\xb1',uint(1000000)))
+  clusters=b''.join(el(b'\x1f\x43\xb6\x75',el(b'\xe7',uint(n))+el(b'\xa3',bytes(64))) for n in range(3))
+  pos=len(seekhead(target,0))+len(info)+len(clusters)+len(middle)
+  return EBML+el(b'\x18\x53\x80\x67',seekhead(target,pos)+info+clusters+middle+tail)
+Cues=el(b'\x1c\x53\xbb\x6b',el(b'\xbb',el(b'\xb3',uint(0))))
+Tags=el(b'\x12\x54\xc3\x67',el(b'\x73\x73',el(b'\x67\xc8',el(b'\x45\xa3',b'SEAL')+el(b'\x44\x87',Rec))))
+# SeekHead lists the Cues, and a SEAL element is between the Clusters and the Cues
+open('middle.mkv','wb').write(sign(segment(b'\x1c\x53\xbb\x6b',el(SEAL,Rec),Cues)))
+# Garbage after the Clusters: the SeekHead still finds the Tags
+open('lost.mkv','wb').write(sign(segment(b'\x12\x54\xc3\x67',b'\x00'*16,Tags)))
+EOF
+
+Out=$("$SEAL" "${VERIFY[@]}" middle.mkv 2>&1)
+expect "matroska: record between Clusters and Cues" "$Out" "SEAL record #1 is valid"
+Out=$("$SEAL" "${VERIFY[@]}" lost.mkv 2>&1)
+expect "matroska: SeekHead finds Tags past bad data" "$Out" "SEAL record #1 is valid"
+finish
@@ -0,0 +1,89 @@
+#!/bin/bash
+# -S with --batch and --pipeline: queued signatures are reported in
+# file order, once written; outputs that are never signed are removed.
+. "$(dirname "$0")/lib.sh"
+
+if ! $HavePython || ! command -v openssl >/dev/null; then
+  skip "remote signing" "needs python3 and openssl"
+  finish
+fi
+
+# signer NAME [options]: start a test signer; sets Port and Pid
+signer() {
+  local n="$1"; shift
+  python3 "$TESTS/signer.py" rsa.key "$n.port" "$n.log" "$@" &
+  Pid=$!
+  Pids="$Pids $Pid"
+  for i in $(seq 50); do [ -s "$n.port" ] && break; sleep 0.1; done
+  Port=$(cat "$n.port")
+}
+
+cp "$REG"/test-unsigned.{jpg,png,wav,webp,mka} .
+Files=(test-unsigned.jpg test-unsigned.mka test-unsigned.png test-unsigned.wav test-unsigned.webp)
+
+###############################
+# Same results as one request per file, in the same order
+###############################
+signer ok --delay 0.05
+OkPort=$Port
+REMOTE=(-S -u "http://127.0.0.1:$Port/" -d example.com -K rsa)
+Ref=$("$SEAL" "${REMOTE[@]}" -o "./%b-r%e" "${Files[@]}" 2>&1 </dev/null)
+expect "remote: sign" "$Ref" "Signature record #1 added: ./test-unsigned-r.webp"
+for o in "--batch 3" "--pipeline 2" "--batch 2 --pipeline 2" "--batch 2 -j 3" "--batch 2 --pipeline 1 -j 2"; do
+  rm -f ok.log
+  Out=$("$SEAL" "${REMOTE[@]}" $o -o "./%b-r%e" "${Files[@]}" 2>&1 </dev/null)
+  if [ "$Out" == "$Ref" ]; then pass "remote $o: same output"; else fail "remote $o: same output"; diff <(echo "$Ref") <(echo "$Out") | sed 's/^/  | /'; fi
+  Out=$("$SEAL" "${VERIFY[@]}" test-unsigned-r.* 2>&1)
+  if [ $(grep -c "is valid" <<< "$Out") == 5 ]; then pass "remote $o: verify"; else fail "remote $o: verify"; echo "$Out" | sed 's/^/  | /'; fi
+  rm -f test-unsigned-r.*
+done
+# Full batches: nothing waits for files that are still being processed
+rm -f ok.log
+"$SEAL" "${REMOTE[@]}" --batch 3 -o "./%b-r%e" "${Files[@]}" >/dev/null 2>&1 </dev/null
+expect "remote --batch 3: batches" "$(tr '\n' ' ' < ok.log)" "^0 3 2 $"
+rm -f test-unsigned-r.*
+
+###############################
+# The signer stops signing: those outputs are removed
+###############################
+signer some --sigs 2
+REMOTE=(-S -u "http://127.0.0.1:$Port/" -d example.com -K rsa)
+Out=$("$SEAL" "${REMOTE[@]}" --batch 2 -o "./%b-r%e" "${Files[@]}" 2>&1 </dev/null)
+expect "remote: signed before the failure" "$Out" "added: ./test-unsigned-r.mka"
+expect "remote: failure is reported" "$Out" "ERROR: Signature record #1 not added: no signature from the remote signer; removed './test-unsigned-r.png'"
+expect "remote: failure is under its file" "$(grep -A1 '^\[test-unsigned.wav\]' <<< "$Out")" "removed './test-unsigned-r.wav'"
+if [ -e test-unsigned-r.png ] || [ -e test-unsigned-r.webp ]; then fail "remote: unsigned outputs removed"; else pass "remote: unsigned outputs removed"; fi
+Out=$("$SEAL" "${VERIFY[@]}" test-unsigned-r.jpg test-unsigned-r.mka 2>&1)
+if [ $(grep -c "is valid" <<< "$Out") == 2 ]; then pass "remote: signed outputs verify"; else fail "remote: signed outputs verify"; echo "$Out" | sed 's/^/  | /'; fi
+rm -f test-unsigned-r.*
+
+###############################
+# jsonl: one line per file, in order, after its signature is written
+###############################
+REMOTE=(-S -u "http://127.0.0.1:$OkPort/" -d example.com -K rsa)
+for o in "--batch 3" "--batch 2 --pipeline 1 -j 2"; do
+  Out=$("$SEAL" "${REMOTE[@]}" $o --output jsonl -o "./%b-r%e" "${Files[@]}" 2>&1 </dev/null)
+  expect "jsonl $o: one line per file" "$(echo "$Out" | cut -d'"' -f4 | tr '\n' ' ')" "^test-unsigned.jpg test-unsigned.mka test-unsigned.png test-unsigned.wav test-unsigned.webp $"
+  expect "jsonl $o: signed" "$(echo "$Out" | sed -n 3p)" '"signed":\[{"record":1,"output":"./test-unsigned-r.png"}\]}$'
+  reject "jsonl $o: nothing queued" "$Out" "queued"
+  rm -f test-unsigned-r.*
+done
+signer few --sigs 1
+REMOTE=(-S -u "http://127.0.0.1:$Port/" -d example.com -K rsa)
+Out=$("$SEAL" "${REMOTE[@]}" --batch 2 --output jsonl -o "./%b-r%e" "${Files[@]}" 2>/dev/null </dev/null)
+expect "jsonl: one line per file after a failure" "$(echo "$Out" | wc -l)" "^5$"
+expect "jsonl: failure in its record" "$(echo "$Out" | sed -n 3p)" '"output":"./test-unsigned-r.png","error":"no signature from the remote signer; removed'
+rm -f test-unsigned-r.*
+
+###############################
+# The signer is gone: everything queued is removed at exit
+###############################
+signer gone
+kill $Pid; wait $Pid 2>/dev/null
+REMOTE=(-S -u "http://127.0.0.1:$Port/" -d example.com -K rsa --sigsize 256)
+Out=$("$SEAL" "${REMOTE[@]}" --batch 8 -o "./%b-r%e" "${Files[@]}" 2>&1 </dev/null)
+expect "remote: signer is gone" "$Out" "ERROR: curl"
+expect "remote: unsigned output reported" "$Out" "'./test-unsigned-r.png' was not signed; removed it"
+if ls test-unsigned-r.* >/dev/null 2>&1; then fail "remote: nothing left unsigned"; else pass "remote: nothing left unsigned"; fi
+
+finish
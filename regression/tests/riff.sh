@@ -0,0 +1,65 @@
+#!/bin/bash
+# RIFF with 64-bit sizes (RF64, BW64) and AVI AVIX sequels.
+. "$(dirname "$0")/lib.sh"
+
+if ! $HavePython; then
+  skip "riff: 64-bit sizes" "needs python3"
+  finish
+fi
+
+# riffcheck FILE: the top-level sizes (ds64 for RF64/BW64) must add up
+# to the file size.  Reads only the chunk headers.
+riffcheck() {
+  python3 - "$1" <<'EOF'
+import os,struct,sys
+f=open(sys.argv[1],'rb'); n=os.path.getsize(sys.argv[1]); o=0
+while o+8 <= n:
+  f.seek(o); h=f.read(28); sz=struct.unpack('<I',h[4:8])[0]
+  if h[:4] in (b'RF64',b'BW64'): sz=struct.unpack('<Q',h[20:28])[0]
+  o+=8+sz+(sz&1)
+sys.exit(0 if o==n else 1)
+EOF
+}
+
+# BW64 is RF64 with a different name
+python3 - "$REG"/test-unsigned-rf64.wav test-unsigned-bw64.wav <<'EOF'
+import sys
+d=open(sys.argv[1],'rb').read()
+open(sys.argv[2],'wb').write(b'BW64'+d[4:])
+EOF
+cp "$REG"/test-unsigned-rf64.wav "$REG"/test-unsigned-avix.avi .
+
+for f in test-unsigned-rf64.wav test-unsigned-bw64.wav test-unsigned-avix.avi; do
+  Out=$("$SEAL" "${SIGN[@]}" -o "./%b-seal%e" "$f" 2>&1 </dev/null)
+  s="${f%.*}-seal.${f##*.}"
+  expect "riff $f: sign" "$Out" "Signature record #1 added: ./$s"
+  reject "riff $f: no warning" "$Out" "WARNING\|ERROR"
+  Out=$("$SEAL" "${VERIFY[@]}" "$s" 2>&1)
+  expect "riff $f: verify" "$Out" "SEAL record #1 is valid"
+  check "riff $f: sizes" riffcheck "$s"
+done
+
+# AVIX: the record goes in the last RIFF chunk; the first keeps its size
+check "riff avix: first RIFF size unchanged" cmp -s -n 8 test-unsigned-avix.avi test-unsigned-avix-seal.avi
+
+###############################
+# More than 4 GB: the data is skipped, not read
+###############################
+python3 - test-unsigned-rf64.wav big.wav <<'EOF'
+import struct,sys
+d=bytearray(open(sys.argv[1],'rb').read()); Big=5<<30
+i=d.index(b'data')
+h=d[:i]+b'data\xff\xff\xff\xff'
+h[20:28]=struct.pack('<Q',len(h)-8+Big) # RIFF size
+h[28:36]=struct.pack('<Q',Big) # data size
+f=open(sys.argv[2],'wb'); f.write(h); f.truncate(len(h)+Big) # sparse
+EOF
+Out=$(timeout 5 "$SEAL" "${VERIFY[@]}" big.wav 2>&1)
+expect "riff 5 GB: walk without reading" "$Out" "No SEAL signatures found"
+Out=$("$SEAL" "${SIGN[@]}" -O inplace big.wav 2>&1 </dev/null)
+expect "riff 5 GB: sign" "$Out" "Signature record #1 added: big.wav"
+check "riff 5 GB: sizes" riffcheck big.wav
+Out=$("$SEAL" "${VERIFY[@]}" big.wav 2>&1)
+expect "riff 5 GB: verify" "$Out" "SEAL record #1 is valid"
+rm -f big.wav
+finish
@@ -0,0 +1,27 @@
+#!/bin/bash
+####################################################################
+# SEAL regression tests
+# See LICENSE.md
+#
+# Run from the top of the repository (or use "make test").
+#   regression/tests/run.sh         :: run every test
+#   regression/tests/run.sh jobs    :: run only regression/tests/jobs.sh
+# Each test is a script in regression/tests/ that sources lib.sh.
+# Each case prints PASS, FAIL, or SKIP; the exit code is the number
+# of failures.  Cases that need python3 are skipped without it.
+####################################################################
+Dir=$(dirname "$0")
+Fail=0
+if [ $# -gt 0 ]; then List=(); for n in "$@"; do List+=("$Dir/$n.sh"); done
+else List=("$Dir"/*.sh); fi
+
+for t in "${List[@]}"; do
+  case "$(basename "$t")" in lib.sh|run.sh) continue ;; esac
+  echo "== $(basename "$t" .sh)"
+  bash "$t"
+  Fail=$((Fail+$?))
+done
+
+if [ $Fail -gt 0 ]; then echo "$Fail failed"; else echo "All tests passed"; fi
+[ $Fail -lt 255 ] || Fail=255
+exit $Fail
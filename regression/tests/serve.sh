@@ -0,0 +1,48 @@
+#!/bin/bash
+# --serve: sign and verify requests through a socket
+. "$(dirname "$0")/lib.sh"
+
+###############################
+# --serve: sign and verify through the socket
+###############################
+if $HavePython; then
+  "$SEAL" "${SIGN[@]}" "${VERIFY[@]}" -o "$T/%b-served%e" --serve "$T/seal.sock" 2>serve.err &
+  ServePid=$!; Pids="$Pids $ServePid"
+  for i in $(seq 50); do [ -S "$T/seal.sock" ] && break; sleep 0.1; done
+  # request SOCK LINE: send one request and print the reply
+  request() {
+    python3 - "$1" "$2" <<'EOF'
+import socket,sys
+s=socket.socket(socket.AF_UNIX); s.connect(sys.argv[1])
+s.sendall((sys.argv[2]+'\n').encode())
+d=b''
+while not d.endswith(b'\n.\n'):
+  c=s.recv(4096)
+  if not c: break
+  d+=c
+sys.stdout.write(d.decode())
+EOF
+  }
+  Out=$(request "$T/seal.sock" "sign $REG/test-unsigned.jpg" 2>&1)
+  expect "serve: sign" "$Out" "added: $T/test-unsigned-served.jpg"
+  expect "serve: reply ends" "$Out" "^\.$"
+  Out=$(request "$T/seal.sock" "verify $T/test-unsigned-served.jpg" 2>&1)
+  expect "serve: verify" "$Out" "SEAL record #1 is valid"
+  # A failed request is reported and the server keeps going
+  Out=$(request "$T/seal.sock" "sign $T/test-unsigned-served.jpg" 2>&1)
+  expect "serve: failed request" "$Out" "Request failed"
+  Out=$(request "$T/seal.sock" "verify $T/test-unsigned-served.jpg" 2>&1)
+  expect "serve: still running" "$Out" "SEAL record #1 is valid"
+  # A record without b= is invalid; it must not stop the server
+  pngtext "$REG"/test-unsigned.png nob.png '<seal seal="1" d="x.invalid" s="AAAA"/>'
+  Out=$(request "$T/seal.sock" "verify $T/nob.png" 2>&1)
+  expect "serve: record without b=" "$Out" "SEAL record #1 is invalid: no byte range"
+  Out=$(request "$T/seal.sock" "verify $T/test-unsigned-served.jpg" 2>&1)
+  expect "serve: running after bad record" "$Out" "SEAL record #1 is valid"
+  Out=$("$SEAL" "${VERIFY[@]}" test-unsigned-served.jpg 2>&1)
+  expect "serve: signed file" "$Out" "SEAL record #1 is valid"
+  kill $ServePid 2>/dev/null; wait $ServePid 2>/dev/null; ServePid=
+else
+  echo "SKIP --serve (needs python3)"
+fi
+finish
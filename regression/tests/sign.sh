@@ -0,0 +1,20 @@
+#!/bin/bash
+# Sign and verify every unsigned file in regression/.
+. "$(dirname "$0")/lib.sh"
+
+for f in "$REG"/test-unsigned*; do
+  b=$(basename "$f")
+  Out=$("$SEAL" "${SIGN[@]}" -o "./%b-seal%e" "$f" 2>&1 </dev/null)
+  expect "sign $b" "$Out" "Signature record #1 added"
+  s="${b%.*}-seal.${b##*.}"
+  Out=$("$SEAL" "${VERIFY[@]}" "$s" 2>&1)
+  expect "verify $b" "$Out" "SEAL record #1 is valid"
+  reject "verify $b (one record)" "$Out" "record #2"
+done
+
+# The bad signatures stay bad
+for f in "$REG"/test-badsig*; do
+  Out=$("$SEAL" "${VERIFY[@]}" "$f" 2>&1)
+  expect "badsig $(basename "$f")" "$Out" "is invalid"
+done
+finish
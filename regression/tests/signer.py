@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+####################################################################
+# SEAL regression tests: a remote signer for -S
+# See LICENSE.md
+#
+# Usage: signer.py KEYFILE PORTFILE LOG [options]
+#   Listens on 127.0.0.1 (any free port) and writes the port to PORTFILE.
+#   Each request adds one line to LOG: the number of digests.
+#   --nobatch   :: only sign single digests (no "signature" lists)
+#   --sigs N    :: stop returning signatures after N digests
+#   --delay S   :: wait S seconds before each reply
+# Signs with "openssl pkeyutl", so the replies match sealtool -s.
+####################################################################
+import argparse,http.server,json,subprocess,tempfile,threading,time,urllib.parse
+
+Opt = argparse.ArgumentParser()
+Opt.add_argument('key')
+Opt.add_argument('portfile')
+Opt.add_argument('log')
+Opt.add_argument('--nobatch',action='store_true')
+Opt.add_argument('--sigs',type=int,default=-1)
+Opt.add_argument('--delay',type=float,default=0)
+Opt = Opt.parse_args()
+Lock = threading.Lock()
+
+def sign(digest):
+  with tempfile.NamedTemporaryFile() as f:
+    f.write(bytes.fromhex(digest)); f.flush()
+    return subprocess.run(['openssl','pkeyutl','-sign','-inkey',Opt.key,'-in',f.name,
+                           '-pkeyopt','digest:sha256'],capture_output=True).stdout.hex()
+
+class Signer(http.server.BaseHTTPRequestHandler):
+  protocol_version = 'HTTP/1.1'
+  def log_message(self,*args): pass
+  def do_POST(self):
+    q = urllib.parse.parse_qs(self.rfile.read(int(self.headers.get('Content-Length',0))).decode())
+    ds = q.get('digest',[])
+    with Lock:
+      open(Opt.log,'a').write('%d\n' % len(ds))
+      ok = (Opt.sigs < 0) or (Opt.sigs >= len(ds))
+      if ok and (Opt.sigs >= 0): Opt.sigs -= len(ds)
+    time.sleep(Opt.delay)
+    r = {'sigsize':'512'} # RSA-2048 in hex
+    if ok and (len(ds) > 1) and not Opt.nobatch: r['signature'] = [sign(d) for d in ds]
+    elif ok and (len(ds) == 1): r['signature'] = sign(ds[0])
+    b = json.dumps(r).encode()
+    self.send_response(200)
+    self.send_header('Content-Type','application/json')
+    self.send_header('Content-Length',str(len(b)))
+    self.end_headers()
+    self.wfile.write(b)
+
+Server = http.server.ThreadingHTTPServer(('127.0.0.1',0),Signer)
+open(Opt.portfile,'w').write('%d\n' % Server.server_address[1])
+Server.serve_forever()
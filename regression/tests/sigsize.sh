@@ -0,0 +1,37 @@
+#!/bin/bash
+# --sigsize: the remote signer is not asked for the signature size.
+. "$(dirname "$0")/lib.sh"
+
+if ! $HavePython || ! command -v openssl >/dev/null; then
+  skip "signature size" "needs python3 and openssl"
+  finish
+fi
+
+python3 "$TESTS/signer.py" rsa.key signer.port signer.log &
+Pids="$Pids $!"
+for i in $(seq 50); do [ -s signer.port ] && break; sleep 0.1; done
+REMOTE=(-S -u "http://127.0.0.1:$(cat signer.port)/" -d example.com -K rsa)
+cp "$REG"/test-unsigned.{jpg,png} .
+
+# Without --sigsize: one request (with no digest) before the files
+Out=$("$SEAL" "${REMOTE[@]}" -o "./%b-a%e" test-unsigned.jpg test-unsigned.png 2>&1 </dev/null)
+expect "sigsize: ask the signer" "$Out" "added: ./test-unsigned-a.png"
+expect "sigsize: asked first" "$(tr '\n' ' ' < signer.log)" "^0 1 1 $"
+
+# With --sigsize: one request per file (RSA-2048 is 256 bytes)
+rm -f signer.log
+Out=$("$SEAL" "${REMOTE[@]}" --sigsize 256 -o "./%b-b%e" test-unsigned.jpg test-unsigned.png 2>&1 </dev/null)
+expect "sigsize: given" "$Out" "added: ./test-unsigned-b.png"
+expect "sigsize: not asked" "$(tr '\n' ' ' < signer.log)" "^1 1 $"
+for f in jpg png; do
+  if cmp -s "test-unsigned-a.$f" "test-unsigned-b.$f"; then pass "sigsize $f: same output"; else fail "sigsize $f: same output"; fi
+done
+Out=$("$SEAL" "${VERIFY[@]}" test-unsigned-b.* 2>&1)
+if [ $(grep -c "is valid" <<< "$Out") == 2 ]; then pass "sigsize: verify"; else fail "sigsize: verify"; echo "$Out" | sed 's/^/  | /'; fi
+
+# Wrong sizes
+Out=$("$SEAL" "${REMOTE[@]}" --sigsize 128 -o "./%b-c%e" test-unsigned.png 2>&1 </dev/null)
+expect "sigsize: too small" "$Out" "ERROR: signature size changed while writing"
+Out=$("$SEAL" "${REMOTE[@]}" --sigsize 2k -o "./%b-c%e" test-unsigned.png 2>&1 </dev/null)
+expect "sigsize: not a number" "$Out" "ERROR: Invalid signature size (2k)"
+finish
@@ -0,0 +1,23 @@
+#!/bin/bash
+# --stats: run totals, and only the slowest files are listed.
+. "$(dirname "$0")/lib.sh"
+
+"$SEAL" "${SIGN[@]}" -o "./%b-seal%e" "$REG"/test-unsigned.png >/dev/null 2>&1 </dev/null
+
+Out=$("$SEAL" "${VERIFY[@]}" --stats test-unsigned-seal.png 2>&1 >/dev/null)
+expect "stats: run files" "$Out" '"files":[[:space:]]*1,'
+expect "stats: file entry" "$Out" '"file":[[:space:]]*"test-unsigned-seal.png"'
+expect "stats: records counted" "$Out" '"records_png":[[:space:]]*1'
+
+if $HavePython; then
+  for i in $(seq 105); do echo test-unsigned-seal.png; done > list
+  Out=$("$SEAL" "${VERIFY[@]}" --stats --files-from list 2>&1 >/dev/null)
+  Out=$(python3 -c '
+import json,sys
+r=json.loads(sys.stdin.read()); ms=[f["ms"] for f in r["files"]]
+print(r["run"]["files"],len(ms),"sorted" if ms==sorted(ms,reverse=True) else "unsorted")' <<< "$Out")
+  expect "stats: 100 slowest of 105 files" "$Out" "^105 100 sorted$"
+else
+  skip "stats: file list is bounded" "needs python3"
+fi
+finish
@@ -168,7 +168,7 @@ char *	MakeFilename	(char *Template, const char *Filename)
 	fprintf(stderr,"ERROR: Output filename contains illegal character: %%");
 	if (isprint(p[1]) && !isspace(p[1])) { fprintf(stderr,"%c",p[1]); }
 	fprintf(stderr,"\n");
-	exit(1);
+	SealFatal();
       }
     Template+=2; // move past '%'
     }
@@ -200,11 +200,30 @@ FILE *	SealFileOpen   (const char *fname, const char *mode)
   if (!Fout)
 	{
 	fprintf(stderr,"ERROR: Unable to access '%s'. Aborting.\n",fname);
-	exit(1);
+	SealFatal();
 	}
+  SealCleanupPush(SealFileCleanup,Fout);
   return(Fout);
 } /* SealFileOpen() */
 
+/**************************************
+ SealFileClose(): Close a file from SealFileOpen().
+ Returns: same as fclose.
+ **************************************/
+int	SealFileClose	(FILE *Fout)
+{
+  SealCleanupPop(Fout);
+  return(fclose(Fout));
+} /* SealFileClose() */
+
+/**************************************
+ SealFileCleanup(): Close a file after a recovered fatal error.
+ **************************************/
+void	SealFileCleanup	(void *Fout)
+{
+  fclose((FILE*)Fout);
+} /* SealFileCleanup() */
+
 /**************************************
  SealFileWrite(): Write data to a file.
  Abort on failure.
@@ -219,18 +238,59 @@ void	SealFileWrite   (FILE *Fout, size_t Len, byte *Data)
     if (w <= 0)
       {
       fprintf(stderr,"ERROR: Failed to write to file. Aborting.\n");
-      exit(1);
+      SealFatal();
       }
     }
 } /* SealFileWrite() */
 
+#pragma GCC visibility push(hidden)
 /**************************************
- MmapFile(): memory map the file for quick access.
- Used for rapidly computing checksums, scanning, and
- changing values.
+ _MmapRead(): Read a non-mappable input (pipe, FIFO, device)
+ into memory.  Used instead of mmap for read-only access.
+ Returns: true on success, false on failure.
+ **************************************/
+bool	_MmapRead	(mmapfile *Mmap)
+{
+  size_t Max=0, r;
+  byte *New;
+
+  Mmap->memsize = 0;
+  while(1)
+    {
+    if (Mmap->memsize + 65536 > Max) // grow geometrically
+      {
+      Max = (Max < 65536) ? 262144 : Max*2;
+      New = (byte*)realloc(Mmap->mem,Max);
+      if (!New) { return(false); }
+      Mmap->mem = New;
+      }
+    r = fread(Mmap->mem+Mmap->memsize,1,Max-Mmap->memsize,Mmap->fp);
+    if (r == 0) { break; }
+    Mmap->memsize += r;
+    }
+  return(!ferror(Mmap->fp));
+} /* _MmapRead() */
+
+/**************************************
+ _MmapCleanup(): MmapFree() after a recovered fatal error.
+ **************************************/
+void	_MmapCleanup	(void *Data)
+{
+  MmapFree((mmapfile*)Data);
+} /* _MmapCleanup() */
+#pragma GCC visibility pop
+
+/**************************************
+ MmapOpen(): Open a file for MmapMap().
+ Sets memsize but does not map anything, so callers can look
+ at the header (MmapPeek) and skip unknown files cheaply.
+ Read-only inputs that cannot be mapped (pipes, FIFOs,
+ character devices) are read into memory now.
+ Failures are reported (to SealOut) but do not abort, so one
+ bad file does not stop a batch.
  Returns: mmapfile* or NULL.
  **************************************/
-mmapfile *	MmapFile	(const char *Filename, int Prot)
+mmapfile *	MmapOpen	(const char *Filename, int Prot)
 {
   mmapfile *Mmap;
   int FileHandle;
@@ -240,7 +300,7 @@ mmapfile *	MmapFile	(const char *Filename, int Prot)
   if (!Mmap) // should never happen
     {
     fprintf(stderr,"ERROR: Cannot allocate mmap structure\n");
-    exit(1);
+    SealFatal();
     }
 
   // Open file and check it
@@ -254,51 +314,167 @@ mmapfile *	MmapFile	(const char *Filename, int Prot)
     }
   if (!Mmap->fp)
     {
-    fprintf(stderr,"ERROR: Cannot open file (%s)\n",Filename);
+    SealPrintf("ERROR: Cannot open file (%s)\n",Filename);
     free(Mmap);
-    exit(1);
+    return(NULL);
     }
 
   // mmap requires file handle
   FileHandle = fileno(Mmap->fp);
   if (FileHandle == -1) // should never happen since fopen worked
     {
-    fprintf(stderr,"ERROR: File inaccessible (%s)\n",Filename);
+    SealPrintf("ERROR: File inaccessible (%s)\n",Filename);
     fclose(Mmap->fp);
     free(Mmap);
-    exit(1);
+    return(NULL);
     }
 
   stat_t Stat;
-  if ((fstat64(FileHandle,&Stat) == -1) || !S_ISREG(Stat.st_mode))
+  if (fstat64(FileHandle,&Stat) == -1)
     {
-    fprintf(stderr,"ERROR: Not a regular file (%s)\n",Filename);
+    SealPrintf("ERROR: Cannot stat file (%s)\n",Filename);
     fclose(Mmap->fp);
     free(Mmap);
-    exit(1);
+    return(NULL);
+    }
+
+  // Pipes and devices: read it all (read-only)
+  if (!S_ISREG(Stat.st_mode))
+    {
+    if ((Prot & PROT_WRITE) || S_ISDIR(Stat.st_mode) || !_MmapRead(Mmap))
+      {
+      SealPrintf("ERROR: Not a regular file (%s)\n",Filename);
+      free(Mmap->mem);
+      fclose(Mmap->fp);
+      free(Mmap);
+      return(NULL);
+      }
+    Mmap->IsAlloc = true;
+    SealCleanupPush(_MmapCleanup,Mmap);
+    return(Mmap);
     }
 
   Mmap->memsize = Stat.st_size;
-  Mmap->mem = (byte *)mmap64(0,Mmap->memsize,Prot,MAP_SHARED,FileHandle,0);
+  SealCleanupPush(_MmapCleanup,Mmap);
+  return(Mmap);
+} /* MmapOpen() */
+
+/**************************************
+ MmapPeek(): Copy the start of the file into Buf.
+ Works before or after MmapMap().
+ Returns: number of bytes copied (less than Len at end of file).
+ **************************************/
+size_t	MmapPeek	(mmapfile *Mmap, size_t Len, byte *Buf)
+{
+  ssize_t r;
+
+  if (!Mmap) { return(0); }
+  if (Len > Mmap->memsize) { Len = Mmap->memsize; }
+  if (Mmap->mem) { memcpy(Buf,Mmap->mem,Len); return(Len); }
+  r = pread(fileno(Mmap->fp),Buf,Len,0);
+  return((r > 0) ? (size_t)r : 0);
+} /* MmapPeek() */
+
+/**************************************
+ MmapMap(): Map a file from MmapOpen().
+ Does nothing if it is already in memory.
+ Returns: true on success, false on failure (caller reports it).
+ **************************************/
+bool	MmapMap	(mmapfile *Mmap, int Prot)
+{
+  if (!Mmap) { return(false); }
+  if (Mmap->mem) { return(true); } // already in memory
+
+  if (Mmap->memsize == 0) // mmap cannot map empty files
+    {
+    Mmap->mem = (byte*)calloc(1,16);
+    Mmap->IsAlloc = true;
+    return(true);
+    }
+  Mmap->mem = (byte *)mmap64(0,Mmap->memsize,Prot,MAP_SHARED,fileno(Mmap->fp),0);
   if (!Mmap->mem || (Mmap->mem == MAP_FAILED)) // should never happen
     {
-    fprintf(stderr,"ERROR: Memory map failed for file (%s)\n",Filename);
-    fclose(Mmap->fp);
-    free(Mmap);
-    exit(1);
+    Mmap->mem = NULL;
+    return(false);
     }
 
+  // Reads are (mostly) front to back: scan, then digest
+  if (!(Prot & PROT_WRITE)) { madvise(Mmap->mem,Mmap->memsize,MADV_SEQUENTIAL); }
+  return(true);
+} /* MmapMap() */
+
+/**************************************
+ MmapFile(): memory map the file for quick access.
+ Used for rapidly computing checksums, scanning, and
+ changing values.
+ Same as MmapOpen() + MmapMap().
+ Returns: mmapfile* or NULL.
+ **************************************/
+mmapfile *	MmapFile	(const char *Filename, int Prot)
+{
+  mmapfile *Mmap;
+
+  Mmap = MmapOpen(Filename,Prot);
+  if (Mmap && !MmapMap(Mmap,Prot))
+    {
+    SealPrintf("ERROR: Cannot map file (%s)\n",Filename);
+    MmapFree(Mmap);
+    Mmap=NULL;
+    }
   return(Mmap);
 } /* MmapFile() */
 
+/**************************************
+ MmapBuffer(): Treat memory as a read-only file.
+ The data is not copied; it must stay valid until MmapFree().
+ There is no file handle, so it is handled like a heap copy.
+ Returns: mmapfile*.
+ **************************************/
+mmapfile *	MmapBuffer	(size_t Len, const byte *Data)
+{
+  mmapfile *Mmap;
+
+  Mmap = (mmapfile*)calloc(sizeof(mmapfile),1);
+  if (!Mmap) // should never happen
+    {
+    fprintf(stderr,"ERROR: Cannot allocate mmap buffer structure\n");
+    SealFatal();
+    }
+  Mmap->mem = (byte*)Data;
+  Mmap->memsize = Len;
+  Mmap->IsAlloc = true;
+  Mmap->IsBorrowed = true;
+  SealCleanupPush(_MmapCleanup,Mmap);
+  return(Mmap);
+} /* MmapBuffer() */
+
+/**************************************
+ MmapWillNeed(): Tell the kernel that a range will be read soon.
+ Lets network filesystems fetch the next window while
+ the current one is being hashed.
+ **************************************/
+void	MmapWillNeed	(mmapfile *Mmap, uint64_t Offset, uint64_t Len)
+{
+  uint64_t Page;
+
+  if (!Mmap || Mmap->IsAlloc || (Offset >= Mmap->memsize)) { return; }
+  if (Len > Mmap->memsize - Offset) { Len = Mmap->memsize - Offset; }
+  Page = Offset % sysconf(_SC_PAGESIZE); // madvise needs page alignment
+  madvise(Mmap->mem+Offset-Page,Len+Page,MADV_WILLNEED);
+} /* MmapWillNeed() */
+
 /**************************************
  MmapFree(): Free memory map from MmapFile.
  **************************************/
 void	MmapFree	(mmapfile *Mmap)
 {
   if (!Mmap) { return; }
-  munmap(Mmap->mem,Mmap->memsize);
-  fclose(Mmap->fp);
+  SealCleanupPop(Mmap);
+  SealDigestFree(Mmap);
+  if (Mmap->IsBorrowed) { ; } // caller's memory
+  else if (Mmap->IsAlloc) { free(Mmap->mem); }
+  else if (Mmap->mem) { munmap(Mmap->mem,Mmap->memsize); }
+  if (Mmap->fp) { fclose(Mmap->fp); }
   free(Mmap);
 } /* MmapFree() */
 
@@ -318,14 +494,14 @@ bool	CopyFile	(const char *dst, const char *src)
   if (!Mmap) // never happens since MmapFile checks errors
     {
     fprintf(stderr,"ERROR: Copy failed from file (%s)\n",src);
-    exit(1);
+    SealFatal();
     }
 
   Fout = fopen(dst,"wb+");
   if (!Fout)
     {
     fprintf(stderr,"ERROR: Copy failed to file (%s)\n",dst);
-    exit(1);
+    SealFatal();
     }
 
   WriteOut = TotalOut = 0;
@@ -336,7 +512,7 @@ bool	CopyFile	(const char *dst, const char *src)
 	if (WriteOut <= 0) // write failure
 	  {
 	  fprintf(stderr,"ERROR: Copy from (%s) to (%s) failed\n",src,dst);
-	  exit(1);
+	  SealFatal();
 	  }
 	TotalOut += WriteOut;
 	}
@@ -345,7 +521,7 @@ bool	CopyFile	(const char *dst, const char *src)
         {
 	fclose(Fout);
 	unlink(dst);
-	exit(1); // abort
+	SealFatal(); // abort
 	}
 
   // Clean up
@@ -21,6 +21,9 @@ typedef struct
   FILE *fp;
   byte *mem;
   uint64_t memsize;
+  struct sealdigestcp *Checkpoint; // digest midstates (see sign-digest.cpp)
+  bool IsAlloc; // mem is a heap copy (pipe or empty file), not a mapping
+  bool IsBorrowed; // mem belongs to the caller (MmapBuffer); never freed
   } mmapfile;
 
 unsigned char *	GetPassword	();
@@ -29,7 +32,8 @@ char *	MakeFilename	(char *Template, const char *Filename);
 bool	CopyFile	(const char *dst, const char *src);
 
 FILE *	SealFileOpen	(const char *fname, const char *mode);
-#define SealFileClose(x)	fclose(x)
+int	SealFileClose	(FILE *Fout);
+void	SealFileCleanup	(void *Fout); // fclose() for SealCleanupPush()
 void	SealFileWrite	(FILE *Fout, size_t Len, byte *Data);
 
 #ifndef PROT_NONE
@@ -37,7 +41,13 @@ void	SealFileWrite	(FILE *Fout, size_t Len, byte *Data);
 #define PROT_READ       1
 #define PROT_WRITE      2
 #endif
+mmapfile *	MmapOpen	(const char *Filename, int Prot);
+size_t	MmapPeek	(mmapfile *Mmap, size_t Len, byte *Buf);
+bool	MmapMap	(mmapfile *Mmap, int Prot);
 mmapfile *	MmapFile	(const char *Filename, int Prot);
+mmapfile *	MmapBuffer	(size_t Len, const byte *Data);
+void	MmapWillNeed	(mmapfile *Mmap, uint64_t Offset, uint64_t Len);
 void	MmapFree	(mmapfile *Mmap);
+void	SealDigestFree	(mmapfile *Mmap); // in sign-digest.cpp
 
 #endif
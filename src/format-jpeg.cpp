@@ -123,8 +123,11 @@
 #include "files.hpp"
 #include "seal-parse.hpp"
 #include "sign.hpp"
+#include "stats.hpp"
 
 #pragma GCC visibility push(hidden)
+#define JPEG_MPF_MAX	16 // most MPF images checked by a deep scan
+
 /**************************************
  _JPEGblock(): Generate the signature block.
  Return a stub block.
@@ -185,8 +188,8 @@ sealfield *     _JPEGblock   (sealfield *Args, uint16_t Tag)
   rec = SealSearch(Args,"@record");
   if (rec==NULL) // should never happen
     {
-    printf("ERROR: Cannot generate the signature. Aborting.\n");
-    exit(1);
+    SealPrintf("ERROR: Cannot generate the signature. Aborting.\n");
+    SealFatal();
     }
 
   /*****
@@ -204,8 +207,8 @@ sealfield *     _JPEGblock   (sealfield *Args, uint16_t Tag)
   i = rec->ValueLen + 2 + 5;
   if (i > 0xfffe)
     {
-    printf("ERROR: SEAL record is too large for JPEG. Aborting.\n");
-    exit(1);
+    SealPrintf("ERROR: SEAL record is too large for JPEG. Aborting.\n");
+    SealFatal();
     }
   Args = SealSetCindex(Args,"@BLOCK",2, (i>>8) & 0xff);
   Args = SealSetCindex(Args,"@BLOCK",3, i & 0xff);
@@ -384,7 +387,7 @@ void	_SealFileWriteMPF	(FILE *Fout, size_t IncValue, size_t FFDAoffset, size_t *
 MPFdone:
   if (IsError)
     {
-    printf("ERROR: Invalid MPF metadata block; not fixing.\n");
+    SealPrintf("ERROR: Invalid MPF metadata block; not fixing.\n");
     SealFileWrite(Fout, MPFoffset[1]-MPFoffset[0], Mmap->mem + MPFoffset[0]);
     }
   else
@@ -394,6 +397,291 @@ MPFdone:
   SealFree(MPF);
   return;
 } /* _SealFileWriteMPF() */
+
+/**************************************
+ _JPEGrecords(): Check a range of bytes for signatures.
+ Scans from Start to End (absolute offsets).
+ **************************************/
+sealfield *	_JPEGrecords	(sealfield *Args, mmapfile *Mmap, size_t Start, size_t End)
+{
+  sealfield *Rec;
+  size_t RecEnd;
+
+  while(Start < End)
+    {
+    Rec = SealParse(End-Start,Mmap->mem+Start,Start,Args);
+    if (!Rec) { break; } // nothing found
+
+    // Iterate on remainder
+    // (Read it now: verifying merges in the DNS record, which has its own '@RecEnd'.)
+    RecEnd = SealGetIindex(Rec,"@RecEnd",0);
+    if (RecEnd <= 0) { RecEnd=1; } // should never happen, but if it does, stop infinite loops
+    Start += RecEnd;
+
+    /*****
+     Without a signature (s=), it is only text that looks like a record.
+     (Deep scans read image data and trailers, which can be anything.)
+     SealVerify() checks the other fields.
+     *****/
+    if (!SealSearch(Rec,"@S")) { SealFree(Rec); continue; }
+    SealStatInc(SEAL_COUNT_REC_JPEG,1);
+
+    // Found a signature!
+    // Verify the data!
+    Rec = SealCopy2(Rec,"@pubkeyfile",Args,"@pubkeyfile");
+    Rec = SealVerify(Rec,Mmap);
+
+    // Retain state
+    Args = SealCopy2(Args,"@p",Rec,"@p"); // keep previous settings
+    Args = SealCopy2(Args,"@s",Rec,"@s"); // keep previous settings
+    Args = SealCopy2(Args,"@dnscachelast",Rec,"@dnscachelast"); // store any cached DNS
+    Args = SealCopy2(Args,"@public",Rec,"@public"); // store any cached DNS
+    Args = SealCopy2(Args,"@publicbin",Rec,"@publicbin"); // store any cached DNS
+    Args = SealCopy2(Args,"@sflags",Rec,"@sflags"); // retain sflags
+
+    // Clean up
+    SealFree(Rec);
+    }
+  return(Args);
+} /* _JPEGrecords() */
+
+/**************************************
+ _JPEGapp(): Check one APP block for signatures.
+ Offset is the APP tag and BlockSize includes the 2-byte length.
+ **************************************/
+sealfield *	_JPEGapp	(sealfield *Args, mmapfile *Mmap, size_t Offset, size_t BlockSize)
+{
+  // EXIF gets special handling
+  if ((BlockSize > 8) && !memcmp(Mmap->mem+Offset+4,"Exif\0\0",6))
+    {
+    // TBD: Process exif which begins at Offset+10 and length is BlockSize-8
+    // EXIF can be large, spanning multiple apps! SEAL must be in first block.
+    return(Args);
+    }
+
+  /*****
+   Skip known-blocks that can contain nested media and that don't
+   support their own comment structure.
+   *****/
+  int kl;
+  static struct // known block types to skip
+    {
+    int LabelLen; 
+    const char *Label; // some labels are null-terminated; "standard" /smh
+    } KnownLabel[] =
+    {
+      // Ordered by length (stop searching if it's too small)
+      { 3, "JP\0" },
+      { 4, "JPN\0" },
+      { 4, "HPQ-" },
+      { 4, "DP2\0" },
+      { 4, "PIC\0" },
+      { 5, "AROT\0" },
+      { 5, "JFIF\0" },
+      { 5, "JFXX\0" },
+      { 5, "HPSC\0" },
+      { 5, "H3X0\0" },
+      { 5, "FPXR\0" },
+      { 5, "MOTO\0" },
+      { 5, "XMTH\0" },
+      { 6, "Adobe\0" },
+      { 6, "Ducky\0" },
+      { 6, "AJPEG\0" },
+      { 7, "SCRNAIL" },
+      { 7, "MMIMETA" },
+      { 8, "Ocad$Rev" },
+      { 8, "Qualcomm" },
+      { 10, "ssuniqueid" },
+      { 11, "HPQ-Capture" },
+      { 12, "ICC_PROFILE\0" },
+      { 14, "Photoshop 3.0\0" },
+      { 17, "GenaPhotoStamperd" },
+      { 0, NULL } // end marker
+      // Permit "XMP\0" for XMP metadata
+      // Permit "http://ns.adobe.com/\0" for XMP extension
+    };
+  for(kl=0; KnownLabel[kl].Label && ((size_t)KnownLabel[kl].LabelLen+2 < BlockSize); kl++)
+    {
+    if (!memcmp(Mmap->mem+Offset+4, KnownLabel[kl].Label, KnownLabel[kl].LabelLen))
+      {
+      //DEBUGPRINT("Skipping known: %s",KnownLabel[kl].Label);
+      return(Args);
+      }
+    }
+
+  /*****
+   Found a "standard" APP block (IPTC, XMP, or dozens of others).
+   Scan the APP block for a signature
+
+   WARNING: If the block contains a nested JPEG or PNG or other file
+   that contains it's own SEAL signature, then this will pick it up and
+   scan it, likely resulting in an invalid signature being found.
+
+   And if the nested media is finalized, then this file cannot be signed.
+   *****/
+  //DEBUGPRINT("Scanning %04x",(int)readbe16(Mmap->mem+Offset));
+  return(_JPEGrecords(Args,Mmap,Offset+4,Offset+2+BlockSize));
+} /* _JPEGapp() */
+
+/**************************************
+ _JPEGscanEnd(): Skip the entropy-coded data after a SOS.
+ Offset is the ffda tag.
+ In the stream, ff is followed by 00 (a stuffed ff), d0-d7 (restart),
+ or ff (fill).  Anything else is a real marker: progressive JPEGs
+ have more tables and scans, and ffd9 ends the image.
+ memchr() is much faster than checking every byte.
+ Returns: offset after the ffd9, or End if there isn't one.
+ **************************************/
+size_t	_JPEGscanEnd	(mmapfile *Mmap, size_t Offset, size_t End)
+{
+  const byte *ff;
+  byte b;
+
+  while(Offset+4 <= End)
+    {
+    // Skip the marker's header (the SOS header or a table between scans)
+    Offset += readbe16(Mmap->mem+Offset+2) + 2;
+
+    // Find the next real marker
+    for(;;)
+      {
+      if (Offset >= End) { return(End); }
+      ff = (const byte*)memchr(Mmap->mem+Offset,0xff,End-Offset);
+      if (!ff || (ff+1 >= Mmap->mem+End)) { return(End); }
+      Offset = ff - Mmap->mem;
+      b = ff[1];
+      if ((b == 0x00) || (b == 0xff) || ((b >= 0xd0) && (b <= 0xd7))) { Offset++; continue; }
+      break;
+      }
+    if (b == 0xd9) { return(Offset+2); } // end of image
+    }
+  return(End);
+} /* _JPEGscanEnd() */
+
+/**************************************
+ _JPEGimage(): Check an embedded image's APP blocks for signatures.
+ Start is the image's ffd8 and End bounds it.
+ Returns: offset after the image's ffd9.
+ **************************************/
+sealfield *	_JPEGimage	(sealfield *Args, mmapfile *Mmap, size_t Start, size_t End, size_t *ImageEnd)
+{
+  size_t Offset;
+  uint16_t BlockType, PreviousBlockType=0;
+  size_t BlockSize;
+
+  *ImageEnd = End;
+  Offset = Start+2; // skip ffd8
+  while(Offset+4 <= End)
+    {
+    BlockType = readbe16(Mmap->mem+Offset);
+    if ((BlockType & 0xffc0) != 0xffc0) { Offset++; continue; }
+    if (BlockType == 0xffd9) { *ImageEnd = Offset+2; break; } // no image data
+    if (BlockType == 0xffda) { *ImageEnd = _JPEGscanEnd(Mmap,Offset,End); break; }
+
+    BlockSize = readbe16(Mmap->mem+Offset+2);
+    if ((BlockSize < 2) || (Offset+2+BlockSize > End)) { break; } // corrupted; stop here
+
+    // Same rules as the primary image: no continuations, no MPF
+    if (((BlockType & 0xfff0) == 0xffe0) && (BlockType != PreviousBlockType) &&
+        !((BlockSize > 8) && !memcmp(Mmap->mem+Offset+4,"MPF\0",4)))
+	{
+	Args = _JPEGapp(Args,Mmap,Offset,BlockSize);
+	}
+    Offset += BlockSize+2; // tag + size
+    PreviousBlockType = BlockType;
+    }
+  return(Args);
+} /* _JPEGimage() */
+
+/**************************************
+ _JPEGmpfImages(): Find the images listed in the MPF index.
+ Only the first IFD (the MP index) lists images.
+ The primary image (offset 0) is not included.
+ Returns: number of images, sorted by Start.
+ **************************************/
+int	_JPEGmpfImages	(sealfield *Args, mmapfile *Mmap, size_t *Start, size_t *Size, int Max)
+{
+  size_t Base, MPFend;
+  size_t ifd, count, c, co, type;
+  size_t entries=0, entriesoffset=0, e, eo;
+  size_t s, o;
+  bool LE;
+  int Images=0, i;
+
+  if (!SealGetIindex(Args,"@jpegmpf",0)) { return(0); } // no MPF
+  Base = SealGetIindex(Args,"@jpegmpf",0) + 6; // the endian definition
+  MPFend = SealGetIindex(Args,"@jpegmpf",1);
+  if (MPFend > Mmap->memsize) { MPFend = Mmap->memsize; }
+  if (Base+8 > MPFend) { return(0); }
+  if (!memcmp(Mmap->mem+Base,"II*\0",4)) { LE=true; }
+  else if (!memcmp(Mmap->mem+Base,"MM\0*",4)) { LE=false; }
+  else { return(0); }
+
+  // Offsets are relative to the endian definition
+  ifd = LE ? readle32(Mmap->mem+Base+4) : readbe32(Mmap->mem+Base+4);
+  if ((ifd < 8) || (Base+ifd+2 > MPFend)) { return(0); }
+  count = LE ? readle16(Mmap->mem+Base+ifd) : readbe16(Mmap->mem+Base+ifd);
+  for(c=0; c < count; c++)
+    {
+    co = Base+ifd+2+c*12;
+    if (co+12 > MPFend) { break; }
+    type = LE ? readle16(Mmap->mem+co) : readbe16(Mmap->mem+co);
+    if (type == 0xb001) { entries = LE ? readle32(Mmap->mem+co+8) : readbe32(Mmap->mem+co+8); }
+    if (type == 0xb002) { entriesoffset = LE ? readle32(Mmap->mem+co+8) : readbe32(Mmap->mem+co+8); }
+    }
+  if (!entriesoffset) { return(0); }
+
+  for(e=0; (e < entries) && (Images < Max); e++)
+    {
+    eo = Base+entriesoffset+e*16;
+    if (eo+12 > MPFend) { break; }
+    s = LE ? readle32(Mmap->mem+eo+4) : readbe32(Mmap->mem+eo+4);
+    o = LE ? readle32(Mmap->mem+eo+8) : readbe32(Mmap->mem+eo+8);
+    if (o == 0) { continue; } // primary image
+    o += Base;
+    if ((o+4 > Mmap->memsize) || (readbe16(Mmap->mem+o) != 0xffd8)) { continue; } // not an image
+    if ((s < 4) || (s > Mmap->memsize-o)) { s = Mmap->memsize-o; }
+
+    // Insertion sort; there are only a few
+    for(i=Images; (i > 0) && (Start[i-1] > o); i--)
+      {
+      Start[i] = Start[i-1];
+      Size[i] = Size[i-1];
+      }
+    Start[i] = o;
+    Size[i] = s;
+    Images++;
+    }
+  return(Images);
+} /* _JPEGmpfImages() */
+
+/**************************************
+ _JPEGdeep(): Deep scan past the primary image.
+ Checks MPF images and any data after the primary image's ffd9.
+ Only used with "deepscan"; this reads the whole file.
+ **************************************/
+sealfield *	_JPEGdeep	(sealfield *Args, mmapfile *Mmap, size_t FFDAoffset)
+{
+  size_t Start[JPEG_MPF_MAX], Size[JPEG_MPF_MAX];
+  size_t Cursor, ImageEnd;
+  int Images, i;
+
+  if (!FFDAoffset) { return(Args); } // no image data
+  Cursor = _JPEGscanEnd(Mmap,FFDAoffset,Mmap->memsize);
+  Images = _JPEGmpfImages(Args,Mmap,Start,Size,JPEG_MPF_MAX);
+
+  // Trailing data and embedded images, in file order
+  for(i=0; i < Images; i++)
+    {
+    if (Start[i] < Cursor) { continue; } // overlaps; not a real image
+    Args = _JPEGrecords(Args,Mmap,Cursor,Start[i]);
+    Args = _JPEGimage(Args,Mmap,Start[i],Start[i]+Size[i],&ImageEnd);
+    Cursor = Start[i]+Size[i];
+    if (ImageEnd > Cursor) { Cursor = ImageEnd; }
+    }
+  Args = _JPEGrecords(Args,Mmap,Cursor,Mmap->memsize);
+  return(Args);
+} /* _JPEGdeep() */
 #pragma GCC visibility pop
 
 /**************************************
@@ -463,7 +751,7 @@ sealfield *     Seal_JPEGsign    (sealfield *Rec, mmapfile *MmapIn, size_t FFDAo
   if (SealGetCindex(Rec,"@sflags",1)=='f')
 	{
 	fprintf(stderr,"ERROR: JPEG is finalized; cannot sign. Aborting.\n");
-	exit(1);
+	SealFatal();
 	}
 
   // Check for MPF
@@ -480,7 +768,7 @@ sealfield *     Seal_JPEGsign    (sealfield *Rec, mmapfile *MmapIn, size_t FFDAo
   if (!Fout)
     {
     fprintf(stderr,"ERROR: Cannot create file (%s). Aborting.\n",fname);
-    exit(1);
+    SealFatal();
     }
 
   // Grab the new block placeholder
@@ -524,7 +812,12 @@ sealfield *     Seal_JPEGsign    (sealfield *Rec, mmapfile *MmapIn, size_t FFDAo
   // Insert new signature
   mmapfile *MmapOut;
   MmapOut = MmapFile(fname,PROT_WRITE);
-  SealSign(Rec,MmapOut);
+  if (!MmapOut)
+    {
+    fprintf(stderr,"ERROR: Unable to reopen the signed JPEG (%s). Aborting.\n",fname);
+    SealFatal();
+    }
+  SealSign(Rec,MmapOut,NULL);
   MmapFree(MmapOut);
 
   return(Rec);
@@ -557,13 +850,11 @@ sealfield *	Seal_JPEG	(sealfield *Args, mmapfile *Mmap)
    This way, the scope of all values is limited to Rec.
    When this finishes, moves the values I want to keep back into Args.
    *****/
-  sealfield *Rec;
-  size_t RecEnd=0;
   size_t Offset;
   uint16_t BlockType, PreviousBlockType=0;
   size_t BlockSize;
   size_t FFDAoffset=0; // set when 0xffda (start of stream; SOS) insertion point is found
-  size_t SearchOffset;
+  char Mode;
 
   Offset=2; // skip ffd8 header; it has no length.
   BlockType = 0xffd8;
@@ -639,103 +930,7 @@ sealfield *	Seal_JPEG	(sealfield *Args, mmapfile *Mmap)
 	goto NextBlock;
 	}
 
-      // EXIF gets special handling
-      if ((BlockSize > 8) && !memcmp(Mmap->mem+Offset+4,"Exif\0\0",6))
-	{
-	// TBD: Process exif which begins at Offset+10 and length is BlockSize-8
-	// EXIF can be large, spanning multiple apps! SEAL must be in first block.
-	goto NextBlock;
-	}
-
-      /*****
-       Skip known-blocks that can contain nested media and that don't
-       support their own comment structure.
-       *****/
-      int kl;
-      static struct // known block types to skip
-	{
-	int LabelLen; 
-	const char *Label; // some labels are null-terminated; "standard" /smh
-	} KnownLabel[] =
-	{
-	  // Ordered by length (stop searching if it's too small)
-	  { 3, "JP\0" },
-	  { 4, "JPN\0" },
-	  { 4, "HPQ-" },
-	  { 4, "DP2\0" },
-	  { 4, "PIC\0" },
-	  { 5, "AROT\0" },
-	  { 5, "JFIF\0" },
-	  { 5, "JFXX\0" },
-	  { 5, "HPSC\0" },
-	  { 5, "H3X0\0" },
-	  { 5, "FPXR\0" },
-	  { 5, "MOTO\0" },
-	  { 5, "XMTH\0" },
-	  { 6, "Adobe\0" },
-	  { 6, "Ducky\0" },
-	  { 6, "AJPEG\0" },
-	  { 7, "SCRNAIL" },
-	  { 7, "MMIMETA" },
-	  { 8, "Ocad$Rev" },
-	  { 8, "Qualcomm" },
-	  { 10, "ssuniqueid" },
-	  { 11, "HPQ-Capture" },
-	  { 12, "ICC_PROFILE\0" },
-	  { 14, "Photoshop 3.0\0" },
-	  { 17, "GenaPhotoStamperd" },
-	  { 0, NULL } // end marker
-	  // Permit "XMP\0" for XMP metadata
-	  // Permit "http://ns.adobe.com/\0" for XMP extension
-	};
-      for(kl=0; KnownLabel[kl].Label && ((size_t)KnownLabel[kl].LabelLen+2 < BlockSize); kl++)
-	{
-	if (!memcmp(Mmap->mem+Offset+4, KnownLabel[kl].Label, KnownLabel[kl].LabelLen))
-	  {
-	  //DEBUGPRINT("Skipping known: %s",KnownLabel[kl].Label);
-	  goto NextBlock;
-	  }
-	}
-
-      /*****
-       Found a "standard" APP block (IPTC, XMP, or dozens of others).
-       Scan the APP block for a signature
-
-       WARNING: If the block contains a nested JPEG or PNG or other file
-       that contains it's own SEAL signature, then this will pick it up and
-       scan it, likely resulting in an invalid signature being found.
-
-       And if the nested media is finalized, then this file cannot be signed.
-       *****/
-      Rec=NULL;
-      SearchOffset=2; // skip size
-      //DEBUGPRINT("Scanning %04x",(int)BlockType);
-      while(SearchOffset < BlockSize)
-	{
-	Rec = SealParse(BlockSize-SearchOffset,Mmap->mem+Offset+2+SearchOffset,Offset+2+SearchOffset,Args);
-	if (!Rec) { break; } // nothing found
-
-	// Found a signature!
-	// Verify the data!
-	Rec = SealCopy2(Rec,"@pubkeyfile",Args,"@pubkeyfile");
-	Rec = SealVerify(Rec,Mmap);
-
-	// Iterate on remainder
-	RecEnd = SealGetIindex(Rec,"@RecEnd",0);
-	if (RecEnd <= 0) { RecEnd=1; } // should never happen, but if it does, stop infinite loops
-	SearchOffset += RecEnd;
-
-	// Retain state
-	Args = SealCopy2(Args,"@p",Rec,"@p"); // keep previous settings
-	Args = SealCopy2(Args,"@s",Rec,"@s"); // keep previous settings
-	Args = SealCopy2(Args,"@dnscachelast",Rec,"@dnscachelast"); // store any cached DNS
-	Args = SealCopy2(Args,"@public",Rec,"@public"); // store any cached DNS
-	Args = SealCopy2(Args,"@publicbin",Rec,"@publicbin"); // store any cached DNS
-	Args = SealCopy2(Args,"@sflags",Rec,"@sflags"); // retain sflags
-
-	// Clean up
-	SealFree(Rec); Rec=NULL;
-	}
+      Args = _JPEGapp(Args,Mmap,Offset,BlockSize);
       }
 
 NextBlock:
@@ -744,6 +939,18 @@ NextBlock:
     PreviousBlockType = BlockType;
     }
 
+  /*****
+   Signatures are usually in the primary image's APP blocks.
+   When verifying with "deepscan", also check the MPF images
+   and anything after the primary image.
+   (Signing inserts before the ffda, so it never looks past it.)
+   *****/
+  Mode = SealGetCindex(Args,"@mode",0);
+  if ((Mode != 's') && (Mode != 'S') && SealGetText(Args,"deepscan"))
+    {
+    Args = _JPEGdeep(Args,Mmap,FFDAoffset);
+    }
+
   /*****
    Add a signature as needed
    By default, use APP8 (ffe8).
@@ -752,7 +959,7 @@ NextBlock:
   Args = Seal_JPEGsign(Args,Mmap,FFDAoffset, (PreviousBlockType == 0xffe8) ? 0xffe9 : 0xffe8);
   if (SealGetIindex(Args,"@s",2)==0) // no signatures
     {
-    printf("No SEAL signatures found.\n");
+    SealPrintf("No SEAL signatures found.\n");
     }
 
   return(Args);
@@ -26,6 +26,15 @@
    - tag 0x05345414C (SEAL), encoded as 0x085345414C
  The value of the SEAL chunk is a "<seal .../>" record.
 
+ SEAL records are found in SEAL elements (after a Segment or
+ inside one) and in Tags values.  The walker only descends
+ into Segment and Tags.  Clusters are skipped by their size,
+ so verifying a long recording reads one header per Cluster
+ (plus the digest).  The SeekHead index is only used to find
+ Tags and SEAL elements that the walk could not reach.
+ Live recordings may use unknown sizes (all value bits set);
+ those elements end where their parent's next element begins.
+
  For signing? Append the SEAL record at the end of the file.
  ************************************************/
 #include <stdlib.h>
@@ -36,8 +45,31 @@
 #include "sign.hpp"
 #include "files.hpp"
 #include "formats.hpp"
+#include "stats.hpp"
 
 #pragma GCC visibility push(hidden)
+// Element IDs (with their length marker, as in the specification)
+#define MA_ID_EBML	0x1A45DFA3
+#define MA_ID_SEGMENT	0x18538067
+#define MA_ID_SEEKHEAD	0x114D9B74
+#define MA_ID_SEEK	0x4DBB
+#define MA_ID_SEEKID	0x53AB
+#define MA_ID_SEEKPOS	0x53AC
+#define MA_ID_TAGS	0x1254C367
+#define MA_ID_TAG	0x7373
+#define MA_ID_SIMPLETAG	0x67C8
+#define MA_ID_TAGSTRING	0x4487
+#define MA_ID_TAGBINARY	0x4485
+#define MA_ID_SEAL	0x085345414C
+#define MA_UNKNOWN	((size_t)(-2)) // element size is unknown (streaming)
+#define MA_SEEK_MAX	64 // SeekHead entries kept per Segment
+#define MA_TAG_DEPTH	8 // nested SimpleTags
+
+typedef struct
+  {
+  uint64_t ID;
+  size_t Pos; // offset in the file
+  } maseek;
 
 /**************************************
  _MaReadData(): Read a variable-length value.
@@ -101,60 +133,323 @@ sealfield *	_MaWriteData	(sealfield *Rec, const char *Field, size_t Value)
   return(Rec);
 } /* _MaWriteData() */
 
+/**************************************
+ _MaReadID(): Read an element ID.
+ Unlike sizes, IDs keep their length marker (e.g., Segment
+ is 0x18538067), matching the Matroska specification.
+ Updates Offset.
+ Returns: ID, or -1 if invalid.
+ **************************************/
+size_t	_MaReadID	(mmapfile *Mmap, size_t *Offset)
+{
+  size_t Val=0;
+  byte Dat;
+  int Len,i;
+
+  if (Offset[0] >= Mmap->memsize) return((size_t)(-1));
+  Dat = Mmap->mem[Offset[0]];
+  if (Dat==0) return((size_t)(-1)); /* invalid */
+  for(Len=1; !(Dat & (0x80 >> (Len-1))); Len++) ;
+  if (Offset[0]+Len > Mmap->memsize) return((size_t)(-1)); /* truncated */
+  for(i=0; i < Len; i++) { Val = (Val << 8) | Mmap->mem[Offset[0]+i]; }
+  Offset[0] += Len;
+  return(Val);
+} /* _MaReadID() */
+
+/**************************************
+ _MaReadSize(): Read an element size.
+ All value bits set means the size is unknown (streaming).
+ Updates Offset.
+ Returns: size, MA_UNKNOWN, or -1 if invalid.
+ **************************************/
+size_t	_MaReadSize	(mmapfile *Mmap, size_t *Offset)
+{
+  size_t Start, Val;
+  int Len;
+
+  Start = Offset[0];
+  Val = _MaReadData(Mmap,Offset);
+  if (Val == (size_t)(-1)) { return(Val); }
+  for(Len=1; !(Mmap->mem[Start] & (0x80 >> (Len-1))); Len++) ;
+  if (Offset[0]-Start != (size_t)Len) { return((size_t)(-1)); } /* truncated */
+  if (Val == ((size_t)1 << (7*Len)) - 1) { return(MA_UNKNOWN); }
+  return(Val);
+} /* _MaReadSize() */
+
+/**************************************
+ _MaReadUint(): Read an unsigned integer element's value.
+ **************************************/
+uint64_t	_MaReadUint	(mmapfile *Mmap, size_t Offset, size_t Len)
+{
+  uint64_t Val=0;
+  size_t i;
+
+  if (Len > 8) { return(0); } // invalid
+  for(i=0; i < Len; i++) { Val = (Val << 8) | Mmap->mem[Offset+i]; }
+  return(Val);
+} /* _MaReadUint() */
+
+/**************************************
+ _MaRecords(): Process any SEAL records in an element's data.
+ **************************************/
+sealfield *	_MaRecords	(sealfield *Args, mmapfile *Mmap, size_t Offset, size_t iLen)
+{
+  sealfield *Rec;
+  size_t ChunkOffset, RecEnd;
+
+  ChunkOffset=0; // permit multiple SEAL records in one field
+  while(ChunkOffset < iLen)
+    {
+    Rec = SealParse(iLen-ChunkOffset,Mmap->mem+Offset+ChunkOffset,Offset+ChunkOffset,Args);
+    if (!Rec) { break; } // no record found; stop looking in this chunk
+    SealStatInc(SEAL_COUNT_REC_MATROSKA,1);
+
+    // Found a signature!
+    // Verify the data!
+    Rec = SealCopy2(Rec,"@pubkeyfile",Args,"@pubkeyfile");
+    Rec = SealVerify(Rec,Mmap);
+
+    // Iterate on remainder
+    RecEnd = SealGetIindex(Rec,"@RecEnd",0);
+    if (RecEnd <= 0) { RecEnd=1; } // should never happen, but if it does, stop infinite loops
+    ChunkOffset += RecEnd;
+
+    // Retain state
+    Args = SealCopy2(Args,"@p",Rec,"@p"); // keep previous settings
+    Args = SealCopy2(Args,"@s",Rec,"@s"); // keep previous settings
+    Args = SealCopy2(Args,"@dnscachelast",Rec,"@dnscachelast"); // store any cached DNS
+    Args = SealCopy2(Args,"@public",Rec,"@public"); // store any cached DNS
+    Args = SealCopy2(Args,"@publicbin",Rec,"@publicbin"); // store any cached DNS
+    Args = SealCopy2(Args,"@sflags",Rec,"@sflags"); // retain sflags
+
+    // Clean up
+    SealFree(Rec);
+    }
+  return(Args);
+} /* _MaRecords() */
+
+/**************************************
+ _MaSkipUnknown(): Find the end of an unknown-size element.
+ Its children are walked until something that cannot be a
+ child appears.  Cluster children have 1- or 2-byte IDs, and
+ every Segment-level element has a 4-byte (or longer) ID.
+ Returns: offset after the element.
+ **************************************/
+size_t	_MaSkipUnknown	(mmapfile *Mmap, size_t Offset, size_t End)
+{
+  size_t Pos, iTag, iLen;
+
+  while(Offset < End)
+    {
+    Pos = Offset;
+    iTag = _MaReadID(Mmap,&Offset);
+    if ((iTag == (size_t)(-1)) || (Offset-Pos >= 4)) { return(Pos); } // not a child
+    iLen = _MaReadSize(Mmap,&Offset);
+    if ((iLen == (size_t)(-1)) || (iLen == MA_UNKNOWN)) { return(Pos); }
+    if (Offset+iLen > End) { return(End); } // still being written
+    Offset += iLen;
+    }
+  return(End);
+} /* _MaSkipUnknown() */
+
+/**************************************
+ _MaTags(): Walk Tags for SEAL records in tag values.
+ Tags, Tag, and SimpleTag (which can nest) are containers;
+ TagString and TagBinary hold the values.
+ NOTE: This is recursive!
+ **************************************/
+sealfield *	_MaTags	(sealfield *Args, mmapfile *Mmap, size_t Offset, size_t End, int Depth)
+{
+  size_t iTag, iLen;
+
+  while(Offset < End)
+    {
+    iTag = _MaReadID(Mmap,&Offset);
+    if (iTag == (size_t)(-1)) { break; } // invalid
+    iLen = _MaReadSize(Mmap,&Offset);
+    if ((iLen == (size_t)(-1)) || (iLen == MA_UNKNOWN)) { break; } // tags always have a size
+    if (Offset+iLen > End) { break; } // overflow
+
+    switch(iTag)
+      {
+      case MA_ID_TAG:
+      case MA_ID_SIMPLETAG:
+	if (Depth < MA_TAG_DEPTH) { Args = _MaTags(Args,Mmap,Offset,Offset+iLen,Depth+1); }
+	break;
+      case MA_ID_TAGSTRING:
+      case MA_ID_TAGBINARY:
+      case MA_ID_SEAL:
+	Args = _MaRecords(Args,Mmap,Offset,iLen);
+	break;
+      default: break;
+      }
+    Offset += iLen;
+    }
+  return(Args);
+} /* _MaTags() */
+
+/**************************************
+ _MaSeekHead(): Remember where a SeekHead says elements are.
+ Positions are relative to the Segment's data (SegStart).
+ Only elements that can hold records (Tags, SEAL) are kept.
+ Returns: number of entries in Seek.
+ **************************************/
+int	_MaSeekHead	(mmapfile *Mmap, size_t Offset, size_t End, size_t SegStart, maseek *Seek, int SeekCount)
+{
+  size_t iTag, iLen, SeekEnd, Pos;
+  uint64_t ID, SeekPos;
+
+  while((Offset < End) && (SeekCount < MA_SEEK_MAX))
+    {
+    iTag = _MaReadID(Mmap,&Offset);
+    if (iTag == (size_t)(-1)) { break; }
+    iLen = _MaReadSize(Mmap,&Offset);
+    if ((iLen == (size_t)(-1)) || (iLen == MA_UNKNOWN) || (Offset+iLen > End)) { break; }
+    if (iTag == MA_ID_SEEK)
+      {
+      // Seek: SeekID (the element's ID, as bytes) and SeekPosition
+      ID=0; SeekPos=(uint64_t)(-1);
+      SeekEnd = Offset+iLen;
+      while(Offset < SeekEnd)
+	{
+	iTag = _MaReadID(Mmap,&Offset);
+	if (iTag == (size_t)(-1)) { break; }
+	iLen = _MaReadSize(Mmap,&Offset);
+	if ((iLen == (size_t)(-1)) || (iLen == MA_UNKNOWN) || (Offset+iLen > SeekEnd)) { break; }
+	if (iTag == MA_ID_SEEKID) { ID = _MaReadUint(Mmap,Offset,iLen); }
+	else if (iTag == MA_ID_SEEKPOS) { SeekPos = _MaReadUint(Mmap,Offset,iLen); }
+	Offset += iLen;
+	}
+      Offset = SeekEnd;
+      Pos = SegStart + SeekPos;
+      if (((ID == MA_ID_TAGS) || (ID == MA_ID_SEAL)) && (SeekPos < Mmap->memsize) && (Pos < Mmap->memsize))
+	{
+	Seek[SeekCount].ID = ID;
+	Seek[SeekCount].Pos = Pos;
+	SeekCount++;
+	}
+      continue;
+      }
+    Offset += iLen;
+    }
+  return(SeekCount);
+} /* _MaSeekHead() */
+
+/**************************************
+ _MaSegment(): Walk the elements in a Segment.
+ Only SEAL and Tags are read.  Everything else (including every
+ Cluster) is skipped by its size, so no record between elements
+ is missed.
+ If the walk runs into data it cannot parse, then any Tags or
+ SEAL elements that a SeekHead listed after that point are
+ read from where the index says they are.
+ A Segment with an unknown size (still being written) ends at
+ End or at the next EBML header or Segment.
+ Sets Stop to the offset after the Segment.
+ **************************************/
+sealfield *	_MaSegment	(sealfield *Args, mmapfile *Mmap, size_t Start, size_t End, size_t *Stop)
+{
+  maseek Seek[MA_SEEK_MAX];
+  int SeekCount=0;
+  size_t Offset, Pos, iTag, iLen, Next;
+  bool Lost=false;
+  int i,j;
+
+  Offset = Start;
+  while(Offset < End)
+    {
+    Pos = Offset;
+    iTag = _MaReadID(Mmap,&Offset);
+    if (iTag == (size_t)(-1)) { Offset=Pos; Lost=true; break; } // invalid
+    if ((iTag == MA_ID_EBML) || (iTag == MA_ID_SEGMENT)) { Offset=Pos; break; } // next segment
+    iLen = _MaReadSize(Mmap,&Offset);
+    if (iLen == (size_t)(-1)) { Offset=Pos; Lost=true; break; } // invalid
+
+    if (iLen == MA_UNKNOWN) // live recording
+      {
+      Offset = _MaSkipUnknown(Mmap,Offset,End);
+      continue;
+      }
+    if (Offset+iLen > End)
+      {
+      if (iTag == MA_ID_SEAL) { Offset=Pos; break; } // truncated record
+      iLen = End-Offset; // the rest is this element
+      }
+
+    switch(iTag)
+      {
+      case MA_ID_SEAL:
+	Args = _MaRecords(Args,Mmap,Offset,iLen);
+	break;
+      case MA_ID_TAGS:
+	Args = _MaTags(Args,Mmap,Offset,Offset+iLen,0);
+	break;
+      case MA_ID_SEEKHEAD:
+	SeekCount = _MaSeekHead(Mmap,Offset,Offset+iLen,Start,Seek,SeekCount);
+	break;
+      default: break; // including Clusters
+      }
+    Offset += iLen;
+    }
+  *Stop = Offset;
+
+  // Lost? Read the indexed targets after this point, in order
+  Pos = Offset;
+  while(Lost)
+    {
+    i=-1;
+    for(j=0; j < SeekCount; j++)
+      {
+      if ((Seek[j].Pos > Pos) && (Seek[j].Pos < End) && ((i < 0) || (Seek[j].Pos < Seek[i].Pos))) { i=j; }
+      }
+    if (i < 0) { break; }
+    Pos = Offset = Seek[i].Pos;
+    iTag = _MaReadID(Mmap,&Offset);
+    if (iTag != Seek[i].ID) { continue; } // index is wrong here
+    iLen = _MaReadSize(Mmap,&Offset);
+    if ((iLen == (size_t)(-1)) || (iLen == MA_UNKNOWN) || (Offset+iLen > End)) { continue; }
+    if (iTag == MA_ID_TAGS) { Args = _MaTags(Args,Mmap,Offset,Offset+iLen,0); }
+    else { Args = _MaRecords(Args,Mmap,Offset,iLen); }
+    Next = Offset+iLen;
+    if (Next > *Stop) { *Stop = Next; }
+    }
+  return(Args);
+} /* _MaSegment() */
+
 /**************************************
  _Matroskawalk(): Given a Matroska, walk the structures.
  Evaluate any SEAL or text chunks.
- Data and Pos may change during recursion, but Mmap is always source file.
- NOTE: This is recursive!
+ The top level has the EBML header, Segments, and any SEAL
+ elements appended after a Segment.
  **************************************/
 sealfield *	_Matroskawalk	(sealfield *Args, mmapfile *Mmap)
 {
-  sealfield *Rec;
-  size_t iTag,iLen;
+  size_t iTag,iLen,Stop;
   size_t Offset=0;
 
-  //_MaWriteData(NULL,0x05345414C);
-
   while(Offset < Mmap->memsize)
     {
-    iTag = _MaReadData(Mmap,&Offset);
+    iTag = _MaReadID(Mmap,&Offset);
     if (iTag == (size_t)(-1)) { break; } // invalid
-    iLen = _MaReadData(Mmap,&Offset);
+    iLen = _MaReadSize(Mmap,&Offset);
     if (iLen == (size_t)(-1)) { break; } // invalid
-    if (Offset+iLen > Mmap->memsize) { break; } // overflow
 
-    if (iTag == 0x5345414C) // if SEAL chunk
+    if (iTag == MA_ID_SEGMENT)
 	{
-	// Process possible SEAL record.
-	size_t ChunkOffset, RecEnd;
-	Rec=NULL;
-	ChunkOffset=0; // permit multiple SEAL records in one field
-	while(ChunkOffset < iLen)
+	if ((iLen == MA_UNKNOWN) || (Offset+iLen > Mmap->memsize))
 	  {
-	  Rec = SealParse(iLen-ChunkOffset,Mmap->mem+Offset+ChunkOffset,Offset+ChunkOffset,Args);
-	  if (!Rec) { break; } // no record found; stop looking in this chunk
-
-	  // Found a signature!
-	  // Verify the data!
-	  Rec = SealCopy2(Rec,"@pubkeyfile",Args,"@pubkeyfile");
-	  Rec = SealVerify(Rec,Mmap);
-
-	  // Iterate on remainder
-	  RecEnd = SealGetIindex(Rec,"@RecEnd",0);
-	  if (RecEnd <= 0) { RecEnd=1; } // should never happen, but if it does, stop infinite loops
-	  ChunkOffset += RecEnd;
-
-	  // Retain state
-	  Args = SealCopy2(Args,"@p",Rec,"@p"); // keep previous settings
-	  Args = SealCopy2(Args,"@s",Rec,"@s"); // keep previous settings
-	  Args = SealCopy2(Args,"@dnscachelast",Rec,"@dnscachelast"); // store any cached DNS
-	  Args = SealCopy2(Args,"@public",Rec,"@public"); // store any cached DNS
-	  Args = SealCopy2(Args,"@publicbin",Rec,"@publicbin"); // store any cached DNS
-	  Args = SealCopy2(Args,"@sflags",Rec,"@sflags"); // retain sflags
-
-	  // Clean up
-	  SealFree(Rec); Rec=NULL;
+	  // Streaming or truncated: the Segment runs to the end of the file
+	  Args = _MaSegment(Args,Mmap,Offset,Mmap->memsize,&Offset);
+	  continue;
 	  }
+	Args = _MaSegment(Args,Mmap,Offset,Offset+iLen,&Stop);
+	}
+    else if (iLen == MA_UNKNOWN) { break; } // cannot skip it
+    else if (Offset+iLen > Mmap->memsize) { break; } // overflow
+    else if (iTag == MA_ID_SEAL) // if SEAL chunk
+	{
+	// Process possible SEAL record.
+	Args = _MaRecords(Args,Mmap,Offset,iLen);
 	}
 
     Offset+=iLen;
@@ -178,6 +473,29 @@ bool	Seal_isMatroska	(mmapfile *Mmap)
   return(true);
 } /* Seal_isMatroska() */
 
+/**************************************
+ Seal_Matroskablock(): Wrap '@record' in a Matroska SEAL element.
+ Stores the element in '@BLOCK' and makes '@s' relative to it.
+ **************************************/
+sealfield *	Seal_Matroskablock	(sealfield *Args)
+{
+  sealfield *rec;
+
+  Args = _MaWriteData(Args,"@BLOCK",0x5345414C); // encode "SEAL" tag
+  Args = _MaWriteData(Args,"@@iLen",SealGetSize(Args,"@record")); // encode length
+  rec = SealSearch(Args,"@@iLen");
+  Args = SealAddBin(Args,"@BLOCK",rec->ValueLen,rec->Value);
+  Args = SealDel(Args,"@@iLen");
+  // Make '@s' relative to block
+  SealIncIindex(Args, "@s", 0, SealGetSize(Args,"@BLOCK"));
+  SealIncIindex(Args, "@s", 1, SealGetSize(Args,"@BLOCK"));
+  // Add record
+  rec = SealSearch(Args,"@record");
+  Args = SealAddBin(Args,"@BLOCK",rec->ValueLen,rec->Value);
+  SealSetType(Args,"@BLOCK",'x');
+  return(Args);
+} /* Seal_Matroskablock() */
+
 /**************************************
  Seal_Matroskasign(): Sign a Matroska.
  Insert a Matroska signature.
@@ -190,7 +508,6 @@ sealfield *	Seal_Matroskasign	(sealfield *Args, mmapfile *MmapIn)
    The only hard part is computing the encoded integers for tag and length.
    *****/
   const char *fname;
-  sealfield *rec; // SEAL record
   char *Opt;
   mmapfile *MmapOut;
 
@@ -235,24 +552,13 @@ sealfield *	Seal_Matroskasign	(sealfield *Args, mmapfile *MmapIn)
   Args = SealRecord(Args); // get placeholder
 
   // Create the block
-  Args = _MaWriteData(Args,"@BLOCK",0x5345414C); // encode "SEAL" tag
-  Args = _MaWriteData(Args,"@@iLen",SealGetSize(Args,"@record")); // encode length
-  rec = SealSearch(Args,"@@iLen");
-  Args = SealAddBin(Args,"@BLOCK",rec->ValueLen,rec->Value);
-  Args = SealDel(Args,"@@iLen");
-  // Make '@s' relative to block
-  SealIncIindex(Args, "@s", 0, SealGetSize(Args,"@BLOCK"));
-  SealIncIindex(Args, "@s", 1, SealGetSize(Args,"@BLOCK"));
-  // Add record
-  rec = SealSearch(Args,"@record");
-  Args = SealAddBin(Args,"@BLOCK",rec->ValueLen,rec->Value);
-  SealSetType(Args,"@BLOCK",'x');
-  
+  Args = Seal_Matroskablock(Args);
+
   MmapOut = SealInsert(Args,MmapIn,MmapIn->memsize);
   if (MmapOut)
     {
     // Sign it!
-    SealSign(Args,MmapOut);
+    SealSign(Args,MmapOut,NULL);
     MmapFree(MmapOut);
     }
   
@@ -277,7 +583,7 @@ sealfield *	Seal_Matroska	(sealfield *Args, mmapfile *Mmap)
   Args = Seal_Matroskasign(Args,Mmap); // Add a signature as needed
   if (SealGetIindex(Args,"@s",2)==0) // no signatures
     {
-    printf("No SEAL signatures found.\n");
+    SealPrintf("No SEAL signatures found.\n");
     }
 
   return(Args);
@@ -15,6 +15,11 @@
  The outer chunk is "RIFF".
    4-byte: RIFF
    4-byte: length of file in little endian
+ Files over 4 GB use one of:
+   - "RF64" or "BW64" instead of "RIFF": 32-bit sizes that do not
+     fit are 0xFFFFFFFF and the real sizes are in a "ds64" chunk.
+   - AVI (OpenDML): more "RIFF" "AVIX" chunks after the first
+     "RIFF" "AVI " chunk, each with its own 32-bit size.
 
  "RIFF" and "LIST" are special chunks that permits nesting.
    No other chunks are nested by default.
@@ -26,7 +31,7 @@
  Unknown FourCC chunks are ignored by processing software!
 
  A SEAL record can exist:
-   - "SEAL" chunk under the top-level RIFF.
+   - "SEAL" chunk under a top-level RIFF (including AVIX).
    - Any chunk under a "LIST" chunk under the top-level RIFF.
  The value of the SEAL chunk is a "<seal .../>" record.
  ************************************************/
@@ -38,9 +43,19 @@
 #include "sign.hpp"
 #include "files.hpp"
 #include "formats.hpp"
+#include "stats.hpp"
 
 #pragma GCC visibility push(hidden)
 
+typedef struct
+  {
+  bool Valid; // is RF64 or BW64
+  uint64_t RiffSize;
+  uint64_t DataSize;
+  const byte *Table; // FourCC + 8-byte size for other large chunks
+  uint32_t TableCount;
+  } riffds64;
+
 const char *_RIFFvalidate[] = {
 	"SEAL", // SEAL record
 	"XMP ", // XMP data
@@ -83,43 +98,122 @@ const char *_RIFFvalidate[] = {
 	NULL
 	};
 
+/**************************************
+ _RIFFds64(): Read the "ds64" chunk of an RF64 or BW64 file.
+ RF64 (EBU Tech 3306) and BW64 (ITU-R BS.2088) are RIFF with
+ 64-bit sizes.  Any 32-bit size that does not fit is 0xFFFFFFFF,
+ and the real size is in "ds64", which must be the first chunk:
+   8-byte RIFF size, 8-byte "data" size, 8-byte sample count,
+   4-byte table length, then table entries (FourCC + 8-byte size)
+   for any other chunk that is too large.
+ Returns: true if found.
+ **************************************/
+bool	_RIFFds64	(mmapfile *Mmap, riffds64 *Ds64)
+{
+  uint32_t size;
+
+  memset(Ds64,0,sizeof(riffds64));
+  if (Mmap->memsize < 48) { return(false); }
+  if (memcmp(Mmap->mem,"RF64",4) && memcmp(Mmap->mem,"BW64",4)) { return(false); }
+  if (memcmp(Mmap->mem+12,"ds64",4)) { return(false); }
+  size = readle32(Mmap->mem+16);
+  if ((size < 28) || (20 + (uint64_t)size > Mmap->memsize)) { return(false); }
+
+  Ds64->RiffSize = readle64(Mmap->mem+20);
+  Ds64->DataSize = readle64(Mmap->mem+28);
+  Ds64->TableCount = readle32(Mmap->mem+44);
+  if ((uint64_t)Ds64->TableCount*12 > size-28) { Ds64->TableCount = (size-28)/12; }
+  Ds64->Table = Mmap->mem+48;
+  Ds64->Valid = true;
+  return(true);
+} /* _RIFFds64() */
+
+/**************************************
+ _RIFFsize(): Get a chunk's size (without padding).
+ With RF64/BW64, 0xFFFFFFFF means the size is in ds64.
+ **************************************/
+uint64_t	_RIFFsize	(const byte *Data, riffds64 *Ds64)
+{
+  uint32_t size, i;
+
+  size = readle32(Data+4);
+  if ((size != 0xffffffff) || !Ds64->Valid) { return(size); }
+  if (!memcmp(Data,"RF64",4) || !memcmp(Data,"BW64",4)) { return(Ds64->RiffSize); }
+  if (!memcmp(Data,"data",4)) { return(Ds64->DataSize); }
+  for(i=0; i < Ds64->TableCount; i++)
+    {
+    if (!memcmp(Ds64->Table+i*12,Data,4)) { return(readle64(Ds64->Table+i*12+4)); }
+    }
+  return(size);
+} /* _RIFFsize() */
+
+/**************************************
+ _RIFFlast(): Find the last top-level chunk.
+ Large AVI files (OpenDML) continue in "RIFF" "AVIX" chunks
+ after the first "RIFF" "AVI " chunk.  Only the chunk headers
+ are read; each one says where the next begins.
+ Returns: offset of the last chunk, or -1 if the chunks do not
+ exactly cover the file.
+ **************************************/
+size_t	_RIFFlast	(mmapfile *Mmap, riffds64 *Ds64)
+{
+  size_t Offset=0, Last=(size_t)(-1);
+  uint64_t size;
+
+  while(Offset+8 <= Mmap->memsize)
+    {
+    if ((Offset > 0) && memcmp(Mmap->mem+Offset,"RIFF",4)) { return((size_t)(-1)); } // garbage
+    size = _RIFFsize(Mmap->mem+Offset,Ds64);
+    if (size > Mmap->memsize - Offset - 8) { return((size_t)(-1)); } // overflow
+    Last = Offset;
+    Offset += 8 + size;
+    if (Offset == Mmap->memsize) { return(Last); }
+    Offset += size%2; // padding
+    }
+  return((Offset == Mmap->memsize) ? Last : (size_t)(-1));
+} /* _RIFFlast() */
+
 /**************************************
  _RIFFwalk(): Given a RIFF, walk the structures.
  Evaluate any SEAL or text chunks.
+ Only chunk headers are read while walking: large payloads
+ ("LIST" "movi", "data") are skipped by their size, so their
+ pages are never touched.
  Data and Pos may change during recursion, but Mmap is always source file.
  NOTE: This is recursive!
  **************************************/
-sealfield *	_RIFFwalk	(sealfield *Args, size_t DataLen, byte *Data, size_t Pos, int Depth, mmapfile *Mmap)
+sealfield *	_RIFFwalk	(sealfield *Args, size_t DataLen, byte *Data, size_t Pos, int Depth, mmapfile *Mmap, riffds64 *Ds64)
 {
   sealfield *Rec;
-  size_t size;
+  uint64_t size, ChunkLen;
   int r;
 
   while(DataLen >= 8)
     {
-    size = readle32(Data+4);
-    if (size%2) { size++; } // any padding
-    if (size > DataLen) { break; } // overflow
+    ChunkLen = _RIFFsize(Data,Ds64);
+    if (ChunkLen > DataLen-8) { break; } // overflow
+    size = ChunkLen + (ChunkLen%2); // any padding
 
-    if ((Depth < 1) && !memcmp(Data,"RIFF",4)) // iterate on RIFF!
+    if ((Depth < 1) &&
+        (!memcmp(Data,"RIFF",4) || !memcmp(Data,"RF64",4) || !memcmp(Data,"BW64",4))) // iterate on RIFF!
 	{
-	if (size > 4)
+	if (ChunkLen > 4)
 	  {
-	  // "RIFF" size and 4-byte type
+	  // "RIFF" size and 4-byte type (including any "AVIX" sequels)
 	  //DEBUGPRINT("%*s%.4s: %.4s",Depth*2,"",Data,Data+8);
-	  Args = _RIFFwalk(Args, DataLen-12, Data+12, Pos+12, Depth+1, Mmap);
+	  Args = _RIFFwalk(Args, ChunkLen-4, Data+12, Pos+12, Depth+1, Mmap, Ds64);
 	  }
 	}
     else if ((Depth < 2) && !memcmp(Data,"LIST",4)) // iterate on LIST!
 	{
-	if (size > 4)
+	if (ChunkLen > 4)
 	  {
 	  // "LIST" size and 4-byte type
 	  //DEBUGPRINT("%*s%.4s: %.4s",Depth*2,"",Data,Data+8);
 	  // only recurse on "INFO"
 	  if (!memcmp(Data+8,"INFO",4))
 	    {
-	    Args = _RIFFwalk(Args, DataLen-12, Data+12, Pos+12, Depth+1, Mmap);
+	    Args = _RIFFwalk(Args, ChunkLen-4, Data+12, Pos+12, Depth+1, Mmap, Ds64);
 	    }
 	  }
 	}
@@ -139,10 +233,11 @@ sealfield *	_RIFFwalk	(sealfield *Args, size_t DataLen, byte *Data, size_t Pos,
 	  size_t ChunkOffset, RecEnd;
 	  Rec=NULL;
 	  ChunkOffset=0; // permit multiple SEAL records in one field
-	  while(ChunkOffset < DataLen)
+	  while(ChunkOffset < ChunkLen)
 	    {
-	    Rec = SealParse(DataLen-8-ChunkOffset,Data+8+ChunkOffset,Pos+8+ChunkOffset,Args);
+	    Rec = SealParse(ChunkLen-ChunkOffset,Data+8+ChunkOffset,Pos+8+ChunkOffset,Args);
 	    if (!Rec) { break; } // no record found; stop looking in this chunk
+	    SealStatInc(SEAL_COUNT_REC_RIFF,1);
 
 	    // Found a signature!
 	    // Verify the data!
@@ -165,11 +260,13 @@ sealfield *	_RIFFwalk	(sealfield *Args, size_t DataLen, byte *Data, size_t Pos,
 	    // Clean up
 	    SealFree(Rec); Rec=NULL;
 	    }
+	  break; // each chunk is processed once
 	  } // foreach possible chunk
 	}
 
     // Skip size and padding
     size += 8;
+    if (size >= DataLen) { break; } // last chunk (padding is optional at the end)
     DataLen -= size;
     Data += size;
     Pos += size;
@@ -186,35 +283,64 @@ sealfield *	_RIFFwalk	(sealfield *Args, size_t DataLen, byte *Data, size_t Pos,
  **************************************/
 bool	Seal_isRIFF	(mmapfile *Mmap)
 {
+  riffds64 Ds64;
+
   if (!Mmap || (Mmap->memsize < 16)) { return(false); }
 
-  /* header begins with "RIFF" */
-  if (memcmp(Mmap->mem,"RIFF",4)) { return(false); } /* not a RIFF! */
-  size_t size;
-  size = readle32(Mmap->mem+4);
-  if (size+8 != Mmap->memsize) { return(false); } /* incorrect size; corrupt or wrong format */
+  /* header begins with "RIFF" (or "RF64"/"BW64" with a "ds64" chunk) */
+  if (!memcmp(Mmap->mem,"RIFF",4)) { Ds64.Valid=false; }
+  else if (!_RIFFds64(Mmap,&Ds64)) { return(false); } /* not a RIFF! */
+
+  /* The top-level chunks must exactly cover the file */
+  if (_RIFFlast(Mmap,&Ds64) == (size_t)(-1)) { return(false); } /* incorrect size; corrupt or wrong format */
   return(true);
 } /* Seal_isRIFF() */
 
+/**************************************
+ Seal_RIFFblock(): Wrap '@record' in a RIFF "SEAL" chunk.
+ Stores the chunk in '@BLOCK' and makes '@s' relative to the chunk.
+ **************************************/
+sealfield *	Seal_RIFFblock	(sealfield *Args)
+{
+  sealfield *rec, *block;
+  size_t BlockLen;
+
+  Args = SealSetTextLen(Args,"@BLOCK",8,"SEAL...."); // record + space for data size
+  // Make "@s" relative to the start of the block
+  SealIncIindex(Args, "@s", 0, 8);
+  SealIncIindex(Args, "@s", 1, 8);
+  rec = SealSearch(Args,"@record");
+  Args = SealAddBin(Args,"@BLOCK",rec->ValueLen, rec->Value);
+
+  // Set block length
+  block = SealSearch(Args,"@BLOCK");
+  BlockLen = block->ValueLen;
+  writele32(block->Value+4,BlockLen-8);
+  return(Args);
+} /* Seal_RIFFblock() */
+
 /**************************************
  Seal_RIFFsign(): Sign a RIFF.
  Insert a RIFF signature.
  **************************************/
-sealfield *	Seal_RIFFsign	(sealfield *Args, mmapfile *MmapIn)
+sealfield *	Seal_RIFFsign	(sealfield *Args, mmapfile *MmapIn, riffds64 *Ds64)
 {
   /*****
    Signing a RIFF is straightforward.
    1. Compute the size of the SEAL record + chunk.
    2. Increase the RIFF header's total size.
+      For RF64/BW64, that is the 64-bit size in ds64.
+      For AVI with "AVIX" sequels, that is the last RIFF chunk.
    3. Append the signature to the end.
    4. Computer the new signature's value.
    5. insert the new signature.
    *****/
   const char *fname;
-  sealfield *rec, *block; // SEAL record
   char *Opt;
   mmapfile *MmapOut;
-  size_t BlockLen;
+  size_t Last;
+  uint64_t NewSize;
+  byte Size[8];
 
   fname = SealGetText(Args,"@FilenameOut");
   if (!fname || !fname[0] || !MmapIn) { return(Args); } // not signing
@@ -257,26 +383,37 @@ sealfield *	Seal_RIFFsign	(sealfield *Args, mmapfile *MmapIn)
   Args = SealRecord(Args); // get placeholder
 
   // Create the block
-  Args = SealSetTextLen(Args,"@BLOCK",8,"SEAL...."); // record + space for data size
-  // Make "@s" relative to the start of the block
-  SealIncIindex(Args, "@s", 0, 8);
-  SealIncIindex(Args, "@s", 1, 8);
-  rec = SealSearch(Args,"@record");
-  Args = SealAddBin(Args,"@BLOCK",rec->ValueLen, rec->Value);
+  Args = Seal_RIFFblock(Args);
 
-  // Set block length
-  block = SealSearch(Args,"@BLOCK");
-  BlockLen = block->ValueLen;
-  writele32(block->Value+4,BlockLen-8);
+  // The RIFF chunk that the record is appended to gets the new size
+  if (Ds64->Valid) // 64-bit size in ds64
+    {
+    writele64(Size, MmapIn->memsize + SealGetSize(Args,"@BLOCK") - 8);
+    Args = SealSetBin(Args,"@HEADER",8,Size);
+    Args = SealSetIindex(Args,"@HEADERpos",0,20);
+    }
+  else
+    {
+    Last = _RIFFlast(MmapIn,Ds64); // first RIFF, unless there are AVIX sequels
+    NewSize = MmapIn->memsize + SealGetSize(Args,"@BLOCK") - Last - 8;
+    if ((Last == (size_t)(-1)) || (NewSize > 0xffffffff))
+	{
+	SealPrintf("ERROR: RIFF chunk would be larger than 4 GB; cannot sign. Skipping.\n");
+	return(Args);
+	}
+    writele32(Size, NewSize);
+    Args = SealSetBin(Args,"@HEADER",4,Size);
+    Args = SealSetIindex(Args,"@HEADERpos",0,Last+4);
+    }
 
   // Write the output; append new record to the end of the file
   MmapOut = SealInsert(Args,MmapIn,MmapIn->memsize);
+  Args = SealDel(Args,"@HEADER");
+  Args = SealDel(Args,"@HEADERpos");
   if (MmapOut)
     {
-    // Update file (initial RIFF block) with new size
-    writele32(MmapOut->mem + 4, MmapOut->memsize - 8);
     // Sign it!
-    SealSign(Args,MmapOut);
+    SealSign(Args,MmapOut,NULL);
     MmapFree(MmapOut);
     }
   
@@ -290,18 +427,21 @@ sealfield *	Seal_RIFFsign	(sealfield *Args, mmapfile *MmapIn)
  **************************************/
 sealfield *	Seal_RIFF	(sealfield *Args, mmapfile *Mmap)
 {
+  riffds64 Ds64;
+
   // Make sure it's a RIFF.
   if (!Seal_isRIFF(Mmap)) { return(Args); }
+  _RIFFds64(Mmap,&Ds64); // RF64 and BW64
 
-  Args = _RIFFwalk(Args, Mmap->memsize, Mmap->mem, 0, 0, Mmap);
+  Args = _RIFFwalk(Args, Mmap->memsize, Mmap->mem, 0, 0, Mmap, &Ds64);
 
   /*****
    Sign as needed
    *****/
-  Args = Seal_RIFFsign(Args,Mmap); // Add a signature as needed
+  Args = Seal_RIFFsign(Args,Mmap,&Ds64); // Add a signature as needed
   if (SealGetIindex(Args,"@s",2)==0) // no signatures
     {
-    printf("No SEAL signatures found.\n");
+    SealPrintf("No SEAL signatures found.\n");
     }
 
   return(Args);
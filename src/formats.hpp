@@ -19,9 +19,11 @@ sealfield *	Seal_JPEG	(sealfield *Args, mmapfile *MmapIn);
 
 bool		Seal_isRIFF	(mmapfile *Mmap);
 sealfield *	Seal_RIFF	(sealfield *Args, mmapfile *MmapIn);
+sealfield *	Seal_RIFFblock	(sealfield *Args);
 
 bool		Seal_isMatroska	(mmapfile *Mmap);
 sealfield *	Seal_Matroska	(sealfield *Args, mmapfile *MmapIn);
+sealfield *	Seal_Matroskablock	(sealfield *Args);
 
 #endif
 
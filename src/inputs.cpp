@@ -0,0 +1,416 @@
+/************************************************
+ SEAL: Input file lists.
+ See LICENSE
+
+ Files to process come from, in order:
+   1. the command line
+   2. --files-from FILE (or '-' for stdin): one name per entry,
+      separated by NUL or newline.  A list with a NUL in its
+      first PATH_MAX bytes (or before its first newline after
+      them) is NUL-separated, so "find -print0" output keeps
+      names that contain newlines.  Otherwise it is
+      newline-separated.
+   3. --recursive DIR: every regular file under DIR.
+      Directories are read as they are reached (in directory
+      order, not sorted), so millions of files never have to
+      be listed in memory first.  Symbolic links to files are
+      included; links to directories are not followed.
+
+ The next SEAL_INPUT_AHEAD names are kept in a small window.
+ Each name that enters the window is handed to a background
+ thread that opens it and asks the kernel to read it ahead
+ (posix_fadvise WILLNEED).  With a cold cache, the reads for
+ the next few files overlap with hashing the current one.
+ ************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h> // PATH_MAX
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "seal.hpp"
+#include "inputs.hpp"
+
+struct sealinput
+  {
+  // Sources, in order
+  char **Argv;
+  int Argc, Argi;
+  FILE *List; // --files-from
+  int Sep; // list separator: '\0', '\n', or -1 (not known yet)
+  char *Line;
+  size_t LineMax;
+  char *Head; // entries read while finding the separator
+  size_t HeadLen, HeadPos, HeadMax;
+  DIR *Dir; // --recursive: directory being read
+  char *DirPath;
+  char **Dirs; // directories waiting to be read
+  size_t DirCount, DirMax;
+
+  // Window of upcoming names
+  char *Window[SEAL_INPUT_AHEAD];
+  int WinStart, WinCount;
+  char *Current; // returned by SealInputNext()
+
+  // Read-ahead thread
+  pthread_mutex_t Lock;
+  pthread_cond_t Ready;
+  pthread_t Thread;
+  bool HasThread;
+  bool Finished;
+  char *Queue[SEAL_INPUT_AHEAD];
+  int QueueStart, QueueCount;
+  };
+
+#pragma GCC visibility push(hidden)
+/**************************************
+ _SealReadAheadWorker(): Thread that reads ahead upcoming files.
+ **************************************/
+void *	_SealReadAheadWorker	(void *Arg)
+{
+  sealinput *In = (sealinput*)Arg;
+  char *Name;
+  int fd;
+
+  pthread_mutex_lock(&In->Lock);
+  while(!In->Finished)
+    {
+    if (!In->QueueCount) { pthread_cond_wait(&In->Ready,&In->Lock); continue; }
+    Name = In->Queue[In->QueueStart];
+    In->QueueStart = (In->QueueStart+1) % SEAL_INPUT_AHEAD;
+    In->QueueCount--;
+    pthread_mutex_unlock(&In->Lock);
+
+    // O_NONBLOCK: never wait on a FIFO
+    fd = open(Name,O_RDONLY|O_NOCTTY|O_NONBLOCK);
+    if (fd >= 0)
+      {
+      posix_fadvise(fd,0,SEAL_READAHEAD,POSIX_FADV_WILLNEED);
+      close(fd);
+      }
+    free(Name);
+    pthread_mutex_lock(&In->Lock);
+    }
+  pthread_mutex_unlock(&In->Lock);
+  return(NULL);
+} /* _SealReadAheadWorker() */
+
+/**************************************
+ _SealReadAhead(): Queue a file for reading ahead.
+ This is only a hint; if the queue is full, the file is skipped.
+ **************************************/
+void	_SealReadAhead	(sealinput *In, const char *Name)
+{
+  char *Copy;
+
+  if (!strcmp(Name,"-")) { return; } // stdin
+  pthread_mutex_lock(&In->Lock);
+  if (!In->HasThread)
+    {
+    In->HasThread = !pthread_create(&In->Thread,NULL,_SealReadAheadWorker,In);
+    }
+  if (In->HasThread && (In->QueueCount < SEAL_INPUT_AHEAD) && (Copy = strdup(Name)))
+    {
+    In->Queue[(In->QueueStart+In->QueueCount) % SEAL_INPUT_AHEAD] = Copy;
+    In->QueueCount++;
+    pthread_cond_signal(&In->Ready);
+    }
+  pthread_mutex_unlock(&In->Lock);
+} /* _SealReadAhead() */
+
+/**************************************
+ _SealInputPushDir(): Add a directory to read later.
+ Takes ownership of Path.
+ **************************************/
+void	_SealInputPushDir	(sealinput *In, char *Path)
+{
+  if (In->DirCount >= In->DirMax)
+    {
+    In->DirMax = In->DirMax ? In->DirMax*2 : 64;
+    In->Dirs = (char**)realloc(In->Dirs,In->DirMax*sizeof(char*));
+    if (!In->Dirs)
+	{
+	fprintf(stderr,"ERROR: Unable to allocate directory list. Aborting.\n");
+	SealFatal();
+	}
+    }
+  In->Dirs[In->DirCount++] = Path;
+} /* _SealInputPushDir() */
+
+/**************************************
+ _SealInputSep(): Find the --files-from separator.
+ Reads whole entries into Head until a NUL (NUL-separated), or
+ a newline after PATH_MAX bytes (no name is that long, so it is
+ newline-separated), or the end of the list.
+ **************************************/
+void	_SealInputSep	(sealinput *In)
+{
+  int c;
+
+  In->Sep = '\n';
+  while((c = getc_unlocked(In->List)) != EOF)
+    {
+    if (In->HeadLen >= In->HeadMax)
+      {
+      In->HeadMax = In->HeadMax ? In->HeadMax*2 : 256;
+      In->Head = (char*)realloc(In->Head,In->HeadMax);
+      if (!In->Head)
+	{
+	fprintf(stderr,"ERROR: Unable to allocate file list entry. Aborting.\n");
+	SealFatal();
+	}
+      }
+    In->Head[In->HeadLen++] = c;
+    if (c == '\0') { In->Sep = '\0'; break; }
+    if ((c == '\n') && (In->HeadLen >= PATH_MAX)) { break; }
+    }
+} /* _SealInputSep() */
+
+/**************************************
+ _SealInputList(): Read the next name from --files-from.
+ Returns: malloc'd name, or NULL at the end of the list.
+ **************************************/
+char *	_SealInputList	(sealinput *In)
+{
+  ssize_t Len;
+  char *Start, *End;
+
+  while(In->List)
+    {
+    if (In->Sep < 0) { _SealInputSep(In); } // first entry
+    if (In->HeadPos < In->HeadLen) // entries read by _SealInputSep()
+      {
+      Start = In->Head + In->HeadPos;
+      End = (char*)memchr(Start,In->Sep,In->HeadLen - In->HeadPos);
+      Len = End ? End-Start : (ssize_t)(In->HeadLen - In->HeadPos);
+      In->HeadPos += Len + (End ? 1 : 0);
+      if ((size_t)Len+1 > In->LineMax)
+	{
+	In->LineMax = Len+1;
+	In->Line = (char*)realloc(In->Line,In->LineMax);
+	if (!In->Line)
+	  {
+	  fprintf(stderr,"ERROR: Unable to allocate file list entry. Aborting.\n");
+	  SealFatal();
+	  }
+	}
+      memcpy(In->Line,Start,Len);
+      In->Line[Len]='\0';
+      }
+    else
+      {
+      Len = getdelim(&In->Line,&In->LineMax,In->Sep,In->List);
+      if ((Len > 0) && (In->Line[Len-1] == In->Sep)) { In->Line[--Len]='\0'; }
+      }
+
+    if (Len < 0) // end of list
+      {
+      if (In->List != stdin) { fclose(In->List); }
+      In->List=NULL;
+      break;
+      }
+    if ((In->Sep == '\n') && (Len > 0) && (In->Line[Len-1] == '\r')) { In->Line[--Len]='\0'; }
+    if (Len == 0) { continue; } // skip blank entries
+    return(strdup(In->Line));
+    }
+  return(NULL);
+} /* _SealInputList() */
+
+/**************************************
+ _SealInputDir(): Find the next regular file for --recursive.
+ Returns: malloc'd path, or NULL when there are no more.
+ **************************************/
+char *	_SealInputDir	(sealinput *In)
+{
+  struct dirent *Entry;
+  struct stat64 st;
+  char *Path;
+  size_t Len;
+  int Type;
+
+  for(;;)
+    {
+    if (!In->Dir)
+      {
+      free(In->DirPath); In->DirPath=NULL;
+      if (In->DirCount == 0) { return(NULL); } // done
+      In->DirPath = In->Dirs[--In->DirCount];
+      In->Dir = opendir(In->DirPath);
+      if (!In->Dir)
+	{
+	fprintf(stderr,"WARNING: Cannot read directory (%s). Skipping.\n",In->DirPath);
+	}
+      continue;
+      }
+
+    Entry = readdir(In->Dir);
+    if (!Entry) // finished this directory
+      {
+      closedir(In->Dir);
+      In->Dir=NULL;
+      continue;
+      }
+    if (!strcmp(Entry->d_name,".") || !strcmp(Entry->d_name,"..")) { continue; }
+
+    Len = strlen(In->DirPath);
+    Path = (char*)malloc(Len + strlen(Entry->d_name) + 2);
+    if (!Path)
+      {
+      fprintf(stderr,"ERROR: Unable to allocate path. Aborting.\n");
+      SealFatal();
+      }
+    if (Len && (In->DirPath[Len-1]=='/')) { sprintf(Path,"%s%s",In->DirPath,Entry->d_name); }
+    else { sprintf(Path,"%s/%s",In->DirPath,Entry->d_name); }
+
+    // Most filesystems report the type, so this rarely needs a stat()
+    Type = Entry->d_type;
+    if ((Type == DT_UNKNOWN) && !lstat64(Path,&st))
+      {
+      if (S_ISDIR(st.st_mode)) { Type=DT_DIR; }
+      else if (S_ISREG(st.st_mode)) { Type=DT_REG; }
+      else if (S_ISLNK(st.st_mode)) { Type=DT_LNK; }
+      }
+    if ((Type == DT_LNK) && !stat64(Path,&st) && S_ISREG(st.st_mode)) { Type=DT_REG; }
+
+    if (Type == DT_REG) { return(Path); }
+    if (Type == DT_DIR) { _SealInputPushDir(In,Path); continue; }
+    free(Path); // devices, sockets, links to directories, ...
+    }
+} /* _SealInputDir() */
+
+/**************************************
+ _SealInputFill(): Fill the window with up to Want names.
+ **************************************/
+void	_SealInputFill	(sealinput *In, int Want)
+{
+  char *Name;
+
+  if (Want > SEAL_INPUT_AHEAD) { Want = SEAL_INPUT_AHEAD; }
+  while(In->WinCount < Want)
+    {
+    if (In->Argi < In->Argc) { Name = strdup(In->Argv[In->Argi++]); }
+    else if (In->List) { Name = _SealInputList(In); }
+    else { Name = NULL; }
+    if (!Name && (In->Dir || In->DirCount)) { Name = _SealInputDir(In); }
+    if (!Name) { return; } // no more files
+
+    In->Window[(In->WinStart+In->WinCount) % SEAL_INPUT_AHEAD] = Name;
+    In->WinCount++;
+    _SealReadAhead(In,Name);
+    }
+} /* _SealInputFill() */
+#pragma GCC visibility pop
+
+/**************************************
+ SealInputOpen(): Collect the input sources.
+ argv holds the command-line files (after the options).
+ 'files-from' and 'recursive' add more.
+ Aborts if a list or directory cannot be opened.
+ **************************************/
+sealinput *	SealInputOpen	(sealfield *Args, int argc, char *argv[])
+{
+  sealinput *In;
+  const char *Str;
+  char *Path;
+
+  In = (sealinput*)calloc(1,sizeof(sealinput));
+  if (!In)
+    {
+    fprintf(stderr,"ERROR: Unable to allocate input list. Aborting.\n");
+    SealFatal();
+    }
+  pthread_mutex_init(&In->Lock,NULL);
+  pthread_cond_init(&In->Ready,NULL);
+  In->Argv = argv;
+  In->Argc = argc;
+  In->Sep = -1;
+
+  Str = SealGetText(Args,"files-from");
+  if (Str && Str[0])
+    {
+    In->List = strcmp(Str,"-") ? fopen(Str,"rb") : stdin;
+    if (!In->List)
+	{
+	fprintf(stderr,"ERROR: Cannot open file list (%s). Aborting.\n",Str);
+	SealFatal();
+	}
+    }
+
+  Str = SealGetText(Args,"recursive");
+  if (Str && Str[0])
+    {
+    Path = strdup(Str);
+    if (!Path || !(In->Dir = opendir(Path)))
+	{
+	fprintf(stderr,"ERROR: Cannot read directory (%s). Aborting.\n",Str);
+	SealFatal();
+	}
+    In->DirPath = Path;
+    }
+  return(In);
+} /* SealInputOpen() */
+
+/**************************************
+ SealInputNext(): Get the next file to process.
+ The name stays valid until the next call.
+ Returns: filename, or NULL when there are no more.
+ **************************************/
+const char *	SealInputNext	(sealinput *In)
+{
+  free(In->Current); In->Current=NULL;
+  _SealInputFill(In,SEAL_INPUT_AHEAD);
+  if (In->WinCount == 0) { return(NULL); }
+  In->Current = In->Window[In->WinStart];
+  In->WinStart = (In->WinStart+1) % SEAL_INPUT_AHEAD;
+  In->WinCount--;
+  _SealInputFill(In,SEAL_INPUT_AHEAD); // keep reading ahead
+  return(In->Current);
+} /* SealInputNext() */
+
+/**************************************
+ SealInputPeek(): Look at an upcoming file without taking it.
+ Ahead=0 is what SealInputNext() returns next.
+ Returns: filename, or NULL if there are not that many
+ (or Ahead is past the window).
+ **************************************/
+const char *	SealInputPeek	(sealinput *In, int Ahead)
+{
+  if ((Ahead < 0) || (Ahead >= SEAL_INPUT_AHEAD)) { return(NULL); }
+  _SealInputFill(In,Ahead+1);
+  if (Ahead >= In->WinCount) { return(NULL); }
+  return(In->Window[(In->WinStart+Ahead) % SEAL_INPUT_AHEAD]);
+} /* SealInputPeek() */
+
+/**************************************
+ SealInputClose(): Stop reading ahead and free the list.
+ **************************************/
+void	SealInputClose	(sealinput *In)
+{
+  int i;
+
+  if (!In) { return; }
+  pthread_mutex_lock(&In->Lock);
+  In->Finished = true;
+  pthread_cond_signal(&In->Ready);
+  pthread_mutex_unlock(&In->Lock);
+  if (In->HasThread) { pthread_join(In->Thread,NULL); }
+  for(i=0; i < In->QueueCount; i++) { free(In->Queue[(In->QueueStart+i) % SEAL_INPUT_AHEAD]); }
+  for(i=0; i < In->WinCount; i++) { free(In->Window[(In->WinStart+i) % SEAL_INPUT_AHEAD]); }
+  free(In->Current);
+
+  if (In->List && (In->List != stdin)) { fclose(In->List); }
+  free(In->Line);
+  free(In->Head);
+  if (In->Dir) { closedir(In->Dir); }
+  free(In->DirPath);
+  while(In->DirCount > 0) { free(In->Dirs[--In->DirCount]); }
+  free(In->Dirs);
+  pthread_mutex_destroy(&In->Lock);
+  pthread_cond_destroy(&In->Ready);
+  free(In);
+} /* SealInputClose() */
@@ -0,0 +1,27 @@
+/************************************************
+ SEAL: implemented in C
+ See LICENSE
+
+ Input file lists: command-line, --files-from, and --recursive.
+ ************************************************/
+#ifndef INPUTS_HPP
+#define INPUTS_HPP
+
+// C headers
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "seal.hpp"
+
+#define SEAL_INPUT_AHEAD	8 // upcoming files kept in the window (and read ahead)
+#define SEAL_READAHEAD	(16*1024*1024) // bytes read ahead from each upcoming file
+
+typedef struct sealinput sealinput;
+
+sealinput *	SealInputOpen	(sealfield *Args, int argc, char *argv[]);
+const char *	SealInputNext	(sealinput *In);
+const char *	SealInputPeek	(sealinput *In, int Ahead);
+void	SealInputClose	(sealinput *In);
+
+#endif
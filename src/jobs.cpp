@@ -0,0 +1,334 @@
+/************************************************
+ SEAL: implemented in C
+ See LICENSE
+
+ Worker pool for processing many files in parallel.
+
+ The main thread adds filenames to a bounded ring of slots.
+ Worker threads take the next queued slot, process the file,
+ and store the file's output (SealOut) in the slot.
+ The main thread prints completed slots in the same order
+ as they were added.  This way, parallel output looks
+ exactly like serial output: every file's results stay
+ grouped under its "[filename]" header.
+
+ A file can finish before all of its results are known (e.g.,
+ a remote signature that is sent in a later batch).  The job
+ holds its slot (SealJobsHold) until each result is released
+ (SealJobsRelease).  The released text follows the file's own
+ output.  If the main thread must wait for a held slot and no
+ job is running, it calls the hold's Kick function so the result
+ is not waiting for files that can never be queued.
+
+ Errors that abort (fatal errors to stderr) still abort.
+ ************************************************/
+// C headers
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "seal.hpp"
+#include "jobs.hpp"
+
+#pragma GCC visibility push(hidden)
+struct sealjob
+  {
+  char *Filename;
+  char *Output; // buffered output from SealOut
+  size_t OutputLen;
+  bool Done;
+  int Held; // results not yet released
+  char *Later; // released text; follows Output
+  size_t LaterLen;
+  sealjobkick Kick;
+  sealjobmerge Merge;
+  };
+static __thread sealjob *Current=NULL; // the worker's job
+
+static struct
+  {
+  pthread_mutex_t Lock;
+  pthread_cond_t Ready; // workers wait for new jobs
+  pthread_cond_t Done; // main thread waits for results
+  pthread_t *Thread;
+  int Jobs; // number of worker threads
+  sealjob *Slot; // ring buffer of jobs
+  size_t SlotMax;
+  size_t Head; // next slot to fill
+  size_t Next; // next slot to run
+  size_t Tail; // next slot to print
+  bool Finished; // no more jobs are coming
+  sealjobfunc Func;
+  sealfield *Args;
+  } Pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/**************************************
+ _SealJobsWorker(): Thread that processes queued files.
+ **************************************/
+void *	_SealJobsWorker	(void *unused)
+{
+  sealjob *Job;
+  FILE *Out;
+
+  pthread_mutex_lock(&Pool.Lock);
+  while(1)
+    {
+    while((Pool.Next == Pool.Head) && !Pool.Finished)
+      {
+      pthread_cond_wait(&Pool.Ready,&Pool.Lock);
+      }
+    if (Pool.Next == Pool.Head) { break; } // finished and nothing left
+    Job = &Pool.Slot[Pool.Next % Pool.SlotMax];
+    Pool.Next++;
+    pthread_mutex_unlock(&Pool.Lock);
+
+    // Process the file; all output is buffered
+    Out = open_memstream(&Job->Output,&Job->OutputLen);
+    if (!Out)
+	{
+	fprintf(stderr,"ERROR: Unable to allocate job output. Aborting.\n");
+	exit(1);
+	}
+    SealOut = Out;
+    Current = Job;
+    Pool.Func(Pool.Args,Job->Filename);
+    Current = NULL;
+    SealOut = NULL;
+    fclose(Out);
+
+    pthread_mutex_lock(&Pool.Lock);
+    Job->Done = true;
+    pthread_cond_broadcast(&Pool.Done);
+    }
+  pthread_mutex_unlock(&Pool.Lock);
+  return(NULL);
+} /* _SealJobsWorker() */
+
+/**************************************
+ _SealJobsIdle(): Is every queued job done?
+ (Then nothing else will add to a partial batch.)
+ Lock must be held by the caller.
+ **************************************/
+bool	_SealJobsIdle	()
+{
+  size_t i;
+  for(i=Pool.Tail; i < Pool.Head; i++)
+    {
+    if (!Pool.Slot[i % Pool.SlotMax].Done) { return(false); }
+    }
+  return(true);
+} /* _SealJobsIdle() */
+
+/**************************************
+ _SealJobsFlush(): Print completed jobs in order.
+ Blocks until every job before Until is printed.
+ Lock must be held by the caller.
+ **************************************/
+void	_SealJobsFlush	(size_t Until)
+{
+  sealjob *Job;
+  sealjobkick Kick;
+  char *Text;
+  size_t TextLen;
+
+  while(Pool.Tail < Pool.Head)
+    {
+    Job = &Pool.Slot[Pool.Tail % Pool.SlotMax];
+    if (!Job->Done || Job->Held)
+      {
+      if (Pool.Tail >= Until) { break; } // don't wait for it
+      Kick = (Job->Done && _SealJobsIdle()) ? Job->Kick : NULL;
+      if (Kick) // waiting on a result that no running job will send
+	{
+	pthread_mutex_unlock(&Pool.Lock);
+	Kick();
+	pthread_mutex_lock(&Pool.Lock);
+	if (!Job->Held) { continue; }
+	}
+      pthread_cond_wait(&Pool.Done,&Pool.Lock);
+      continue;
+      }
+
+    // Print outside of the lock; only the main thread uses Tail
+    pthread_mutex_unlock(&Pool.Lock);
+    if (Job->Later && Job->Merge) // combine the results (e.g., one JSON line)
+      {
+      Text = Job->Merge(Job->Output,Job->OutputLen,Job->Later,Job->LaterLen,&TextLen);
+      if (Text)
+	{
+	free(Job->Output);
+	Job->Output = Text;
+	Job->OutputLen = TextLen;
+	free(Job->Later);
+	Job->Later = NULL;
+	}
+      }
+    if (Job->Output) { fwrite(Job->Output,Job->OutputLen,1,stdout); }
+    if (Job->Later) { fwrite(Job->Later,Job->LaterLen,1,stdout); }
+    fflush(stdout);
+    free(Job->Output);
+    free(Job->Later);
+    free(Job->Filename);
+    memset(Job,0,sizeof(sealjob));
+    pthread_mutex_lock(&Pool.Lock);
+    Pool.Tail++;
+    }
+} /* _SealJobsFlush() */
+#pragma GCC visibility pop
+
+/**************************************
+ SealJobsHold(): The current file has a result that comes later.
+ Kick (optional) sends the result on its way if the main thread
+ has to wait for it.  Merge (optional) combines the file's output
+ with the released text; otherwise the text is appended.
+ Returns: the job to release, or NULL if the file is not a job
+   (then the result must be finished now).
+ **************************************/
+sealjob *	SealJobsHold	(sealjobkick Kick, sealjobmerge Merge)
+{
+  sealjob *Job;
+
+  Job = Current;
+  if (!Job) { return(NULL); }
+  pthread_mutex_lock(&Pool.Lock);
+  Job->Held++;
+  Job->Kick = Kick;
+  Job->Merge = Merge;
+  pthread_mutex_unlock(&Pool.Lock);
+  return(Job);
+} /* SealJobsHold() */
+
+/**************************************
+ SealJobsRelease(): A held result is ready.
+ Text (may be NULL) is added after the file's output.
+ Can be called from any thread.
+ **************************************/
+void	SealJobsRelease	(sealjob *Job, const char *Text)
+{
+  char *Later;
+  size_t Len;
+
+  if (!Job) { return; }
+  Len = Text ? strlen(Text) : 0;
+  pthread_mutex_lock(&Pool.Lock);
+  if (Len)
+    {
+    Later = (char*)realloc(Job->Later,Job->LaterLen+Len);
+    if (!Later)
+      {
+      fprintf(stderr,"ERROR: Unable to allocate job output. Aborting.\n");
+      exit(1);
+      }
+    memcpy(Later+Job->LaterLen,Text,Len);
+    Job->Later = Later;
+    Job->LaterLen += Len;
+    }
+  Job->Held--;
+  pthread_cond_broadcast(&Pool.Done);
+  pthread_mutex_unlock(&Pool.Lock);
+} /* SealJobsRelease() */
+
+/**************************************
+ SealJobsCount(): Convert the -j value to a number of workers.
+ "0" means one worker per online CPU.
+ Returns: number of jobs, or aborts on a bad value.
+ **************************************/
+int	SealJobsCount	(const char *Value)
+{
+  long Jobs;
+  char *End=NULL;
+
+  if (!Value || !Value[0]) { return(1); }
+  Jobs = strtol(Value,&End,10);
+  if (!End || End[0] || (Jobs < 0) || (Jobs > 1024))
+    {
+    fprintf(stderr,"ERROR: Invalid number of jobs (%s). Aborting.\n",Value);
+    exit(1);
+    }
+  if (Jobs==0) { Jobs = sysconf(_SC_NPROCESSORS_ONLN); }
+  if (Jobs < 1) { Jobs=1; }
+  return((int)Jobs);
+} /* SealJobsCount() */
+
+/**************************************
+ SealJobsStart(): Start the worker threads.
+ Func is called for each file with the (read-only) Args.
+ Held is how many finished files may be waiting for results
+ (they keep their slots).
+ **************************************/
+void	SealJobsStart	(int Jobs, size_t Held, sealjobfunc Func, sealfield *Args)
+{
+  int j;
+
+  Pool.Func = Func;
+  Pool.Args = Args;
+  Pool.Jobs = Jobs;
+  Pool.SlotMax = Jobs * 4 + Held; // bounded; don't read ahead forever
+  Pool.Slot = (sealjob*)calloc(Pool.SlotMax,sizeof(sealjob));
+  Pool.Thread = (pthread_t*)calloc(Jobs,sizeof(pthread_t));
+  if (!Pool.Slot || !Pool.Thread)
+    {
+    fprintf(stderr,"ERROR: Unable to allocate jobs. Aborting.\n");
+    exit(1);
+    }
+  Pool.Head = Pool.Next = Pool.Tail = 0;
+  Pool.Finished = false;
+
+  for(j=0; j < Jobs; j++)
+    {
+    if (pthread_create(&Pool.Thread[j],NULL,_SealJobsWorker,NULL))
+	{
+	fprintf(stderr,"ERROR: Unable to start job thread. Aborting.\n");
+	exit(1);
+	}
+    }
+} /* SealJobsStart() */
+
+/**************************************
+ SealJobsAdd(): Queue a file for processing.
+ Blocks when the queue is full.
+ While waiting, completed jobs are printed in order.
+ **************************************/
+void	SealJobsAdd	(const char *Filename)
+{
+  sealjob *Job;
+
+  pthread_mutex_lock(&Pool.Lock);
+  _SealJobsFlush(0); // print anything that finished
+  while(Pool.Head - Pool.Tail >= Pool.SlotMax) // full? Wait for oldest
+    {
+    _SealJobsFlush(Pool.Tail+1);
+    }
+
+  Job = &Pool.Slot[Pool.Head % Pool.SlotMax];
+  Job->Filename = strdup(Filename);
+  Job->Done = false;
+  Pool.Head++;
+  pthread_cond_signal(&Pool.Ready);
+  pthread_mutex_unlock(&Pool.Lock);
+} /* SealJobsAdd() */
+
+/**************************************
+ SealJobsFinish(): Wait for all jobs, print results, and stop workers.
+ **************************************/
+void	SealJobsFinish	()
+{
+  int j;
+
+  pthread_mutex_lock(&Pool.Lock);
+  Pool.Finished = true;
+  pthread_cond_broadcast(&Pool.Ready);
+  _SealJobsFlush(Pool.Head);
+  pthread_mutex_unlock(&Pool.Lock);
+
+  for(j=0; j < Pool.Jobs; j++)
+    {
+    pthread_join(Pool.Thread[j],NULL);
+    }
+  free(Pool.Thread); Pool.Thread=NULL;
+  free(Pool.Slot); Pool.Slot=NULL;
+  Pool.Jobs = 0;
+} /* SealJobsFinish() */
+
@@ -0,0 +1,32 @@
+/************************************************
+ SEAL: implemented in C
+ See LICENSE
+
+ Worker pool for processing many files in parallel.
+ ************************************************/
+#ifndef JOBS_HPP
+#define JOBS_HPP
+
+// C headers
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "seal.hpp"
+
+// Callback that processes one file; output goes to SealOut
+typedef void (*sealjobfunc)(sealfield *Args, const char *Filename);
+
+// Results that are finished after the file (see SealJobsHold)
+typedef struct sealjob sealjob;
+typedef void (*sealjobkick)();
+typedef char * (*sealjobmerge)(const char *Output, size_t OutputLen, const char *Later, size_t LaterLen, size_t *Len);
+
+int	SealJobsCount	(const char *Value);
+void	SealJobsStart	(int Jobs, size_t Held, sealjobfunc Func, sealfield *Args);
+void	SealJobsAdd	(const char *Filename);
+void	SealJobsFinish	();
+sealjob *	SealJobsHold	(sealjobkick Kick, sealjobmerge Merge);
+void	SealJobsRelease	(sealjob *Job, const char *Text);
+
+#endif
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <string.h>
 #include "seal.hpp"
 #include "json.hpp"
 
@@ -54,6 +55,23 @@ sealfield *	Json2Seal	(sealfield *JsonData)
 	// else: skip unknown
 	break;
 	}
+      case cJSON_Array:
+        {
+        // Lists of strings become "name[0]", "name[1]", ...
+        struct cJSON *jitem;
+        char *Name;
+        int i=0;
+        Name = (char*)calloc(strlen(jnext->string)+24,1);
+        if (!Name) { break; }
+        for(jitem=jnext->child; jitem; jitem = jitem->next, i++)
+          {
+          if (jitem->type != cJSON_String) { continue; }
+          sprintf(Name,"%s[%d]",jnext->string,i);
+          SF=SealSetText(SF,Name,jitem->valuestring);
+          }
+        free(Name);
+        break;
+        }
       default:
 	// skip unknown
 	break;
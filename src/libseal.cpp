@@ -0,0 +1,379 @@
+/************************************************
+ SEAL: implemented in C
+ See LICENSE
+
+ libseal: sign and verify in-process (see libseal.hpp).
+
+ Each call works like sealtool with one file:
+ the options are cloned into a per-call arena, the data is
+ treated as a read-only file (no copy), and the results that
+ sealtool would print are captured in the result.
+ Signed output is written to an anonymous memory file (memfd)
+ and returned as a buffer.
+
+ Fatal errors normally exit.  During a call, SealFatalJump
+ points at this call, so SealFatal() returns here instead.
+ Files, mmaps, and other resources that the call had open are
+ registered (SealCleanupPush) and released, so the caller keeps going.
+ The shared caches are process globals (see libseal.hpp).
+ ************************************************/
+// C headers
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <sys/mman.h> // memfd_create()
+#include <sys/stat.h>
+
+#include "seal.hpp"
+#include "files.hpp"
+#include "formats.hpp"
+#include "sign.hpp"
+#include "libseal.hpp"
+
+struct sealctx
+  {
+  sealfield *Options; // as set by the caller
+  sealfield *Args; // checked options; NULL until the first call
+  EVP_PKEY *Key; // local signing key
+  int Mode; // 0 = not ready to sign, 's' = local signer, 'S' = remote signer
+  pthread_mutex_t Lock; // for getting Args and Mode ready
+  };
+
+#pragma GCC visibility push(hidden)
+/*****
+ Per-call state.
+ It is in memory (not registers) so it survives SealFatal().
+ *****/
+typedef struct
+  {
+  FILE *Out; // previous SealOut
+  FILE *Capture; // results text
+  char *Text;
+  size_t TextLen;
+  sealarena *Arena, *PrevArena;
+  EVP_PKEY *PrevKey;
+  bool KeySet;
+  bool Locked; // holding Ctx->Lock
+  mmapfile *Mmap;
+  int MemFd; // signed output; -1 = none
+  } sealcall;
+
+/**************************************
+ _SealCtxReset(): Forget everything derived from the options.
+ **************************************/
+void	_SealCtxReset	(sealctx *Ctx)
+{
+  SealFree(Ctx->Args); Ctx->Args=NULL;
+  if (Ctx->Key) { EVP_PKEY_free(Ctx->Key); Ctx->Key=NULL; }
+  Ctx->Mode=0;
+} /* _SealCtxReset() */
+
+/**************************************
+ _SealCtxReady(): Check the options (and get ready to sign).
+ Done once per context; this is the per-context part of
+ sealtool's main().
+ Returns: SEAL_OK or an error code.
+ **************************************/
+int	_SealCtxReady	(sealctx *Ctx, sealcall *Call, bool Sign)
+{
+  sealfield *Args;
+  int Rc=SEAL_OK;
+
+  pthread_mutex_lock(&Ctx->Lock);
+  Call->Locked=true;
+  if (!Ctx->Args)
+    {
+    Args = SealClone(Ctx->Options);
+    Args = SealParmCheck(Args);
+    // One file at a time; remote signatures are never deferred
+    Args = SealSetText(Args,"batch","1");
+    Args = SealSetText(Args,"pipeline","0");
+    Args = SealSetIindex(Args,"@s",2,0);
+    Args = SealSetIindex(Args,"@p",1,0);
+    Args = SealSetCindex(Args,"@sflags",2,0);
+    Ctx->Args = Args;
+    }
+
+  if (Sign && !Ctx->Mode)
+    {
+    if (SealIsURL(Ctx->Args))
+      {
+      Ctx->Args = SealSignURLSize(Ctx->Args);
+      Ctx->Args = SealSetCindex(Ctx->Args,"@mode",0,'S');
+      }
+    else if (SealIsLocal(Ctx->Args))
+      {
+      Ctx->Key = SealReadPrivateKey(Ctx->Args);
+      Call->PrevKey = SealUsePrivateKey(Ctx->Key);
+      Call->KeySet=true;
+      Ctx->Args = SealSignLocal(Ctx->Args); // sets @sigsize
+      Ctx->Args = SealSetCindex(Ctx->Args,"@mode",0,'s');
+      }
+    if (SealGetU32index(Ctx->Args,"@sigsize",0)==0) { Rc=SEAL_ERR_ARGS; }
+    else { Ctx->Mode = SealGetCindex(Ctx->Args,"@mode",0); }
+    }
+
+  Call->Locked=false;
+  pthread_mutex_unlock(&Ctx->Lock);
+  return(Rc);
+} /* _SealCtxReady() */
+
+/**************************************
+ _SealCtxRun(): Verify or sign one buffer.
+ Everything that must be undone goes in Call.
+ Returns: SEAL_OK or an error code.
+ **************************************/
+__attribute__((noinline))
+int	_SealCtxRun	(sealctx *Ctx, sealcall *Call, bool Sign, size_t Len, const byte *Data, sealresult *Result)
+{
+  sealfield *Args;
+  char Name[64];
+  int Rc;
+
+  Rc = _SealCtxReady(Ctx,Call,Sign);
+  if (Rc != SEAL_OK) { return(Rc); }
+
+  // Capture the results
+  Call->Out = SealOut;
+  Call->Capture = open_memstream(&Call->Text,&Call->TextLen);
+  if (!Call->Capture) { return(SEAL_ERR_FATAL); }
+  SealOut = Call->Capture;
+
+  // Every sealfield for the call comes from one arena
+  // (The call owns them; _SealCtxDone() releases them, even after a fatal error.)
+  Call->Arena = SealArenaNew();
+  SealCleanupPop(Call->Arena);
+  Call->PrevArena = SealArenaUse(Call->Arena);
+  Args = SealClone(Ctx->Args);
+
+  Call->Mmap = MmapBuffer(Len,Data);
+  SealCleanupPop(Call->Mmap);
+  if (Sign)
+    {
+    if (Ctx->Key && !Call->KeySet)
+      {
+      Call->PrevKey = SealUsePrivateKey(Ctx->Key);
+      Call->KeySet=true;
+      }
+    Call->MemFd = memfd_create("seal",MFD_CLOEXEC);
+    if (Call->MemFd < 0)
+      {
+      fprintf(stderr,"ERROR: Unable to create the signed buffer.\n");
+      return(SEAL_ERR_FATAL);
+      }
+    snprintf(Name,sizeof(Name),"/proc/self/fd/%d",Call->MemFd);
+    Args = SealSetText(Args,"@FilenameOut",Name);
+    Args = SealSetText(Args,"@nameout",""); // the path is only ours
+    }
+  else { Args = SealDel(Args,"@mode"); } // verify
+
+  // Process based on file format
+  if (Seal_isPNG(Call->Mmap)) { Args = Seal_PNG(Args,Call->Mmap); }
+  else if (Seal_isJPEG(Call->Mmap)) { Args = Seal_JPEG(Args,Call->Mmap); }
+  else if (Seal_isRIFF(Call->Mmap)) { Args = Seal_RIFF(Args,Call->Mmap); }
+  else if (Seal_isMatroska(Call->Mmap)) { Args = Seal_Matroska(Args,Call->Mmap); }
+  else { return(SEAL_ERR_FORMAT); }
+
+  Result->Records = SealGetIindex(Args,"@s",2);
+  SealVerifyCount(&Result->Valid,&Result->Invalid);
+  if (Sign) { return(SEAL_OK); } // _SealCtxDone() collects the output
+  if (Result->Invalid > 0) { return(SEAL_ERR_INVALID); }
+  if (Result->Valid == 0) { return(SEAL_ERR_NOSIG); }
+  return(SEAL_OK);
+} /* _SealCtxRun() */
+
+/**************************************
+ _SealCtxDone(): Undo the call's state and fill in the result.
+ Also used after SealFatal().
+ Returns: the final return code.
+ **************************************/
+int	_SealCtxDone	(sealctx *Ctx, sealcall *Call, int Rc, sealresult *Result)
+{
+  struct stat Stat;
+  ssize_t r;
+  size_t Got;
+
+  if (Call->Locked) { pthread_mutex_unlock(&Ctx->Lock); }
+  if (Call->KeySet) { SealUsePrivateKey(Call->PrevKey); }
+  MmapFree(Call->Mmap);
+  if (Call->Arena)
+    {
+    SealArenaUse(Call->PrevArena);
+    SealArenaFree(Call->Arena);
+    }
+  if (Call->Capture)
+    {
+    SealOut = Call->Out;
+    fclose(Call->Capture);
+    Result->Text = Call->Text;
+    Result->TextLen = Call->TextLen;
+    }
+  SealVerifyCount(NULL,NULL); // nothing carries over to the next call
+
+  // Collect the signed output
+  if (Call->MemFd >= 0)
+    {
+    if ((Rc == SEAL_OK) && !fstat(Call->MemFd,&Stat) && (Stat.st_size > 0) &&
+	(Result->Data = (unsigned char*)malloc(Stat.st_size)))
+      {
+      for(Got=0; Got < (size_t)Stat.st_size; Got += r)
+	{
+	r = pread(Call->MemFd,Result->Data+Got,Stat.st_size-Got,Got);
+	if (r <= 0) { break; }
+	}
+      Result->DataLen = Got;
+      }
+    if ((Rc == SEAL_OK) && (Result->DataLen == 0)) { Rc = SEAL_ERR_SIGN; }
+    close(Call->MemFd);
+    }
+
+  Result->Status = Rc;
+  return(Rc);
+} /* _SealCtxDone() */
+
+/**************************************
+ _SealCtxCall(): Run one call, catching fatal errors.
+ **************************************/
+int	_SealCtxCall	(sealctx *Ctx, bool Sign, size_t Len, const byte *Data, sealresult *Result)
+{
+  sealcall Call;
+  jmp_buf Jump, *PrevJump;
+  size_t Mark;
+  int Rc;
+
+  if (!Result) { return(SEAL_ERR_ARGS); }
+  memset(Result,0,sizeof(sealresult));
+  if (!Ctx || (!Data && Len)) { Result->Status=SEAL_ERR_ARGS; return(SEAL_ERR_ARGS); }
+
+  memset(&Call,0,sizeof(Call));
+  Call.MemFd = -1;
+  PrevJump = SealFatalJump;
+  SealFatalJump = &Jump;
+  Mark = SealCleanupMark();
+  if (setjmp(Jump) == 0) { Rc = _SealCtxRun(Ctx,&Call,Sign,Len,Data,Result); }
+  else // from SealFatal()
+    {
+    SealCleanupRun(Mark);
+    Rc = SEAL_ERR_FATAL;
+    }
+  SealFatalJump = PrevJump;
+  return(_SealCtxDone(Ctx,&Call,Rc,Result));
+} /* _SealCtxCall() */
+#pragma GCC visibility pop
+
+/**************************************
+ SealCtxNew(): Create a context with the default options.
+ Returns: context, or NULL if out of memory.
+ Caller must use SealCtxFree().
+ **************************************/
+sealctx *	SealCtxNew	()
+{
+  sealctx *Ctx;
+  sealarena *Prev;
+  sealfield *Options=NULL;
+
+  Ctx = (sealctx*)calloc(1,sizeof(sealctx));
+  if (!Ctx) { return(NULL); }
+  pthread_mutex_init(&Ctx->Lock,NULL);
+
+  // Same defaults as sealtool (contexts outlive any arena)
+  Prev = SealArenaUse(NULL);
+  Options = SealSetText(Options,"seal","1");
+  Options = SealSetText(Options,"b","F~S,s~f");
+  Options = SealSetText(Options,"digestalg","sha256");
+  Options = SealSetText(Options,"keyalg","rsa");
+  Options = SealSetText(Options,"keyfile","");
+  Options = SealSetText(Options,"options","");
+  Options = SealSetText(Options,"kv","1");
+  Options = SealSetText(Options,"sf","HEX");
+  Options = SealSetText(Options,"domain","localhost.localdomain");
+  Options = SealSetText(Options,"dnsfile","");
+  Options = SealSetText(Options,"copyright","");
+  Options = SealSetText(Options,"comment","");
+  Options = SealSetText(Options,"info","");
+  Options = SealSetText(Options,"id","");
+  Options = SealSetText(Options,"apiurl","");
+  Options = SealSetText(Options,"apikey","");
+  SealArenaUse(Prev);
+  Ctx->Options = Options;
+  return(Ctx);
+} /* SealCtxNew() */
+
+/**************************************
+ SealCtxSet(): Set an option.
+ Field is a config file name (e.g., "keyfile") or "pubkeyfile".
+ Returns: SEAL_OK or SEAL_ERR_ARGS.
+ **************************************/
+int	SealCtxSet	(sealctx *Ctx, const char *Field, const char *Value)
+{
+  sealarena *Prev;
+
+  if (!Ctx || !Field || !Field[0] || (Field[0]=='@') || !Value) { return(SEAL_ERR_ARGS); }
+  if (!strcmp(Field,"pubkeyfile")) { Field="@pubkeyfile"; } // same as --pubkeyfile
+
+  Prev = SealArenaUse(NULL);
+  Ctx->Options = SealSetText(Ctx->Options,Field,Value);
+  SealArenaUse(Prev);
+  _SealCtxReset(Ctx); // checked again on the next call
+  return(SEAL_OK);
+} /* SealCtxSet() */
+
+/**************************************
+ SealCtxFree(): Release a context.
+ **************************************/
+void	SealCtxFree	(sealctx *Ctx)
+{
+  if (!Ctx) { return; }
+  _SealCtxReset(Ctx);
+  SealFree(Ctx->Options);
+  pthread_mutex_destroy(&Ctx->Lock);
+  free(Ctx);
+} /* SealCtxFree() */
+
+/**************************************
+ SealVerifyBuffer(): Verify every SEAL record in Data.
+ Returns: SEAL_OK if every record is valid, or an error.
+ Caller must use SealResultFree().
+ **************************************/
+int	SealVerifyBuffer	(sealctx *Ctx, size_t Len, const unsigned char *Data, sealresult *Result)
+{
+  return(_SealCtxCall(Ctx,false,Len,Data,Result));
+} /* SealVerifyBuffer() */
+
+/**************************************
+ SealSignBuffer(): Add a SEAL signature.
+ Uses the local key ("keyfile") or the remote signer ("apiurl").
+ Result->Data is the signed file.
+ Returns: SEAL_OK or an error.
+ Caller must use SealResultFree().
+ **************************************/
+int	SealSignBuffer	(sealctx *Ctx, size_t Len, const unsigned char *Data, sealresult *Result)
+{
+  return(_SealCtxCall(Ctx,true,Len,Data,Result));
+} /* SealSignBuffer() */
+
+/**************************************
+ SealResultFree(): Release a result's buffers.
+ **************************************/
+void	SealResultFree	(sealresult *Result)
+{
+  if (!Result) { return; }
+  free(Result->Text);
+  free(Result->Data);
+  memset(Result,0,sizeof(sealresult));
+} /* SealResultFree() */
+
+/**************************************
+ SealLibFree(): Release the shared caches.
+ Call once, after the last call on any context.
+ **************************************/
+void	SealLibFree	()
+{
+  SealVerifyCacheFree(); // also finishes any DNS prefetches
+  SealDNSCacheFree();
+  SealFreePrivateKey(); // providers and this thread's sign context
+  SealCurlFree();
+} /* SealLibFree() */
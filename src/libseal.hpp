@@ -0,0 +1,82 @@
+/************************************************
+ SEAL: implemented in C
+ See LICENSE
+
+ libseal: sign and verify in-process.
+
+ Build with "make lib" (bin/libseal.a and bin/libseal.so).
+ This header is all a caller needs; it does not pull in
+ the rest of the SEAL headers.
+
+ A context (sealctx) holds the options and the private key.
+ Options use the same names as the config file (domain,
+ keyfile, keyalg, digestalg, apiurl, dnsfile, ...), plus
+ "pubkeyfile" (same as --pubkeyfile) for testing.
+
+ Calls on the same context may run in parallel threads.
+ Don't change a context's options while it is in use.
+
+ Errors are returned; a call never exits the process.
+ Fatal problems are still described on stderr.
+
+ Limitations:
+ - Inside the library, fatal errors are not propagated as return
+   codes.  They still use SealFatal(), which jumps back to the
+   call; whatever the call had open (maps, files, its arena,
+   OpenSSL contexts, claimed DNS lookups) is released, and the
+   call returns SEAL_ERR_FATAL.  Helper threads (DNS prefetch)
+   have no call to return to; a fatal error there still exits.
+ - The DNS public key cache, the per-thread verify and sign
+   contexts, and the remote signer (curl) connections are
+   process globals, not part of a sealctx.  They are shared by
+   every context (they are thread-safe and keyed by domain and
+   algorithm), so contexts cannot use separate caches.
+   SealLibFree() releases them.
+ ************************************************/
+#ifndef LIBSEAL_HPP
+#define LIBSEAL_HPP
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Return codes
+#define SEAL_OK		0
+#define SEAL_ERR_ARGS	1 // bad parameter or option
+#define SEAL_ERR_FORMAT	2 // not a supported file format
+#define SEAL_ERR_NOSIG	3 // verify: no SEAL records found
+#define SEAL_ERR_INVALID	4 // verify: at least one record is invalid
+#define SEAL_ERR_SIGN	5 // sign: no signature was added
+#define SEAL_ERR_FATAL	6 // the operation could not continue (see stderr)
+
+typedef struct sealctx sealctx; // opaque
+
+typedef struct
+  {
+  int Status; // same as the return code
+  long Records; // SEAL records found
+  long Valid; // verify: records that validate
+  long Invalid; // verify: records that do not
+  char *Text; // results as sealtool prints them (without the "[file]" line or output names)
+  size_t TextLen;
+  unsigned char *Data; // sign: the signed file
+  size_t DataLen;
+  } sealresult;
+
+sealctx *	SealCtxNew	();
+int	SealCtxSet	(sealctx *Ctx, const char *Field, const char *Value);
+void	SealCtxFree	(sealctx *Ctx);
+
+int	SealVerifyBuffer	(sealctx *Ctx, size_t Len, const unsigned char *Data, sealresult *Result);
+int	SealSignBuffer	(sealctx *Ctx, size_t Len, const unsigned char *Data, sealresult *Result);
+void	SealResultFree	(sealresult *Result);
+
+void	SealLibFree	();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,298 @@
+/************************************************
+ SEAL: Per-file results.
+ See LICENSE
+
+ By default, results are the text that sealtool has always printed.
+ With --output=jsonl, each file gets one JSON object on one line:
+   { "file":name,
+     "records":[ { "record":N, "valid":true|false, "error":text,
+                   "signed_bytes":[[start,end],...], "date":iso8601,
+                   "signer":domain, "id":user, "copyright":text,
+                   "comment":text }, ... ],
+     "signed":[ { "record":N, "output":filename, "error":text }, ... ],
+     "messages":[ text, ... ] }
+ Fields that are not set are omitted.
+ A queued signature (remote 'batch' or 'pipeline') is written
+ after the file is done.  The file's line waits for it (see
+ SealJobsHold), and SealResultMerge() adds any "error".
+ "messages" holds any other text (warnings, errors, "No SEAL
+ signatures found.") so nothing printed is lost.
+
+ SealResultBegin() sends the file's text to a memory buffer.
+ SealVerify() and SealSign() add records instead of printing them.
+ SealResultEnd() builds the line and writes it in one call,
+ so parallel jobs and the server never split a result.
+ ************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "seal.hpp"
+#include "results.hpp"
+#include "cJSON/cJSON.h"
+
+bool SealResultJson=false;
+
+#pragma GCC visibility push(hidden)
+static __thread struct
+  {
+  cJSON *File; // the file's result object
+  FILE *Out; // where the line goes (the previous SealOut)
+  FILE *Capture; // buffers the file's text messages
+  char *Text;
+  size_t TextLen;
+  } Result;
+
+/********************************************************
+ _SealResultText(): Add an optional string.
+ ********************************************************/
+void	_SealResultText	(cJSON *Obj, const char *Name, const char *Value)
+{
+  if (Value && Value[0]) { cJSON_AddStringToObject(Obj,Name,Value); }
+} /* _SealResultText() */
+
+/********************************************************
+ _SealResultArray(): Get (or add) a named array.
+ ********************************************************/
+cJSON *	_SealResultArray	(const char *Name)
+{
+  cJSON *Array;
+  Array = cJSON_GetObjectItemCaseSensitive(Result.File,Name);
+  if (!Array) { Array = cJSON_AddArrayToObject(Result.File,Name); }
+  return(Array);
+} /* _SealResultArray() */
+
+/********************************************************
+ _SealResultCleanup(): Release an abandoned file's results.
+ ********************************************************/
+void	_SealResultCleanup	(void *Data)
+{
+  (void)Data;
+  if (Result.Capture) { fclose(Result.Capture); }
+  free(Result.Text);
+  cJSON_Delete(Result.File);
+  SealOut = Result.Out;
+  memset(&Result,0,sizeof(Result));
+} /* _SealResultCleanup() */
+#pragma GCC visibility pop
+
+/********************************************************
+ SealResultInit(): Select the output format from 'output'.
+ ********************************************************/
+void	SealResultInit	(sealfield *Args)
+{
+  const char *Output;
+
+  Output = SealGetText(Args,"output");
+  if (!Output || !strcmp(Output,"text")) { SealResultJson=false; }
+  else if (!strcmp(Output,"jsonl")) { SealResultJson=true; }
+  else
+    {
+    fprintf(stderr,"ERROR: Unknown output format '%s' (use text or jsonl). Aborting.\n",Output);
+    SealFatal();
+    }
+} /* SealResultInit() */
+
+/********************************************************
+ SealResultBegin(): Start collecting a file's results.
+ ********************************************************/
+void	SealResultBegin	(const char *Filename)
+{
+  if (!SealResultJson) { return; }
+  Result.File = cJSON_CreateObject();
+  cJSON_AddStringToObject(Result.File,"file",Filename);
+  Result.Out = SealOut;
+  Result.Text = NULL;
+  Result.TextLen = 0;
+  Result.Capture = open_memstream(&Result.Text,&Result.TextLen);
+  if (!Result.File || !Result.Capture)
+    {
+    fprintf(stderr,"ERROR: Unable to allocate the file's results. Aborting.\n");
+    SealFatal();
+    }
+  SealCleanupPush(_SealResultCleanup,&Result);
+  SealOut = Result.Capture;
+} /* SealResultBegin() */
+
+/********************************************************
+ SealResultVerified(): Add a checked signature.
+ Error is NULL if the signature is valid.
+ ********************************************************/
+void	SealResultVerified	(sealfield *Rec, long Num, const char *Error)
+{
+  cJSON *Record, *Ranges, *Range;
+  sealfield *range;
+  const size_t *rangeval;
+  const char *Txt;
+  char Date[40];
+  int i, MaxRange;
+
+  if (!SealResultJson || !Result.File) { return; }
+  Record = cJSON_CreateObject();
+  cJSON_AddNumberToObject(Record,"record",(double)Num);
+  cJSON_AddBoolToObject(Record,"valid",!Error);
+  if (Error) { cJSON_AddStringToObject(Record,"error",Error); }
+  else
+    {
+    // Ranges are [start,end) pairs; report the last byte, like the text
+    range = SealSearch(Rec,"@digestrange");
+    if (range && (range->ValueLen > 0))
+      {
+      rangeval = (const size_t*)(range->Value);
+      MaxRange = range->ValueLen / sizeof(size_t);
+      Ranges = cJSON_AddArrayToObject(Record,"signed_bytes");
+      for(i=0; i+1 < MaxRange; i+=2)
+	{
+	Range = cJSON_CreateArray();
+	cJSON_AddItemToArray(Range,cJSON_CreateNumber((double)rangeval[i]));
+	cJSON_AddItemToArray(Range,cJSON_CreateNumber((double)rangeval[i+1]-1));
+	cJSON_AddItemToArray(Ranges,Range);
+	}
+      }
+
+    Txt = SealGetText(Rec,"@sigdate");
+    if (Txt && (strlen(Txt) >= 14))
+      {
+      snprintf(Date,sizeof(Date),"%.4s-%.2s-%.2sT%.2s:%.2s:%.2s%.16sZ",
+	Txt,Txt+4,Txt+6,Txt+8,Txt+10,Txt+12,(Txt[14]=='.') ? Txt+14 : "");
+      cJSON_AddStringToObject(Record,"date",Date);
+      }
+    _SealResultText(Record,"signer",SealGetText(Rec,"d"));
+    _SealResultText(Record,"id",SealGetText(Rec,"id"));
+    _SealResultText(Record,"copyright",SealGetText(Rec,"copyright"));
+    _SealResultText(Record,"comment",SealGetText(Rec,"info"));
+    }
+  cJSON_AddItemToArray(_SealResultArray("records"),Record);
+} /* SealResultVerified() */
+
+/********************************************************
+ SealResultAdded(): Add a new signature.
+ ********************************************************/
+void	SealResultAdded	(long Num, const char *Outname)
+{
+  cJSON *Record;
+
+  if (!SealResultJson || !Result.File) { return; }
+  Record = cJSON_CreateObject();
+  cJSON_AddNumberToObject(Record,"record",(double)Num);
+  _SealResultText(Record,"output",Outname);
+  cJSON_AddItemToArray(_SealResultArray("signed"),Record);
+} /* SealResultAdded() */
+
+/********************************************************
+ SealResultLater(): The text for a queued signature, once it
+ is written (Error is NULL) or has failed.
+ In jsonl mode, the record is already in the file's line;
+ only a failure needs text (for SealResultMerge).
+ Returns: allocated text, or NULL for none.
+ ********************************************************/
+char *	SealResultLater	(long Num, const char *Outname, const char *Error)
+{
+  cJSON *Record;
+  char *Str;
+  int Len;
+
+  if (SealResultJson)
+    {
+    if (!Error) { return(NULL); }
+    Record = cJSON_CreateObject();
+    cJSON_AddNumberToObject(Record,"record",(double)Num);
+    cJSON_AddStringToObject(Record,"error",Error);
+    Str = cJSON_PrintUnformatted(Record);
+    cJSON_Delete(Record);
+    if (Str) // one line per result; cJSON and malloc share an allocator
+      {
+      Len = strlen(Str);
+      Str = (char*)realloc(Str,Len+2);
+      if (Str) { Str[Len]='\n'; Str[Len+1]='\0'; }
+      }
+    return(Str);
+    }
+
+  if (Error) { Len = asprintf(&Str,"ERROR: Signature record #%ld not added: %s.\n",Num,Error); }
+  else { Len = asprintf(&Str," Signature record #%ld added%s%s\n",Num,Outname[0] ? ": " : "",Outname); }
+  return((Len < 0) ? NULL : Str);
+} /* SealResultLater() */
+
+/********************************************************
+ SealResultMerge(): Add failed queued signatures to a file's line.
+ Output is the file's line; Later has one failure per line
+ (from SealResultLater).  For SealJobsHold().
+ Returns: the allocated new line, or NULL to keep both as-is.
+ ********************************************************/
+char *	SealResultMerge	(const char *Output, size_t OutputLen, const char *Later, size_t LaterLen, size_t *Len)
+{
+  cJSON *File, *Fail, *Record, *Num;
+  const char *End, *Next;
+  char *Str;
+
+  File = cJSON_ParseWithLength(Output,OutputLen);
+  if (!File) { return(NULL); }
+  for(End=Later; End < Later+LaterLen; End=Next)
+    {
+    Next = (const char*)memchr(End,'\n',Later+LaterLen-End);
+    Next = Next ? Next+1 : Later+LaterLen;
+    Fail = cJSON_ParseWithLength(End,Next-End);
+    Num = cJSON_GetObjectItemCaseSensitive(Fail,"record");
+    cJSON_ArrayForEach(Record,cJSON_GetObjectItemCaseSensitive(File,"signed"))
+      {
+      if (!Num || (cJSON_GetNumberValue(cJSON_GetObjectItemCaseSensitive(Record,"record")) != Num->valuedouble)) { continue; }
+      cJSON_AddStringToObject(Record,"error",cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(Fail,"error")));
+      break;
+      }
+    cJSON_Delete(Fail);
+    }
+
+  Str = cJSON_PrintUnformatted(File);
+  cJSON_Delete(File);
+  if (!Str) { return(NULL); }
+  *Len = strlen(Str);
+  Str = (char*)realloc(Str,*Len+1);
+  if (Str) { Str[(*Len)++] = '\n'; } // the line's terminator replaces the string's
+  return(Str);
+} /* SealResultMerge() */
+
+/********************************************************
+ SealResultEnd(): Write the file's results as one line.
+ ********************************************************/
+void	SealResultEnd	()
+{
+  cJSON *Messages=NULL;
+  char *Line, *Next, *Str;
+  size_t Len;
+
+  if (!SealResultJson || !Result.File) { return; }
+  SealCleanupPop(&Result);
+  SealOut = Result.Out;
+  fclose(Result.Capture);
+  Result.Capture = NULL;
+
+  // Any other text becomes messages, one per line
+  for(Line=Result.Text; Line && *Line; Line=Next)
+    {
+    Next = strchr(Line,'\n');
+    if (Next) { *Next++ = '\0'; }
+    else { Next = Line+strlen(Line); }
+    while(isspace(*Line)) { Line++; }
+    if (!*Line) { continue; }
+    if (!Messages) { Messages = cJSON_AddArrayToObject(Result.File,"messages"); }
+    cJSON_AddItemToArray(Messages,cJSON_CreateString(Line));
+    }
+  free(Result.Text);
+  Result.Text = NULL;
+
+  Str = cJSON_PrintUnformatted(Result.File);
+  cJSON_Delete(Result.File);
+  Result.File = NULL;
+  if (!Str)
+    {
+    fprintf(stderr,"ERROR: Unable to format the file's results. Aborting.\n");
+    SealFatal();
+    }
+  Len = strlen(Str);
+  Str[Len] = '\n'; // replaces the terminator; one write for the whole line
+  fwrite(Str,1,Len+1,SealOut ? SealOut : stdout);
+  cJSON_free(Str);
+} /* SealResultEnd() */
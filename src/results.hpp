@@ -0,0 +1,31 @@
+/************************************************
+ SEAL: implemented in C
+ See LICENSE
+
+ Per-file results: text or JSON lines (--output=jsonl).
+ ************************************************/
+#ifndef RESULTS_HPP
+#define RESULTS_HPP
+
+// C headers
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "seal.hpp"
+
+/*****
+ With --output=jsonl, each file's results are collected in one
+ object and written as a single line when the file is done.
+ Otherwise every call is one test of SealResultJson.
+ *****/
+extern bool SealResultJson;
+
+void	SealResultInit	(sealfield *Args);
+void	SealResultBegin	(const char *Filename);
+void	SealResultVerified	(sealfield *Rec, long Num, const char *Error);
+void	SealResultAdded	(long Num, const char *Outname);
+char *	SealResultLater	(long Num, const char *Outname, const char *Error);
+char *	SealResultMerge	(const char *Output, size_t OutputLen, const char *Later, size_t LaterLen, size_t *Len);
+void	SealResultEnd	();
+
+#endif
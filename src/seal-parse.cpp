@@ -17,13 +17,10 @@
 #include <string.h>
 #include <ctype.h>
 
-// For Base64
-#include <openssl/bio.h>
-#include <openssl/buffer.h>
-#include <openssl/evp.h>
 
 #include "seal.hpp"
 #include "seal-parse.hpp"
+#include "stats.hpp"
 
 struct {
   int len;
@@ -47,6 +44,7 @@ void	SealStrDecode	(sealfield *Data)
   // Do the decoding inline
   size_t i,j;
   if (!Data || !Data->ValueLen) { return; }
+  if (!memchr(Data->Value,'\\',Data->ValueLen)) { return; } // nothing quoted
   for(i=j=0; i < Data->ValueLen; i++,j++)
     {
     if (Data->Value[i]=='\\') { i++; }
@@ -74,9 +72,7 @@ void	SealStrEncode	(sealfield *Data)
   // i=string length, j=new string length
   if (j > i)
     {
-    Data->ValueLen=j;
-    Data->Value = (byte*)realloc(Data->Value,Data->ValueLen+4);
-    memset(Data->Value+i,0,j-i+4); // clear new memory
+    SealResizeValue(Data,j); // clears new memory
     // Now copy over all new characters
     i--; j--; // Start at the last character
     while((i >= 0) && (j > i))
@@ -101,6 +97,7 @@ void	SealXmlDecode	(sealfield *Data)
   int e,n;
   size_t i,j;
   if (!Data || !Data->ValueLen) { return; }
+  if (!memchr(Data->Value,'&',Data->ValueLen)) { return; } // no entities
 
   for(i=j=0; i < Data->ValueLen; i++,j++)
     {
@@ -247,12 +244,79 @@ void	SealXmlEncode	(sealfield *Data)
 	j++;
 	}
       }
-    free(Data->Value);
-    Data->ValueLen=j;
-    Data->Value=Str;
+    SealSetValue(Data,j,Str);
+    free(Str);
     }
 } /* SealXmlEncode() */
 
+#pragma GCC visibility push(hidden)
+/*****
+ Codec tables.
+ Lookups replace the per-character isxdigit()/snprintf() calls
+ and the OpenSSL BIO chains.  Signatures and public keys are
+ decoded for every record, so this is on the verify path.
+ *****/
+static const char _SealHexDigit[2][17] = { "0123456789abcdef", "0123456789ABCDEF" };
+static const char _SealBase64Digit[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const signed char _SealHexValue[256] = { // -1 = not hex
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  0,1,2,3,4,5,6,7,8,9,-1,-1,-1,-1,-1,-1,
+  -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,10,11,12,13,14,15,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+  };
+static const signed char _SealBase64Value[256] = { // -1 = not base64
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,62,-1,-1,-1,63,
+  52,53,54,55,56,57,58,59,60,61,-1,-1,-1,-1,-1,-1,
+  -1,0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,
+  15,16,17,18,19,20,21,22,23,24,25,-1,-1,-1,-1,-1,
+  -1,26,27,28,29,30,31,32,33,34,35,36,37,38,39,40,
+  41,42,43,44,45,46,47,48,49,50,51,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+  -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1
+  };
+#pragma GCC visibility pop
+
+/**************************************
+ SealHexDecodeTo(): Convert hex to binary.
+ Dst must hold SrcLen/2 bytes.  Dst may be Src (in place).
+ Returns: output length, or 0 if invalid or odd-length.
+ **************************************/
+size_t	SealHexDecodeTo	(size_t SrcLen, const byte *Src, byte *Dst)
+{
+  size_t i;
+  int hi,lo;
+
+  if (SrcLen % 2) { return(0); }
+  for(i=0; i < SrcLen; i+=2)
+    {
+    hi = _SealHexValue[Src[i]];
+    lo = _SealHexValue[Src[i+1]];
+    if ((hi | lo) < 0) { return(0); } // invalid
+    Dst[i/2] = (hi << 4) | lo;
+    }
+  return(SrcLen/2);
+} /* SealHexDecodeTo() */
+
 /**************************************
  SealHexDecode(): Given a string, convert hex to binary
  NOTE: Invalid or odd-length returns noting.
@@ -262,30 +326,32 @@ void	SealHexDecode	(sealfield *Data)
   // Do the decoding inline
   if (!Data || !Data->ValueLen) { return; }
 
-  size_t i,j;
-  int c=0,bits=0;
-  for(i=j=0; i < Data->ValueLen; i++)
-    {
-    c <<= 4; bits+=4;
-    if (!isxdigit(Data->Value[i])) { j=0; break; } // invalid
-    else if (isdigit(Data->Value[i])) { c |= (Data->Value[i]-'0'); }
-    else if (isupper(Data->Value[i])) { c |= (Data->Value[i]-'A'+10); }
-    else if (islower(Data->Value[i])) { c |= (Data->Value[i]-'a'+10); }
-    if (bits >= 8)
-	{
-	Data->Value[j] = c & 0xff;
-	j++;
-	bits=0;
-	}
-    }
-  if (bits != 0)
-    {
-    j=0;
-    }
-  Data->ValueLen = j;
+  Data->ValueLen = SealHexDecodeTo(Data->ValueLen,Data->Value,Data->Value);
   Data->Type = 'x';
 } /* SealHexDecode() */
 
+/**************************************
+ SealHexEncodeTo(): Convert binary to hex.
+ Dst must hold SrcLen*2 bytes (not null-terminated).
+ Dst may be the same buffer as Src (in place).
+ Returns: output length.
+ **************************************/
+size_t	SealHexEncodeTo	(size_t SrcLen, const byte *Src, byte *Dst, bool IsUpper)
+{
+  const char *Digit = _SealHexDigit[IsUpper ? 1 : 0];
+  size_t i;
+  byte c;
+
+  // Work backwards so it can be done in place
+  for(i=SrcLen; i > 0; i--)
+    {
+    c = Src[i-1];
+    Dst[i*2-1] = Digit[c & 0x0f];
+    Dst[i*2-2] = Digit[c >> 4];
+    }
+  return(SrcLen*2);
+} /* SealHexEncodeTo() */
+
 /**************************************
  SealHexEncode(): Given binary, convert to hex.
  NOTE: Odd values assume terminating "0".
@@ -293,29 +359,56 @@ void	SealHexDecode	(sealfield *Data)
  **************************************/
 void	SealHexEncode	(sealfield *Data, bool IsUpper)
 {
-  sealfield *D=NULL;
-  char d[3];
-  size_t i;
+  size_t Len;
 
   // Do the decoding inline
   if (!Data || !Data->ValueLen) { return; }
 
-  for(i=0; i < Data->ValueLen; i++)
+  Len = Data->ValueLen;
+  SealResizeValue(Data,Len*2);
+  SealHexEncodeTo(Len,Data->Value,Data->Value,IsUpper);
+  Data->Type = 'c';
+} /* SealHexEncode() */
+
+/**************************************
+ SealBase64DecodeTo(): Convert base64 to binary.
+ Padding ("=") is optional.
+ Stops at the first non-base64 character (including "=").
+ Dst must hold (SrcLen*3)/4 bytes.  Dst may be Src (in place).
+ Returns: output length.
+ **************************************/
+size_t	SealBase64DecodeTo	(size_t SrcLen, const byte *Src, byte *Dst)
+{
+  size_t i,j;
+  int a,b,c,d;
+
+  // Full 4-character groups
+  for(i=j=0; i+4 <= SrcLen; i+=4)
     {
-    if (IsUpper) { snprintf(d,3,"%02X",Data->Value[i]); }
-    else { snprintf(d,3,"%02x",Data->Value[i]); }
-    D = SealAddTextLen(D,"bin",2,d);
+    a = _SealBase64Value[Src[i]];
+    b = _SealBase64Value[Src[i+1]];
+    c = _SealBase64Value[Src[i+2]];
+    d = _SealBase64Value[Src[i+3]];
+    if ((a | b | c | d) < 0) { break; } // padding or end of data
+    Dst[j++] = (a << 2) | (b >> 4);
+    Dst[j++] = (b << 4) | (c >> 2);
+    Dst[j++] = (c << 6) | d;
     }
 
-  // Replace inline
-  byte *tmp; // swap memory
-  tmp = Data->Value;
-  Data->Value = D->Value;
-  Data->ValueLen = D->ValueLen;
-  D->Value = tmp;
-  SealFree(D);
-  Data->Type = 'c';
-} /* SealHexEncode() */
+  // Partial group (usually the padded end)
+  if (i >= SrcLen) { return(j); }
+  a = _SealBase64Value[Src[i]];
+  b = (i+1 < SrcLen) ? _SealBase64Value[Src[i+1]] : -1;
+  if ((a | b) < 0) { return(j); } // need at least 2 characters for a byte
+  Dst[j++] = (a << 2) | (b >> 4);
+  c = (i+2 < SrcLen) ? _SealBase64Value[Src[i+2]] : -1;
+  if (c < 0) { return(j); }
+  Dst[j++] = (b << 4) | (c >> 2);
+  d = (i+3 < SrcLen) ? _SealBase64Value[Src[i+3]] : -1;
+  if (d < 0) { return(j); }
+  Dst[j++] = (c << 6) | d;
+  return(j);
+} /* SealBase64DecodeTo() */
 
 /**************************************
  SealBase64Decode(): Given base64, decode to binary.
@@ -323,38 +416,49 @@ void	SealHexEncode	(sealfield *Data, bool IsUpper)
  **************************************/
 void	SealBase64Decode	(sealfield *Data)
 {
-  BIO *bio, *b64;
-  sealfield *D=NULL;
-  byte d[16];
-  int dlen;
+  size_t Len;
 
   // Do the decoding inline
   if (!Data || !Data->ValueLen) { return; }
 
-  // Make sure it ends with "=" padding
-  while(Data->ValueLen % 4) { Data = SealAddC(Data,Data->Field,'='); }
+  Len = SealBase64DecodeTo(Data->ValueLen,Data->Value,Data->Value);
+  SealResizeValue(Data,Len); // clears the leftover text
+  Data->Type = 'x';
+} /* SealBase64Decode() */
 
-  b64 = BIO_new(BIO_f_base64());
-  bio = BIO_new_mem_buf(Data->Value,Data->ValueLen);
-  bio = BIO_push(b64, bio);
-  BIO_set_flags(bio, BIO_FLAGS_BASE64_NO_NL);
-  while((dlen = BIO_read(bio, d, 16)) > 0) // decode in small chunks
+/**************************************
+ SealBase64EncodeTo(): Convert binary to base64 (with padding).
+ Dst must hold ((SrcLen+2)/3)*4 bytes (not null-terminated).
+ Dst may be the same buffer as Src (in place).
+ Returns: output length.
+ **************************************/
+size_t	SealBase64EncodeTo	(size_t SrcLen, const byte *Src, byte *Dst)
+{
+  size_t Groups, i, j;
+  uint32_t v;
+  byte b0, b1, b2;
+
+  Groups = (SrcLen+2)/3;
+  // Work backwards so it can be done in place
+  for(i=Groups; i > 0; i--)
     {
-    D = SealAddBin(D,"bin",dlen,d);
+    j = (i-1)*3; // source offset
+    b0 = Src[j];
+    b1 = (j+1 < SrcLen) ? Src[j+1] : 0;
+    b2 = (j+2 < SrcLen) ? Src[j+2] : 0;
+    v = (b0 << 16) | (b1 << 8) | b2;
+    j = (i-1)*4; // destination offset
+    Dst[j]   = _SealBase64Digit[(v >> 18) & 0x3f];
+    Dst[j+1] = _SealBase64Digit[(v >> 12) & 0x3f];
+    Dst[j+2] = _SealBase64Digit[(v >> 6) & 0x3f];
+    Dst[j+3] = _SealBase64Digit[v & 0x3f];
     }
-  BIO_free_all(bio); // frees memory
-
-  if (!D) { Data->ValueLen=0; }
 
-  // Replace inline
-  byte *tmp; // swap memory
-  tmp = Data->Value;
-  Data->Value = D->Value;
-  Data->ValueLen = D->ValueLen;
-  D->Value = tmp;
-  SealFree(D);
-  Data->Type = 'x';
-} /* SealBase64Decode() */
+  // Padding
+  if (SrcLen % 3 == 1) { Dst[Groups*4-2] = Dst[Groups*4-1] = '='; }
+  else if (SrcLen % 3 == 2) { Dst[Groups*4-1] = '='; }
+  return(Groups*4);
+} /* SealBase64EncodeTo() */
 
 /**************************************
  SealBase64Encode(): Given base64, decode to binary.
@@ -362,28 +466,36 @@ void	SealBase64Decode	(sealfield *Data)
  **************************************/
 void	SealBase64Encode	(sealfield *Data)
 {
-  BIO *bio, *b64;
-  BUF_MEM *bptr;
+  size_t Len;
 
   if (!Data || !Data->ValueLen) { return; }
 
-  b64 = BIO_new(BIO_f_base64());
-  bio = BIO_new(BIO_s_mem());
-  bio = BIO_push(b64, bio);
-  BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
-  BIO_write(b64,Data->Value,Data->ValueLen);
-  BIO_flush(b64);
-
-  BIO_get_mem_ptr(b64, &bptr);
-  Data->Value = (byte*)realloc(Data->Value,bptr->length+4);
-  Data->ValueLen = bptr->length;
-  memset(Data->Value,0,Data->ValueLen+4);
-  memcpy(Data->Value, bptr->data, bptr->length);
-
-  BIO_free_all(bio); // frees memory
+  Len = Data->ValueLen;
+  SealResizeValue(Data,((Len+2)/3)*4);
+  SealBase64EncodeTo(Len,Data->Value,Data->Value);
   Data->Type = 'c';
 } /* SealBase64Encode() */
 
+#pragma GCC visibility push(hidden)
+/**************************************
+ _SealIsTagEnd(): Can this character follow "<seal"?
+ Same as strchr("> ",c), including the string's NUL.
+ **************************************/
+static inline bool	_SealIsTagEnd	(byte c)
+{
+  return((c=='>') || (c==' ') || (c=='\0'));
+} /* _SealIsTagEnd() */
+
+/**************************************
+ _SealIsValueEnd(): Does this character end an unquoted value?
+ Same as strchr(" <>",c), including the string's NUL.
+ **************************************/
+static inline bool	_SealIsValueEnd	(byte c)
+{
+  return((c==' ') || (c=='<') || (c=='>') || (c=='\0'));
+} /* _SealIsValueEnd() */
+#pragma GCC visibility pop
+
 /**************************************
  SealParse(): Parse a SEAL record.
  This will scan the entire input space for any SEAL record,
@@ -409,8 +521,11 @@ sealfield *	SealParse	(size_t TextLen, const byte *Text, size_t Offset, sealfiel
   uint32_t fs=0,fe=0; // field start and end offsets
   uint32_t vs=0,ve=0; // value start and end offsets
   bool IsBad=false;
+  const byte *Next; // next candidate record start
+  double Start;
 
   if (!Text || (TextLen < 10)) { return(NULL); }
+  Start = SealStatStart();
 
   for(i=0; i < TextLen; i++)
     {
@@ -428,9 +543,14 @@ sealfield *	SealParse	(size_t TextLen, const byte *Text, size_t Offset, sealfiel
     if (State==0)
       {
       // Must begin with "<"
-      if (Text[i] != '<') { continue; } // nope!
+      // Most of the data is not a record, so jump to the next "<"
+      // (memchr is vectorized by the C library.)
+      Next = (const byte*)memchr(Text+i,'<',TextLen-i);
+      if (!Next) { i=TextLen; break; } // no more candidates
+      i = Next-Text;
       // "<seal>" or "<seal "
-      if ((i+6 < TextLen) && !memcmp(Text+i,"<seal",5) && strchr("> ",Text[i+5]))
+      // (This also accepts "<seal\0", the same as strchr("> ").)
+      if ((i+6 < TextLen) && !memcmp(Text+i,"<seal",5) && _SealIsTagEnd(Text[i+5]))
         {
 	// found a start!
 	i+=5;
@@ -438,7 +558,7 @@ sealfield *	SealParse	(size_t TextLen, const byte *Text, size_t Offset, sealfiel
 	continue;
 	}
       // "<xmp:seal>" or "<xmp:seal "
-      if ((i+10 < TextLen) && !memcmp(Text+i,"<xmp:seal",9) && strchr("> ",Text[i+9]))
+      if ((i+10 < TextLen) && !memcmp(Text+i,"<xmp:seal",9) && _SealIsTagEnd(Text[i+9]))
         {
 	// found a start!
 	i+=9;
@@ -476,7 +596,7 @@ sealfield *	SealParse	(size_t TextLen, const byte *Text, size_t Offset, sealfiel
       for( ; i < TextLen; i++)
         {
 	if (Text[i]=='\\') { i++; } // permit quoting next character.
-	else if (!Quote && strchr(" <>",Text[i])) { ve=i; State=3; break; } // found value!
+	else if (!Quote && _SealIsValueEnd(Text[i])) { ve=i; State=3; break; } // found value!
 	else if ((Quote!=1) && (Text[i]==Quote)) { ve=i; i++; State=3; break; } // found value!
 	else if (Quote==1) // Special case for '&quot;'
 	  {
@@ -505,7 +625,7 @@ sealfield *	SealParse	(size_t TextLen, const byte *Text, size_t Offset, sealfiel
 	// Warn if there is a duplicate!
 	if (SealSearch(Rec,Str))
 	  {
-	  printf("WARNING: '%s' redefined.\n",Str);
+	  SealPrintf("WARNING: '%s' redefined.\n",Str);
 	  }
 
 	// Check for the signature position and save it
@@ -519,6 +639,7 @@ sealfield *	SealParse	(size_t TextLen, const byte *Text, size_t Offset, sealfiel
 	  if (Args)
 	    {
 	    Rec = SealCopy2(Rec,"@p",Args,"@s"); // previous '@s' is now '@p'
+	    Rec = SealSetIindex(Rec,"@s",2,SealGetIindex(Args,"@s",2)); // records so far
 	    Rec = SealIncIindex(Rec,"@s",2,1); // increment record number
 	    Rec = SealCopy2(Rec,"@sflags",Args,"@sflags"); // tell verifier the sflags
 	    Rec = SealCopy2(Rec,"@dnscachelast",Args,"@dnscachelast"); // use any cached DNS
@@ -558,6 +679,7 @@ Done:
     {
     Rec = SealSetIindex(Rec,"@RecEnd",0,i); // Mark end of the record
     }
+  SealStatStop(SEAL_PHASE_PARSE,Start);
   return(Rec);
 } /* SealParse() */
 
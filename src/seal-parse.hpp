@@ -23,6 +23,11 @@ void	SealHexDecode	(sealfield *Data);
 void	SealHexEncode	(sealfield *Data, bool IsUpper);
 void	SealBase64Decode	(sealfield *Data);
 void	SealBase64Encode	(sealfield *Data);
+// Codecs with caller-provided buffers (Dst may be Src)
+size_t	SealHexDecodeTo	(size_t SrcLen, const byte *Src, byte *Dst);
+size_t	SealHexEncodeTo	(size_t SrcLen, const byte *Src, byte *Dst, bool IsUpper);
+size_t	SealBase64DecodeTo	(size_t SrcLen, const byte *Src, byte *Dst);
+size_t	SealBase64EncodeTo	(size_t SrcLen, const byte *Src, byte *Dst);
 
 #define TESTPARSE 0
 #if TESTPARSE
@@ -17,6 +17,466 @@
 #define PAD 4 /* padding to prevent overflow; should not be needed */
 
 int Verbose=0;
+__thread FILE *SealOut=NULL; // per-thread output; NULL = stdout
+__thread jmp_buf *SealFatalJump=NULL; // set by libseal calls
+
+/**************************************
+ SealFatal(): Stop after a fatal error.
+ The caller has already reported it.
+ If the thread is inside a libseal call, return to it.
+ **************************************/
+void	SealFatal	()
+{
+  if (SealFatalJump) { longjmp(*SealFatalJump,1); }
+  exit(1);
+} /* SealFatal() */
+
+#define SEAL_CLEANUP_MAX 64 // resources held at once by one call
+static __thread struct
+  {
+  sealcleanupfunc Func;
+  void *Data;
+  } SealCleanup[SEAL_CLEANUP_MAX];
+static __thread size_t SealCleanupCount=0;
+
+/**************************************
+ SealCleanupPush(): Register a resource to release after a fatal error.
+ Only needed when a fatal error can be recovered.
+ **************************************/
+void	SealCleanupPush	(sealcleanupfunc Func, void *Data)
+{
+  if (!SealFatalJump || !Data) { return; }
+  if (SealCleanupCount >= SEAL_CLEANUP_MAX) { return; } // too many; it may leak
+  SealCleanup[SealCleanupCount].Func = Func;
+  SealCleanup[SealCleanupCount].Data = Data;
+  SealCleanupCount++;
+} /* SealCleanupPush() */
+
+/**************************************
+ SealCleanupPop(): The resource was released; forget it.
+ **************************************/
+void	SealCleanupPop	(void *Data)
+{
+  size_t i;
+
+  for(i=SealCleanupCount; i > 0; i--) // usually the newest
+    {
+    if (SealCleanup[i-1].Data != Data) { continue; }
+    memmove(SealCleanup+i-1,SealCleanup+i,(SealCleanupCount-i)*sizeof(SealCleanup[0]));
+    SealCleanupCount--;
+    return;
+    }
+} /* SealCleanupPop() */
+
+/**************************************
+ SealCleanupMark(): Where the next call's resources begin.
+ **************************************/
+size_t	SealCleanupMark	()
+{
+  return(SealCleanupCount);
+} /* SealCleanupMark() */
+
+/**************************************
+ SealCleanupRun(): Release everything registered since Mark.
+ Call after recovering from SealFatal().
+ **************************************/
+void	SealCleanupRun	(size_t Mark)
+{
+  sealcleanupfunc Func;
+  void *Data;
+
+  while(SealCleanupCount > Mark)
+    {
+    SealCleanupCount--;
+    Func = SealCleanup[SealCleanupCount].Func;
+    Data = SealCleanup[SealCleanupCount].Data;
+    Func(Data); // may call SealCleanupPop(); it is already gone
+    }
+} /* SealCleanupRun() */
+
+/**************************************
+ Arenas.
+ An arena is a list of large chunks.  Allocations are carved
+ off the current chunk and are never freed individually; the
+ whole arena is released at once (e.g., after each file).
+ The most recent allocation can grow or be returned in place,
+ which covers the common append-then-append pattern.
+ **************************************/
+#define SEAL_ARENA_CHUNK (64*1024) /* default chunk size */
+#define SEAL_ARENA_ALIGN 16
+
+typedef struct sealarenachunk
+  {
+  struct sealarenachunk *Next;
+  size_t Size; // usable bytes
+  size_t Used; // bytes allocated
+  } sealarenachunk;
+// Memory starts after the header (rounded to the alignment)
+#define SEAL_ARENA_HDR ((sizeof(sealarenachunk)+SEAL_ARENA_ALIGN-1) & ~(size_t)(SEAL_ARENA_ALIGN-1))
+#define SEAL_ARENA_MEM(c) ((byte*)(c) + SEAL_ARENA_HDR)
+#define SEAL_ARENA_ROUND(n) (((n)+SEAL_ARENA_ALIGN-1) & ~(size_t)(SEAL_ARENA_ALIGN-1))
+
+struct sealarena
+  {
+  sealarenachunk *Chunk; // current chunk is first
+  byte *Last; // most recent allocation in the current chunk
+  };
+
+static __thread sealarena *SealArena=NULL; // arena for new sealfields (NULL = heap)
+
+#pragma GCC visibility push(hidden)
+/**************************************
+ _SealArenaGet(): Allocate from an arena.
+ Memory is not cleared.
+ **************************************/
+void *	_SealArenaGet	(sealarena *Arena, size_t Size)
+{
+  sealarenachunk *c;
+  byte *Mem;
+
+  Size = SEAL_ARENA_ROUND(Size);
+  c = Arena->Chunk;
+  if (c && (c->Used + Size <= c->Size))
+    {
+    Mem = SEAL_ARENA_MEM(c) + c->Used;
+    c->Used += Size;
+    Arena->Last = Mem;
+    return(Mem);
+    }
+
+  // Need a new chunk
+  if (Size > SEAL_ARENA_CHUNK/4)
+    {
+    // Big allocations get their own chunk; keep using the current one
+    c = (sealarenachunk*)malloc(SEAL_ARENA_HDR + Size);
+    if (!c) { fprintf(stderr,"ERROR: Unable to allocate arena memory. Aborting.\n"); SealFatal(); }
+    c->Size = c->Used = Size;
+    if (Arena->Chunk)
+      {
+      c->Next = Arena->Chunk->Next;
+      Arena->Chunk->Next = c;
+      }
+    else
+      {
+      c->Next = NULL;
+      Arena->Chunk = c;
+      Arena->Last = NULL; // full chunk; nothing to grow in place
+      }
+    return(SEAL_ARENA_MEM(c));
+    }
+
+  c = (sealarenachunk*)malloc(SEAL_ARENA_HDR + SEAL_ARENA_CHUNK);
+  if (!c) { fprintf(stderr,"ERROR: Unable to allocate arena chunk. Aborting.\n"); SealFatal(); }
+  c->Size = SEAL_ARENA_CHUNK;
+  c->Used = Size;
+  c->Next = Arena->Chunk;
+  Arena->Chunk = c;
+  Arena->Last = SEAL_ARENA_MEM(c);
+  return(Arena->Last);
+} /* _SealArenaGet() */
+
+/**************************************
+ _SealMalloc(): Allocate cleared memory.
+ Arena may be NULL for the heap.
+ **************************************/
+void *	_SealMalloc	(sealarena *Arena, size_t Size)
+{
+  void *Mem;
+  if (!Arena) { return(calloc(Size,1)); }
+  Mem = _SealArenaGet(Arena,Size);
+  memset(Mem,0,Size);
+  return(Mem);
+} /* _SealMalloc() */
+
+/**************************************
+ _SealRealloc(): Resize memory.
+ OldSize is the size of the current allocation.
+ New space is not cleared.
+ **************************************/
+void *	_SealRealloc	(sealarena *Arena, void *Mem, size_t OldSize, size_t NewSize)
+{
+  void *NewMem;
+  sealarenachunk *c;
+
+  if (!Arena) { return(realloc(Mem,NewSize)); }
+  if (!Mem) { return(_SealArenaGet(Arena,NewSize)); }
+
+  // Most recent allocation? Grow or shrink in place.
+  c = Arena->Chunk;
+  if ((Mem == Arena->Last) &&
+      ((size_t)((byte*)Mem - SEAL_ARENA_MEM(c)) + SEAL_ARENA_ROUND(NewSize) <= c->Size))
+    {
+    c->Used = ((byte*)Mem - SEAL_ARENA_MEM(c)) + SEAL_ARENA_ROUND(NewSize);
+    return(Mem);
+    }
+
+  NewMem = _SealArenaGet(Arena,NewSize);
+  memcpy(NewMem,Mem,(OldSize < NewSize) ? OldSize : NewSize);
+  return(NewMem);
+} /* _SealRealloc() */
+
+/**************************************
+ _SealRelease(): Free memory.
+ With an arena, only the most recent allocation can be returned;
+ everything else waits for SealArenaFree().
+ **************************************/
+void	_SealRelease	(sealarena *Arena, void *Mem)
+{
+  if (!Mem) { return; }
+  if (!Arena) { free(Mem); return; }
+  if (Mem == Arena->Last)
+    {
+    Arena->Chunk->Used = (byte*)Mem - SEAL_ARENA_MEM(Arena->Chunk);
+    Arena->Last = NULL;
+    }
+} /* _SealRelease() */
+
+/**************************************
+ _SealArenaCleanup(): SealArenaFree() after a recovered fatal error.
+ **************************************/
+void	_SealArenaCleanup	(void *Data)
+{
+  SealArenaFree((sealarena*)Data);
+} /* _SealArenaCleanup() */
+#pragma GCC visibility pop
+
+/**************************************
+ SealArenaNew(): Create an empty arena.
+ Chunks are allocated as needed.
+ **************************************/
+sealarena *	SealArenaNew	()
+{
+  sealarena *Arena;
+  Arena = (sealarena*)calloc(1,sizeof(sealarena));
+  if (!Arena) { fprintf(stderr,"ERROR: Unable to allocate arena. Aborting.\n"); SealFatal(); }
+  SealCleanupPush(_SealArenaCleanup,Arena);
+  return(Arena);
+} /* SealArenaNew() */
+
+/**************************************
+ SealArenaFree(): Release an arena and everything allocated from it.
+ Every sealfield from this arena becomes invalid.
+ **************************************/
+void	SealArenaFree	(sealarena *Arena)
+{
+  sealarenachunk *c;
+
+  if (!Arena) { return; }
+  SealCleanupPop(Arena);
+  if (SealArena == Arena) { SealArena = NULL; } // no longer usable
+  while(Arena->Chunk)
+    {
+    c = Arena->Chunk;
+    Arena->Chunk = c->Next;
+    free(c);
+    }
+  free(Arena);
+} /* SealArenaFree() */
+
+/**************************************
+ SealArenaUse(): Set the arena for new sealfields in this thread.
+ NULL means use the heap.
+ Returns: the previous arena (so it can be restored).
+ **************************************/
+sealarena *	SealArenaUse	(sealarena *Arena)
+{
+  sealarena *Prev;
+  Prev = SealArena;
+  SealArena = Arena;
+  return(Prev);
+} /* SealArenaUse() */
+
+/**************************************
+ Field index.
+ Most chains are short, so a linear scan is fine.
+ Long chains (e.g., Args with every option, or records with
+ many fields) get a hash table so lookups do not walk the chain.
+ The table uses open addressing: each slot is a pointer to a
+ node in the chain, or NULL.  It is owned by the chain's head
+ and moves to the new head whenever the head changes.
+ **************************************/
+#define SEAL_INDEX_MIN 12 /* build an index when a chain gets this long */
+
+struct sealindex
+  {
+  size_t Count; // number of nodes in the table
+  size_t Max; // number of slots; always a power of 2
+  sealfield **Slot;
+  sealarena *Arena; // where the table lives (NULL = heap)
+  };
+
+#pragma GCC visibility push(hidden)
+/**************************************
+ _SealIndexAdd(): Add a node to the index.
+ Grows the table when it gets half-full.
+ If the field is already indexed, the existing node is kept
+ (same as SealSearch: the first match wins).
+ **************************************/
+void	_SealIndexAdd	(sealindex *Index, sealfield *vf)
+{
+  size_t s,Mask;
+
+  if (2*(Index->Count+1) > Index->Max)
+    {
+    sealindex Old;
+    Old = *Index;
+    Index->Max = Old.Max ? Old.Max*2 : 32;
+    Index->Count = 0;
+    Index->Slot = (sealfield**)_SealMalloc(Index->Arena,Index->Max*sizeof(sealfield*));
+    for(s=0; s < Old.Max; s++)
+      {
+      if (Old.Slot[s]) { _SealIndexAdd(Index,Old.Slot[s]); }
+      }
+    _SealRelease(Index->Arena,Old.Slot);
+    }
+
+  Mask = Index->Max-1;
+  for(s = vf->Hash & Mask; Index->Slot[s]; s = (s+1) & Mask)
+    {
+    if ((Index->Slot[s]->Hash == vf->Hash) &&
+	(Index->Slot[s]->FieldLen == vf->FieldLen) &&
+	!memcmp(Index->Slot[s]->Field,vf->Field,vf->FieldLen))
+	{ return; } // already indexed
+    }
+  Index->Slot[s] = vf;
+  Index->Count++;
+} /* _SealIndexAdd() */
+
+/**************************************
+ _SealIndexFind(): Find a field in the index.
+ Returns: sealfield* on match, NULL if missed.
+ **************************************/
+sealfield *	_SealIndexFind	(sealindex *Index, const char *Field, size_t FieldLen, uint32_t Hash)
+{
+  size_t s,Mask;
+
+  Mask = Index->Max-1;
+  for(s = Hash & Mask; Index->Slot[s]; s = (s+1) & Mask)
+    {
+    if ((Index->Slot[s]->Hash == Hash) &&
+	(Index->Slot[s]->FieldLen == FieldLen) &&
+	!memcmp(Index->Slot[s]->Field,Field,FieldLen))
+	{ return(Index->Slot[s]); }
+    }
+  return(NULL);
+} /* _SealIndexFind() */
+
+/**************************************
+ _SealIndexRemove(): Remove a node from the index.
+ Later entries in the same run are shifted back so
+ lookups never stop at a hole.
+ **************************************/
+void	_SealIndexRemove	(sealindex *Index, sealfield *vf)
+{
+  size_t s,n,Home,Mask;
+
+  Mask = Index->Max-1;
+  for(s = vf->Hash & Mask; Index->Slot[s] != vf; s = (s+1) & Mask)
+    {
+    if (!Index->Slot[s]) { return; } // not indexed
+    }
+  Index->Slot[s] = NULL;
+  Index->Count--;
+
+  // Close the gap
+  for(n = (s+1) & Mask; Index->Slot[n]; n = (n+1) & Mask)
+    {
+    Home = Index->Slot[n]->Hash & Mask;
+    // Move it if its home slot is not between the hole and here
+    if (((n - Home) & Mask) >= ((n - s) & Mask))
+      {
+      Index->Slot[s] = Index->Slot[n];
+      Index->Slot[n] = NULL;
+      s = n;
+      }
+    }
+} /* _SealIndexRemove() */
+
+/**************************************
+ _SealIndexFree(): Free an index.
+ **************************************/
+void	_SealIndexFree	(sealindex *Index)
+{
+  if (!Index) { return; }
+  _SealRelease(Index->Arena,Index->Slot);
+  _SealRelease(Index->Arena,Index);
+} /* _SealIndexFree() */
+
+/**************************************
+ _SealFind(): Find a field in the chain.
+ Uses the index if the head has one.
+ If Count is set, then it is set to the number of
+ nodes scanned (the chain length when not found).
+ Returns: sealfield* on match, NULL if missed.
+ **************************************/
+sealfield *	_SealFind	(sealfield *vfhead, const char *Field, size_t FieldLen, uint32_t Hash, size_t *Count)
+{
+  sealfield *vf;
+  size_t c=0;
+
+  if (vfhead && vfhead->Index)
+    {
+    if (Count) { *Count = vfhead->Index->Count; }
+    return(_SealIndexFind(vfhead->Index,Field,FieldLen,Hash));
+    }
+
+  for(vf=vfhead; vf; vf=vf->Next)
+    {
+    c++;
+    if ((vf->Hash == Hash) && (vf->FieldLen == FieldLen) &&
+	!memcmp(vf->Field,Field,FieldLen))
+	{ break; }
+    }
+  if (Count) { *Count = c; }
+  return(vf);
+} /* _SealFind() */
+
+/**************************************
+ _SealFreeNode(): Free one node (not the chain).
+ Does not touch the index.
+ **************************************/
+void	_SealFreeNode	(sealfield *vf)
+{
+  _SealRelease(vf->Arena,vf->Value);
+  _SealRelease(vf->Arena,vf->Field);
+  _SealRelease(vf->Arena,vf);
+} /* _SealFreeNode() */
+
+/**************************************
+ _SealGrowValue(): Make sure Value can hold ValueLen bytes.
+ Grows geometrically so repeated appends do not reallocate
+ every time.  New space (and the padding) is cleared.
+ ValueLen is not changed.
+ **************************************/
+void	_SealGrowValue	(sealfield *vf, size_t ValueLen)
+{
+  size_t NewMax;
+
+  if (vf->Value && (ValueLen <= vf->ValueMax)) { return; } // fits
+  NewMax = vf->ValueMax * 2;
+  if (NewMax < ValueLen) { NewMax = ValueLen; }
+  vf->Value = (byte*)_SealRealloc(vf->Arena,vf->Value,vf->Value ? vf->ValueMax+PAD : 0,NewMax+PAD);
+  if (!vf->Value) { fprintf(stderr,"ERROR: Unable to allocate field value. Aborting.\n"); SealFatal(); }
+  memset(vf->Value+vf->ValueLen,0,NewMax+PAD - vf->ValueLen); // clear new space
+  vf->ValueMax = NewMax;
+} /* _SealGrowValue() */
+#pragma GCC visibility pop
+
+/**************************************
+ SealHash(): Hash a field name (FNV-1a).
+ **************************************/
+uint32_t	SealHash	(const char *Field, size_t FieldLen)
+{
+  uint32_t Hash=2166136261u;
+  size_t i;
+
+  for(i=0; i < FieldLen; i++)
+    {
+    Hash ^= (byte)Field[i];
+    Hash *= 16777619u;
+    }
+  return(Hash);
+} /* SealHash() */
 
 /**************************************
  DEBUGhexdump(): Display hexdump of data.
@@ -59,10 +519,9 @@ void	SealFree	(sealfield *vf)
   while(vf)
     {
     //DEBUGPRINT("Free: [%s] [%s]",vf->Field,vf->Type=='c' ? (char*)vf->Value : "");
-    if (vf->Field) { free(vf->Field); }
-    if (vf->Value) { free(vf->Value); }
+    if (vf->Index) { _SealIndexFree(vf->Index); }
     vfnext = vf->Next;
-    free(vf);
+    _SealFreeNode(vf);
     vf = vfnext;
     }
 } /* SealFree() */
@@ -218,43 +677,66 @@ int	SealCmp2	(sealfield *vfhead1, const char *Field1, sealfield *vfhead2, const
 sealfield *	SealAlloc	(sealfield *vfhead, const char *Field, size_t ValueLen, const char Type)
 {
   sealfield *vf=NULL,*vfp;
+  size_t FieldLen, Count=0;
+  uint32_t Hash;
+
+  FieldLen = strlen(Field);
+  Hash = SealHash(Field,FieldLen);
+
+  // Find element to replace
+  vf = _SealFind(vfhead,Field,FieldLen,Hash,&Count);
+  if (vf) // if found it
+    {
+    // replace value; reuse the space if it fits
+    if (vf->Value && (ValueLen <= vf->ValueMax))
+      {
+      memset(vf->Value,0,((ValueLen > vf->ValueLen) ? ValueLen : vf->ValueLen)+PAD);
+      }
+    else
+      {
+      _SealRelease(vf->Arena,vf->Value);
+      vf->Value = (byte*)_SealMalloc(vf->Arena,ValueLen+PAD);
+      vf->ValueMax = ValueLen;
+      }
+    vf->Type = Type;
+    vf->ValueLen = ValueLen;
+    return(vfhead);
+    }
+
+  // If it gets here, then nothing to replace; do add!
 
   // clear and allocate
-  vfp = (sealfield*)calloc(sizeof(sealfield),1); // clear and allocate
+  vfp = (sealfield*)_SealMalloc(SealArena,sizeof(sealfield)); // clear and allocate
+  vfp->Arena = SealArena;
 
   // Set Field
-  vfp->FieldLen = strlen(Field);
-  vfp->Field = (char*)calloc(vfp->FieldLen+PAD,1); // extra space ensures null termination
+  vfp->FieldLen = FieldLen;
+  vfp->Field = (char*)_SealMalloc(vfp->Arena,vfp->FieldLen+PAD); // extra space ensures null termination
   memcpy(vfp->Field,Field,vfp->FieldLen);
+  vfp->Hash = Hash;
 
   // Set Value
   vfp->Type = Type;
   vfp->ValueLen = ValueLen;
-  vfp->Value = (byte*)calloc(ValueLen+PAD,1);
+  vfp->ValueMax = ValueLen;
+  vfp->Value = (byte*)_SealMalloc(vfp->Arena,ValueLen+PAD);
 
-  // Base case: no head so make this the head
-  //if (!vfhead) { return(vfp); }
+  // if adding, then append to the start of the chain
+  vfp->Next = vfhead;
 
-  // Find element to replace
-  for(vf=vfhead; vf; vf=vf->Next)
+  // The new head owns the index
+  if (vfhead && vfhead->Index)
     {
-    if (!strcmp(vf->Field,Field)) // if found it
-	{
-	free(vfp->Field); // already have it; don't keep
-	// replace value
-	if (vf->Value) { free(vf->Value); }
-	vf->ValueLen = ValueLen;
-	vf->Value = vfp->Value;
-	// no longer need vfp structure
-	free(vfp);
-	return(vfhead);
-	}
+    vfp->Index = vfhead->Index;
+    vfhead->Index = NULL;
+    _SealIndexAdd(vfp->Index,vfp);
+    }
+  else if (Count+1 >= SEAL_INDEX_MIN) // long enough to index
+    {
+    vfp->Index = (sealindex*)_SealMalloc(vfp->Arena,sizeof(sealindex));
+    vfp->Index->Arena = vfp->Arena;
+    for(vf=vfp; vf; vf=vf->Next) { _SealIndexAdd(vfp->Index,vf); }
     }
-
-  // If it gets here, then nothing to replace; do add!
-
-  // if adding, then append to the start of the chain
-  vfp->Next = vfhead;
   return(vfp);
 } /* SealAlloc() */
 
@@ -300,8 +782,9 @@ sealfield *	SealCopy	(sealfield *vfhead, const char *NewField, const char *OldFi
   sealfield *vfold, *vfnew;
   vfold = SealSearch(vfhead,OldField);
   if (!vfold) { return(SealDel(vfhead,NewField)); } // can't copy if it doesn't exist.
+  // SealAlloc() clears (or frees) the destination's value before it is copied
+  if (SealSearch(vfhead,NewField) == vfold) { return(vfhead); } // same node
 
-  vfhead = SealDel(vfhead,NewField);
   vfhead = SealAlloc(vfhead,NewField,vfold->ValueLen,vfold->Type);
   vfnew = SealSearch(vfhead,NewField);
   if (!vfnew) { return(vfhead); } // should never fail
@@ -318,12 +801,15 @@ sealfield *	SealCopy2	(sealfield *vfhead2, const char *Field2, sealfield *vfhead
 {
   // Idiot checking
   if (!vfhead1 || !Field1) { return(vfhead2); }
+  if ((vfhead1 == vfhead2) && Field2 && !strcmp(Field1,Field2)) { return(vfhead2); } // same field
 
   sealfield *vf1, *vf2;
   vf1 = SealSearch(vfhead1,Field1);
   if (!vf1) { return(SealDel(vfhead2,Field2)); } // can't copy if it doesn't exist.
+  // The chains may overlap (vfhead1 can be part of vfhead2), and
+  // SealAlloc() clears (or frees) the destination's value first
+  if (SealSearch(vfhead2,Field2) == vf1) { return(vfhead2); } // same node
 
-  vfhead2 = SealDel(vfhead2,Field2);
   vfhead2 = SealAlloc(vfhead2,Field2,vf1->ValueLen,vf1->Type);
   vf2 = SealSearch(vfhead2,Field2);
   if (!vf2) { return(vfhead2); } // should never fail
@@ -335,17 +821,14 @@ sealfield *	SealCopy2	(sealfield *vfhead2, const char *Field2, sealfield *vfhead
 /**************************************
  SealClone(): Copy entire sealfield chain to a new chain.
  Returns: head of new sealfield chain.
- THIS IS RECURSIVE.
  **************************************/
 sealfield *	SealClone	(sealfield *src)
 {
-  sealfield *dst=NULL,*s,*d;
+  sealfield *dst=NULL,*s;
 
   for(s=src; s; s=s->Next)
     {
-    d = SealCopy2(NULL,s->Field,s,s->Field);
-    d->Next = dst;
-    dst = d;
+    dst = SealCopy2(dst,s->Field,s,s->Field);
     }
   return(dst);
 } /* SealClone() */
@@ -361,17 +844,46 @@ sealfield *	SealMove	(sealfield *vfhead, const char *NewField, const char *OldFi
 
   sealfield *vfp;
   vfp = SealSearch(vfhead,NewField);
-  if (vfp) { return(SealDel(vfhead,NewField)); } // remove new location
+  if (vfp) { vfhead = SealDel(vfhead,NewField); } // remove new location
 
   vfp = SealSearch(vfhead,OldField);
   if (!vfp) { return(vfhead); } // nothing to move!
+  if (vfhead->Index) { _SealIndexRemove(vfhead->Index,vfp); }
+  _SealRelease(vfp->Arena,vfp->Field);
   vfp->FieldLen = strlen(NewField);
-  vfp->Field = (char*)calloc(vfp->FieldLen+PAD,1); // extra space ensures null termination
+  vfp->Field = (char*)_SealMalloc(vfp->Arena,vfp->FieldLen+PAD); // extra space ensures null termination
   memcpy(vfp->Field,NewField,vfp->FieldLen);
+  vfp->Hash = SealHash(vfp->Field,vfp->FieldLen);
+  if (vfhead->Index) { _SealIndexAdd(vfhead->Index,vfp); }
 
   return(vfhead);
 } /* SealMove() */
 
+/**************************************
+ SealResizeValue(): Change the length of a field's value.
+ New space is cleared; the value is always null-padded.
+ Use this instead of realloc() on vf->Value.
+ **************************************/
+void	SealResizeValue	(sealfield *vf, size_t ValueLen)
+{
+  if (!vf) { return; }
+  _SealGrowValue(vf,ValueLen);
+  if (ValueLen < vf->ValueLen) { memset(vf->Value+ValueLen,0,vf->ValueLen-ValueLen); }
+  vf->ValueLen = ValueLen;
+  memset(vf->Value+ValueLen,0,PAD);
+} /* SealResizeValue() */
+
+/**************************************
+ SealSetValue(): Replace a field's value.
+ Use this instead of swapping or freeing vf->Value.
+ **************************************/
+void	SealSetValue	(sealfield *vf, size_t ValueLen, const byte *Value)
+{
+  if (!vf) { return; }
+  SealResizeValue(vf,ValueLen);
+  if (ValueLen) { memmove(vf->Value,Value,ValueLen); }
+} /* SealSetValue() */
+
 /**************************************
  SealSetBin(): Insert binary data into the sealfield chain.
  Returns: head of sealfield chain.
@@ -386,10 +898,7 @@ sealfield *	SealSetBin	(sealfield *vfhead, const char *Field, size_t ValueLen, c
   if (!Value) { ValueLen=0; }
 
   // Find element!
-  for(vf=vfhead; vf; vf = vf->Next)
-    {
-    if (!strcmp(vf->Field,Field)) { break; } // if found it
-    }
+  vf = SealSearch(vfhead,Field);
 
   if (!vf) { return(vfhead); } // never happens since SealAlloc() was called.
 
@@ -417,10 +926,7 @@ sealfield *	SealSetTextLen	(sealfield *vfhead, const char *Field, size_t ValueLe
   if (!vfhead) { return(vfhead); }
 
   // Find element!
-  for(vf=vfhead; vf; vf = vf->Next)
-    {
-    if (!strcmp(vf->Field,Field)) { break; } // if found it
-    }
+  vf = SealSearch(vfhead,Field);
 
   if (!vf) { return(vfhead); } // never happens since SealAlloc() was called.
 
@@ -459,10 +965,7 @@ sealfield *	SealAddTextLen	(sealfield *vfhead, const char *Field, size_t ValueLe
   if (!vfhead) { return(SealSetText(vfhead,Field,Value)); }
 
   // Find the field if it exists
-  for(vf=vfhead; vf; vf = vf->Next)
-    {
-    if (!strcmp(vf->Field,Field)) { break; } // if found it
-    }
+  vf = SealSearch(vfhead,Field);
 
   // If not found, then set it!
   if (!vf) { return(SealSetText(vfhead,Field,Value)); }
@@ -471,8 +974,8 @@ sealfield *	SealAddTextLen	(sealfield *vfhead, const char *Field, size_t ValueLe
   if (ValueLen > 0)
     {
     OldValueLen = vf->ValueLen;
+    _SealGrowValue(vf,OldValueLen+ValueLen); // extra space ensures null termination
     vf->ValueLen += ValueLen;
-    vf->Value = (byte*)realloc(vf->Value,vf->ValueLen+PAD); // extra space ensures null termination
     memcpy(vf->Value+OldValueLen,Value,ValueLen); // append
     memset(vf->Value+OldValueLen+ValueLen,0,PAD); // clear remaining space
     }
@@ -531,7 +1034,7 @@ sealfield *	SealAddTextPad	(sealfield *vfhead, const char *Field, size_t PadLen,
   if (!vf) { return(vfhead); } // should never happen
 
   // Append padding
-  vf->Value = (byte*)realloc(vf->Value,vf->ValueLen+PadLen+PAD);
+  _SealGrowValue(vf,vf->ValueLen+PadLen);
   memset(vf->Value+vf->ValueLen,' ',PadLen);
   memset(vf->Value+vf->ValueLen+PadLen,0,PAD); // clear extra space
 
@@ -565,18 +1068,15 @@ sealfield *	SealAddBin	(sealfield *vfhead, const char *Field, size_t ValueLen, c
   if (!vfhead) { return(SealSetBin(vfhead,Field,ValueLen,Value)); }
 
   // Find the field if it exists
-  for(vf=vfhead; vf; vf = vf->Next)
-    {
-    if (!strcmp(vf->Field,Field)) { break; } // if found it
-    }
+  vf = SealSearch(vfhead,Field);
 
   // If not found, then set it!
   if (!vf) { return(SealSetBin(vfhead,Field,ValueLen,Value)); }
 
   // Found it! Reallocate space and append.
   OldValueLen = vf->ValueLen;
+  _SealGrowValue(vf,OldValueLen+ValueLen); // extra space ensures null termination
   vf->ValueLen += ValueLen;
-  vf->Value = (byte*)realloc(vf->Value,vf->ValueLen+PAD); // extra space ensures null termination
   memcpy(vf->Value+OldValueLen,Value,ValueLen); // append
   memset(vf->Value+OldValueLen+ValueLen,0,PAD); // clear remaining space
   return(vfhead);
@@ -589,23 +1089,11 @@ sealfield *	SealAddBin	(sealfield *vfhead, const char *Field, size_t ValueLen, c
 sealfield *	SealSearch	(sealfield *vf, const char *Field)
 {
   size_t FieldLen;
-  sealfield *vfp; // sealfield pointer into the linked list
 
   if (!Field || !vf) { return(NULL); } // idiot checking
 
   FieldLen = strlen(Field);
-
-  // Fine the name!
-  for(vfp=vf; vfp; vfp=vfp->Next)
-    {
-    if (!vfp->FieldLen && !FieldLen) { return(vfp); } // same zero length
-    if ((vfp->FieldLen == FieldLen) && // same length
-	!memcmp(vfp->Field, Field, FieldLen) ) // same value
-	{ return(vfp); }
-    }
-
-  // Not found!
-  return(NULL);
+  return(_SealFind(vf,Field,FieldLen,SealHash(Field,FieldLen),NULL));
 } /* SealSearch() */
 
 /**************************************
@@ -615,36 +1103,46 @@ sealfield *	SealSearch	(sealfield *vf, const char *Field)
 sealfield *	SealDel	(sealfield *vfhead, const char *Field)
 {
   sealfield *vf, *vfn, *vfp;
+  sealindex *Index;
+  size_t FieldLen;
+  uint32_t Hash;
 
   // Base case: Nothing to search
   if (!vfhead || !Field) { return(vfhead); }
 
+  FieldLen = strlen(Field);
+  Hash = SealHash(Field,FieldLen);
+  Index = vfhead->Index;
+  if (Index && !_SealIndexFind(Index,Field,FieldLen,Hash)) { return(vfhead); } // not here
+
   // There should only be one element with this Field.
   // But just in case, check for duplicates!
 
   // Base case: Want to delete head (may appear multiple times?)
-  while(vfhead && !strcmp(vfhead->Field,Field))
+  while(vfhead && (vfhead->Hash == Hash) && !strcmp(vfhead->Field,Field))
     {
     vf = vfhead->Next;
-    free(vfhead->Field);
-    free(vfhead->Value);
-    free(vfhead);
+    if (Index) { _SealIndexRemove(Index,vfhead); }
+    _SealFreeNode(vfhead);
     vfhead = vf;
     }
 
+  // The index moves to the new head
+  if (vfhead) { vfhead->Index = Index; }
+  else { _SealIndexFree(Index); Index=NULL; }
+
   // Search for element to delete
   if (vfhead)
     {
     vfp=vfhead;
     for(vf=vfhead; vf && vf->Next; vf = vf->Next)
       {
-      if (!strcmp(vf->Next->Field,Field))
+      if ((vf->Next->Hash == Hash) && !strcmp(vf->Next->Field,Field))
         {
         vfn = vf->Next;
-        free(vfn->Field);
-        free(vfn->Value);
         vf->Next = vfn->Next;
-        free(vfn);
+        if (Index) { _SealIndexRemove(Index,vfn); }
+        _SealFreeNode(vfn);
 	vf=vfp;
         }
       else { vfp=vf; }
@@ -722,8 +1220,8 @@ sealfield *	SealSetGindex	(sealfield *vfhead, const char *Field, char Type, size
     {
     size_t OldValueLen;
     OldValueLen = vf->ValueLen;
+    _SealGrowValue(vf,(Index+1)*Size); // extra space ensures null termination
     vf->ValueLen = (Index+1)*Size;
-    vf->Value = (byte*)realloc(vf->Value,vf->ValueLen+PAD); // extra space ensures null termination
     memset(vf->Value+OldValueLen, 0, (vf->ValueLen - OldValueLen) +PAD); // clear new space
     }
 
@@ -865,7 +1363,7 @@ sealfield *	SealParmCheck	(sealfield *Args)
 	  {
 	  fprintf(stderr,"ERROR: Invalid parameter: '%.*s' value contains mixed quotes.\n",
 		(int)vf->FieldLen, vf->Field);
-	  exit(1);
+	  SealFatal();
 	  }
 	}
       else if (isalnum(vf->Value[i]) || ispunct(vf->Value[i])) { ; }
@@ -874,7 +1372,7 @@ sealfield *	SealParmCheck	(sealfield *Args)
 	  {
 	  fprintf(stderr,"ERROR: Invalid parameter: '%.*s' value contains an invalid character.\n",
 		(int)vf->FieldLen, vf->Field);
-	  exit(1);
+	  SealFatal();
 	  }
       }
 
@@ -890,7 +1388,7 @@ sealfield *	SealParmCheck	(sealfield *Args)
 	    {
 	    fprintf(stderr,"ERROR: Invalid parameter: '%.*s' value is not numeric.\n",
 		(int)vf->FieldLen, vf->Field);
-	    exit(1);
+	    SealFatal();
 	    }
 	  u16=u16*10 + (vf->Value[i] - '0');
 	  }
@@ -904,13 +1402,13 @@ sealfield *	SealParmCheck	(sealfield *Args)
         {
 	fprintf(stderr,"ERROR: Invalid parameter: '%.*s' value is too small (at least 64).\n",
 		(int)vf->FieldLen, vf->Field);
-	exit(1);
+	SealFatal();
 	}
       else if (u16 & (u16-1)) // power of 2?
         {
 	fprintf(stderr,"ERROR: Invalid parameter: '%.*s' value is not a power of 2.\n",
 		(int)vf->FieldLen, vf->Field);
-	exit(1);
+	SealFatal();
 	}
       }
 
@@ -935,7 +1433,7 @@ sealfield *	SealParmCheck	(sealfield *Args)
 	    {
 	    fprintf(stderr,"ERROR: Invalid parameter: '%.*s' value contains invalid characters.\n",
 		(int)vf->FieldLen, vf->Field);
-	    exit(1);
+	    SealFatal();
 	    }
 	  }
 	}
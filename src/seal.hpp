@@ -16,12 +16,49 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <setjmp.h>
 
 // Revise the version if there is any significant change
 #define SEAL_VERSION "0.0.2-beta"
 
+/*****
+ Verbose is only set while parsing the command-line.
+ After that, it is read-only and safe to share between threads.
+ *****/
 extern int Verbose;
 
+/*****
+ Per-file output.
+ Each thread writes its results to SealOut so parallel jobs
+ keep their output grouped by file.  NULL means stdout.
+ *****/
+extern __thread FILE *SealOut;
+#define SealPrintf(...)	fprintf(SealOut ? SealOut : stdout, __VA_ARGS__)
+
+/*****
+ Fatal errors.
+ After reporting the problem to stderr, call SealFatal().
+ sealtool exits.  Inside a libseal call (SealFatalJump is set
+ for that thread), the call returns an error instead.
+ *****/
+extern __thread jmp_buf *SealFatalJump;
+void	SealFatal	() __attribute__((noreturn));
+
+/*****
+ Cleanup after a recovered fatal error.
+ While SealFatalJump is set, anything a call holds (maps, files,
+ arenas, OpenSSL contexts, DNS claims) is registered with
+ SealCleanupPush() and dropped with SealCleanupPop() when it is
+ released normally.  After the longjmp, SealCleanupRun(Mark)
+ releases everything registered since SealCleanupMark(), newest
+ first.  Without a jump target these do nothing; sealtool exits.
+ *****/
+typedef void (*sealcleanupfunc)(void *Data);
+void	SealCleanupPush	(sealcleanupfunc Func, void *Data);
+void	SealCleanupPop	(void *Data);
+size_t	SealCleanupMark	();
+void	SealCleanupRun	(size_t Mark);
+
 // Common data types
 typedef unsigned char byte;
 struct sealfield
@@ -51,8 +88,44 @@ struct sealfield
   size_t FieldLen; // length of field. e.g., "b" would be 1
   size_t ValueLen; // length of field. e.g., "-s,s-" would be 5
   struct sealfield *Next;
+
+  /*****
+   For fast lookups.
+   Hash is the hash of Field (set when the Field is set).
+   Index is a hash table for the entire chain. Long chains
+   have one, short chains do not.  Only the head of the
+   chain owns the Index; it is NULL for every other element.
+   (Every function returns the head, so always use the return value!)
+   *****/
+  uint32_t Hash;
+  struct sealindex *Index;
+
+  /*****
+   Memory management.
+   ValueMax is the allocated size of Value (not counting padding);
+   appends grow it geometrically so repeated appends are cheap.
+   Arena is where this node, Field, and Value live (NULL = heap).
+   Code outside of seal.cpp must never free() or realloc() Value;
+   use SealSetValue() or SealResizeValue() instead.
+   *****/
+  size_t ValueMax;
+  struct sealarena *Arena;
   };
 typedef struct sealfield sealfield;
+typedef struct sealindex sealindex;
+
+/*****
+ Arenas: bulk memory for sealfield chains.
+ While an arena is in use (SealArenaUse), every new sealfield
+ is allocated from it, and SealFree() is nearly free.
+ SealArenaFree() releases everything at once.
+ Arenas are per-thread; a chain must not outlive its arena.
+ Long-lived chains (caches) must be built with SealArenaUse(NULL).
+ *****/
+typedef struct sealarena sealarena;
+sealarena *	SealArenaNew	();
+void	SealArenaFree	(sealarena *Arena);
+sealarena *	SealArenaUse	(sealarena *Arena);
 
 // Macros and code for debugging
 #define WHERESTR  "DEBUG[%s:%d]"
@@ -71,15 +144,20 @@ void	DEBUGhexdump	(size_t DataLen, const byte *Data);
 #define readle32(buf)	( (((buf)[3]&0xff)<<24) | (((buf)[2]&0xff)<<16) | (((buf)[1]&0xff)<<8) | ((buf)[0]&0xff) )
 #define readbe16(buf)	( (((buf)[0]&0xff)<<8) | ((buf)[1]&0xff) )
 #define readle16(buf)	( (((buf)[1]&0xff)<<8) | ((buf)[0]&0xff) )
+#define readle64(buf)	( ((uint64_t)(uint32_t)readle32((buf)+4) << 32) | (uint64_t)(uint32_t)readle32(buf) )
 
 // Writing raw bytes with a specific endian
 #define writebe32(buf,u32) { (buf)[0]=((u32)>>24)&0xff; (buf)[1]=((u32)>>16)&0xff; (buf)[2]=((u32)>>8)&0xff; (buf)[3]=(u32)&0xff; }
 #define writele32(buf,u32) { (buf)[3]=((u32)>>24)&0xff; (buf)[2]=((u32)>>16)&0xff; (buf)[1]=((u32)>>8)&0xff; (buf)[0]=(u32)&0xff; }
 #define writebe16(buf,u16) { (buf)[0]=((u16)>>8)&0xff; (buf)[1]=(u16)&0xff; }
 #define writele16(buf,u16) { (buf)[1]=((u16)>>8)&0xff; (buf)[0]=(u16)&0xff; }
+#define writele64(buf,u64) { writele32((buf)+4,((uint64_t)(u64))>>32); writele32(buf,((uint64_t)(u64))&0xffffffff); }
 
 // SEAL structure functions
+uint32_t	SealHash	(const char *Field, size_t FieldLen);
 sealfield *	SealClone	(sealfield *src);
+void	SealSetValue	(sealfield *vf, size_t ValueLen, const byte *Value);
+void	SealResizeValue	(sealfield *vf, size_t ValueLen);
 
 void	SealFree	(sealfield *vf);
 void	SealWalk	(sealfield *vf);
@@ -0,0 +1,859 @@
+/************************************************
+ SEAL: Benchmarks for the hot paths.
+ See LICENSE
+
+ This is NOT part of sealtool.  Build it with "make bench".
+ It links every source file except sealtool.cpp.
+
+ Usage: bin/sealbench [options] [file...]
+   -n N       :: Base iteration count (default: 10)
+   --size MB  :: Size of each synthetic file (default: 64)
+   --dir path :: Where to write synthetic files (default: a new /tmp directory)
+   --keep     :: Do not delete the synthetic files
+   --only str :: Only run benchmarks whose name contains str
+   --pubkeyfile fname :: Public key for the files on the command line
+   -v         :: Show the output from the first run of each file
+
+ Each benchmark reports:
+   iter    = timed runs
+   MB/s    = input bytes per second (median run)
+   items/s = records, fields, or files per second (median run)
+   allocs  = malloc/calloc/realloc calls per run
+   p50/p99 = latency per run, in microseconds
+
+ The inputs are:
+   - Microbenchmarks with synthetic buffers: SealParse, the
+     hex and base64 codecs, the PNG CRC, and sealfield operations.
+   - Synthetic PNG, JPEG, AVI (RIFF), and MKV (Matroska) files,
+     each with one SEAL record that covers the whole file.
+     These time SealDigest (the range planner and hashing) and
+     the four format walkers.
+     For large runs, use --size 4096 (4 GB).  RIFF cannot
+     exceed 4 GB, so the AVI is capped just below 4 GB.
+   - Every file in regression/ plus any files on the command line
+     (end-to-end: map, detect, walk, and verify).
+
+ The synthetic records use a generated RSA key (via --pubkeyfile),
+ but their signatures are random.  Verification does all of the
+ work (digest, decode, RSA verify) and then reports a mismatch.
+ ************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+
+#include "seal.hpp"
+#include "seal-parse.hpp"
+#include "files.hpp"
+#include "formats.hpp"
+#include "sign.hpp"
+
+// Internal to format-png.cpp
+uint32_t	_PNGCrc32	(size_t DataLen, const byte *Data);
+
+/*****
+ Allocation counting.
+ Every malloc, calloc, and realloc in the process is counted,
+ including the ones made by OpenSSL.
+ *****/
+extern "C" void *	__libc_malloc	(size_t Size);
+extern "C" void *	__libc_calloc	(size_t Num, size_t Size);
+extern "C" void *	__libc_realloc	(void *Ptr, size_t Size);
+
+#pragma GCC visibility push(hidden)
+static uint64_t AllocCount=0;
+
+/*****
+ Benchmark state
+ *****/
+static int BenchIter=10; // base iteration count
+static const char *BenchOnly=NULL; // only run matching names
+static double *BenchSample=NULL; // latency per run (ns)
+static int BenchSampleMax=0;
+static FILE *BenchNull=NULL; // discarded output
+static char BenchDNS[4096]; // generated public key file
+static char BenchRecord[1024]; // synthetic SEAL record
+static const char *BenchPubKey=NULL; // public key file for real inputs
+static volatile uint32_t BenchSink; // keeps results from being optimized away
+
+#define BENCH_CHUNK (1024*1024) // synthetic data is written in 1MB chunks
+#pragma GCC visibility pop
+
+extern "C" void *	malloc	(size_t Size)
+{
+  __atomic_fetch_add(&AllocCount,1,__ATOMIC_RELAXED);
+  return(__libc_malloc(Size));
+} /* malloc() */
+
+extern "C" void *	calloc	(size_t Num, size_t Size)
+{
+  __atomic_fetch_add(&AllocCount,1,__ATOMIC_RELAXED);
+  return(__libc_calloc(Num,Size));
+} /* calloc() */
+
+extern "C" void *	realloc	(void *Ptr, size_t Size)
+{
+  __atomic_fetch_add(&AllocCount,1,__ATOMIC_RELAXED);
+  return(__libc_realloc(Ptr,Size));
+} /* realloc() */
+
+#pragma GCC visibility push(hidden)
+
+/********************************************************
+ _BenchNow(): Current monotonic time in nanoseconds.
+ ********************************************************/
+double	_BenchNow	()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return((double)ts.tv_sec*1e9 + (double)ts.tv_nsec);
+} /* _BenchNow() */
+
+/********************************************************
+ _BenchCmp(): qsort comparison for samples.
+ ********************************************************/
+int	_BenchCmp	(const void *a, const void *b)
+{
+  double da = *(const double*)a, db = *(const double*)b;
+  return((da > db) - (da < db));
+} /* _BenchCmp() */
+
+/********************************************************
+ _BenchFill(): Fill a buffer with repeatable pseudo-random data.
+ ********************************************************/
+void	_BenchFill	(byte *Buf, size_t Len, uint64_t *Seed)
+{
+  uint64_t x = *Seed;
+  size_t i;
+  for(i=0; i+8 <= Len; i+=8)
+    {
+    x ^= x << 13; x ^= x >> 7; x ^= x << 17; // xorshift64
+    memcpy(Buf+i,&x,8);
+    }
+  for( ; i < Len; i++) { x ^= x << 13; x ^= x >> 7; x ^= x << 17; Buf[i] = x & 0xff; }
+  *Seed = x;
+} /* _BenchFill() */
+
+/********************************************************
+ _BenchWant(): Should this benchmark run?
+ ********************************************************/
+bool	_BenchWant	(const char *Name)
+{
+  return(!BenchOnly || strstr(Name,BenchOnly));
+} /* _BenchWant() */
+
+/********************************************************
+ _BenchRun(): Time Func(Data) for Iter runs and report.
+ Bytes and Items are the work done by one run.
+ ********************************************************/
+void	_BenchRun	(const char *Name, void (*Func)(void *Data), void *Data,
+			 int Iter, uint64_t Bytes, uint64_t Items)
+{
+  double t, Median;
+  uint64_t Allocs;
+  int i;
+
+  if (!_BenchWant(Name)) { return; }
+  if (Iter < 1) { Iter=1; }
+  if (Iter > BenchSampleMax)
+    {
+    BenchSampleMax = Iter;
+    BenchSample = (double*)realloc(BenchSample,BenchSampleMax*sizeof(double));
+    if (!BenchSample) { fprintf(stderr,"ERROR: Unable to allocate benchmark samples. Aborting.\n"); exit(1); }
+    }
+
+  Func(Data); // warm up (caches, tables, page cache)
+  Allocs = __atomic_load_n(&AllocCount,__ATOMIC_RELAXED);
+  for(i=0; i < Iter; i++)
+    {
+    t = _BenchNow();
+    Func(Data);
+    BenchSample[i] = _BenchNow() - t;
+    }
+  Allocs = __atomic_load_n(&AllocCount,__ATOMIC_RELAXED) - Allocs;
+
+  qsort(BenchSample,Iter,sizeof(double),_BenchCmp);
+  Median = BenchSample[Iter/2];
+  if (Median <= 0) { Median = 1; }
+  printf("%-34s %6d",Name,Iter);
+  if (Bytes) { printf(" %10.1f",(double)Bytes / Median * 1e9 / (1024.0*1024.0)); }
+  else { printf(" %10s","-"); }
+  if (Items) { printf(" %12.0f",(double)Items / Median * 1e9); }
+  else { printf(" %12s","-"); }
+  printf(" %10.1f %12.1f %12.1f\n",
+	(double)Allocs/Iter,
+	BenchSample[Iter/2]/1000.0,
+	BenchSample[(Iter*99)/100]/1000.0);
+  fflush(stdout);
+} /* _BenchRun() */
+
+/********************************************************
+ _BenchArgs(): Verification arguments, like sealtool's.
+ ********************************************************/
+sealfield *	_BenchArgs	(const char *PubKeyFile)
+{
+  sealfield *Args=NULL;
+  Args = SealSetText(Args,"Mode","verify");
+  Args = SealSetIindex(Args,"@s",2,0);
+  Args = SealSetIindex(Args,"@p",1,0);
+  Args = SealSetCindex(Args,"@sflags",2,0);
+  if (PubKeyFile) { Args = SealSetText(Args,"@pubkeyfile",PubKeyFile); }
+  return(Args);
+} /* _BenchArgs() */
+
+/**************************************************************
+ Synthetic inputs
+ **************************************************************/
+
+/********************************************************
+ _BenchKey(): Generate the RSA public key file.
+ Sets BenchDNS and BenchRecord.
+ ********************************************************/
+void	_BenchKey	(const char *Dir)
+{
+  EVP_PKEY *Key;
+  byte *Der=NULL, *B64;
+  byte Sig[256];
+  char Sig64[512];
+  int DerLen;
+  size_t Len;
+  uint64_t Seed=0x5ea15ea1;
+  FILE *fp;
+
+  Key = EVP_RSA_gen(2048);
+  if (!Key) { fprintf(stderr,"ERROR: Unable to generate an RSA key. Aborting.\n"); exit(1); }
+  DerLen = i2d_PUBKEY(Key,&Der);
+  EVP_PKEY_free(Key);
+  if (DerLen <= 0) { fprintf(stderr,"ERROR: Unable to encode the RSA key. Aborting.\n"); exit(1); }
+
+  B64 = (byte*)calloc(1,DerLen*2+4);
+  Len = SealBase64EncodeTo(DerLen,Der,B64);
+  OPENSSL_free(Der);
+  snprintf(BenchDNS,sizeof(BenchDNS),"%s/bench.dns",Dir);
+  fp = fopen(BenchDNS,"wb");
+  if (!fp) { fprintf(stderr,"ERROR: Unable to write %s. Aborting.\n",BenchDNS); exit(1); }
+  fprintf(fp,"seal=1 ka=rsa p=%.*s\n",(int)Len,(char*)B64);
+  fclose(fp);
+  free(B64);
+
+  // A record that covers everything except the signature
+  _BenchFill(Sig,sizeof(Sig),&Seed);
+  Len = SealBase64EncodeTo(sizeof(Sig),Sig,(byte*)Sig64);
+  snprintf(BenchRecord,sizeof(BenchRecord),
+	"<seal seal=\"1\" ka=\"rsa\" da=\"sha256\" sf=\"base64\" b=\"F~S,s~f\" d=\"bench.invalid\" s=\"%.*s\"/>",
+	(int)Len,Sig64);
+} /* _BenchKey() */
+
+/********************************************************
+ _BenchData(): Write Len bytes of random data.
+ Avoid is a byte that must not appear (-1 for none).
+ ********************************************************/
+void	_BenchData	(FILE *fp, uint64_t Len, int Avoid, uint64_t *Seed)
+{
+  byte *Buf;
+  size_t n,i;
+
+  Buf = (byte*)malloc(BENCH_CHUNK);
+  while(Len > 0)
+    {
+    n = (Len > BENCH_CHUNK) ? BENCH_CHUNK : Len;
+    _BenchFill(Buf,n,Seed);
+    if (Avoid >= 0)
+      {
+      for(i=0; i < n; i++) { if (Buf[i]==Avoid) { Buf[i]--; } }
+      }
+    fwrite(Buf,1,n,fp);
+    Len -= n;
+    }
+  free(Buf);
+} /* _BenchData() */
+
+/********************************************************
+ _BenchPNGChunk(): Write one PNG chunk.
+ ********************************************************/
+void	_BenchPNGChunk	(FILE *fp, const char *Type, size_t Len, const byte *Data)
+{
+  byte *Buf;
+  uint32_t Crc;
+
+  Buf = (byte*)malloc(Len+12);
+  writebe32(Buf,Len);
+  memcpy(Buf+4,Type,4);
+  if (Len) { memcpy(Buf+8,Data,Len); }
+  Crc = _PNGCrc32(Len+4,Buf+4);
+  writebe32(Buf+8+Len,Crc);
+  fwrite(Buf,1,Len+12,fp);
+  free(Buf);
+} /* _BenchPNGChunk() */
+
+/********************************************************
+ _BenchMakePNG(): A large RGB PNG ("100 megapixels" at 300MB).
+ ********************************************************/
+void	_BenchMakePNG	(const char *Fname, uint64_t Size)
+{
+  FILE *fp;
+  byte Hdr[13], *Buf;
+  uint64_t Pixels, Done;
+  size_t n;
+  uint64_t Seed=1;
+
+  fp = fopen(Fname,"wb");
+  if (!fp) { fprintf(stderr,"ERROR: Unable to write %s. Aborting.\n",Fname); exit(1); }
+  fwrite("\x89PNG\r\n\x1a\n",1,8,fp);
+  Pixels = Size/3;
+  writebe32(Hdr,10000); // width
+  writebe32(Hdr+4,(Pixels/10000) ? Pixels/10000 : 1); // height
+  Hdr[8]=8; Hdr[9]=2; Hdr[10]=0; Hdr[11]=0; Hdr[12]=0; // 8-bit RGB
+  _BenchPNGChunk(fp,"IHDR",13,Hdr);
+
+  Buf = (byte*)malloc(BENCH_CHUNK);
+  for(Done=0; Done < Size; Done += n)
+    {
+    n = (Size-Done > BENCH_CHUNK) ? BENCH_CHUNK : Size-Done;
+    _BenchFill(Buf,n,&Seed);
+    _BenchPNGChunk(fp,"IDAT",n,Buf);
+    }
+  free(Buf);
+  _BenchPNGChunk(fp,"seAl",strlen(BenchRecord),(byte*)BenchRecord);
+  _BenchPNGChunk(fp,"IEND",0,NULL);
+  fclose(fp);
+} /* _BenchMakePNG() */
+
+/********************************************************
+ _BenchMakeJPEG(): A large baseline-looking JPEG.
+ The record is in an APP9 block; the scan data has no 0xff.
+ ********************************************************/
+void	_BenchMakeJPEG	(const char *Fname, uint64_t Size)
+{
+  FILE *fp;
+  byte Hdr[4];
+  size_t Len;
+  uint64_t Seed=2;
+
+  fp = fopen(Fname,"wb");
+  if (!fp) { fprintf(stderr,"ERROR: Unable to write %s. Aborting.\n",Fname); exit(1); }
+  fwrite("\xff\xd8",1,2,fp); // SOI
+  fwrite("\xff\xe0\x00\x10JFIF\0\x01\x01\x00\x00\x01\x00\x01\x00\x00",1,18,fp); // APP0
+  Len = strlen(BenchRecord);
+  writebe16(Hdr,0xffe9); // APP9
+  writebe16(Hdr+2,Len+2);
+  fwrite(Hdr,1,4,fp);
+  fwrite(BenchRecord,1,Len,fp);
+  fwrite("\xff\xda\x00\x0c\x03\x01\x00\x02\x11\x03\x11\x00\x3f\x00",1,14,fp); // SOS
+  _BenchData(fp,Size,0xff,&Seed);
+  fwrite("\xff\xd9",1,2,fp); // EOI
+  fclose(fp);
+} /* _BenchMakeJPEG() */
+
+/********************************************************
+ _BenchMakeRIFF(): A large AVI with one LIST 'movi'.
+ ********************************************************/
+void	_BenchMakeRIFF	(const char *Fname, uint64_t Size)
+{
+  FILE *fp;
+  byte Hdr[12];
+  sealfield *Args=NULL, *Block;
+  uint64_t Chunks, c, Movi;
+  uint64_t Seed=3;
+
+  // RIFF sizes are 32 bits
+  if (Size > 0xffffffffULL - 2*BENCH_CHUNK) { Size = 0xffffffffULL - 2*BENCH_CHUNK; }
+  Chunks = (Size + BENCH_CHUNK-1) / BENCH_CHUNK;
+  if (Chunks < 1) { Chunks=1; }
+  Movi = 4 + Chunks*(8+BENCH_CHUNK);
+
+  Args = SealSetIindex(Args,"@s",2,0);
+  Args = SealSetText(Args,"@record",BenchRecord);
+  Args = Seal_RIFFblock(Args);
+  Block = SealSearch(Args,"@BLOCK");
+
+  fp = fopen(Fname,"wb");
+  if (!fp) { fprintf(stderr,"ERROR: Unable to write %s. Aborting.\n",Fname); exit(1); }
+  memcpy(Hdr,"RIFF",4);
+  writele32(Hdr+4,4 + 8+Movi + Block->ValueLen + (Block->ValueLen%2));
+  memcpy(Hdr+8,"AVI ",4);
+  fwrite(Hdr,1,12,fp);
+  memcpy(Hdr,"LIST",4);
+  writele32(Hdr+4,Movi);
+  memcpy(Hdr+8,"movi",4);
+  fwrite(Hdr,1,12,fp);
+  for(c=0; c < Chunks; c++)
+    {
+    memcpy(Hdr,"00dc",4);
+    writele32(Hdr+4,BENCH_CHUNK);
+    fwrite(Hdr,1,8,fp);
+    _BenchData(fp,BENCH_CHUNK,-1,&Seed);
+    }
+  fwrite(Block->Value,1,Block->ValueLen,fp);
+  if (Block->ValueLen%2) { fputc(0,fp); } // RIFF chunks are word aligned
+  fclose(fp);
+  SealFree(Args);
+} /* _BenchMakeRIFF() */
+
+/********************************************************
+ _BenchMakeMatroska(): A large MKV: EBML header, one
+ Segment of Void elements, and a SEAL element.
+ ********************************************************/
+void	_BenchMakeMatroska	(const char *Fname, uint64_t Size)
+{
+  FILE *fp;
+  byte Hdr[16];
+  sealfield *Args=NULL, *Block;
+  uint64_t Chunks, c, Segment;
+  uint64_t Seed=4;
+  int i;
+
+  Chunks = (Size + BENCH_CHUNK-1) / BENCH_CHUNK;
+  if (Chunks < 1) { Chunks=1; }
+  Segment = Chunks*(1+8+BENCH_CHUNK);
+
+  Args = SealSetIindex(Args,"@s",2,0);
+  Args = SealSetText(Args,"@record",BenchRecord);
+  Args = Seal_Matroskablock(Args);
+  Block = SealSearch(Args,"@BLOCK");
+
+  fp = fopen(Fname,"wb");
+  if (!fp) { fprintf(stderr,"ERROR: Unable to write %s. Aborting.\n",Fname); exit(1); }
+  // EBML header with DocType "matroska"
+  fwrite("\x1a\x45\xdf\xa3\x8b\x42\x82\x88matroska",1,16,fp);
+  // Segment with an 8-byte size
+  fwrite("\x18\x53\x80\x67\x01",1,5,fp);
+  for(i=0; i < 7; i++) { Hdr[i] = (Segment >> (8*(6-i))) & 0xff; }
+  fwrite(Hdr,1,7,fp);
+  for(c=0; c < Chunks; c++)
+    {
+    Hdr[0] = 0xec; // Void
+    Hdr[1] = 0x01; // 8-byte size
+    for(i=0; i < 7; i++) { Hdr[2+i] = ((uint64_t)BENCH_CHUNK >> (8*(6-i))) & 0xff; }
+    fwrite(Hdr,1,9,fp);
+    _BenchData(fp,BENCH_CHUNK,-1,&Seed);
+    }
+  fwrite(Block->Value,1,Block->ValueLen,fp);
+  fclose(fp);
+  SealFree(Args);
+} /* _BenchMakeMatroska() */
+
+/**************************************************************
+ Microbenchmarks
+ **************************************************************/
+
+typedef struct
+  {
+  size_t Len;
+  byte *Src;
+  byte *Dst;
+  } benchbuf;
+
+void	_BenchParse	(void *Data)
+{
+  benchbuf *B = (benchbuf*)Data;
+  sealfield *Rec;
+  Rec = SealParse(B->Len,B->Src,0,NULL);
+  if (!Rec) { fprintf(stderr,"ERROR: Benchmark record did not parse.\n"); exit(1); }
+  SealFree(Rec);
+} /* _BenchParse() */
+
+void	_BenchHexEncode	(void *Data)
+{ benchbuf *B = (benchbuf*)Data; SealHexEncodeTo(B->Len,B->Src,B->Dst,false); }
+void	_BenchHexDecode	(void *Data)
+{ benchbuf *B = (benchbuf*)Data; SealHexDecodeTo(B->Len*2,B->Dst,B->Src); }
+void	_BenchB64Encode	(void *Data)
+{ benchbuf *B = (benchbuf*)Data; SealBase64EncodeTo(B->Len,B->Src,B->Dst); }
+void	_BenchB64Decode	(void *Data)
+{ benchbuf *B = (benchbuf*)Data; SealBase64DecodeTo(((B->Len+2)/3)*4,B->Dst,B->Src); }
+void	_BenchCrc	(void *Data)
+{
+  benchbuf *B = (benchbuf*)Data;
+  BenchSink = _PNGCrc32(B->Len,B->Src);
+}
+
+/*****
+ sealfield operations: a chain of 64 fields, like a file's Args.
+ *****/
+#define BENCH_FIELDS 64
+static char BenchFieldName[BENCH_FIELDS][16];
+
+void	_BenchFieldSetGet	(void *Data)
+{
+  sealfield *vf=NULL;
+  int i;
+  (void)Data;
+  for(i=0; i < BENCH_FIELDS; i++) { vf = SealSetText(vf,BenchFieldName[i],"value"); }
+  for(i=0; i < BENCH_FIELDS; i++) { if (!SealGetText(vf,BenchFieldName[i])) { exit(1); } }
+  for(i=0; i < BENCH_FIELDS; i++) { vf = SealAddText(vf,BenchFieldName[i],"+more"); }
+  SealFree(vf);
+} /* _BenchFieldSetGet() */
+
+void	_BenchFieldArena	(void *Data)
+{
+  sealarena *Arena, *Prev;
+  Arena = SealArenaNew();
+  Prev = SealArenaUse(Arena);
+  _BenchFieldSetGet(Data);
+  SealArenaUse(Prev);
+  SealArenaFree(Arena);
+} /* _BenchFieldArena() */
+
+void	_BenchFieldClone	(void *Data)
+{
+  SealFree(SealClone((sealfield*)Data));
+} /* _BenchFieldClone() */
+
+/**************************************************************
+ File benchmarks
+ **************************************************************/
+
+typedef struct
+  {
+  const char *Fname;
+  mmapfile *Mmap; // for digest and walker runs
+  sealfield *Args;
+  sealfield *Rec; // for digest runs
+  int Format;
+  bool Show; // show output from the next run
+  } benchfile;
+
+/********************************************************
+ _BenchDigest(): Hash the synthetic record's ranges.
+ Checkpoints are dropped so every run hashes everything.
+ ********************************************************/
+void	_BenchDigest	(void *Data)
+{
+  benchfile *F = (benchfile*)Data;
+  sealfield *Rec;
+  SealDigestFree(F->Mmap);
+  Rec = SealClone(F->Rec);
+  Rec = SealDigest(Rec,F->Mmap);
+  if (!SealSearch(Rec,"@digest")) { fprintf(stderr,"ERROR: Benchmark digest failed.\n"); exit(1); }
+  SealFree(Rec);
+} /* _BenchDigest() */
+
+/********************************************************
+ _BenchFormat(): Identify a mapped file.
+ ********************************************************/
+int	_BenchFormat	(mmapfile *Mmap)
+{
+  if (Seal_isPNG(Mmap)) { return('P'); }
+  if (Seal_isJPEG(Mmap)) { return('J'); }
+  if (Seal_isRIFF(Mmap)) { return('R'); }
+  if (Seal_isMatroska(Mmap)) { return('M'); }
+  return(0);
+} /* _BenchFormat() */
+
+/********************************************************
+ _BenchWalkMapped(): Run a format walker (verify) on a
+ mapped file, with a per-file arena like sealtool.
+ ********************************************************/
+void	_BenchWalkMapped	(benchfile *F, mmapfile *Mmap)
+{
+  sealarena *Arena, *Prev;
+  sealfield *Args;
+
+  SealOut = F->Show ? NULL : BenchNull;
+  F->Show = false;
+  Arena = SealArenaNew();
+  Prev = SealArenaUse(Arena);
+  Args = SealClone(F->Args);
+  switch(F->Format)
+    {
+    case 'P': Args = Seal_PNG(Args,Mmap); break;
+    case 'J': Args = Seal_JPEG(Args,Mmap); break;
+    case 'R': Args = Seal_RIFF(Args,Mmap); break;
+    case 'M': Args = Seal_Matroska(Args,Mmap); break;
+    default: break;
+    }
+  if (Args) { SealFree(Args); }
+  SealArenaUse(Prev);
+  SealArenaFree(Arena);
+  SealOut = NULL;
+} /* _BenchWalkMapped() */
+
+/********************************************************
+ _BenchWalk(): Walker on a file that stays mapped.
+ ********************************************************/
+void	_BenchWalk	(void *Data)
+{
+  benchfile *F = (benchfile*)Data;
+  SealDigestFree(F->Mmap);
+  _BenchWalkMapped(F,F->Mmap);
+} /* _BenchWalk() */
+
+/********************************************************
+ _BenchFile(): End-to-end: map, identify, walk, unmap.
+ ********************************************************/
+void	_BenchFile	(void *Data)
+{
+  benchfile *F = (benchfile*)Data;
+  mmapfile *Mmap;
+
+  SealOut = BenchNull; // MmapFile() problems are not benchmark output
+  Mmap = MmapFile(F->Fname,PROT_READ);
+  SealOut = NULL;
+  if (!Mmap) { return; }
+  F->Format = _BenchFormat(Mmap);
+  _BenchWalkMapped(F,Mmap);
+  MmapFree(Mmap);
+} /* _BenchFile() */
+
+/********************************************************
+ _BenchBasename(): Filename without the directory.
+ ********************************************************/
+const char *	_BenchBasename	(const char *Fname)
+{
+  const char *s = strrchr(Fname,'/');
+  return(s ? s+1 : Fname);
+} /* _BenchBasename() */
+
+/********************************************************
+ _BenchSynthetic(): Benchmark one synthetic file.
+ ********************************************************/
+void	_BenchSynthetic	(const char *Label, const char *Fname, bool Show)
+{
+  benchfile F;
+  char Name[256];
+  const byte *Pos;
+  uint64_t Off;
+
+  memset(&F,0,sizeof(F));
+  F.Fname = Fname;
+  F.Args = _BenchArgs(BenchDNS);
+  F.Mmap = MmapFile(Fname,PROT_READ);
+  if (!F.Mmap) { fprintf(stderr,"ERROR: Unable to map %s.\n",Fname); exit(1); }
+  F.Format = _BenchFormat(F.Mmap);
+  if (!F.Format) { fprintf(stderr,"ERROR: Synthetic %s is not recognized.\n",Label); exit(1); }
+
+  // Find the record (it is near the end)
+  Off = (F.Mmap->memsize > 4096) ? F.Mmap->memsize-4096 : 0;
+  Pos = (const byte*)memmem(F.Mmap->mem+Off,F.Mmap->memsize-Off,"<seal ",6);
+  if (!Pos) { Pos = (const byte*)memmem(F.Mmap->mem,F.Mmap->memsize,"<seal ",6); } // JPEG: at the start
+  if (!Pos) { fprintf(stderr,"ERROR: Synthetic %s has no record.\n",Label); exit(1); }
+  Off = Pos - F.Mmap->mem;
+  F.Rec = SealParse(F.Mmap->memsize-Off,Pos,Off,F.Args);
+
+  snprintf(Name,sizeof(Name),"digest/%s",Label);
+  _BenchRun(Name,_BenchDigest,&F,BenchIter,F.Mmap->memsize,0);
+
+  snprintf(Name,sizeof(Name),"walk/%s",Label);
+  F.Show = Show;
+  _BenchRun(Name,_BenchWalk,&F,BenchIter,F.Mmap->memsize,1);
+
+  SealFree(F.Rec);
+  SealFree(F.Args);
+  MmapFree(F.Mmap);
+} /* _BenchSynthetic() */
+
+/********************************************************
+ _BenchEndToEnd(): Benchmark one real file.
+ ********************************************************/
+void	_BenchEndToEnd	(const char *Fname, bool Show)
+{
+  benchfile F;
+  char Name[256];
+  stat_t Stat;
+
+  if (stat64(Fname,&Stat) || !S_ISREG(Stat.st_mode)) { return; }
+  memset(&F,0,sizeof(F));
+  F.Fname = Fname;
+  F.Args = _BenchArgs(BenchPubKey);
+  if (Show) { printf("[%s]\n",Fname); }
+  F.Show = Show;
+  snprintf(Name,sizeof(Name),"file/%s",_BenchBasename(Fname));
+  _BenchRun(Name,_BenchFile,&F,BenchIter*10,Stat.st_size,1);
+  SealFree(F.Args);
+} /* _BenchEndToEnd() */
+#pragma GCC visibility pop
+
+/********************************************************
+ Usage(): Show usage.
+ ********************************************************/
+void	Usage	(const char *progname)
+{
+  printf("Usage: %s [options] [file...]\n",progname);
+  printf("  -n N       :: Base iteration count (default: 10)\n");
+  printf("  --size MB  :: Size of each synthetic file (default: 64; e.g., 4096 for 4 GB)\n");
+  printf("  --dir path :: Directory for synthetic files (default: a new /tmp directory)\n");
+  printf("  --keep     :: Do not delete the synthetic files\n");
+  printf("  --only str :: Only run benchmarks whose name contains str\n");
+  printf("  -v         :: Show the output from the first run of each file\n");
+  printf("  --pubkeyfile fname :: Public key (DNS TXT) for the files on the command line (default: use DNS)\n");
+  printf("Files on the command line are benchmarked end-to-end along with regression/.\n");
+} /* Usage() */
+
+/********************************************************
+ main()
+ ********************************************************/
+int	main	(int argc, char *argv[])
+{
+  int c, i;
+  uint64_t Size=64;
+  bool Keep=false, Show=false;
+  char Dir[4096]="", Fname[4096+64];
+  const char *Label[4] = { "png", "jpeg", "avi", "mkv" };
+  void (*Make[4])(const char*,uint64_t) = { _BenchMakePNG, _BenchMakeJPEG, _BenchMakeRIFF, _BenchMakeMatroska };
+  char Synthetic[4][4096+64];
+  benchbuf B;
+  uint64_t Seed=42;
+  size_t Len;
+
+  struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"size", required_argument, NULL, 1},
+    {"dir",  required_argument, NULL, 2},
+    {"keep", no_argument, NULL, 3},
+    {"only", required_argument, NULL, 4},
+    {"pubkeyfile", required_argument, NULL, 5},
+    {NULL,0,NULL,0}
+    };
+  while((c = getopt_long(argc,argv,"hn:v",long_options,NULL)) != -1)
+    {
+    switch(c)
+      {
+      case 1: Size = strtoull(optarg,NULL,10); break;
+      case 2: snprintf(Dir,sizeof(Dir),"%s",optarg); break;
+      case 3: Keep=true; break;
+      case 4: BenchOnly = optarg; break;
+      case 5: BenchPubKey = optarg; break;
+      case 'n': BenchIter = atoi(optarg); if (BenchIter < 1) { BenchIter=1; } break;
+      case 'v': Show=true; break;
+      case 'h':
+      default: Usage(argv[0]); exit(1);
+      }
+    }
+  if (Size < 1) { Size=1; }
+  Size *= 1024*1024;
+
+  BenchNull = fopen("/dev/null","w");
+  if (!Dir[0])
+    {
+    snprintf(Dir,sizeof(Dir),"/tmp/sealbench-XXXXXX");
+    if (!mkdtemp(Dir)) { fprintf(stderr,"ERROR: Unable to create a temporary directory. Aborting.\n"); exit(1); }
+    }
+  else { mkdir(Dir,0755); }
+  _BenchKey(Dir);
+  for(i=0; i < BENCH_FIELDS; i++) { snprintf(BenchFieldName[i],sizeof(BenchFieldName[i]),"field%d",i); }
+
+  printf("%-34s %6s %10s %12s %10s %12s %12s\n","benchmark","iter","MB/s","items/s","allocs","p50(us)","p99(us)");
+
+  // SealParse: one record, and a scan through data with many '<'
+  B.Len = strlen(BenchRecord);
+  B.Src = (byte*)BenchRecord;
+  _BenchRun("parse/record",_BenchParse,&B,BenchIter*1000,B.Len,1);
+  Len = 16*1024*1024;
+  B.Src = (byte*)malloc(Len);
+  _BenchFill(B.Src,Len-B.Len,&Seed);
+  memcpy(B.Src+Len-B.Len,BenchRecord,B.Len);
+  B.Len = Len;
+  _BenchRun("parse/scan-16MB",_BenchParse,&B,BenchIter,B.Len,1);
+  free(B.Src);
+
+  // Codecs: signature-sized and 1MB buffers
+  {
+  size_t Sizes[2] = { 256, 1024*1024 };
+  const char *SizeName[2] = { "256B", "1MB" };
+  char Name[64];
+  int s, n;
+  for(s=0; s < 2; s++)
+    {
+    B.Len = Sizes[s];
+    B.Src = (byte*)malloc(B.Len+4);
+    B.Dst = (byte*)malloc(B.Len*2+8);
+    _BenchFill(B.Src,B.Len,&Seed);
+    n = (s==0) ? BenchIter*1000 : BenchIter*10;
+    snprintf(Name,sizeof(Name),"hex/encode-%s",SizeName[s]);
+    _BenchRun(Name,_BenchHexEncode,&B,n,B.Len,0);
+    snprintf(Name,sizeof(Name),"hex/decode-%s",SizeName[s]);
+    _BenchRun(Name,_BenchHexDecode,&B,n,B.Len*2,0);
+    snprintf(Name,sizeof(Name),"base64/encode-%s",SizeName[s]);
+    _BenchRun(Name,_BenchB64Encode,&B,n,B.Len,0);
+    _BenchB64Encode(&B); // decode needs valid input
+    snprintf(Name,sizeof(Name),"base64/decode-%s",SizeName[s]);
+    _BenchRun(Name,_BenchB64Decode,&B,n,((B.Len+2)/3)*4,0);
+    free(B.Src);
+    free(B.Dst);
+    }
+  }
+
+  // PNG CRC
+  B.Len = 16*1024*1024;
+  B.Src = (byte*)malloc(B.Len);
+  _BenchFill(B.Src,B.Len,&Seed);
+  _BenchRun("crc/png-16MB",_BenchCrc,&B,BenchIter,B.Len,0);
+  free(B.Src);
+
+  // sealfield operations
+  _BenchRun("sealfield/set-get-add",_BenchFieldSetGet,NULL,BenchIter*100,0,BENCH_FIELDS*3);
+  _BenchRun("sealfield/set-get-add-arena",_BenchFieldArena,NULL,BenchIter*100,0,BENCH_FIELDS*3);
+  {
+  sealfield *Chain=NULL;
+  for(i=0; i < BENCH_FIELDS; i++) { Chain = SealSetText(Chain,BenchFieldName[i],"value"); }
+  _BenchRun("sealfield/clone",_BenchFieldClone,Chain,BenchIter*100,0,BENCH_FIELDS);
+  SealFree(Chain);
+  }
+
+  // Synthetic files: digest and format walkers
+  for(i=0; i < 4; i++)
+    {
+    char Name[64];
+    snprintf(Name,sizeof(Name),"digest/%s",Label[i]);
+    snprintf(Fname,sizeof(Fname),"walk/%s",Label[i]);
+    if (!_BenchWant(Name) && !_BenchWant(Fname)) { Synthetic[i][0]='\0'; continue; }
+    snprintf(Synthetic[i],sizeof(Synthetic[i]),"%s/bench-%d.%s",Dir,i,Label[i]);
+    Make[i](Synthetic[i],Size);
+    _BenchSynthetic(Label[i],Synthetic[i],Show);
+    }
+
+  // End-to-end: regression corpus and command-line files
+  {
+  DIR *d;
+  struct dirent *de;
+  d = opendir("regression");
+  if (d)
+    {
+    char *Names[256];
+    int n=0, j;
+    while((de = readdir(d)) && (n < 256))
+      {
+      if (de->d_name[0]=='.') { continue; }
+      Names[n] = (char*)malloc(strlen(de->d_name)+16);
+      sprintf(Names[n],"regression/%s",de->d_name);
+      n++;
+      }
+    closedir(d);
+    // readdir order is arbitrary; report in a stable order
+    for(i=0; i < n; i++)
+      {
+      for(j=i+1; j < n; j++)
+	{
+	if (strcmp(Names[i],Names[j]) > 0) { char *t=Names[i]; Names[i]=Names[j]; Names[j]=t; }
+	}
+      }
+    for(i=0; i < n; i++) { _BenchEndToEnd(Names[i],Show); free(Names[i]); }
+    }
+  }
+  for( ; optind < argc; optind++) { _BenchEndToEnd(argv[optind],Show); }
+
+  // Clean up
+  if (!Keep)
+    {
+    for(i=0; i < 4; i++) { if (Synthetic[i][0]) { unlink(Synthetic[i]); } }
+    unlink(BenchDNS);
+    rmdir(Dir); // only removes it if it is empty
+    }
+  else { printf("Synthetic files are in %s\n",Dir); }
+  SealVerifyCacheFree();
+  SealDNSCacheFree();
+  fclose(BenchNull);
+  free(BenchSample);
+  return(0);
+} /* main() */
+
@@ -29,6 +29,11 @@
 #include "formats.hpp"
 #include "seal-parse.hpp"
 #include "sign.hpp"
+#include "jobs.hpp"
+#include "stats.hpp"
+#include "serve.hpp"
+#include "inputs.hpp"
+#include "results.hpp"
 
 /**************************************
  ReadCfg(): Read the config file.
@@ -199,11 +204,22 @@ void	Usage	(const char *progname)
   printf("  --config file.cfg :: Optional configuration file (default: $HOME/.seal.cfg)\n");
   printf("  -v                :: Verbose debugging (probably not what you want)\n");
   printf("  -V, --version     :: Show the code version and exit.\n");
+  printf("  -j, --jobs N      :: Process N files in parallel; 0 = one per CPU (default: 1)\n");
+  printf("  --stats           :: Report per-phase timings and counters as JSON on stderr\n");
+  printf("  --output fmt      :: Results as 'text' or 'jsonl' (one JSON object per file) (default: text)\n");
+  printf("  --files-from list :: Also process the files named in list ('-' = stdin; NUL or newline separated)\n");
+  printf("  --recursive dir   :: Also process every file under dir\n");
+  printf("  --serve sock      :: Serve sign/verify requests on a Unix socket until SIGTERM (see BUILD.md)\n");
   printf("\n");
   printf("  Verifying:\n");
   printf("  Verify any SEAL signature in the file(s)\n");
   printf("  -D, --dnsfile fname  :: Optional: text file with DNS TXT value. (default: unset; use DNS)\n");
   printf("  --pubkeyfile fname   :: For debugging: instead of DNs, use the dns file from the -g option.\n");
+  printf("  --dnscachefile fname :: Optional: remember DNS public keys between runs (default: unset)\n");
+  printf("  --verifycachefile fname :: Optional: reuse results for unchanged files between runs (default: unset)\n");
+  printf("  --verifyttl sec      :: Optional: revalidate cached results after sec seconds (default: 86400)\n");
+  printf("  --crc                :: Optional: report PNG chunks with bad checksums (default: unset)\n");
+  printf("  --deepscan           :: Optional: also check JPEG MPF images and data after the image (default: unset)\n");
   printf("\n");
   printf("  Generate signature:\n");
   printf("  -g, --generate       :: Required: generate a signature\n");
@@ -219,12 +235,18 @@ void	Usage	(const char *progname)
   printf("  Signing with a local private key:\n");
   printf("  -s, --sign           :: Required: Enable signing\n");
   printf("  -k, --keyfile fname  :: File for storing the private key in PEM format (default: ./seal-private.pem)\n");
+  printf("  --provider names     :: OpenSSL providers to load, comma-separated (e.g., HSM or accelerator; default: none)\n");
+  printf("  --propq query        :: OpenSSL property query for the key and signing (e.g., provider=pkcs11; default: none)\n");
   printf("\n");
   printf("  Signing with a remote signing service:\n");
   printf("  -S, --Sign           :: Required: Enable signing\n");
   printf("  -u, --apiurl url     :: For remote signers (default: no url)\n");
   printf("  -a, --apikey id      :: For remote signers (default: no API key)\n");
   printf("  -i, --id id          :: User-specific identifier (default: no identifier)\n");
+  printf("  --http2              :: Use HTTP/2 with the remote signer, if supported (default: HTTP/1.1)\n");
+  printf("  --batch N            :: Send up to N digests per request to the remote signer (default: 1)\n");
+  printf("  --sigsize N          :: Raw signature size in bytes (e.g., 256 for RSA-2048); skips asking the signer (default: ask)\n");
+  printf("  --pipeline N         :: Keep up to N remote signing requests in flight while processing (default: 0)\n");
   printf("\n");
   printf("  Common signing options (for local and remote)\n");
   printf("  -d, --domain domain  :: DNS entry with the public key (default: localhost.localdomain)\n");
@@ -238,6 +260,9 @@ void	Usage	(const char *progname)
   printf("        -O text may contain a comma-separated list of options:\n");
   printf("        append  :: This is an appending signature; not final signature.\n");
   printf("        seAl,SEAL,teXt,tEXt,...  :: PNG: chunk name to use.\n");
+  printf("        inplace :: Sign the original file instead of writing a new one (PNG, RIFF, Matroska).\n");
+  printf("  --stream             :: Sign while copying a live recording (RIFF, Matroska; '-' = stdin)\n");
+  printf("  --interim seconds    :: With --stream: add an interim signature this often (default: 0 = final only)\n");
   printf("  -K, --keyalg alg     :: Key algorithm  (default: rsa)\n");
   printf("  -A, --digestalg alg    :: Digest (hash) algorithm  (default: sha256)\n");
   printf("               Supports: sha224, sha256, sha384, sha512\n");
@@ -248,6 +273,300 @@ void	Usage	(const char *progname)
   exit(1);
 } /* Usage() */
 
+/*****
+ Magic bytes for every supported format.
+ A cheap first test from a small header read, so files that
+ are not media (sidecars, logs, archives) are never mapped.
+ The full Seal_is*() check still runs after mapping.
+ *****/
+static const struct
+  {
+  size_t Len;
+  const char *Magic;
+  } _KnownHeaders[] =
+  {
+    { 8, "\x89PNG\r\n\x1a\n" }, // PNG
+    { 3, "\xff\xd8\xff" }, // JPEG
+    { 4, "RIFF" }, // RIFF (WAV, AVI, WebP)
+    { 4, "RF64" }, // RIFF with 64-bit sizes (EBU Tech 3306)
+    { 4, "BW64" }, // RIFF with 64-bit sizes (ITU-R BS.2088)
+    { 4, "\x1A\x45\xDF\xA3" }, // Matroska (EBML)
+    { 0, NULL }
+  };
+
+/**************************************
+ _IsKnownHeader(): Could this header be a supported format?
+ Returns: true if it matches any known magic.
+ **************************************/
+bool	_IsKnownHeader	(size_t HeaderLen, const byte *Header)
+{
+  int i;
+  for(i=0; _KnownHeaders[i].Len; i++)
+    {
+    if ((HeaderLen >= _KnownHeaders[i].Len) &&
+	!memcmp(Header,_KnownHeaders[i].Magic,_KnownHeaders[i].Len))
+      {
+      return(true);
+      }
+    }
+  return(false);
+} /* _IsKnownHeader() */
+
+/**************************************
+ _ProcessFile(): Sign or verify one file.
+ CleanArgs is never modified, so parallel jobs can share it.
+ All output goes to SealOut.
+ **************************************/
+void	_ProcessFile	(sealfield *CleanArgs, const char *Filename)
+{
+  sealfield *Args;
+  mmapfile *Mmap=NULL;
+  int FileFormat='@';
+  int Mode;
+  byte Header[64]; // enough for every format's magic
+  size_t HeaderLen;
+  double Start; // for --stats
+  const char *Opt;
+  bool InPlace;
+
+  // Start off with a clean set of parameters
+  Args = SealClone(CleanArgs);
+  Mode = SealGetCindex(Args,"@mode",0);
+
+  // In-place signing: undo any interrupted attempt before reading the file
+  Opt = SealGetText(Args,"options");
+  InPlace = ((Mode=='s') || (Mode=='S')) && Opt && strstr(Opt,"inplace") &&
+            !SealSearch(Args,"@FilenameOut"); // not when the server was given the output
+  if (InPlace) { SealInPlaceRecover(Filename); }
+
+  // Open the file, but only map it if the header looks like a known format
+  Start = SealStatStart();
+  Mmap = MmapOpen(Filename,PROT_READ); // read-only
+  if (!Mmap) // MmapOpen() reported the problem; skip this file
+	{
+	SealFree(Args);
+	return;
+	}
+  HeaderLen = MmapPeek(Mmap,sizeof(Header),Header);
+  SealStatStop(SEAL_PHASE_MMAP,Start);
+  if (!_IsKnownHeader(HeaderLen,Header))
+	{
+	SealPrintf("ERROR: Unknown file format '%s'. Skipping.\n",Filename);
+	MmapFree(Mmap);
+	SealFree(Args);
+	return;
+	}
+
+  // Memory map the file; needed for finding the SEAL record's location.
+  Start = SealStatStart();
+  if (!MmapMap(Mmap,PROT_READ))
+	{
+	SealPrintf("ERROR: Memory map failed for file (%s)\n",Filename);
+	MmapFree(Mmap);
+	SealFree(Args);
+	return;
+	}
+
+  SealStatStop(SEAL_PHASE_MMAP,Start);
+
+  // Identify the filename format
+  Start = SealStatStart();
+  if (Seal_isPNG(Mmap)) { FileFormat='P'; } // PNG
+  else if (Seal_isJPEG(Mmap)) { FileFormat='J'; } // JPEG
+  else if (Seal_isRIFF(Mmap)) { FileFormat='R'; } // RIFF
+  else if (Seal_isMatroska(Mmap)) { FileFormat='M'; } // Matroska
+  else
+	{
+	SealPrintf("ERROR: Unknown file format '%s'. Skipping.\n",Filename);
+	MmapFree(Mmap);
+	SealFree(Args);
+	return;
+	}
+  SealStatStop(SEAL_PHASE_DETECT,Start);
+
+  // File exists! Now process it!
+  if (InPlace && (FileFormat!='J') && !Mmap->IsAlloc)
+    {
+    // The record goes near the end; extend the original file
+    Args = SealSetText(Args,"@FilenameOut",Filename);
+    Args = SealSetText(Args,"@inplace","1");
+    }
+  else if (((Mode=='s') || // if signing from local file
+       (Mode=='S')) && // if signing from remote service
+      !SealSearch(Args,"@FilenameOut")) // unless the server was given the output
+    {
+    char *Outname, *Template, *Name;
+    Template = (char*)(SealSearch(Args,"outfile")->Value);
+    Name = SealGetText(Args,"@name"); // server: the client's name for a passed file
+    Outname = MakeFilename(Template,Name ? Name : Filename);
+    if (!Outname) { MmapFree(Mmap); SealFree(Args); return; }
+    if (InPlace) { SealPrintf(" WARNING: Cannot sign this file in place; writing '%s'.\n",Outname); }
+    Args = SealSetText(Args,"@FilenameOut",Outname);
+    free(Outname);
+    }
+
+  // Process based on file format
+  switch(FileFormat)
+	{
+	case 'J': Args = Seal_JPEG(Args,Mmap); break; // JPEG
+	case 'P': Args = Seal_PNG(Args,Mmap); break; // PNG
+	case 'R': Args = Seal_RIFF(Args,Mmap); break; // RIFF
+	case 'M': Args = Seal_Matroska(Args,Mmap); break; // Matroska
+	default: break; // should never happen
+	}
+
+  if (Verbose > 1) { DEBUGWALK("Post-File Parameters",Args); } // DEBUGGING
+  MmapFree(Mmap);
+  if (Args) { SealFree(Args); }
+} /* _ProcessFile() */
+
+/**************************************
+ Capture: Holds the text captured for the result cache.
+ It is not on the stack, so a fatal error can still release it.
+ **************************************/
+static __thread struct
+  {
+  FILE *fp;
+  char *Text;
+  size_t Len;
+  } Capture;
+
+/**************************************
+ _CaptureCleanup(): Release an abandoned capture.
+ **************************************/
+static void	_CaptureCleanup	(void *Data)
+{
+  (void)Data;
+  if (Capture.fp) { fclose(Capture.fp); }
+  free(Capture.Text);
+  memset(&Capture,0,sizeof(Capture));
+} /* _CaptureCleanup() */
+
+/**************************************
+ ProcessFile(): Sign or verify one file.
+ Every sealfield for the file comes from one arena,
+ so the file's working set is released all at once.
+ If '@name' is set, then it is shown instead of Filename.
+ **************************************/
+void	ProcessFile	(sealfield *CleanArgs, const char *Filename)
+{
+  sealarena *Arena, *Prev;
+  char Key[2048];
+  char *Results;
+  FILE *Out;
+  int Mode;
+  double Start;
+  const char *Name;
+
+  // Show file being processed.
+  Name = SealGetText(CleanArgs,"@name");
+  if (SealResultJson) { SealResultBegin(Name ? Name : Filename); }
+  else { SealPrintf("[%s]\n",Name ? Name : Filename); }
+  Start = SealStatStart();
+
+  // When verifying, an unchanged file reuses its earlier results
+  // (The cache holds text, so JSON results are always computed.)
+  Mode = SealGetCindex(CleanArgs,"@mode",0);
+  if ((Mode!='s') && (Mode!='S') && !Verbose && !SealResultJson &&
+      SealResultCacheKey(CleanArgs,Filename,Key,sizeof(Key)))
+    {
+    Results = SealResultCacheGet(Key);
+    if (Results)
+      {
+      SealPrintf("%s",Results);
+      free(Results);
+      SealStatInc(SEAL_COUNT_RESULTHIT,1);
+      SealStatsFile(Filename,Start);
+      return;
+      }
+    Capture.fp = open_memstream(&Capture.Text,&Capture.Len);
+    if (Capture.fp) { SealCleanupPush(_CaptureCleanup,&Capture); }
+    }
+
+  // Capture the results so they can be cached
+  Out = SealOut;
+  if (Capture.fp) { SealOut = Capture.fp; }
+
+  Arena = SealArenaNew();
+  Prev = SealArenaUse(Arena);
+  SealDNSLookupFailed(); // only this file's lookups count
+  _ProcessFile(CleanArgs,Filename);
+  SealArenaUse(Prev);
+  SealArenaFree(Arena);
+
+  if (Capture.fp)
+    {
+    SealOut = Out;
+    fclose(Capture.fp);
+    Capture.fp = NULL;
+    if (Capture.Text)
+      {
+      fwrite(Capture.Text,1,Capture.Len,Out ? Out : stdout);
+      SealResultCacheSet(Key,Capture.Len,Capture.Text,SealDNSLookupFailed());
+      }
+    SealCleanupPop(&Capture);
+    _CaptureCleanup(&Capture);
+    }
+  SealResultEnd();
+  SealStatsFile(Filename,Start);
+} /* ProcessFile() */
+
+/**************************************
+ StreamFile(): Sign a live recording while copying it.
+ The input is read once, in order, so it can be a pipe ("-" is stdin).
+ The output is signed as it is written; it is never re-read.
+ **************************************/
+void	StreamFile	(sealfield *CleanArgs, const char *Filename)
+{
+  sealfield *Args;
+  sealstream *Stream;
+  FILE *fp;
+  byte *Buf;
+  size_t Len;
+  char *Outname, *Template;
+  bool IsStdin;
+  double Start;
+
+  if (SealResultJson) { SealResultBegin(Filename); }
+  else { SealPrintf("[%s]\n",Filename); }
+  Start = SealStatStart();
+  IsStdin = !strcmp(Filename,"-");
+  fp = IsStdin ? stdin : fopen(Filename,"rb");
+  if (!fp)
+	{
+	SealPrintf("ERROR: Unknown stream '%s'. Skipping.\n",Filename);
+	SealResultEnd();
+	return;
+	}
+
+  Args = SealClone(CleanArgs);
+  Template = (char*)(SealSearch(Args,"outfile")->Value);
+  Outname = MakeFilename(Template,IsStdin ? "stream" : Filename);
+  if (!Outname) { if (!IsStdin) { fclose(fp); } SealFree(Args); SealResultEnd(); return; }
+  Args = SealSetText(Args,"@FilenameOut",Outname);
+  free(Outname);
+
+  Stream = SealStreamOpen(Args);
+  Buf = (byte*)malloc(65536);
+  if (!Buf)
+	{
+	fprintf(stderr,"ERROR: Unable to allocate stream buffer. Aborting.\n");
+	exit(1);
+	}
+  while((Len = fread(Buf,1,65536,fp)) > 0)
+	{
+	SealStreamWrite(Stream,Len,Buf);
+	}
+  if (ferror(fp)) { SealPrintf("ERROR: Failed to read stream '%s'; signing what was read.\n",Filename); }
+  SealStreamClose(Stream,true);
+
+  free(Buf);
+  if (!IsStdin) { fclose(fp); }
+  SealFree(Args);
+  SealResultEnd();
+  SealStatsFile(Filename,Start);
+} /* StreamFile() */
+
 /**************************************
  main()
  **************************************/
@@ -256,7 +575,9 @@ int main (int argc, char *argv[])
   sealfield *Args=NULL, *CleanArgs;
   int c;
   int Mode='v';
-  int FileFormat='@';
+  int Jobs=1;
+  sealinput *Input;
+  const char *Filename;
   bool IsURL=false; // for signing, use URL?
   bool IsLocal=false; // for signing, use local?
 
@@ -285,6 +606,12 @@ int main (int argc, char *argv[])
   Args = SealSetText(Args,"id","");
   Args = SealSetText(Args,"apiurl","");
   Args = SealSetText(Args,"apikey","");
+  Args = SealSetText(Args,"jobs","1");
+  Args = SealSetText(Args,"dnscachefile","");
+  Args = SealSetText(Args,"verifycachefile","");
+  Args = SealSetText(Args,"interim","0");
+  Args = SealSetText(Args,"batch","1");
+  Args = SealSetText(Args,"pipeline","0");
 
   // Set default config file based on user's home.
   Args = SealSetText(Args,"config",getenv("HOME"));
@@ -323,14 +650,33 @@ int main (int argc, char *argv[])
     {"pubkeyfile", required_argument, NULL, 'P'}, // specify dns via command-line
     {"outfile",   required_argument, NULL, 'o'},
     {"options",   required_argument, NULL, 'O'},
+    {"jobs",      required_argument, NULL, 'j'},
     // long-only options
     {"sf",        required_argument, NULL, 1},
     {"kv",        required_argument, NULL, 1}, // must be numeric >= 0
     {"uid",       required_argument, NULL, 1},
+    {"dnscachefile", required_argument, NULL, 1},
+    {"verifycachefile", required_argument, NULL, 1}, // verify: cached results
+    {"verifyttl", required_argument, NULL, 1}, // verify: seconds to trust cached results
+    {"stream",    no_argument, NULL, 2},
+    {"interim",   required_argument, NULL, 1}, // seconds between stream signatures
+    {"http2",     no_argument, NULL, 2}, // remote signer: use HTTP/2
+    {"crc",       no_argument, NULL, 2}, // PNG: report bad chunk checksums
+    {"deepscan",  no_argument, NULL, 2}, // JPEG: check MPF images and trailing data
+    {"batch",     required_argument, NULL, 1}, // remote signer: digests per request
+    {"pipeline",  required_argument, NULL, 1}, // remote signer: requests in flight
+    {"sigsize",   required_argument, NULL, 1}, // remote signer: raw signature size
+    {"provider",  required_argument, NULL, 1}, // local signer: openssl providers
+    {"stats",     no_argument, NULL, 2}, // report timings and counters to stderr
+    {"output",    required_argument, NULL, 1}, // results as text or jsonl
+    {"serve",     required_argument, NULL, 1}, // Unix socket for requests
+    {"files-from", required_argument, NULL, 1}, // more input files, listed in a file
+    {"recursive", required_argument, NULL, 1}, // more input files, from a directory tree
+    {"propq",     required_argument, NULL, 1}, // local signer: openssl property query
     // modes
     {NULL,0,NULL,0}
     };
-  while ((c = getopt_long(argc,argv,"A:a:C:c:D:d:ghi:K:k:o:O:Ssu:VvW?",long_options,&long_option_index)) != -1)
+  while ((c = getopt_long(argc,argv,"A:a:C:c:D:d:ghi:j:K:k:o:O:Ssu:VvW?",long_options,&long_option_index)) != -1)
     {
     switch(c)
       {
@@ -339,6 +685,9 @@ int main (int argc, char *argv[])
       case 1: // generic longopt with required_argument (and no single-letter mapping)
 	Args = SealSetText(Args,long_options[long_option_index].name,optarg);
 	break;
+      case 2: // generic longopt flag (no_argument) that is stored
+	Args = SealSetText(Args,long_options[long_option_index].name,"1");
+	break;
       case 9: // read configuration file
 	Args = SealSetText(Args,"config",optarg);
 	Args = ReadCfg(Args);
@@ -350,6 +699,7 @@ int main (int argc, char *argv[])
       case 'D': Args = SealSetText(Args,"dnsfile",optarg); break;
       case 'd': Args = SealSetText(Args,"domain",optarg); break;
       case 'i': Args = SealSetText(Args,"id",optarg); break;
+      case 'j': Args = SealSetText(Args,"jobs",optarg); break;
       case 'K': Args = SealSetText(Args,"keyalg",optarg); break;
       case 'k': Args = SealSetText(Args,"keyfile",optarg); break;
       case 'P': Args = SealSetText(Args,"@pubkeyfile",optarg); break; // for debugging
@@ -421,7 +771,8 @@ int main (int argc, char *argv[])
     }
 
   // Process all args
-  if (optind >= argc)
+  if ((optind >= argc) && !SealGetText(Args,"serve") &&
+      !SealGetText(Args,"files-from") && !SealGetText(Args,"recursive"))
     {
     fprintf(stderr,"ERROR: No input files.\n");
     exit(1);
@@ -433,8 +784,10 @@ int main (int argc, char *argv[])
     /*****
      When signing, no digest gets the size of the signature (@sigsize).
      This never changes between calls, so do it now.
+     Local keys know their size.  Remote signers are asked,
+     unless 'sigsize' says it.
      *****/
-    if (IsURL && (Mode=='S')) { Args = SealSignURL(Args); }
+    if (IsURL && (Mode=='S')) { Args = SealSignURLSize(Args); }
     else if (IsLocal && (Mode=='s')) { Args = SealSignLocal(Args); }
     // Must have sigsize!
     if (SealGetU32index(Args,"@sigsize",0)==0)
@@ -450,71 +803,73 @@ int main (int argc, char *argv[])
     }
   if (Verbose > 3) { DEBUGWALK("Post-CLI Parameters",Args); } // DEBUGGING
 
+  // Public keys from DNS are cached across files (and runs)
+  SealDNSCacheLoad(Args);
+  // Verification results are cached across runs
+  SealResultCacheLoad(Args);
+  // Optional timings
+  SealStatsInit(Args);
+  // Text or JSON lines
+  SealResultInit(Args);
+
   // Don't mess up command-line parameters
   CleanArgs = Args;
   Args=NULL;
 
-  // Process command-line files.
-  for( ; optind < argc; optind++)
+  // Process command-line files (and any lists or directories).
+  Jobs = SealJobsCount(SealGetText(CleanArgs,"jobs"));
+  Input = SealInputOpen(CleanArgs,argc-optind,argv+optind);
+  if (SealGetText(CleanArgs,"serve")) // long-running server
     {
-    // Start off with a clean set of parameters
-    if (Args) { SealFree(Args); Args=NULL; }
-    Args = SealClone(CleanArgs);
-
-    // Show file being processed.
-    printf("[%s]\n",argv[optind]);
-
-    // Memory map the file; needed for finding the SEAL record's location.
-    mmapfile *Mmap=NULL;
-    Mmap = MmapFile(argv[optind],PROT_READ); // read-only
-    if (!Mmap)
-	{
-	fprintf(stdout,"ERROR: Unknown file '%s'. Skipping.\n",argv[optind]);
-	continue;
-	}
-
-    // Identify the filename format
-    if (Seal_isPNG(Mmap)) { FileFormat='P'; } // PNG
-    else if (Seal_isJPEG(Mmap)) { FileFormat='J'; } // JPEG
-    else if (Seal_isRIFF(Mmap)) { FileFormat='R'; } // RIFF
-    else if (Seal_isMatroska(Mmap)) { FileFormat='M'; } // Matroska
-    else
+    SealServe(SealGetText(CleanArgs,"serve"),Jobs,ProcessFile,CleanArgs);
+    }
+  else if (SealGetText(CleanArgs,"stream")) // live recordings
+    {
+    if (!strchr("sS",Mode))
 	{
-	fprintf(stdout,"ERROR: Unknown file format '%s'. Skipping.\n",argv[optind]);
-	MmapFree(Mmap);
-	continue;
+	fprintf(stderr,"ERROR: --stream requires -s or -S. Aborting.\n");
+	exit(1);
 	}
-
-    // File exists! Now process it!
-    if ((Mode=='s') || // if signing from local file
-        (Mode=='S')) // if signing from remote service
+    while((Filename = SealInputNext(Input))) { StreamFile(CleanArgs,Filename); }
+    }
+  else if ((Jobs > 1) || SealSignDeferred(CleanArgs)) // parallel (or results that finish later)
+    {
+    // Files that wait for a queued signature keep their slots
+    SealJobsStart(Jobs,SealSignDeferred(CleanArgs),ProcessFile,CleanArgs);
+    while((Filename = SealInputNext(Input)))
       {
-      char *Outname, *Template;
-      Template = (char*)(SealSearch(Args,"outfile")->Value);
-      Outname = MakeFilename(Template,(char*)argv[optind]);
-      if (!Outname) { continue; }
-      Args = SealSetText(Args,"@FilenameOut",Outname);
-      free(Outname);
+      if (Mode=='v') { SealDNSPrefetchFile(CleanArgs,Filename); } // look up keys early
+      SealJobsAdd(Filename);
       }
-
-    // Process based on file format
-    switch(FileFormat)
-    	{
-	case 'J': Args = Seal_JPEG(Args,Mmap); break; // JPEG
-	case 'P': Args = Seal_PNG(Args,Mmap); break; // PNG
-	case 'R': Args = Seal_RIFF(Args,Mmap); break; // RIFF
-	case 'M': Args = Seal_Matroska(Args,Mmap); break; // Matroska
-	default: break; // should never happen
-	}
-
-    if (Verbose > 1) { DEBUGWALK("Post-File Parameters",Args); } // DEBUGGING
-    MmapFree(Mmap);
-    if (Args) { SealFree(Args); Args=NULL; }
-    } // foreach command-line file
+    SealJobsFinish();
+    }
+  else // serial
+    {
+    int Ahead;
+    // When verifying, look up the keys for the next few files early
+    for(Ahead=0; (Mode=='v') && (Ahead < SEAL_DNS_AHEAD); Ahead++)
+      {
+      SealDNSPrefetchFile(CleanArgs,SealInputPeek(Input,Ahead));
+      }
+    while((Filename = SealInputNext(Input)))
+      {
+      if (Mode=='v') { SealDNSPrefetchFile(CleanArgs,SealInputPeek(Input,SEAL_DNS_AHEAD-1)); }
+      ProcessFile(CleanArgs,Filename);
+      }
+    }
+  SealInputClose(Input);
 
   // Clean up
+  SealSignFlush(); // sign anything still queued for the remote signer
+  SealVerifyCacheFree(); // also finishes any DNS prefetches
+  SealDNSCacheSave(CleanArgs);
+  SealDNSCacheFree();
+  SealResultCacheSave(CleanArgs);
+  SealResultCacheFree();
   SealFreePrivateKey(); // if a private key was allocated
-  if (Args) { SealFree(Args); Args=NULL; }
+  SealCurlFree(); // if a remote signer was used
+  SealStatsPrint(stderr); // if --stats; after every thread is done
+  SealStatsFree();
   SealFree(CleanArgs); // free memory for completeness
   return(0);
 } /* main() */
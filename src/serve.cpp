@@ -0,0 +1,395 @@
+/************************************************
+ SEAL: implemented in C
+ See LICENSE
+
+ Long-running server: sign and verify requests over a Unix socket.
+
+ Starting sealtool for every file pays for OpenSSL setup,
+ reading the config, loading (and unlocking) the private key,
+ and a cold DNS cache.  With --serve, one process keeps all of
+ that warm: the key, the public-key cache, each worker's
+ resolver, and the remote signer's connections.
+
+ Protocol (one request per line; any number per connection):
+   verify NAME
+   sign NAME
+ NAME is a file path, unless file descriptors are passed with
+ the request (SCM_RIGHTS).  Then NAME is only shown in the
+ results (and used for the output name when signing), and:
+   verify: the first descriptor is the file.
+   sign: the first descriptor is the input; an optional second
+     descriptor is the output.
+ The reply is the same text that sealtool prints for the file,
+ followed by a line with a single ".".
+
+ Each connection is handled by one worker from the pool (-j).
+ Fatal errors end the request, not the server.
+ SIGINT or SIGTERM stops the server; it then saves the caches.
+ ************************************************/
+// C headers
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "seal.hpp"
+#include "serve.hpp"
+
+#pragma GCC visibility push(hidden)
+#define SEAL_SERVE_LINE 4096 // longest request line
+#define SEAL_SERVE_FDS 4 // most descriptors per request
+#define SEAL_SERVE_POLL 1000 // ms between checks for stopping
+
+typedef struct sealconn
+  {
+  int Fd;
+  struct sealconn *Next;
+  } sealconn;
+
+static volatile sig_atomic_t ServeStop=0;
+
+static struct
+  {
+  pthread_mutex_t Lock;
+  pthread_cond_t Ready; // workers wait for connections
+  sealconn *Head, **Tail;
+  bool Finished;
+  sealjobfunc Func;
+  sealfield *Verify; // Args for verify requests
+  sealfield *Sign; // Args for sign requests; NULL if not signing
+  } Serve = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/**************************************
+ _ServeSignal(): Stop serving (SIGINT, SIGTERM).
+ **************************************/
+void	_ServeSignal	(int Sig)
+{
+  ServeStop=1;
+} /* _ServeSignal() */
+
+/**************************************
+ _ServeSend(): Write everything to the client.
+ Returns: true on success.
+ **************************************/
+bool	_ServeSend	(int Fd, const char *Data, size_t Len)
+{
+  ssize_t w;
+
+  while(Len > 0)
+    {
+    w = send(Fd,Data,Len,MSG_NOSIGNAL); // a closed client must not kill the server
+    if ((w < 0) && (errno == EINTR)) { continue; }
+    if (w <= 0) { return(false); }
+    Data += w;
+    Len -= w;
+    }
+  return(true);
+} /* _ServeSend() */
+
+/**************************************
+ _ServeRead(): Read more of the request.
+ Passed descriptors are added to Fds (extras are closed).
+ Returns: bytes read, 0 at end, or -1 on error.
+ **************************************/
+ssize_t	_ServeRead	(int Fd, char *Buf, size_t Max, int *Fds, int *FdCount)
+{
+  struct msghdr Msg;
+  struct iovec Iov;
+  struct cmsghdr *C;
+  union { struct cmsghdr Align; char Space[CMSG_SPACE(sizeof(int)*SEAL_SERVE_FDS)]; } Control;
+  int *Got;
+  ssize_t r;
+  size_t i,n;
+
+  memset(&Msg,0,sizeof(Msg));
+  Iov.iov_base = Buf;
+  Iov.iov_len = Max;
+  Msg.msg_iov = &Iov;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control.Space;
+  Msg.msg_controllen = sizeof(Control.Space);
+  do { r = recvmsg(Fd,&Msg,MSG_CMSG_CLOEXEC); } while((r < 0) && (errno == EINTR));
+  if (r < 0) { return(-1); }
+
+  for(C = CMSG_FIRSTHDR(&Msg); C; C = CMSG_NXTHDR(&Msg,C))
+    {
+    if ((C->cmsg_level != SOL_SOCKET) || (C->cmsg_type != SCM_RIGHTS)) { continue; }
+    Got = (int*)CMSG_DATA(C);
+    n = (C->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for(i=0; i < n; i++)
+      {
+      if (*FdCount < SEAL_SERVE_FDS) { Fds[(*FdCount)++] = Got[i]; }
+      else { close(Got[i]); }
+      }
+    }
+  return(r);
+} /* _ServeRead() */
+
+/**************************************
+ _ServeRequest(): Handle one request line.
+ Fds are the descriptors that came with it; they are closed.
+ The reply goes to the client.
+ **************************************/
+void	_ServeRequest	(int Client, char *Line, int *Fds, int FdCount)
+{
+  sealfield *Args=NULL;
+  const char *Filename;
+  char *Name, *Output=NULL;
+  size_t OutputLen=0;
+  char Path[2][64];
+  bool IsSign;
+  FILE *Out;
+  jmp_buf Jump;
+  size_t Mark;
+  int i;
+
+  Out = open_memstream(&Output,&OutputLen);
+  if (!Out)
+    {
+    fprintf(stderr,"ERROR: Unable to allocate request output. Aborting.\n");
+    SealFatal();
+    }
+  SealOut = Out;
+
+  Name = strchr(Line,' ');
+  if (Name) { *Name='\0'; Name++; }
+  IsSign = !strcmp(Line,"sign");
+  if (!Name || !Name[0] || (!IsSign && strcmp(Line,"verify")))
+    {
+    SealPrintf("ERROR: Unknown request '%s'.\n",Line);
+    }
+  else if (IsSign && !Serve.Sign)
+    {
+    SealPrintf("ERROR: Not signing; start the server with -s or -S.\n");
+    }
+  else
+    {
+    // Each request gets its own parameters
+    Args = SealClone(IsSign ? Serve.Sign : Serve.Verify);
+    Filename = Name;
+    for(i=0; (i < FdCount) && (i < 2); i++) { snprintf(Path[i],sizeof(Path[i]),"/proc/self/fd/%d",Fds[i]); }
+    if (FdCount > 0)
+      {
+      Args = SealSetText(Args,"@name",Name);
+      Filename = Path[0];
+      }
+    if (IsSign && (FdCount > 1)) { Args = SealSetText(Args,"@FilenameOut",Path[1]); }
+
+    // Fatal errors end this request, not the server
+    SealFatalJump = &Jump;
+    Mark = SealCleanupMark();
+    if (setjmp(Jump) == 0) { Serve.Func(Args,Filename); }
+    else
+      {
+      // Release what the request had open (files, mmaps, arena, claims)
+      SealArenaUse(NULL);
+      SealCleanupRun(Mark);
+      SealOut = Out;
+      SealPrintf("ERROR: Request failed; see the server's stderr.\n");
+      }
+    SealFatalJump = NULL;
+    SealFree(Args);
+    }
+
+  SealOut = NULL;
+  fclose(Out);
+  if (Output) { _ServeSend(Client,Output,OutputLen); }
+  _ServeSend(Client,".\n",2);
+  free(Output);
+  for(i=0; i < FdCount; i++) { close(Fds[i]); }
+} /* _ServeRequest() */
+
+/**************************************
+ _ServeConn(): Handle every request on a connection.
+ **************************************/
+void	_ServeConn	(int Client)
+{
+  char Buf[SEAL_SERVE_LINE+1];
+  size_t Len=0;
+  int Fds[SEAL_SERVE_FDS], FdCount=0;
+  struct pollfd P;
+  char *End;
+  ssize_t r;
+  int i;
+
+  while(!ServeStop)
+    {
+    // Complete request?
+    End = (char*)memchr(Buf,'\n',Len);
+    if (End)
+      {
+      *End = '\0';
+      if ((End > Buf) && (End[-1]=='\r')) { End[-1]='\0'; }
+      _ServeRequest(Client,Buf,Fds,FdCount);
+      FdCount=0;
+      Len -= End+1-Buf;
+      memmove(Buf,End+1,Len);
+      continue;
+      }
+    if (Len >= SEAL_SERVE_LINE)
+      {
+      _ServeSend(Client,"ERROR: Request line too long.\n.\n",32);
+      break;
+      }
+
+    // Wait for more, but notice when the server is stopping
+    P.fd = Client;
+    P.events = POLLIN;
+    if (poll(&P,1,SEAL_SERVE_POLL) <= 0) { continue; }
+    r = _ServeRead(Client,Buf+Len,SEAL_SERVE_LINE-Len,Fds,&FdCount);
+    if (r <= 0) { break; } // client is done
+    Len += r;
+    }
+
+  for(i=0; i < FdCount; i++) { close(Fds[i]); }
+  close(Client);
+} /* _ServeConn() */
+
+/**************************************
+ _ServeWorker(): Thread that handles connections.
+ **************************************/
+void *	_ServeWorker	(void *unused)
+{
+  sealconn *C;
+
+  pthread_mutex_lock(&Serve.Lock);
+  while(1)
+    {
+    while(!Serve.Head && !Serve.Finished)
+      {
+      pthread_cond_wait(&Serve.Ready,&Serve.Lock);
+      }
+    if (!Serve.Head) { break; } // finished and nothing left
+    C = Serve.Head;
+    Serve.Head = C->Next;
+    if (!Serve.Head) { Serve.Tail = &Serve.Head; }
+    pthread_mutex_unlock(&Serve.Lock);
+
+    _ServeConn(C->Fd);
+    free(C);
+
+    pthread_mutex_lock(&Serve.Lock);
+    }
+  pthread_mutex_unlock(&Serve.Lock);
+  return(NULL);
+} /* _ServeWorker() */
+#pragma GCC visibility pop
+
+/**************************************
+ SealServe(): Serve requests on the Unix socket at Path.
+ Func handles one file (like SealJobsStart).
+ Args are the (read-only) parameters; if '@mode' is set,
+ then sign requests are accepted too.
+ Returns when SIGINT or SIGTERM is received.
+ **************************************/
+void	SealServe	(const char *Path, int Jobs, sealjobfunc Func, sealfield *Args)
+{
+  struct sockaddr_un Addr;
+  struct sigaction Sig;
+  struct stat Stat;
+  struct pollfd P;
+  sealconn *C;
+  pthread_t *Thread;
+  int Listen, Client, j;
+  int Mode;
+
+  // Verify requests must never sign
+  Mode = SealGetCindex(Args,"@mode",0);
+  Serve.Sign = NULL;
+  Serve.Verify = Args;
+  if ((Mode=='s') || (Mode=='S'))
+    {
+    /*****
+     The reply must be the final result, and passed descriptors are
+     closed right after it, so remote signatures are never deferred.
+     (Same as libseal.)
+     *****/
+    Serve.Sign = SealClone(Args);
+    Serve.Sign = SealSetText(Serve.Sign,"batch","1");
+    Serve.Sign = SealSetText(Serve.Sign,"pipeline","0");
+    Serve.Verify = SealDel(SealClone(Args),"@mode");
+    }
+  Serve.Func = Func;
+  Serve.Head = NULL;
+  Serve.Tail = &Serve.Head;
+  Serve.Finished = false;
+
+  memset(&Addr,0,sizeof(Addr));
+  Addr.sun_family = AF_UNIX;
+  if (strlen(Path) >= sizeof(Addr.sun_path))
+    {
+    fprintf(stderr,"ERROR: Socket path is too long (%s). Aborting.\n",Path);
+    exit(1);
+    }
+  strcpy(Addr.sun_path,Path);
+
+  // Replace a stale socket, but never a regular file
+  if (!lstat(Path,&Stat) && S_ISSOCK(Stat.st_mode)) { unlink(Path); }
+  Listen = socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+  if ((Listen < 0) || bind(Listen,(struct sockaddr*)&Addr,sizeof(Addr)) ||
+      chmod(Path,0600) || listen(Listen,64))
+    {
+    fprintf(stderr,"ERROR: Unable to listen on socket (%s). Aborting.\n",Path);
+    exit(1);
+    }
+
+  // Stop cleanly; a client that goes away must not stop the server
+  memset(&Sig,0,sizeof(Sig));
+  Sig.sa_handler = _ServeSignal; // no SA_RESTART, so poll() wakes up
+  sigaction(SIGINT,&Sig,NULL);
+  sigaction(SIGTERM,&Sig,NULL);
+  signal(SIGPIPE,SIG_IGN);
+
+  Thread = (pthread_t*)calloc(Jobs,sizeof(pthread_t));
+  if (!Thread)
+    {
+    fprintf(stderr,"ERROR: Unable to allocate server threads. Aborting.\n");
+    exit(1);
+    }
+  for(j=0; j < Jobs; j++)
+    {
+    if (pthread_create(&Thread[j],NULL,_ServeWorker,NULL))
+	{
+	fprintf(stderr,"ERROR: Unable to start server thread. Aborting.\n");
+	exit(1);
+	}
+    }
+
+  // Accept connections until told to stop
+  while(!ServeStop)
+    {
+    P.fd = Listen;
+    P.events = POLLIN;
+    if (poll(&P,1,SEAL_SERVE_POLL) <= 0) { continue; }
+    Client = accept4(Listen,NULL,NULL,SOCK_CLOEXEC);
+    if (Client < 0) { continue; }
+    C = (sealconn*)calloc(1,sizeof(sealconn));
+    if (!C) { close(Client); continue; }
+    C->Fd = Client;
+    pthread_mutex_lock(&Serve.Lock);
+    *Serve.Tail = C;
+    Serve.Tail = &C->Next;
+    pthread_cond_signal(&Serve.Ready);
+    pthread_mutex_unlock(&Serve.Lock);
+    }
+  close(Listen);
+  unlink(Path);
+
+  // Finish the current requests
+  pthread_mutex_lock(&Serve.Lock);
+  Serve.Finished = true;
+  pthread_cond_broadcast(&Serve.Ready);
+  pthread_mutex_unlock(&Serve.Lock);
+  for(j=0; j < Jobs; j++) { pthread_join(Thread[j],NULL); }
+  free(Thread);
+  if (Serve.Sign) { SealFree(Serve.Sign); SealFree(Serve.Verify); }
+  Serve.Verify = Serve.Sign = NULL;
+} /* SealServe() */
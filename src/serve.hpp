@@ -0,0 +1,20 @@
+/************************************************
+ SEAL: implemented in C
+ See LICENSE
+
+ Long-running server: sign and verify requests over a Unix socket.
+ ************************************************/
+#ifndef SERVE_HPP
+#define SERVE_HPP
+
+// C headers
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "seal.hpp"
+#include "jobs.hpp"
+
+void	SealServe	(const char *Path, int Jobs, sealjobfunc Func, sealfield *Args);
+
+#endif
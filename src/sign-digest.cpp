@@ -16,12 +16,197 @@
 #include "seal.hpp"
 #include "files.hpp"
 #include "sign.hpp"
+#include "stats.hpp"
 
 // For openssl 3.x
 #include <openssl/decoder.h>
 #include <openssl/encoder.h>
 #include <openssl/evp.h>
 
+/**************************************
+ Digest checkpoints.
+ Files with many SEAL records usually have overlapping ranges.
+ E.g., with b='F~S,s~f', record #2 hashes the same bytes as
+ record #1's first range, and then some more.
+ After hashing each range, keep a copy of the hash state
+ (midstate) along with the list of ranges that produced it.
+ A later digest with the same leading ranges starts from the
+ saved state instead of rehashing from the start of the file.
+ Checkpoints belong to the mmapfile and are freed with it.
+ **************************************/
+#define SEAL_DIGEST_CP_MAX 16 /* checkpoints per file */
+#define SEAL_DIGEST_CP_MIN (64*1024) /* don't bother saving small prefixes */
+
+struct sealdigestcp
+  {
+  struct sealdigestcp *Next;
+  const EVP_MD *md;
+  EVP_MD_CTX *Ctx; // state after hashing all ranges
+  size_t *Range; // pairs of start,end
+  size_t Count; // number of pairs
+  size_t Bytes; // total bytes hashed
+  };
+typedef struct sealdigestcp sealdigestcp;
+
+#pragma GCC visibility push(hidden)
+/**************************************
+ _SealDigestResume(): Find the best checkpoint for a list of ranges.
+ A checkpoint matches when all of its ranges match, except the
+ last one may end early (the rest of that range is still needed).
+ Returns: checkpoint or NULL.
+ **************************************/
+sealdigestcp *	_SealDigestResume	(mmapfile *Mmap, const EVP_MD *md, size_t Count, const size_t *Range)
+{
+  sealdigestcp *cp, *Best=NULL;
+  size_t k;
+
+  for(cp=Mmap->Checkpoint; cp; cp=cp->Next)
+    {
+    if ((cp->md != md) || (cp->Count > Count)) { continue; }
+    if (Best && (cp->Bytes <= Best->Bytes)) { continue; }
+    k = cp->Count*2;
+    if (memcmp(cp->Range,Range,(k-1)*sizeof(size_t))) { continue; } // different ranges
+    if (cp->Range[k-1] > Range[k-1]) { continue; } // went too far
+    Best = cp;
+    }
+  return(Best);
+} /* _SealDigestResume() */
+
+/**************************************
+ _SealDigestSave(): Save a checkpoint after hashing Count ranges.
+ **************************************/
+void	_SealDigestSave	(mmapfile *Mmap, const EVP_MD *md, EVP_MD_CTX *Ctx, size_t Count, const size_t *Range, size_t Bytes)
+{
+  sealdigestcp *cp;
+  size_t n=0;
+
+  for(cp=Mmap->Checkpoint; cp; cp=cp->Next)
+    {
+    n++;
+    if ((cp->md == md) && (cp->Count == Count) &&
+	!memcmp(cp->Range,Range,Count*2*sizeof(size_t)))
+	{ return; } // already have it
+    }
+  if (n >= SEAL_DIGEST_CP_MAX) { return; } // enough
+
+  cp = (sealdigestcp*)calloc(1,sizeof(sealdigestcp));
+  if (!cp) { return; } // not fatal; just slower
+  cp->Ctx = EVP_MD_CTX_new();
+  cp->Range = (size_t*)malloc(Count*2*sizeof(size_t));
+  if (!cp->Ctx || !cp->Range || !EVP_MD_CTX_copy_ex(cp->Ctx,Ctx))
+    {
+    EVP_MD_CTX_free(cp->Ctx);
+    free(cp->Range);
+    free(cp);
+    return;
+    }
+  memcpy(cp->Range,Range,Count*2*sizeof(size_t));
+  cp->md = md;
+  cp->Count = Count;
+  cp->Bytes = Bytes;
+  cp->Next = Mmap->Checkpoint;
+  Mmap->Checkpoint = cp;
+} /* _SealDigestSave() */
+
+/**************************************
+ _SealDigestUpdate(): Hash bytes Start to End of the file.
+ Hashes in windows, asking for the next window ahead of time
+ so reading overlaps hashing.
+ **************************************/
+#define SEAL_DIGEST_WINDOW (8*1024*1024)
+void	_SealDigestUpdate	(EVP_MD_CTX *Ctx, mmapfile *Mmap, size_t Start, size_t End)
+{
+  size_t Len;
+
+  for( ; Start < End; Start += Len)
+    {
+    Len = End-Start;
+    if (Len > SEAL_DIGEST_WINDOW) { Len = SEAL_DIGEST_WINDOW; }
+    if (Start+Len < End) { MmapWillNeed(Mmap,Start+Len,SEAL_DIGEST_WINDOW); }
+    EVP_DigestUpdate(Ctx,Mmap->mem+Start,Len);
+    SealStatInc(SEAL_COUNT_HASHED,Len);
+    }
+} /* _SealDigestUpdate() */
+
+/**************************************
+ _SealDigestRanges(): Hash the ranges in '@digestrange'.
+ Resumes from a checkpoint when possible.
+ Stores the digest in Digest (at least EVP_MD_size(md) bytes).
+ **************************************/
+void	_SealDigestRanges	(sealfield *Rec, mmapfile *Mmap, const EVP_MD *md, byte *Digest, unsigned int *DigestLen)
+{
+  EVP_MD_CTX *Ctx;
+  sealdigestcp *cp;
+  size_t *Range;
+  size_t Count, i, Start, Bytes=0;
+
+  Range = SealGetIarray(Rec,"@digestrange");
+  Count = SealGetSize(Rec,"@digestrange") / (2*sizeof(size_t));
+
+  Ctx = EVP_MD_CTX_new();
+  i=0;
+  Start = Count ? Range[0] : 0;
+  cp = Count ? _SealDigestResume(Mmap,md,Count,Range) : NULL;
+  if (cp && EVP_MD_CTX_copy_ex(Ctx,cp->Ctx))
+    {
+    i = cp->Count-1; // continue the last range
+    Start = cp->Range[i*2+1];
+    Bytes = cp->Bytes;
+    }
+  else { EVP_DigestInit(Ctx,md); }
+
+  for( ; i < Count; i++)
+    {
+    if (Range[i*2+1] > Start)
+      {
+      _SealDigestUpdate(Ctx,Mmap,Start,Range[i*2+1]);
+      Bytes += Range[i*2+1]-Start;
+      }
+    if (Bytes >= SEAL_DIGEST_CP_MIN) { _SealDigestSave(Mmap,md,Ctx,i+1,Range,Bytes); }
+    if (i+1 < Count) { Start = Range[i*2+2]; }
+    }
+
+  EVP_DigestFinal(Ctx,Digest,DigestLen);
+  EVP_MD_CTX_free(Ctx);
+} /* _SealDigestRanges() */
+#pragma GCC visibility pop
+
+/**************************************
+ SealDigestFree(): Discard saved digest checkpoints.
+ Called when the file is unmapped or modified.
+ **************************************/
+void	SealDigestFree	(mmapfile *Mmap)
+{
+  sealdigestcp *cp;
+
+  if (!Mmap) { return; }
+  while(Mmap->Checkpoint)
+    {
+    cp = Mmap->Checkpoint;
+    Mmap->Checkpoint = cp->Next;
+    EVP_MD_CTX_free(cp->Ctx);
+    free(cp->Range);
+    free(cp);
+    }
+} /* SealDigestFree() */
+
+/**************************************
+ SealDigestSeed(): Save the hash of the file's first End bytes.
+ Used when the bytes were hashed while the file was written,
+ so a digest starting with F~End does not need to re-read them.
+ Saved at any size (SEAL_DIGEST_CP_MIN only applies to ranges
+ that SealDigest hashes itself).
+ **************************************/
+void	SealDigestSeed	(mmapfile *Mmap, const EVP_MD *md, EVP_MD_CTX *Ctx, size_t End)
+{
+  size_t Range[2];
+
+  if (!Mmap || !md || !Ctx || (End > Mmap->memsize)) { return; }
+  Range[0] = 0;
+  Range[1] = End;
+  _SealDigestSave(Mmap,md,Ctx,1,Range,End);
+} /* SealDigestSeed() */
+
 /**************************************
  RangeErrorCheck(): Is the computed range valid?
  Sets error as needed.
@@ -47,6 +232,8 @@ sealfield *	RangeErrorCheck	(sealfield *Rec, uint64_t sum[2], mmapfile *Mmap)
  Computes the digest and stores binary data in @digest.
  Stores the byte range in '@digestrange'.
  Any error messages are stored in @error.
+ The ranges are collected first and hashed at the end,
+ so shared prefixes can reuse saved checkpoints.
  **************************************/
 sealfield *	SealDigest	(sealfield *Rec, mmapfile *Mmap)
 {
@@ -57,6 +244,7 @@ sealfield *	SealDigest	(sealfield *Rec, mmapfile *Mmap)
   size_t *p; // start and end of the previous signature
   uint32_t seg[2]; // for tracking the segment (debugging)
   int state; // finite state machine
+  double Start; // for --stats
 
   // Should never happen
   if (!Rec || !Mmap) { return(Rec); }
@@ -83,9 +271,6 @@ sealfield *	SealDigest	(sealfield *Rec, mmapfile *Mmap)
     return(Rec);
     }
 
-  EVP_MD_CTX* ctx64 = EVP_MD_CTX_new();
-  EVP_DigestInit(ctx64, mdf());
-
   /* Parse the byte string! */
   const char *ValidChar[]=
     {
@@ -98,7 +283,8 @@ sealfield *	SealDigest	(sealfield *Rec, mmapfile *Mmap)
     "+-,", // finished reading offset (+- are for continuation)
     "pPsSfF0123456789", // after +/-
     };
-  int i,acc;
+  int i;
+  int64_t acc; // offsets can be past 2 GB
   uint64_t sum[2]; // total and accumulator
   int Addsym=1; // for addition (-1 for subtraction)
   state=acc=sum[0]=sum[1]=0;
@@ -225,7 +411,6 @@ DEBUGWHERE();
 	{
 	Rec = SealAddI(Rec,"@digestrange",sum[0]);
 	Rec = SealAddI(Rec,"@digestrange",sum[1]);
-	EVP_DigestUpdate(ctx64,Mmap->mem+sum[0],sum[1]-sum[0]);
 	//DEBUGPRINT("Segment: seg=%d '%.*s', range: %u-%u (0x%x - 0x%x)",state,(int)(seg[1]-seg[0]),b+seg[0],(uint)sum[0],(uint)sum[1],(uint)sum[0],(uint)sum[1]);
 	}
       state=acc=sum[0]=sum[1]=0; Addsym=1;
@@ -244,21 +429,21 @@ DEBUGWHERE();
 	{
 	Rec = SealAddI(Rec,"@digestrange",sum[0]);
 	Rec = SealAddI(Rec,"@digestrange",sum[1]);
-	EVP_DigestUpdate(ctx64,Mmap->mem+sum[0],sum[1]-sum[0]);
 	//DEBUGPRINT("Segment: seg=%d '%.*s', range: %u-%u (0x%x - 0x%x)",state,(int)(seg[1]-seg[0]),b+seg[0],(uint)sum[0],(uint)sum[1],(uint)sum[0],(uint)sum[1]);
 	}
     }
-  else if (state == 3) // start of next range and then ends
-    {
-    sum[1] = Mmap->memsize;
-    Rec = RangeErrorCheck(Rec,sum,Mmap);
-    if (SealSearch(Rec,"@error")) { goto Abort; }
-    }
-  else if (state == 5) // end of range
+  else if ((state == 3) || (state == 5)) // end of range is a number (e.g., 's~s+3') or missing
     {
-    sum[1] += acc*Addsym;
+    // Same as the end of a range at ","
+    if ((state==3) && (acc==0)) { sum[1]=Mmap->memsize; }
+    else { sum[1] += acc*Addsym; }
     Rec = RangeErrorCheck(Rec,sum,Mmap);
     if (SealSearch(Rec,"@error")) { goto Abort; }
+    if (sum[1] > sum[0])
+	{
+	Rec = SealAddI(Rec,"@digestrange",sum[0]);
+	Rec = SealAddI(Rec,"@digestrange",sum[1]);
+	}
     }
   else // invalid end state
     {
@@ -273,18 +458,19 @@ DEBUGWHERE();
   mdsize = EVP_MD_size(mdf()); // digest size
   Rec = SealAlloc(Rec,"@digest",mdsize,'b'); // binary digest
   digestbin = SealSearch(Rec,"@digest");
-  EVP_DigestFinal(ctx64,digestbin->Value,&mdsize); // store the digest
+  Start = SealStatStart();
+  _SealDigestRanges(Rec,Mmap,mdf(),digestbin->Value,&mdsize); // store the digest
+  SealStatStop(SEAL_PHASE_DIGEST,Start);
 
   if (Verbose > 1)
     {
     unsigned int i;
-    printf("DEBUG Digest: ");
-    for(i=0; i < mdsize; i++) { printf("%02x",digestbin->Value[i]); }
-    printf("\n");
+    SealPrintf("DEBUG Digest: ");
+    for(i=0; i < mdsize; i++) { SealPrintf("%02x",digestbin->Value[i]); }
+    SealPrintf("\n");
     }
 
 Abort:
-  EVP_MD_CTX_free(ctx64);
   return(Rec);
 } /* SealDigest() */
 
@@ -369,15 +555,14 @@ sealfield *	SealDoubleDigest	(sealfield *Rec)
   EVP_MD_CTX_free(ctx64);
 
   // Replace vf with the new digest
-  digestbin->ValueLen = mdsize;
-  free(digestbin->Value);
-  digestbin->Value = (byte*)mdval;
+  SealSetValue(digestbin,mdsize,mdval);
+  free(mdval);
   if (Verbose > 1)
     {
     unsigned int i;
-    printf("DEBUG Double Digest: ");
-    for(i=0; i < mdsize; i++) { printf("%02x",digestbin->Value[i]); }
-    printf("\n");
+    SealPrintf("DEBUG Double Digest: ");
+    for(i=0; i < mdsize; i++) { SealPrintf("%02x",digestbin->Value[i]); }
+    SealPrintf("\n");
     }
 
   return(Rec);
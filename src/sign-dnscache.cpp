@@ -0,0 +1,259 @@
+/************************************************
+ SEAL: Cache for DNS public key lookups.
+ See LICENSE
+
+ Every SEAL record names a domain (d=) with the public key.
+ A batch of files usually uses a handful of domains, so look
+ each key up once and remember it for the rest of the run.
+
+ The cache is keyed on "seal:d:kv:ka:uid" (the same key as
+ '@dnscache') and stores:
+   expires p=public r=revoke
+ 'p=' and 'r=' are omitted when they are not present.
+ An entry without 'p=' or 'r=' is a negative result: DNS had
+ no matching key.  Negative results are cached too, so
+ unsigned domains do not cause repeated lookups.
+
+ The cache is shared by all threads (parallel jobs).
+ It outlives every file, so entries always come from the heap
+ (never from a per-file arena).
+ Optionally, it is loaded from and saved to a file
+ ('dnscachefile') so the results last across runs.
+ File format: one entry per line: key<TAB>value
+
+ Lookups in flight are tracked too (SealDNSCacheClaim).
+ When many files name the same domain, only one thread asks
+ DNS; the others wait for its answer.
+ ************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "seal.hpp"
+#include "sign.hpp"
+
+#pragma GCC visibility push(hidden)
+static sealfield *DNSCache=NULL;
+static pthread_mutex_t DNSCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static sealfield *DNSPending=NULL; // keys being looked up
+static pthread_cond_t DNSPendingDone = PTHREAD_COND_INITIALIZER;
+#pragma GCC visibility pop
+
+/********************************************************
+ SealDNSCacheGet(): Look up a key in the cache.
+ If found, sets '@public' and '@revoke' in Rec (as cached).
+ Sets Hit to true if the key was found (positive or negative).
+ Returns: Rec.
+ ********************************************************/
+sealfield *	SealDNSCacheGet	(sealfield *Rec, const char *Key, bool *Hit)
+{
+  char *Value, *Copy=NULL;
+  char *Tok, *Save;
+  time_t Expires;
+
+  *Hit = false;
+  if (!Key || !Key[0]) { return(Rec); }
+
+  pthread_mutex_lock(&DNSCacheLock);
+  Value = SealGetText(DNSCache,Key);
+  if (Value)
+    {
+    Expires = (time_t)strtoull(Value,NULL,10);
+    if (Expires >= time(NULL)) { Copy = strdup(Value); } // still valid
+    else { DNSCache = SealDel(DNSCache,Key); } // expired
+    }
+  pthread_mutex_unlock(&DNSCacheLock);
+  if (!Copy) { return(Rec); }
+
+  // Found it!
+  *Hit = true;
+  Tok = strtok_r(Copy," ",&Save); // skip expiration
+  for(Tok = strtok_r(NULL," ",&Save); Tok; Tok = strtok_r(NULL," ",&Save))
+    {
+    if (!strncmp(Tok,"p=",2)) { Rec = SealSetText(Rec,"@public",Tok+2); }
+    else if (!strncmp(Tok,"r=",2)) { Rec = SealSetText(Rec,"@revoke",Tok+2); }
+    }
+  free(Copy);
+  return(Rec);
+} /* SealDNSCacheGet() */
+
+/********************************************************
+ SealDNSCacheSet(): Store the lookup results for a key.
+ Uses '@public' and '@revoke' from Rec.
+ If neither exists, then it stores a negative result.
+ TTL is in seconds and is capped at SEAL_DNS_MAXTTL so
+ revoked keys are eventually noticed.
+ ********************************************************/
+void	SealDNSCacheSet	(sealfield *Rec, const char *Key, uint32_t TTL)
+{
+  char Expires[32];
+  sealfield *Entry=NULL;
+  char *Str;
+  sealarena *Arena;
+
+  if (!Key || !Key[0]) { return; }
+  if (TTL > SEAL_DNS_MAXTTL) { TTL = SEAL_DNS_MAXTTL; }
+
+  snprintf(Expires,sizeof(Expires),"%llu",(unsigned long long)(time(NULL) + TTL));
+  Entry = SealSetText(Entry,"v",Expires);
+  Str = SealGetText(Rec,"@public");
+  if (Str) { Entry = SealAddText(Entry,"v"," p="); Entry = SealAddText(Entry,"v",Str); }
+  Str = SealGetText(Rec,"@revoke");
+  if (Str) { Entry = SealAddText(Entry,"v"," r="); Entry = SealAddText(Entry,"v",Str); }
+
+  pthread_mutex_lock(&DNSCacheLock);
+  Arena = SealArenaUse(NULL);
+  DNSCache = SealSetText(DNSCache,Key,SealGetText(Entry,"v"));
+  SealArenaUse(Arena);
+  pthread_mutex_unlock(&DNSCacheLock);
+  SealFree(Entry);
+} /* SealDNSCacheSet() */
+
+/********************************************************
+ SealDNSCacheClaim(): Claim a key for a DNS lookup.
+ If another thread is already looking it up, then either wait
+ for that lookup to finish (Wait=true) or give up (Wait=false).
+ Returns: true if the caller must do the lookup and then call
+ SealDNSCacheRelease().  false if the key is cached or was just
+ looked up (check the cache again) or is still pending (Wait=false).
+ ********************************************************/
+bool	SealDNSCacheClaim	(const char *Key, bool Wait)
+{
+  bool Claimed=false;
+  sealarena *Arena;
+
+  if (!Key || !Key[0]) { return(false); }
+
+  pthread_mutex_lock(&DNSCacheLock);
+  if (SealSearch(DNSPending,Key))
+    {
+    while(Wait && SealSearch(DNSPending,Key)) { pthread_cond_wait(&DNSPendingDone,&DNSCacheLock); }
+    }
+  else if (!SealSearch(DNSCache,Key))
+    {
+    Arena = SealArenaUse(NULL);
+    DNSPending = SealSetText(DNSPending,Key,"");
+    SealArenaUse(Arena);
+    Claimed=true;
+    }
+  pthread_mutex_unlock(&DNSCacheLock);
+  return(Claimed);
+} /* SealDNSCacheClaim() */
+
+/********************************************************
+ SealDNSCacheRelease(): Finish a claimed lookup.
+ Call SealDNSCacheSet() first (if the result is cacheable).
+ Wakes any threads waiting for the key.
+ ********************************************************/
+void	SealDNSCacheRelease	(const char *Key)
+{
+  sealarena *Arena;
+
+  if (!Key || !Key[0]) { return; }
+  pthread_mutex_lock(&DNSCacheLock);
+  Arena = SealArenaUse(NULL);
+  DNSPending = SealDel(DNSPending,Key);
+  SealArenaUse(Arena);
+  pthread_cond_broadcast(&DNSPendingDone);
+  pthread_mutex_unlock(&DNSCacheLock);
+} /* SealDNSCacheRelease() */
+
+/********************************************************
+ SealDNSCacheLoad(): Load the cache file ('dnscachefile').
+ Missing files are fine (nothing cached yet).
+ Expired entries are skipped.
+ ********************************************************/
+void	SealDNSCacheLoad	(sealfield *Args)
+{
+  FILE *fp;
+  char *fname;
+  char *Line=NULL, *Tab;
+  size_t LineMax=0;
+  ssize_t Len;
+  time_t Now;
+  sealarena *Arena;
+
+  fname = SealGetText(Args,"dnscachefile");
+  if (!fname || !fname[0]) { return; }
+  fp = fopen(fname,"rb");
+  if (!fp) { return; } // no cache yet
+
+  Now = time(NULL);
+  pthread_mutex_lock(&DNSCacheLock);
+  Arena = SealArenaUse(NULL);
+  while((Len = getline(&Line,&LineMax,fp)) > 0)
+    {
+    if (Line[Len-1]=='\n') { Line[--Len]='\0'; }
+    Tab = strchr(Line,'\t');
+    if (!Tab || (Tab==Line)) { continue; } // bad format; ignore it
+    Tab[0]='\0';
+    if ((time_t)strtoull(Tab+1,NULL,10) < Now) { continue; } // expired
+    DNSCache = SealSetText(DNSCache,Line,Tab+1);
+    }
+  SealArenaUse(Arena);
+  pthread_mutex_unlock(&DNSCacheLock);
+  free(Line);
+  fclose(fp);
+} /* SealDNSCacheLoad() */
+
+/********************************************************
+ SealDNSCacheSave(): Save the cache file ('dnscachefile').
+ Writes to a temporary file and renames it, so an
+ interrupted save never leaves a partial cache.
+ ********************************************************/
+void	SealDNSCacheSave	(sealfield *Args)
+{
+  FILE *fp;
+  char *fname;
+  sealfield *vf, *Tmp=NULL;
+  time_t Now;
+
+  fname = SealGetText(Args,"dnscachefile");
+  if (!fname || !fname[0]) { return; }
+
+  Tmp = SealSetText(Tmp,"fname",fname);
+  Tmp = SealAddText(Tmp,"fname",".tmp");
+  fp = fopen(SealGetText(Tmp,"fname"),"wb");
+  if (!fp)
+    {
+    fprintf(stderr,"WARNING: Unable to write DNS cache file (%s).\n",fname);
+    SealFree(Tmp);
+    return;
+    }
+
+  Now = time(NULL);
+  pthread_mutex_lock(&DNSCacheLock);
+  for(vf=DNSCache; vf; vf=vf->Next)
+    {
+    if ((time_t)strtoull((char*)vf->Value,NULL,10) < Now) { continue; } // expired
+    // Keys come from SEAL records; never write a key that breaks the format
+    if (memchr(vf->Field,'\t',vf->FieldLen) || memchr(vf->Field,'\n',vf->FieldLen)) { continue; }
+    fprintf(fp,"%s\t%s\n",vf->Field,(char*)vf->Value);
+    }
+  pthread_mutex_unlock(&DNSCacheLock);
+
+  if (fclose(fp) || rename(SealGetText(Tmp,"fname"),fname))
+    {
+    fprintf(stderr,"WARNING: Unable to save DNS cache file (%s).\n",fname);
+    unlink(SealGetText(Tmp,"fname"));
+    }
+  SealFree(Tmp);
+} /* SealDNSCacheSave() */
+
+/********************************************************
+ SealDNSCacheFree(): Release the cache.
+ ********************************************************/
+void	SealDNSCacheFree	()
+{
+  pthread_mutex_lock(&DNSCacheLock);
+  SealFree(DNSCache);
+  DNSCache=NULL;
+  SealFree(DNSPending);
+  DNSPending=NULL;
+  pthread_mutex_unlock(&DNSCacheLock);
+} /* SealDNSCacheFree() */
+
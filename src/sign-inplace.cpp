@@ -0,0 +1,305 @@
+/************************************************
+ SEAL: In-place signing.
+ See LICENSE
+
+ With "-O inplace", formats that add the record near the end
+ (PNG before IEND, RIFF and Matroska at the end) are signed
+ in the original file.  Only the new block and the bytes after
+ it are written; the rest of the file is never copied.
+
+ A crash part way through must not leave a damaged file.
+ Before anything changes, a journal ("file.sealjournal") saves
+ what will be overwritten:
+   magic "SEALJRN1"
+   dev, inode, original size (uint64 each)
+   header offset, header length, tail offset, tail length (uint64 each)
+   original header bytes, original tail bytes
+   magic "SEALDONE" (the journal is complete)
+ Then the writes happen in order:
+   1. journal written and synced
+   2. file grown (ftruncate), block and tail written
+   3. header (e.g., RIFF size) written, file synced
+   4. signature patched and synced (SealInPlaceCommit)
+   5. journal removed
+ If the journal exists, then the file may be part-way through
+ and SealInPlaceRecover() puts the original bytes back.
+ A journal without the end marker was never finished, so the
+ file was never touched.
+ ************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "seal.hpp"
+#include "files.hpp"
+#include "sign.hpp"
+
+#pragma GCC visibility push(hidden)
+#define JOURNAL_MAGIC	"SEALJRN1"
+#define JOURNAL_DONE	"SEALDONE"
+#define JOURNAL_FIELDS	7 // dev, inode, size, header offset, header length, tail offset, tail length
+
+/**************************************
+ _SealJournalName(): Name of the journal for a file.
+ Returns: false if the name does not fit.
+ **************************************/
+bool	_SealJournalName	(const char *Filename, char *Name, size_t NameMax)
+{
+  int Len;
+  Len = snprintf(Name,NameMax,"%s.sealjournal",Filename);
+  return((Len > 0) && ((size_t)Len < NameMax));
+} /* _SealJournalName() */
+
+/**************************************
+ _SealSyncDir(): Make a create/remove in the file's directory durable.
+ **************************************/
+void	_SealSyncDir	(const char *Filename)
+{
+  char Dir[PATH_MAX];
+  const char *Slash;
+  int fd;
+
+  Slash = strrchr(Filename,'/');
+  if (!Slash) { strcpy(Dir,"."); }
+  else if (Slash == Filename) { strcpy(Dir,"/"); }
+  else if ((size_t)(Slash-Filename) < sizeof(Dir))
+    {
+    memcpy(Dir,Filename,Slash-Filename);
+    Dir[Slash-Filename]='\0';
+    }
+  else { return; }
+
+  fd = open(Dir,O_RDONLY|O_DIRECTORY);
+  if (fd < 0) { return; }
+  fsync(fd);
+  close(fd);
+} /* _SealSyncDir() */
+
+/**************************************
+ _SealPwrite(): Write all bytes at an offset.
+ Returns: false on failure.
+ **************************************/
+bool	_SealPwrite	(int fd, const void *Data, size_t Len, off64_t Offset)
+{
+  ssize_t w;
+
+  while(Len > 0)
+    {
+    w = pwrite64(fd,Data,Len,Offset);
+    if ((w < 0) && (errno == EINTR)) { continue; }
+    if (w <= 0) { return(false); }
+    Data = (const byte*)Data + w;
+    Len -= w;
+    Offset += w;
+    }
+  return(true);
+} /* _SealPwrite() */
+#pragma GCC visibility pop
+
+/**************************************
+ SealInPlaceWrite(): Add the block to the input file.
+ Called by SealInsert() when '@inplace' is set.
+ Iov is SealInsert()'s layout:
+   [0] and [2] input before the block: already in the file
+   [1] replacement header: written at HeaderPos
+   [3] padding, [4] the block, [5] input after the block:
+       written starting at Prefix (the end of [2])
+ Aborts on failure; a journal is left for recovery.
+ **************************************/
+void	SealInPlaceWrite	(const char *Filename, mmapfile *MmapIn, struct iovec *Iov, size_t HeaderPos, size_t Prefix)
+{
+  char Journal[PATH_MAX];
+  uint64_t Field[JOURNAL_FIELDS];
+  byte *Tail;
+  size_t TailLen, NewSize;
+  struct stat64 st;
+  off64_t Offset;
+  FILE *fp, *Fio;
+  int fd, i;
+
+  if (!_SealJournalName(Filename,Journal,sizeof(Journal)))
+    {
+    fprintf(stderr,"ERROR: Filename too long for in-place signing (%s). Aborting.\n",Filename);
+    SealFatal();
+    }
+
+  // The tail is about to be overwritten; keep a copy
+  TailLen = Iov[5].iov_len;
+  Tail = (byte*)malloc(TailLen+1);
+  if (!Tail)
+    {
+    fprintf(stderr,"ERROR: Unable to allocate in-place tail. Aborting.\n");
+    SealFatal();
+    }
+  SealCleanupPush(free,Tail);
+  memcpy(Tail,Iov[5].iov_base,TailLen);
+  Iov[5].iov_base = Tail;
+
+  // The file is only written with pwrite; FILE is for SealCleanupPush()
+  Fio = fopen(Filename,"rb+");
+  fd = Fio ? fileno(Fio) : -1;
+  if (Fio) { SealCleanupPush(SealFileCleanup,Fio); }
+  if ((fd < 0) || fstat64(fd,&st))
+    {
+    fprintf(stderr,"ERROR: Cannot open file for in-place signing (%s). Aborting.\n",Filename);
+    SealFatal();
+    }
+
+  // 1. Journal: everything needed to undo the changes
+  Field[0] = st.st_dev;
+  Field[1] = st.st_ino;
+  Field[2] = MmapIn->memsize;
+  Field[3] = HeaderPos;
+  Field[4] = Iov[1].iov_len;
+  Field[5] = Prefix;
+  Field[6] = TailLen;
+  fp = fopen(Journal,"wb");
+  if (fp) { SealCleanupPush(SealFileCleanup,fp); }
+  if (!fp ||
+      (fwrite(JOURNAL_MAGIC,8,1,fp) != 1) ||
+      (fwrite(Field,sizeof(Field),1,fp) != 1) ||
+      (Iov[1].iov_len && (fwrite(MmapIn->mem+HeaderPos,Iov[1].iov_len,1,fp) != 1)) ||
+      (TailLen && (fwrite(Tail,TailLen,1,fp) != 1)) ||
+      (fwrite(JOURNAL_DONE,8,1,fp) != 1) ||
+      fflush(fp) || fsync(fileno(fp)))
+    {
+    fprintf(stderr,"ERROR: Cannot write the in-place journal (%s). Aborting.\n",Journal);
+    if (fp) { SealCleanupPop(fp); fclose(fp); }
+    unlink(Journal); // the file has not changed
+    SealFatal();
+    }
+  SealCleanupPop(fp);
+  fclose(fp);
+  _SealSyncDir(Journal);
+
+  // 2. Grow the file and write everything after the prefix
+  NewSize = Prefix;
+  for(i=3; i < 6; i++) { NewSize += Iov[i].iov_len; }
+  if (ftruncate64(fd,NewSize))
+    {
+    fprintf(stderr,"ERROR: Cannot extend file for in-place signing (%s). Aborting.\n",Filename);
+    SealFatal();
+    }
+  for(i=3, Offset=Prefix; i < 6; i++)
+    {
+    if (!_SealPwrite(fd,Iov[i].iov_base,Iov[i].iov_len,Offset))
+	{
+	fprintf(stderr,"ERROR: In-place write failed (%s); sign it again to restore it. Aborting.\n",Filename);
+	SealFatal();
+	}
+    Offset += Iov[i].iov_len;
+    }
+
+  // 3. Header last: sizes only cover data that is already there
+  if (!_SealPwrite(fd,Iov[1].iov_base,Iov[1].iov_len,HeaderPos) || fdatasync(fd))
+    {
+    fprintf(stderr,"ERROR: In-place header update failed (%s); sign it again to restore it. Aborting.\n",Filename);
+    SealFatal();
+    }
+  SealCleanupPop(Fio);
+  fclose(Fio);
+  SealCleanupPop(Tail);
+  free(Tail);
+  Iov[5].iov_base = NULL; // the copy is gone
+} /* SealInPlaceWrite() */
+
+/**************************************
+ SealInPlaceCommit(): The signature is in the file; drop the journal.
+ Does nothing unless '@inplace' is set.
+ **************************************/
+void	SealInPlaceCommit	(sealfield *Rec, mmapfile *MmapOut)
+{
+  char Journal[PATH_MAX];
+  const char *Filename;
+
+  if (!SealGetText(Rec,"@inplace")) { return; }
+  Filename = SealGetText(Rec,"@FilenameOut");
+  if (!Filename || !_SealJournalName(Filename,Journal,sizeof(Journal))) { return; }
+
+  // 4. Signature must be on disk before the journal goes away
+  if (msync(MmapOut->mem,MmapOut->memsize,MS_SYNC))
+    {
+    fprintf(stderr,"ERROR: Cannot sync the signed file (%s). Aborting.\n",Filename);
+    SealFatal();
+    }
+
+  // 5. Done
+  unlink(Journal);
+  _SealSyncDir(Journal);
+} /* SealInPlaceCommit() */
+
+/**************************************
+ SealInPlaceRecover(): Undo an interrupted in-place signature.
+ Call before opening a file for in-place signing.
+ Returns: true if the file was restored.
+ **************************************/
+bool	SealInPlaceRecover	(const char *Filename)
+{
+  char Journal[PATH_MAX];
+  char Magic[8];
+  uint64_t Field[JOURNAL_FIELDS];
+  byte *Data=NULL;
+  size_t DataLen;
+  struct stat64 st;
+  FILE *fp;
+  int fd;
+  bool Ok;
+
+  if (!_SealJournalName(Filename,Journal,sizeof(Journal))) { return(false); }
+  fp = fopen(Journal,"rb");
+  if (!fp) { return(false); } // nothing to recover (the usual case)
+
+  // Read and check the journal
+  Ok = (fread(Magic,8,1,fp) == 1) && !memcmp(Magic,JOURNAL_MAGIC,8) &&
+       (fread(Field,sizeof(Field),1,fp) == 1) &&
+       (Field[3] + Field[4] <= Field[5]) && (Field[5] + Field[6] == Field[2]);
+  if (Ok)
+    {
+    DataLen = Field[4] + Field[6];
+    Data = (byte*)malloc(DataLen+1);
+    Ok = Data && (!DataLen || (fread(Data,DataLen,1,fp) == 1)) &&
+         (fread(Magic,8,1,fp) == 1) && !memcmp(Magic,JOURNAL_DONE,8);
+    }
+  fclose(fp);
+  if (!Ok) // unfinished journal: the file was never changed
+    {
+    free(Data);
+    unlink(Journal);
+    return(false);
+    }
+
+  // Only restore the same file
+  if (stat64(Filename,&st) || ((uint64_t)st.st_dev != Field[0]) || ((uint64_t)st.st_ino != Field[1]))
+    {
+    SealPrintf(" WARNING: Ignoring stale in-place journal (%s).\n",Journal);
+    free(Data);
+    unlink(Journal);
+    return(false);
+    }
+
+  // Put back the original size, header, and tail
+  fd = open(Filename,O_RDWR);
+  Ok = (fd >= 0) &&
+       !ftruncate64(fd,Field[2]) &&
+       _SealPwrite(fd,Data+Field[4],Field[6],Field[5]) &&
+       _SealPwrite(fd,Data,Field[4],Field[3]) &&
+       !fdatasync(fd);
+  if (fd >= 0) { close(fd); }
+  free(Data);
+  if (!Ok)
+    {
+    fprintf(stderr,"ERROR: Cannot restore '%s' from its in-place journal. Aborting.\n",Filename);
+    SealFatal();
+    }
+  unlink(Journal);
+  _SealSyncDir(Journal);
+  SealPrintf(" WARNING: Restored '%s' after an interrupted in-place signature.\n",Filename);
+  return(true);
+} /* SealInPlaceRecover() */
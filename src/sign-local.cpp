@@ -37,8 +37,8 @@
 #include <ctype.h> // for isdigit()
 #include <time.h> // for timestamp
 #include <sys/time.h> // for timestamp
-#include <math.h> // for pow
 #include <fcntl.h>  // for access()
+#include <pthread.h> // for parallel jobs
 
 #include "seal.hpp"
 #include "files.hpp"
@@ -50,6 +50,7 @@
 #include <openssl/encoder.h>
 #include <openssl/buffer.h> // for BUF_MEM
 #include <openssl/evp.h>
+#include <openssl/provider.h> // for HSM and accelerator providers
 #include <openssl/rsa.h> // rsa algorithm
 #include <openssl/ec.h> // elliptic curve algorithms
 #include <openssl/x509.h>
@@ -57,15 +58,133 @@
 // Include ed25519? (Disabled; doesn't work yet.)
 #define INC_ED25519 0
 
-EVP_PKEY *PrivateKey=NULL;
+/*****
+ The private key is loaded once and then shared (read-only)
+ by every signing thread.  Only loading needs the lock.
+ KeyGen changes every time a key is loaded, so per-thread
+ contexts for an old key are never reused.
+ *****/
+static EVP_PKEY *PrivateKey=NULL;
+static __thread EVP_PKEY *PrivateKeyUse=NULL; // per-thread override (SealUsePrivateKey)
+static unsigned int KeyGen=0;
+static pthread_mutex_t PrivateKeyLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*****
+ Each signing thread keeps its own sign context (initialized
+ with padding and digest) and reuses it for every file.
+ It also remembers the formatted date for the current second.
+ *****/
+#pragma GCC visibility push(hidden)
+typedef struct
+  {
+  EVP_PKEY_CTX *Ctx;
+  const EVP_MD *md; // digest the context was initialized for
+  unsigned int KeyGen; // key the context was initialized for
+  EVP_PKEY *Key; // key the context was made from (it holds a reference)
+  time_t DateSec; // second that Date was formatted for
+  char Date[16]; // "YYYYMMDDhhmmss"
+  } sealsignctx;
+
+static pthread_once_t SignOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t SignKey;
+
+// Optional providers (e.g., HSM or hardware-accelerated crypto)
+#define SEAL_MAX_PROVIDERS 8
+static OSSL_PROVIDER *Provider[SEAL_MAX_PROVIDERS];
+static int ProviderCount=0;
+
+/**************************************
+ _SealSignCtxFree(): Release a thread's sign context.
+ Called when the thread exits.
+ **************************************/
+void	_SealSignCtxFree	(void *Data)
+{
+  sealsignctx *T = (sealsignctx*)Data;
+  if (!T) { return; }
+  if (T->Ctx) { EVP_PKEY_CTX_free(T->Ctx); }
+  free(T);
+} /* _SealSignCtxFree() */
+
+/**************************************
+ _SealSignInit(): One-time setup for per-thread contexts.
+ **************************************/
+void	_SealSignInit	()
+{
+  pthread_key_create(&SignKey,_SealSignCtxFree);
+} /* _SealSignInit() */
+
+/**************************************
+ _SealSignCtx(): Get this thread's sign context.
+ Returns: context (never NULL; aborts on failure).
+ **************************************/
+sealsignctx *	_SealSignCtx	()
+{
+  sealsignctx *T;
+
+  pthread_once(&SignOnce,_SealSignInit);
+  T = (sealsignctx*)pthread_getspecific(SignKey);
+  if (T) { return(T); }
+  T = (sealsignctx*)calloc(1,sizeof(sealsignctx));
+  if (!T)
+    {
+    fprintf(stderr,"ERROR: Unable to allocate the sign context.\n");
+    SealFatal();
+    }
+  pthread_setspecific(SignKey,T);
+  return(T);
+} /* _SealSignCtx() */
+
+/**************************************
+ _SealLoadProviders(): Load the OpenSSL providers in 'provider'.
+ The value is a comma-separated list of provider names.
+ The built-in providers remain available as a fallback.
+ **************************************/
+void	_SealLoadProviders	(sealfield *Args)
+{
+  char *List, *Name, *Save;
+
+  if (ProviderCount) { return; } // already loaded
+  List = SealGetText(Args,"provider");
+  if (!List || !List[0]) { return; }
+  List = strdup(List);
+  for(Name = strtok_r(List,",",&Save); Name; Name = strtok_r(NULL,",",&Save))
+    {
+    if (ProviderCount >= SEAL_MAX_PROVIDERS)
+      {
+      fprintf(stderr,"ERROR: Too many providers. Aborting.\n");
+      SealFatal();
+      }
+    Provider[ProviderCount] = OSSL_PROVIDER_try_load(NULL,Name,1);
+    if (!Provider[ProviderCount])
+      {
+      fprintf(stderr,"ERROR: Unable to load the provider (%s). Aborting.\n",Name);
+      SealFatal();
+      }
+    ProviderCount++;
+    }
+  free(List);
+} /* _SealLoadProviders() */
+#pragma GCC visibility pop
 
 /********************************************************
  SealFreePrivateKey(): release the private key.
+ Also releases this thread's sign context and any providers.
+ (Other threads release their contexts when they exit.)
  ********************************************************/
 void	SealFreePrivateKey	()
 {
+  sealsignctx *T;
+
+  pthread_once(&SignOnce,_SealSignInit);
+  T = (sealsignctx*)pthread_getspecific(SignKey);
+  if (T) { _SealSignCtxFree(T); pthread_setspecific(SignKey,NULL); }
   if (PrivateKey) { EVP_PKEY_free(PrivateKey); }
   PrivateKey=NULL;
+  while(ProviderCount > 0)
+    {
+    ProviderCount--;
+    OSSL_PROVIDER_unload(Provider[ProviderCount]);
+    }
 } /* SealFreePrivateKey() */
 
 /********************************************************
@@ -82,55 +201,57 @@ bool    SealIsLocal       (sealfield *Args)
 } /* SealIsLocal() */
 
 /**************************************
- SealLoadPrivateKey(): Load the private key for signing.
+ SealReadPrivateKey(): Read the private key for signing.
  Depends on OpenSSL 3.x.
  Returns: keypair or exits
- Stores keypair in global!
- Caller must call SealFreePrivateKey()!
+ Caller must EVP_PKEY_free() it.
  **************************************/
-EVP_PKEY *	SealLoadPrivateKey	(sealfield *Args)
+EVP_PKEY *	SealReadPrivateKey	(sealfield *Args)
 {
+  EVP_PKEY *Key=NULL;
   FILE *fp;
   OSSL_DECODER_CTX *decoder=NULL;
   unsigned char *pwd;
   char *keyfile, *keyalg;
+  char *propq; // provider property query
 
-  // Only load it once
-  if (PrivateKey) { SealFreePrivateKey(); }
+  _SealLoadProviders(Args);
+  propq = SealGetText(Args,"propq");
+  if (propq && !propq[0]) { propq=NULL; }
 
   keyfile = SealGetText(Args,"keyfile");
   if (!keyfile)
     {
     fprintf(stderr,"ERROR: No keyfile defined.\n");
-    exit(1);
+    SealFatal();
     }
 
   keyalg = SealGetText(Args,"ka");
   if (keyalg && !strcmp(keyalg,"rsa"))
     {
-    decoder = OSSL_DECODER_CTX_new_for_pkey(&PrivateKey, "PEM", NULL, "RSA", EVP_PKEY_KEYPAIR, NULL, NULL);
+    decoder = OSSL_DECODER_CTX_new_for_pkey(&Key, "PEM", NULL, "RSA", EVP_PKEY_KEYPAIR, NULL, propq);
     }
 #if INC_ED25519
   else if (keyalg && !strcmp(keyalg,"ed25519"))
     {
-    decoder = OSSL_DECODER_CTX_new_for_pkey(&PrivateKey, "PEM", NULL, "ED25519", EVP_PKEY_KEYPAIR, NULL, NULL);
+    decoder = OSSL_DECODER_CTX_new_for_pkey(&Key, "PEM", NULL, "ED25519", EVP_PKEY_KEYPAIR, NULL, propq);
     }
 #endif
   // If more algorithms are supported, this needs to be updated.
   else if (keyalg) // && !strcmp(keyalg,"ec"))
     {
     // everything else currently supported is ec.
-    decoder = OSSL_DECODER_CTX_new_for_pkey(&PrivateKey, "PEM", NULL, "EC", EVP_PKEY_KEYPAIR, NULL, NULL);
+    decoder = OSSL_DECODER_CTX_new_for_pkey(&Key, "PEM", NULL, "EC", EVP_PKEY_KEYPAIR, NULL, propq);
     }
   else
     {
     fprintf(stderr,"ERROR: No key algorithm defined.\n");
-    exit(1);
+    SealFatal();
     }
   if (decoder == NULL)
     {
     fprintf(stderr,"ERROR: Unable to open context for private key.\n");
-    exit(1);
+    SealFatal();
     }
 
   // Open private key file
@@ -138,7 +259,7 @@ EVP_PKEY *	SealLoadPrivateKey	(sealfield *Args)
   if (!fp)
     {
     fprintf(stderr,"ERROR: Unable to open private key file (%s).\n",keyfile);
-    exit(1);
+    SealFatal();
     }
 
   // Decode from file!
@@ -158,7 +279,7 @@ EVP_PKEY *	SealLoadPrivateKey	(sealfield *Args)
       if (OSSL_DECODER_CTX_set_passphrase(decoder,pwd,strlen((char*)pwd)) != 1)
 	{
 	fprintf(stderr,"ERROR: Unable to set the password.\n");
-	exit(1);
+	SealFatal();
 	}
       free(pwd);
       rc = OSSL_DECODER_from_fp(decoder, fp); // decode with password
@@ -168,14 +289,71 @@ EVP_PKEY *	SealLoadPrivateKey	(sealfield *Args)
   if (rc != 1)
     {
     fprintf(stderr,"ERROR: Unable to load private key file (%s).\n",keyfile);
-    exit(1);
+    SealFatal();
     }
 
   // If it got here, then it worked.
   OSSL_DECODER_CTX_free(decoder);
+  fclose(fp);
+  return(Key);
+} /* SealReadPrivateKey() */
+
+/**************************************
+ SealLoadPrivateKey(): Load the private key for signing.
+ Returns: keypair or exits
+ Stores keypair in global!
+ Caller must call SealFreePrivateKey()!
+ **************************************/
+EVP_PKEY *	SealLoadPrivateKey	(sealfield *Args)
+{
+  // Only load it once
+  if (PrivateKey) { SealFreePrivateKey(); }
+  PrivateKey = SealReadPrivateKey(Args);
+  KeyGen++; // any existing sign contexts are for the old key
   return(PrivateKey);
 } /* SealLoadPrivateKey() */
 
+/**************************************
+ SealUsePrivateKey(): Sign with Key in this thread.
+ This overrides the global key (e.g., for a libseal context).
+ NULL returns to the global key.
+ Returns: the previous key for this thread.
+ **************************************/
+EVP_PKEY *	SealUsePrivateKey	(EVP_PKEY *Key)
+{
+  EVP_PKEY *Prev = PrivateKeyUse;
+  PrivateKeyUse = Key;
+  return(Prev);
+} /* SealUsePrivateKey() */
+
+/**************************************
+ SealSignEncLen(): Compute the encoded signature size.
+ SigLen is the raw (binary) signature size.
+ DateLen is the length of the date string (0 if no date).
+ Aborts on an unknown signature format.
+ Returns: encoded length, including "date:".
+ **************************************/
+size_t	SealSignEncLen	(const char *sf, size_t SigLen, size_t DateLen)
+{
+  size_t enclen=0;
+
+  if (strstr(sf,"base64"))
+    {
+    // base64 is a 4/3 expansion with padding to a multiple of 4
+    enclen = ((SigLen+2)/3) * 4;
+    }
+  else if (strstr(sf,"bin")) { enclen = SigLen; } // bad choice
+  else if (strstr(sf,"hex")) { enclen = SigLen*2; }
+  else if (strstr(sf,"HEX")) { enclen = SigLen*2; }
+  else
+    {
+    fprintf(stderr,"ERROR: Unknown signature format (%s).\n",sf);
+    SealFatal();
+    }
+  if (DateLen) { enclen += DateLen+1; } // "date:"
+  return(enclen);
+} /* SealSignEncLen() */
+
 /**************************************
  SealSignLocal(): Sign data using the private key!
  If there is no @digest, then set the signature size (@sigsize).
@@ -191,10 +369,21 @@ sealfield *	SealSignLocal	(sealfield *Args)
   int datestrlen=0;
   size_t siglen=0; // raw signature length
   size_t enclen=0; // encoded signature length
+  char *propq; // provider property query
+  sealsignctx *T;
+  EVP_PKEY *Key;
   int i;
 
   // Keys must be loaded.
-  if (!PrivateKey) { SealLoadPrivateKey(Args); }
+  Key = PrivateKeyUse;
+  if (!Key)
+    {
+    pthread_mutex_lock(&PrivateKeyLock);
+    if (!PrivateKey) { SealLoadPrivateKey(Args); }
+    pthread_mutex_unlock(&PrivateKeyLock);
+    Key = PrivateKey;
+    }
+  T = _SealSignCtx();
 
   // Set the date string
   memset(datestr,0,30);
@@ -202,7 +391,7 @@ sealfield *	SealSignLocal	(sealfield *Args)
   if (!strncmp(sf,"date",4)) // if there's a date, compute it!
     {
     struct timeval tv;
-    struct tm *tmp; // time pointer
+    struct tm tmbuf, *tmp; // time pointer
 
     // How many fraction decimal places?
     int fract=0;
@@ -214,19 +403,26 @@ sealfield *	SealSignLocal	(sealfield *Args)
       }
 
     // Get and generate the date
+    // Only reformat it when the second changes
     gettimeofday(&tv,NULL);
-    tmp = gmtime(&tv.tv_sec);
-    snprintf(datestr,30,"%04u%02u%02u%02u%02u%02u",
-      (tmp->tm_year+1900) % 10000,
-      (tmp->tm_mon+1) % 100,
-      (tmp->tm_mday) % 100,
-      (tmp->tm_hour) % 100,
-      (tmp->tm_min) % 100,
-      (tmp->tm_sec) % 100);
+    if (!T->Date[0] || (T->DateSec != tv.tv_sec))
+      {
+      tmp = gmtime_r(&tv.tv_sec,&tmbuf); // thread-safe
+      snprintf(T->Date,sizeof(T->Date),"%04u%02u%02u%02u%02u%02u",
+	(tmp->tm_year+1900) % 10000,
+	(tmp->tm_mon+1) % 100,
+	(tmp->tm_mday) % 100,
+	(tmp->tm_hour) % 100,
+	(tmp->tm_min) % 100,
+	(tmp->tm_sec) % 100);
+      T->DateSec = tv.tv_sec;
+      }
+    memcpy(datestr,T->Date,14);
     if ((fract > 0) && (fract < 6))
       {
+      static const long Pow10[6] = { 1, 10, 100, 1000, 10000, 100000 };
       snprintf(datestr+14,fract+2,".%0*d",
-        fract, (int)(tv.tv_usec / powf(10,6-fract)));
+        fract, (int)(tv.tv_usec / Pow10[6-fract]));
       }
     else if (fract >= 6)
       {
@@ -254,7 +450,7 @@ sealfield *	SealSignLocal	(sealfield *Args)
   else
     {
     fprintf(stderr,"ERROR: Unsupported digest algorithm (da=%s).\n",digestalg);
-    exit(1);
+    SealFatal();
     }
 
   // Set the encryption algorithm
@@ -267,58 +463,61 @@ sealfield *	SealSignLocal	(sealfield *Args)
   else
     {
     fprintf(stderr,"ERROR: Unsupported key algorithm (ka=%s).\n",keyalg);
-    exit(1);
+    SealFatal();
     }
 
-  // Allocated the context handle
-  ctx = EVP_PKEY_CTX_new_from_pkey(NULL, PrivateKey, NULL);
-  if (!ctx)
+  // Reuse this thread's context if it is for the same key and digest
+  if (T->Ctx && ((T->KeyGen != KeyGen) || (T->Key != Key) || (T->md != mdf())))
+    {
+    EVP_PKEY_CTX_free(T->Ctx);
+    T->Ctx=NULL;
+    }
+  if (!T->Ctx)
+    {
+    propq = SealGetText(Args,"propq");
+    if (propq && !propq[0]) { propq=NULL; }
+
+    // Allocated the context handle
+    ctx = EVP_PKEY_CTX_new_from_pkey(NULL, Key, propq);
+    if (!ctx)
 	{
 	fprintf(stderr,"ERROR: Unable to initialize the sign context.\n");
-	exit(1);
+	SealFatal();
 	}
+    // The thread owns it now, even if setting it up fails
+    // (md stays unset, so a failed context is never reused)
+    T->Ctx = ctx;
+    T->md = NULL;
 
-  // Initialize context handle
-   if (EVP_PKEY_sign_init(ctx) <= 0) // everyone else
+    // Initialize context handle
+    if (EVP_PKEY_sign_init(ctx) <= 0) // everyone else
 	{
 	fprintf(stderr,"ERROR: Initializing the sign context failed.\n");
-	exit(1);
+	SealFatal();
 	}
 
-  // RSA requires padding
-  if (!strcmp(keyalg,"rsa"))
-    {
-    if ( (EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) != 1) ||
-	 (EVP_PKEY_CTX_set_signature_md(ctx, mdf()) != 1) )
+    // RSA requires padding
+    if (!strcmp(keyalg,"rsa"))
+      {
+      if ( (EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) != 1) ||
+	   (EVP_PKEY_CTX_set_signature_md(ctx, mdf()) != 1) )
 	{
 	fprintf(stderr,"ERROR: Unable to initialize the RSA algorithm.\n");
-	exit(1);
+	SealFatal();
 	}
+      }
+    T->md = mdf();
+    T->KeyGen = KeyGen;
+    T->Key = Key;
     }
+  ctx = T->Ctx;
 
   // Find the key size
-  siglen = EVP_PKEY_size(PrivateKey);
+  siglen = EVP_PKEY_size(Key);
   //EVP_PKEY_sign(ctx, NULL, &siglen, NULL, 0); // get size; does not work with ed25519
 
-  /*****
-   Convert it to the output format.
-   Binary signature is stored in sig!
-   *****/
-  enclen=0;
-  if (strstr(sf,"base64"))
-    {
-    // base64 is a 4/3 expansion with padding to a multiple of 4
-    enclen = ((siglen+2)/3) * 4;
-    }
-  else if (strstr(sf,"bin")) { enclen = siglen; } // bad choice
-  else if (strstr(sf,"hex")) { enclen = siglen*2; }
-  else if (strstr(sf,"HEX")) { enclen = siglen*2; }
-  else
-    {
-    fprintf(stderr,"ERROR: Unknown signature format (%s).\n",sf);
-    exit(1);
-    }
-  if (datestrlen) { enclen += datestrlen+1; } // "date:"
+  // Convert it to the output format.
+  enclen = SealSignEncLen(sf,siglen,datestrlen);
   Args = SealSetU32index(Args,"@sigsize",0,enclen);
 
   /***** Signing! *****/
@@ -333,7 +532,7 @@ sealfield *	SealSignLocal	(sealfield *Args)
     if (EVP_PKEY_sign(ctx, Sign->Value, &siglen, DigestBin->Value, DigestBin->ValueLen) != 1)
       {
       fprintf(stderr,"ERROR: Failed to sign.\n");
-      exit(1);
+      SealFatal();
       }
 
     // Encode the signature
@@ -359,8 +558,7 @@ sealfield *	SealSignLocal	(sealfield *Args)
       }
     }
 
-  // Clean up
-  EVP_PKEY_CTX_free(ctx);
+  // The context is kept for the next signature
   return(Args);
 } /* SealSignLocal() */
 
@@ -377,7 +575,7 @@ void	PrintDNSstring	(FILE *fp, const char *Label, sealfield *vf)
 	{
 	fprintf(stderr,"ERROR: Invalid parameter: '%.*s' value cannot contain quotes or spaces.\n",
 	  (int)vf->FieldLen, vf->Field);
-	exit(1);
+	SealFatal();
 	}
 
   fprintf(fp," %s=%s",Label,vf->Value);
@@ -408,7 +606,7 @@ void	SealGenerateKeys	(sealfield *Args)
   if (!vf || !vf->ValueLen)
     {
     fprintf(stderr,"ERROR: dnsfile (-D) must be set.\n");
-    exit(1);
+    SealFatal();
     }
   pubfile = (char*)vf->Value;
 
@@ -416,7 +614,7 @@ void	SealGenerateKeys	(sealfield *Args)
   if (!vf || !vf->ValueLen)
     {
     fprintf(stderr,"ERROR: keyfile (-k) must be set.\n");
-    exit(1);
+    SealFatal();
     }
   keyfile = (char*)vf->Value;
 
@@ -491,7 +689,7 @@ void	SealGenerateKeys	(sealfield *Args)
   if (!keypair)
     {
     fprintf(stderr,"ERROR: Unable to generate the keys.\n");
-    exit(1);
+    SealFatal();
     }
 
   // Save the private key as PEM
@@ -499,7 +697,7 @@ void	SealGenerateKeys	(sealfield *Args)
   if (!encoder)
     {
     fprintf(stderr,"ERROR: Unable to generate the private key.\n");
-    exit(1);
+    SealFatal();
     }
 
   // Set (optional) password
@@ -513,12 +711,12 @@ void	SealGenerateKeys	(sealfield *Args)
     if (OSSL_ENCODER_CTX_set_cipher(encoder, "AES-128-CBC", NULL) != 1)
 	{
 	fprintf(stderr,"ERROR: Unable to set password cipher.\n");
-	exit(1);
+	SealFatal();
 	}
     if (OSSL_ENCODER_CTX_set_passphrase(encoder,pwd,strlen((char*)pwd)) != 1)
 	{
 	fprintf(stderr,"ERROR: Unable to set the password.\n");
-	exit(1);
+	SealFatal();
 	}
     }
 
@@ -526,13 +724,13 @@ void	SealGenerateKeys	(sealfield *Args)
   if (!fp)
     {
     fprintf(stderr,"ERROR: Unable to write to the private key file (%s).\n",keyfile);
-    exit(1);
+    SealFatal();
     }
 
   if (!OSSL_ENCODER_to_fp(encoder,fp))
     {
     fprintf(stderr,"ERROR: Unable to save to the private key file (%s).\n",keyfile);
-    exit(1);
+    SealFatal();
     }
 
   fclose(fp);
@@ -549,7 +747,7 @@ void	SealGenerateKeys	(sealfield *Args)
     {
     fprintf(stderr,"ERROR: Unable to generate the public key.\n");
     // don't delete the private keyfile since it can still generate public keys
-    exit(1);
+    SealFatal();
     }
 
   // Save binary public key to memory (I'll base64-encode it without the headers)
@@ -569,7 +767,7 @@ void	SealGenerateKeys	(sealfield *Args)
   if (!fp)
     {
     fprintf(stderr,"ERROR: Unable to write to the public key file (%s).\n",pubfile);
-    exit(1);
+    SealFatal();
     }
   vf = SealSearch(Args,"seal");
   fprintf(fp,"seal=%.*s",(int)vf->ValueLen,vf->Value);
@@ -9,13 +9,22 @@
    Easy is synchronous and blocking.
    The other is multithreaded and non-blocking.
  For this code, use easy!
+
+ Every signature is a separate request, so an easy handle is
+ kept for each thread and reused.  All handles share one
+ connection pool, DNS cache, and TLS session cache, so signing
+ many files reuses the same (keep-alive) connection instead of
+ doing a new TCP and TLS handshake each time.
  ************************************************/
 
 #include <curl/curl.h>
 #include <string.h> // memset
+#include <ctype.h> // isdigit
+#include <pthread.h> // pthread_once
 #include "seal.hpp"
 #include "sign.hpp"
 #include "json.hpp"
+#include "stats.hpp"
 
 /********************************************************
  SealIsURL(): Is the signer local (false) or remote (true)?
@@ -30,6 +39,115 @@ bool	SealIsURL	(sealfield *Args)
   return(true);
 } /* SealIsURL() */
 
+#pragma GCC visibility push(hidden)
+static CURLcode CurlInitRc = CURLE_FAILED_INIT;
+static pthread_once_t CurlOnce = PTHREAD_ONCE_INIT;
+static CURLSH *CurlShare=NULL; // shared by every thread's handle
+static pthread_mutex_t CurlShareLock[CURL_LOCK_DATA_LAST];
+static pthread_key_t CurlKey; // per-thread easy handle
+static pthread_mutex_t CurlListLock = PTHREAD_MUTEX_INITIALIZER;
+static CURL **CurlList=NULL; // every thread's handle, for SealCurlFree()
+static int CurlListLen=0, CurlListMax=0;
+
+/********************************************************
+ _SealCurlLock(), _SealCurlUnlock(): Protect the shared caches.
+ ********************************************************/
+void	_SealCurlLock	(CURL *ch, curl_lock_data data, curl_lock_access access, void *parm)
+{
+  pthread_mutex_lock(&CurlShareLock[data]);
+} /* _SealCurlLock() */
+
+void	_SealCurlUnlock	(CURL *ch, curl_lock_data data, void *parm)
+{
+  pthread_mutex_unlock(&CurlShareLock[data]);
+} /* _SealCurlUnlock() */
+
+/********************************************************
+ _SealCurlKeep(): Add a new easy handle to the list.
+ ********************************************************/
+void	_SealCurlKeep	(CURL *ch)
+{
+  pthread_mutex_lock(&CurlListLock);
+  if (CurlListLen >= CurlListMax)
+    {
+    CurlListMax += 8;
+    CurlList = (CURL**)realloc(CurlList,CurlListMax*sizeof(CURL*));
+    }
+  CurlList[CurlListLen++] = ch;
+  pthread_mutex_unlock(&CurlListLock);
+} /* _SealCurlKeep() */
+
+/********************************************************
+ _SealCurlFree(): Release a thread's easy handle.
+ Called automatically when the thread exits.
+ A handle that SealCurlFree() already released is not in
+ the list, so it is not released twice.
+ ********************************************************/
+void	_SealCurlFree	(void *ch)
+{
+  int i;
+
+  if (!ch) { return; }
+  pthread_mutex_lock(&CurlListLock);
+  for(i=0; (i < CurlListLen) && (CurlList[i] != ch); i++) { ; }
+  if (i < CurlListLen)
+    {
+    curl_easy_cleanup((CURL*)ch);
+    CurlList[i] = CurlList[--CurlListLen];
+    }
+  pthread_mutex_unlock(&CurlListLock);
+} /* _SealCurlFree() */
+#pragma GCC visibility pop
+
+/********************************************************
+ SealCurlInit(): Initialize curl.
+ curl_global_init() is not thread-safe, so it must only run once.
+ ********************************************************/
+void	SealCurlInit	()
+{
+  int i;
+
+  CurlInitRc = curl_global_init(CURL_GLOBAL_DEFAULT);
+  if (CurlInitRc != CURLE_OK) { return; }
+  pthread_key_create(&CurlKey,_SealCurlFree);
+
+  // Share connections and caches between handles (not fatal if it fails)
+  CurlShare = curl_share_init();
+  if (!CurlShare) { return; }
+  for(i=0; i < CURL_LOCK_DATA_LAST; i++) { pthread_mutex_init(&CurlShareLock[i],NULL); }
+  curl_share_setopt(CurlShare, CURLSHOPT_LOCKFUNC, _SealCurlLock);
+  curl_share_setopt(CurlShare, CURLSHOPT_UNLOCKFUNC, _SealCurlUnlock);
+  curl_share_setopt(CurlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(CurlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  curl_share_setopt(CurlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+} /* SealCurlInit() */
+
+/********************************************************
+ SealCurlFree(): Release every thread's handle and then
+ the shared caches.  (The share cannot be released while any
+ handle still uses it, and threads that never exit, such as
+ a library caller's, never run _SealCurlFree().)
+ Call after all other threads are done.
+ ********************************************************/
+void	SealCurlFree	()
+{
+  int i;
+
+  if (CurlInitRc != CURLE_OK) { return; } // never used
+  pthread_mutex_lock(&CurlListLock);
+  for(i=0; i < CurlListLen; i++) { curl_easy_cleanup(CurlList[i]); }
+  free(CurlList);
+  CurlList=NULL;
+  CurlListLen=CurlListMax=0;
+  pthread_mutex_unlock(&CurlListLock);
+  pthread_setspecific(CurlKey,NULL);
+  if (CurlShare)
+    {
+    curl_share_cleanup(CurlShare);
+    CurlShare=NULL;
+    }
+} /* SealCurlFree() */
+
 /********************************************************
  SealCurlCallback(): Receive data from curl!
  ********************************************************/
@@ -41,48 +159,117 @@ size_t	SealCurlCallback	(void *buffer, size_t size, size_t nmemb, void *parm)
   return(nmemb*size);
 } /* SealCurlCallback() */
 
+#pragma GCC visibility push(hidden)
 /********************************************************
- SealSignURL(): Sign using a web request.
- There are two modes:
-   If Args['@digest'] is not set, then returns amount of space to allocate (sigsize).
-   If Args['@digest'] is set, then do the signature (signature).
+ _SealPostStart(): Set '@post' to the request parameters
+ (everything except the digest).
+ ********************************************************/
+sealfield *	_SealPostStart	(sealfield *Args)
+{
+  const char *Name[] = { "id", "apikey", "kv", "ka", "sf", NULL };
+  char *Str;
+  int i;
+
+  Args = SealSetText(Args,"@post","seal=1"); // seal version is always 1
+  for(i=0; Name[i]; i++)
+    {
+    Str = SealGetText(Args,Name[i]);
+    if (Str && Str[0])
+      {
+      Args = SealAddText(Args,"@post","&");
+      Args = SealAddText(Args,"@post",Name[i]);
+      Args = SealAddText(Args,"@post","=");
+      Args = SealAddText(Args,"@post",Str);
+      }
+    }
+
+  if (Verbose)
+    {
+    Args = SealAddText(Args,"@post","&verbose=1");
+    }
+  return(Args);
+} /* _SealPostStart() */
+
+/********************************************************
+ _SealPostDigest(): Add a digest to '@post'.
+ ********************************************************/
+sealfield *	_SealPostDigest	(sealfield *Args, sealfield *vf)
+{
+  char *Str;
+  uint64_t b;
+  int n; // nibble
+
+  if (!vf || (vf->ValueLen == 0)) { return(Args); }
+
+  /*****
+   digest is binary, but we need it in hex.
+   *****/
+  Str = (char*)calloc(vf->ValueLen*2+4,1); // allocate extra for null padding
+  for(b=0; b < vf->ValueLen; b++)
+    {
+    n=(vf->Value[b] / 0x10);
+    if (n < 10) { Str[b*2+0] = '0'+n; }
+    else { Str[b*2+0] = 'a'+(n-10); }
+    n=(vf->Value[b] % 0x10);
+    if (n < 10) { Str[b*2+1] = '0'+n; }
+    else { Str[b*2+1] = 'a'+(n-10); }
+    }
+  // Store hex
+  Args = SealAddText(Args,"@post","&digest=");
+  Args = SealAddText(Args,"@post",Str);
+  free(Str);
+  return(Args);
+} /* _SealPostDigest() */
+
+/********************************************************
+ _SealPost(): Send '@post' to the remote signer.
+ Sets *Json to the parsed reply (caller must SealFree), or NULL.
  Returns: Args on success, aborts on failure.
-  Sets the seal field with the results.
-    "@sigsize" = signature length as uint32_t
-    "@signature" = computed signature (always set, but may be empty)
  ********************************************************/
-sealfield *	SealSignURL	(sealfield *Args)
+sealfield *	_SealPost	(sealfield *Args, sealfield **Json)
 {
-  sealfield *vf;
   char *Str;
   CURL *ch; // curl handle
   CURLcode crc; // curl return code
   char errbuf[CURL_ERROR_SIZE];
+  double Start; // for --stats
+
+  *Json = NULL;
 
   // Make sure there's a known API URL!
   if (!SealIsURL(Args)) // Caller should make sure this never happens
     {
     fprintf(stderr,"ERROR: apiurl does not begin with http:// or https://. Aborting.\n");
-    exit(1);
+    SealFatal();
     }
 
-  // Clear any previous results
-  Args = SealDel(Args,"@sigsize");
-  Args = SealDel(Args,"@signature");
-
   // Prepare curl
-  crc = curl_global_init(CURL_GLOBAL_DEFAULT);
-  if (crc != CURLE_OK)
+  pthread_once(&CurlOnce,SealCurlInit);
+  if (CurlInitRc != CURLE_OK)
     {
     fprintf(stderr,"ERROR: Failed to initialize curl. Aborting.\n");
-    exit(1);
+    SealFatal();
     }
 
-  ch = curl_easy_init();
-  if (!ch)
+  // Reuse this thread's handle (reset keeps its connections)
+  ch = (CURL*)pthread_getspecific(CurlKey);
+  if (ch) { curl_easy_reset(ch); }
+  else
+    {
+    ch = curl_easy_init();
+    if (!ch)
+      {
+      fprintf(stderr,"ERROR: Failed to initialize curl handle. Aborting.\n");
+      SealFatal();
+      }
+    pthread_setspecific(CurlKey,ch);
+    _SealCurlKeep(ch);
+    }
+  if (CurlShare) { curl_easy_setopt(ch, CURLOPT_SHARE, CurlShare); }
+  curl_easy_setopt(ch, CURLOPT_TCP_KEEPALIVE, 1L); // keep idle connections open
+  if (SealGetText(Args,"http2")) // use HTTP/2 if the server supports it
     {
-    fprintf(stderr,"ERROR: Failed to initialize curl handle. Aborting.\n");
-    exit(1);
+    curl_easy_setopt(ch, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
     }
 
   // Set retrieval parameters
@@ -96,109 +283,76 @@ sealfield *	SealSignURL	(sealfield *Args)
   curl_easy_setopt(ch, CURLOPT_CONNECTTIMEOUT, 20); // 20 seconds to connect
   curl_easy_setopt(ch, CURLOPT_TIMEOUT, 10); // 10 seconds to transfer data
 
-  // Build the post data
-  Args = SealSetText(Args,"@post","seal=1"); // seal version is always 1
-
-  Str = SealGetText(Args,"id"); // add id
-  if (Str && Str[0])
-    {
-    Args = SealAddText(Args,"@post","&id=");
-    Args = SealAddText(Args,"@post",Str);
-    }
-
-  Str = SealGetText(Args,"apikey"); // add apikey
-  if (Str && Str[0])
-    {
-    Args = SealAddText(Args,"@post","&apikey=");
-    Args = SealAddText(Args,"@post",Str);
-    }
-
-  Str = SealGetText(Args,"kv"); // add key version
-  if (Str && Str[0])
-    {
-    Args = SealAddText(Args,"@post","&kv=");
-    Args = SealAddText(Args,"@post",Str);
-    }
-
-  Str = SealGetText(Args,"ka"); // add key algorithm
-  if (Str && Str[0])
-    {
-    Args = SealAddText(Args,"@post","&ka=");
-    Args = SealAddText(Args,"@post",Str);
-    }
-
-  Str = SealGetText(Args,"sf"); // add signing format
-  if (Str && Str[0])
-    {
-    Args = SealAddText(Args,"@post","&sf=");
-    Args = SealAddText(Args,"@post",Str);
-    }
-
-  if (Verbose)
-    {
-    Args = SealAddText(Args,"@post","&verbose=1");
-    }
-
-  vf = SealSearch(Args,"@digest");
-  if (vf && (vf->ValueLen > 0))
-    {
-    /*****
-     digest is binary, but we need it in hex.
-     *****/
-    uint64_t b;
-    int n; // nibble
-    Str = (char*)calloc(vf->ValueLen*2+4,1); // allocate extra for null padding
-    for(b=0; b < vf->ValueLen; b++)
-      {
-      n=(vf->Value[b] / 0x10);
-      if (n < 10) { Str[b*2+0] = '0'+n; }
-      else { Str[b*2+0] = 'a'+(n-10); }
-      n=(vf->Value[b] % 0x10);
-      if (n < 10) { Str[b*2+1] = '0'+n; }
-      else { Str[b*2+1] = 'a'+(n-10); }
-      }
-    // Store hex
-    Args = SealAddText(Args,"@post","&digest=");
-    Args = SealAddText(Args,"@post",Str);
-    free(Str);
-    }
-
   // Set the post data
   Str = SealGetText(Args,"@post");
   //DEBUGPRINT("POST: %s",Str);
   curl_easy_setopt(ch, CURLOPT_POSTFIELDS, Str);
 
   // Do the request!
+  Start = SealStatStart();
   crc = curl_easy_perform(ch);
-  curl_easy_cleanup(ch);
+  SealStatStop(SEAL_PHASE_SIGNURL,Start);
+  SealStatInc(SEAL_COUNT_CURL,1);
+  curl_easy_setopt(ch, CURLOPT_ERRORBUFFER, NULL); // errbuf is going away
+  curl_easy_setopt(ch, CURLOPT_POSTFIELDS, NULL); // '@post' may be freed
 
   // Clean up
-  curl_global_cleanup();
+  // (The handle is kept for the next request; see SealCurlFree().)
   if (crc != CURLE_OK)
     {
     fprintf(stderr,"ERROR: curl(%d]: %s\n",crc,errbuf[0] ? errbuf : "unknown");
-    exit(1);
+    SealFatal();
     }
 
+  /*****
+   The reply is a small, flat JSON.
+   *****/
+  sealfield *jsonv;
+  *Json = Json2Seal(SealSearch(Args,"@curldata"));
+  if (*Json && (Verbose > 1))
+    {
+    if (Verbose > 2) { DEBUGWALK("Remote results",*Json); }
+    else
+      {
+      jsonv = SealSearch(*Json,"double-digest");
+      if (jsonv) { SealPrintf("DEBUG Double Digest: %s\n",jsonv->Value); }
+      }
+    }
+  return(Args);
+} /* _SealPost() */
+#pragma GCC visibility pop
+
+/********************************************************
+ SealSignURL(): Sign using a web request.
+ There are two modes:
+   If Args['@digest'] is not set, then returns amount of space to allocate (sigsize).
+   If Args['@digest'] is set, then do the signature (signature).
+ Returns: Args on success, aborts on failure.
+  Sets the seal field with the results.
+    "@sigsize" = signature length as uint32_t
+    "@signature" = computed signature (always set, but may be empty)
+ ********************************************************/
+sealfield *	SealSignURL	(sealfield *Args)
+{
+  sealfield *json, *jsonv;
+
+  // Clear any previous results
+  Args = SealDel(Args,"@sigsize");
+  Args = SealDel(Args,"@signature");
+
+  // Build the post data
+  Args = _SealPostStart(Args);
+  Args = _SealPostDigest(Args,SealSearch(Args,"@digest"));
+
+  // Do the request!
+  Args = _SealPost(Args,&json);
+
   /*****
    Check for sigsize and signature!
-   NOTE: I should be parsing the result as a JSON, but libjson is overkill.
-   Let's go small and just look for the field!
    NOTE: The value may contain "\" to quote the next character.
    *****/
-  sealfield *json, *jsonv;
-  json = Json2Seal(SealSearch(Args,"@curldata"));
   if (json)
     {
-    if (Verbose > 1)
-	{
-	if (Verbose > 2) { DEBUGWALK("Remote results",json); }
-	else
-	  {
-	  jsonv = SealSearch(json,"double-digest");
-	  if (jsonv) { printf("DEBUG Double Digest: %s\n",jsonv->Value); }
-	  }
-	}
     jsonv = SealSearch(json,"sigsize");
     if (!jsonv) { ; }
     else if (jsonv->Type=='4') { Args = SealSetU32index(Args,"@sigsize",0,((uint32_t*)jsonv->Value)[0]); }
@@ -214,3 +368,94 @@ sealfield *	SealSignURL	(sealfield *Args)
   return(Args);
 } /* SealSignURL() */
 
+/********************************************************
+ SealSignURLSize(): Find the signature size ('@sigsize').
+ With 'sigsize' (the raw signature size in bytes, from the
+ command line or config file), the size is computed from the
+ signature format ('sf') and no request is sent.
+ Otherwise, asks the remote signer (one request).
+ A wrong 'sigsize' is caught when the first signature does
+ not fit.
+ Returns: Args on success, aborts on failure.
+ ********************************************************/
+sealfield *	SealSignURLSize	(sealfield *Args)
+{
+  char *Str, *End=NULL;
+  char *sf;
+  long SigLen;
+  size_t DateLen=0;
+
+  Str = SealGetText(Args,"sigsize");
+  if (!Str || !Str[0]) { return(SealSignURL(Args)); } // ask the signer
+
+  SigLen = strtol(Str,&End,10);
+  if (!End || End[0] || (SigLen <= 0) || (SigLen > 65536))
+    {
+    fprintf(stderr,"ERROR: Invalid signature size (%s). Aborting.\n",Str);
+    SealFatal();
+    }
+
+  // The signer adds "YYYYMMDDhhmmss[.fraction]:" for date formats
+  sf = SealGetText(Args,"sf");
+  if (!sf) { sf = (char*)""; }
+  if (!strncmp(sf,"date",4))
+    {
+    DateLen = 14;
+    if (isdigit(sf[4]) && (sf[4] > '0')) { DateLen += 1 + (sf[4]-'0'); }
+    }
+
+  Args = SealSetU32index(Args,"@sigsize",0,SealSignEncLen(sf,SigLen,DateLen));
+  return(Args);
+} /* SealSignURLSize() */
+
+/********************************************************
+ SealSignURLBatch(): Sign many digests with one web request.
+ Each Parms[i] must have '@digest'.  All of them must use the
+ same signer (apiurl, apikey, id, kv, ka, sf) as Parms[0].
+ The request has one "digest=" per entry (in order), and the
+ reply has a "signature" list in the same order.
+ Sets '@signatureenc' in every Parms[i] (Parms[i] may change).
+ Returns: true on success, false if the signer did not return
+   one signature per digest (e.g., it does not support batches).
+ ********************************************************/
+bool	SealSignURLBatch	(sealfield **Parms, size_t Count)
+{
+  sealfield *Args=NULL, *json=NULL, *jsonv;
+  const char *Copy[] = { "apiurl", "apikey", "id", "kv", "ka", "sf", "http2", NULL };
+  char Name[32];
+  size_t i;
+  bool Ok=true;
+
+  if (Count == 0) { return(true); }
+
+  // Build the post data
+  for(i=0; Copy[i]; i++) { Args = SealCopy2(Args,Copy[i],Parms[0],Copy[i]); }
+  Args = _SealPostStart(Args);
+  for(i=0; i < Count; i++)
+    {
+    Args = _SealPostDigest(Args,SealSearch(Parms[i],"@digest"));
+    }
+
+  // Do the request!
+  Args = _SealPost(Args,&json);
+
+  // Need every signature
+  for(i=0; Ok && (i < Count); i++)
+    {
+    snprintf(Name,sizeof(Name),"signature[%ld]",(long)i);
+    jsonv = SealSearch(json,Name);
+    if (!jsonv && (Count == 1)) { jsonv = SealSearch(json,"signature"); }
+    if (!jsonv || (jsonv->Type != 'c')) { Ok=false; }
+    }
+  for(i=0; Ok && (i < Count); i++)
+    {
+    snprintf(Name,sizeof(Name),"signature[%ld]",(long)i);
+    jsonv = SealSearch(json,Name);
+    if (!jsonv) { jsonv = SealSearch(json,"signature"); }
+    Parms[i] = SealSetTextLen(Parms[i],"@signatureenc",jsonv->ValueLen,(char*)jsonv->Value);
+    }
+
+  SealFree(json);
+  SealFree(Args);
+  return(Ok);
+} /* SealSignURLBatch() */
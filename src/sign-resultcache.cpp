@@ -0,0 +1,281 @@
+/************************************************
+ SEAL: Cache for verification results.
+ See LICENSE
+
+ Archives are often re-verified while nearly every file is
+ unchanged.  With 'verifycachefile', the results that were
+ printed for a file are remembered, and an unchanged file
+ reuses them without being mapped, hashed, or validated.
+
+ The cache is keyed on the file's identity:
+   dev:inode:size:mtime(ns):ctime(ns):options
+ Any write, truncation, rename-over, or chmod changes the key.
+ 'options' covers the arguments that change what is printed.
+ Each entry stores:
+   expires printed-results
+ Entries expire after 'verifyttl' seconds, so revoked keys
+ and DNS key changes are noticed on a later run.
+ Results are only cached when every key lookup succeeded.
+ DNS failures print as an ordinary "no public key found" or
+ "signature mismatch", so the caller passes the per-file
+ SealDNSLookupFailed() flag. Results with an ERROR are also
+ never cached; they are often temporary.
+
+ The cache is shared by all threads (parallel jobs).
+ Like the DNS cache, entries always come from the heap (never
+ from a per-file arena).
+ File format: one entry per line: key<TAB>value
+ The value is escaped so it fits on one line (\n, \t, \\).
+ ************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "seal.hpp"
+#include "files.hpp"
+#include "sign.hpp"
+
+#pragma GCC visibility push(hidden)
+static sealfield *ResultCache=NULL;
+static pthread_mutex_t ResultCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static bool ResultCacheOn=false;
+static time_t ResultCacheTTL=SEAL_RESULT_TTL;
+static bool ResultCacheDirty=false;
+
+/********************************************************
+ _SealResultCacheEscape(): Write a value on one line.
+ ********************************************************/
+void	_SealResultCacheEscape	(FILE *fp, size_t Len, const byte *Value)
+{
+  size_t i;
+  for(i=0; i < Len; i++)
+    {
+    switch(Value[i])
+      {
+      case '\n': fputs("\\n",fp); break;
+      case '\t': fputs("\\t",fp); break;
+      case '\\': fputs("\\\\",fp); break;
+      default: fputc(Value[i],fp); break;
+      }
+    }
+} /* _SealResultCacheEscape() */
+
+/********************************************************
+ _SealResultCacheUnescape(): Undo the escaping (in place).
+ Returns: new length.
+ ********************************************************/
+size_t	_SealResultCacheUnescape	(size_t Len, char *Value)
+{
+  size_t i,j;
+  for(i=j=0; i < Len; i++,j++)
+    {
+    if ((Value[i]=='\\') && (i+1 < Len))
+      {
+      i++;
+      if (Value[i]=='n') { Value[j]='\n'; }
+      else if (Value[i]=='t') { Value[j]='\t'; }
+      else { Value[j]=Value[i]; }
+      }
+    else { Value[j]=Value[i]; }
+    }
+  Value[j]='\0';
+  return(j);
+} /* _SealResultCacheUnescape() */
+#pragma GCC visibility pop
+
+/********************************************************
+ SealResultCacheKey(): Build the cache key for a file.
+ Only regular files can be cached.
+ Returns: true if Key is set, false if the file cannot be cached.
+ ********************************************************/
+bool	SealResultCacheKey	(sealfield *Args, const char *Filename, char *Key, size_t KeyMax)
+{
+  stat_t Stat;
+  const char *PubKey, *DNSFile;
+  int n;
+
+  if (!ResultCacheOn) { return(false); }
+  if (stat64(Filename,&Stat) || !S_ISREG(Stat.st_mode)) { return(false); }
+  PubKey = SealGetText(Args,"@pubkeyfile");
+  DNSFile = SealGetText(Args,"dnsfile");
+  n = snprintf(Key,KeyMax,"%llu:%llu:%llu:%lld.%09ld:%lld.%09ld:%s%s:%s:%s",
+	(unsigned long long)Stat.st_dev,
+	(unsigned long long)Stat.st_ino,
+	(unsigned long long)Stat.st_size,
+	(long long)Stat.st_mtim.tv_sec, (long)Stat.st_mtim.tv_nsec,
+	(long long)Stat.st_ctim.tv_sec, (long)Stat.st_ctim.tv_nsec,
+	SealGetText(Args,"crc") ? "crc" : "",
+	SealGetText(Args,"deepscan") ? "deep" : "",
+	PubKey ? PubKey : "",
+	DNSFile ? DNSFile : "");
+  if ((n < 0) || ((size_t)n >= KeyMax)) { return(false); } // too long; don't cache
+  // Keys are stored one per line
+  if (strchr(Key,'\t') || strchr(Key,'\n')) { return(false); }
+  return(true);
+} /* SealResultCacheKey() */
+
+/********************************************************
+ SealResultCacheGet(): Look up a file's results.
+ Returns: allocated copy of the printed results (caller must
+ free), or NULL if not cached (or expired).
+ ********************************************************/
+char *	SealResultCacheGet	(const char *Key)
+{
+  sealfield *vf;
+  char *Copy=NULL, *Space;
+  time_t Expires;
+
+  if (!Key || !Key[0]) { return(NULL); }
+
+  pthread_mutex_lock(&ResultCacheLock);
+  vf = SealSearch(ResultCache,Key);
+  if (vf)
+    {
+    Expires = (time_t)strtoull((char*)vf->Value,NULL,10);
+    Space = strchr((char*)vf->Value,' ');
+    if ((Expires >= time(NULL)) && Space) { Copy = strdup(Space+1); } // still valid
+    else { ResultCache = SealDel(ResultCache,Key); ResultCacheDirty=true; } // expired
+    }
+  pthread_mutex_unlock(&ResultCacheLock);
+  return(Copy);
+} /* SealResultCacheGet() */
+
+/********************************************************
+ SealResultCacheSet(): Store a file's printed results.
+ Results are not stored if any key lookup failed (LookupFailed)
+ or if they include an ERROR.
+ ********************************************************/
+void	SealResultCacheSet	(const char *Key, size_t Len, const char *Results, bool LookupFailed)
+{
+  char Expires[32];
+  sealarena *Arena;
+
+  if (!ResultCacheOn || !Key || !Key[0] || !Results) { return; }
+  if (LookupFailed || strstr(Results,"ERROR")) { return; } // may be temporary
+
+  snprintf(Expires,sizeof(Expires),"%llu ",(unsigned long long)(time(NULL) + ResultCacheTTL));
+  pthread_mutex_lock(&ResultCacheLock);
+  Arena = SealArenaUse(NULL);
+  ResultCache = SealSetText(ResultCache,Key,Expires);
+  ResultCache = SealAddTextLen(ResultCache,Key,Len,Results);
+  SealArenaUse(Arena);
+  ResultCacheDirty=true;
+  pthread_mutex_unlock(&ResultCacheLock);
+} /* SealResultCacheSet() */
+
+/********************************************************
+ SealResultCacheLoad(): Enable the cache and load the file
+ ('verifycachefile').  Missing files are fine (nothing cached).
+ Expired entries are skipped.
+ ********************************************************/
+void	SealResultCacheLoad	(sealfield *Args)
+{
+  FILE *fp;
+  char *fname, *Str;
+  char *Line=NULL, *Tab;
+  size_t LineMax=0;
+  ssize_t Len;
+  time_t Now;
+  long TTL;
+  sealarena *Arena;
+
+  fname = SealGetText(Args,"verifycachefile");
+  if (!fname || !fname[0]) { return; }
+  ResultCacheOn=true;
+
+  Str = SealGetText(Args,"verifyttl");
+  if (Str && Str[0])
+    {
+    TTL = atol(Str);
+    if (TTL < 0)
+      {
+      fprintf(stderr,"ERROR: Invalid verification cache TTL (%s). Aborting.\n",Str);
+      SealFatal();
+      }
+    ResultCacheTTL = TTL;
+    }
+
+  fp = fopen(fname,"rb");
+  if (!fp) { return; } // no cache yet
+
+  Now = time(NULL);
+  pthread_mutex_lock(&ResultCacheLock);
+  Arena = SealArenaUse(NULL);
+  while((Len = getline(&Line,&LineMax,fp)) > 0)
+    {
+    if (Line[Len-1]=='\n') { Line[--Len]='\0'; }
+    Tab = strchr(Line,'\t');
+    if (!Tab || (Tab==Line)) { continue; } // bad format; ignore it
+    Tab[0]='\0';
+    if ((time_t)strtoull(Tab+1,NULL,10) < Now) { continue; } // expired
+    Len = _SealResultCacheUnescape(Len-(Tab+1-Line),Tab+1);
+    ResultCache = SealSetTextLen(ResultCache,Line,Len,Tab+1);
+    }
+  SealArenaUse(Arena);
+  pthread_mutex_unlock(&ResultCacheLock);
+  free(Line);
+  fclose(fp);
+} /* SealResultCacheLoad() */
+
+/********************************************************
+ SealResultCacheSave(): Save the cache file ('verifycachefile').
+ Only writes when something changed.
+ Writes to a temporary file and renames it, so an
+ interrupted save never leaves a partial cache.
+ ********************************************************/
+void	SealResultCacheSave	(sealfield *Args)
+{
+  FILE *fp;
+  char *fname;
+  sealfield *vf, *Tmp=NULL;
+  time_t Now;
+
+  fname = SealGetText(Args,"verifycachefile");
+  if (!fname || !fname[0] || !ResultCacheDirty) { return; }
+
+  Tmp = SealSetText(Tmp,"fname",fname);
+  Tmp = SealAddText(Tmp,"fname",".tmp");
+  fp = fopen(SealGetText(Tmp,"fname"),"wb");
+  if (!fp)
+    {
+    fprintf(stderr,"WARNING: Unable to write verification cache file (%s).\n",fname);
+    SealFree(Tmp);
+    return;
+    }
+
+  Now = time(NULL);
+  pthread_mutex_lock(&ResultCacheLock);
+  for(vf=ResultCache; vf; vf=vf->Next)
+    {
+    if ((time_t)strtoull((char*)vf->Value,NULL,10) < Now) { continue; } // expired
+    fprintf(fp,"%s\t",vf->Field);
+    _SealResultCacheEscape(fp,vf->ValueLen,vf->Value);
+    fputc('\n',fp);
+    }
+  pthread_mutex_unlock(&ResultCacheLock);
+
+  if (fclose(fp) || rename(SealGetText(Tmp,"fname"),fname))
+    {
+    fprintf(stderr,"WARNING: Unable to save verification cache file (%s).\n",fname);
+    unlink(SealGetText(Tmp,"fname"));
+    }
+  SealFree(Tmp);
+} /* SealResultCacheSave() */
+
+/********************************************************
+ SealResultCacheFree(): Release the cache.
+ ********************************************************/
+void	SealResultCacheFree	()
+{
+  pthread_mutex_lock(&ResultCacheLock);
+  SealFree(ResultCache);
+  ResultCache=NULL;
+  ResultCacheDirty=false;
+  pthread_mutex_unlock(&ResultCacheLock);
+} /* SealResultCacheFree() */
+
@@ -6,9 +6,97 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h> // copy_file_range()
+#include <unistd.h>
+#include <sys/uio.h> // writev()
+#include <sys/mman.h> // msync()
+#include <pthread.h>
 #include "seal.hpp"
 #include "files.hpp"
 #include "sign.hpp"
+#include "stats.hpp"
+#include "results.hpp"
+#include "jobs.hpp"
+
+#pragma GCC visibility push(hidden)
+/**************************************
+ _SealInsertWritev(): Write a list of buffers to the file.
+ Handles partial writes.  Aborts on failure.
+ **************************************/
+void	_SealInsertWritev	(int Fout, struct iovec *Iov, int IovCount)
+{
+  ssize_t w;
+
+  while(IovCount > 0)
+    {
+    if (Iov->iov_len == 0) { Iov++; IovCount--; continue; }
+    w = writev(Fout,Iov,IovCount);
+    if (w < 0)
+      {
+      if (errno == EINTR) { continue; }
+      fprintf(stderr,"ERROR: Failed to write the signed file. Aborting.\n");
+      SealFatal();
+      }
+    // Skip everything that was written
+    while((IovCount > 0) && ((size_t)w >= Iov->iov_len))
+      {
+      w -= Iov->iov_len;
+      Iov++; IovCount--;
+      }
+    if (IovCount > 0)
+      {
+      Iov->iov_base = (byte*)Iov->iov_base + w;
+      Iov->iov_len -= w;
+      }
+    }
+} /* _SealInsertWritev() */
+
+/**************************************
+ _SealMDCtxCleanup(): Free a digest after a recovered fatal error.
+ **************************************/
+void	_SealMDCtxCleanup	(void *Ctx)
+{
+  EVP_MD_CTX_free((EVP_MD_CTX*)Ctx);
+} /* _SealMDCtxCleanup() */
+
+/**************************************
+ _SealInsertCopy(): Copy part of the input file without
+ passing it through user space.
+ With filesystems that support it (btrfs, xfs, nfs), this
+ shares the blocks (reflink) instead of copying them.
+ Iov (from the input's mmap at Offset) is advanced as bytes are copied.
+ Returns: true if everything was copied, false if the caller
+ needs to write the rest.
+ **************************************/
+bool	_SealInsertCopy	(int Fout, int Fin, off64_t Offset, struct iovec *Iov)
+{
+  ssize_t w;
+
+  while(Iov->iov_len > 0)
+    {
+    w = copy_file_range(Fin,&Offset,Fout,NULL,Iov->iov_len,0);
+    if ((w < 0) && (errno == EINTR)) { continue; }
+    if (w <= 0) { return(false); } // not supported here
+    Iov->iov_base = (byte*)Iov->iov_base + w;
+    Iov->iov_len -= w;
+    }
+  return(true);
+} /* _SealInsertCopy() */
+#pragma GCC visibility pop
+
+/**************************************
+ SealSignName(): The output name to report for a signature.
+ '@nameout' replaces '@FilenameOut' when the path means nothing
+ to the caller (e.g., libseal's memory file); "" leaves it out.
+ **************************************/
+const char *	SealSignName	(sealfield *Rec)
+{
+  const char *Name;
+  Name = SealGetText(Rec,"@nameout");
+  if (!Name) { Name = SealGetText(Rec,"@FilenameOut"); }
+  return(Name ? Name : "");
+} /* SealSignName() */
 
 /**************************************
  SealInsert(): Add a signature block into the file.
@@ -16,7 +104,16 @@
    '@FilenameOut' contains destination filename.
    '@BLOCK' contains ready-to-go block containing SEAL record.
    '@s' is relative to '@BLOCK'.
+   '@HEADER' (optional) replaces bytes before the block
+     (e.g., a header with the new file size).
+     It starts at '@HEADERpos' (default: start of the file).
    InsertOffset = where to insert.
+ The input data is copied by the kernel when possible.
+ With '@inplace', '@FilenameOut' is the input file and only
+ the block and anything after it are written (SealInPlaceWrite).
+ When the range starts with 'F~S', the hash up to the
+ signature is computed while the file is written, so
+ SealSign() does not need to re-read it.
  Returns:  NULL on error, or:
    Updates '@s' to be relative to the file.
    Signature inserted.
@@ -24,11 +121,20 @@
  **************************************/
 mmapfile *	SealInsert	(sealfield *Rec, mmapfile *MmapIn, size_t InsertOffset)
 {
-  const char *fname;
+  const char *fname, *b, *da;
   FILE *Fout;
-  sealfield *block;
+  sealfield *block, *header;
   mmapfile *MmapOut;
   size_t *v;
+  struct iovec Iov[6];
+  bool FromIn[6];
+  int i,j,n;
+  size_t Prefix, Hashed, Len, HeaderPos;
+  byte *Pad=NULL;
+  const EVP_MD *md=NULL;
+  EVP_MD_CTX *Ctx=NULL;
+  bool CanCopy;
+  double Start; // for --stats
 
   fname = SealGetText(Rec,"@FilenameOut");
   if (!fname || !fname[0]) { return(NULL); } // not signing
@@ -44,46 +150,518 @@ mmapfile *	SealInsert	(sealfield *Rec, mmapfile *MmapIn, size_t InsertOffset)
 	return(NULL);
 	}
 
-  // Open file for writing!
-  Fout = SealFileOpen(fname,"w+b"); // returns handle or aborts
-  if (!Fout)
-	{
-	fprintf(stderr,"ERROR: Cannot create file (%s). Aborting.\n",fname);
-	exit(1);
-	}
-  rewind(Fout); // should not be needed
+  Start = SealStatStart();
 
-  // Copy up to the block
+  /*****
+   The output is up to 6 parts:
+     [0] input before the replacement header
+     [1] replacement header
+     [2] input after the header, up to the block
+     [3] padding (if inserting past the end of the input)
+     [4] the block
+     [5] input after the block
+   *****/
+  Prefix = (InsertOffset < MmapIn->memsize) ? InsertOffset : MmapIn->memsize;
+  header = SealSearch(Rec,"@HEADER");
+  HeaderPos = header ? SealGetIindex(Rec,"@HEADERpos",0) : 0;
+  if (header && (HeaderPos + header->ValueLen > Prefix)) { header=NULL; HeaderPos=0; } // should never happen
+  n=0;
+  Iov[n].iov_base = MmapIn->mem;
+  Iov[n].iov_len = HeaderPos;
+  FromIn[n++] = true;
+  Iov[n].iov_base = header ? header->Value : NULL;
+  Iov[n].iov_len = header ? header->ValueLen : 0;
+  FromIn[n++] = false;
+  Iov[n].iov_base = MmapIn->mem + HeaderPos + Iov[1].iov_len;
+  Iov[n].iov_len = Prefix - HeaderPos - Iov[1].iov_len;
+  FromIn[n++] = true;
   if (InsertOffset > MmapIn->memsize) // padding?
     {
-    size_t i;
-    SealFileWrite(Fout, MmapIn->memsize, MmapIn->mem);
-    for(i=MmapIn->memsize; i < InsertOffset; i++) { fputc('\0',Fout); }
-    }
-  else
-    {
-    SealFileWrite(Fout, InsertOffset, MmapIn->mem);
+    Pad = (byte*)calloc(InsertOffset - MmapIn->memsize,1);
+    if (!Pad)
+	{
+	fprintf(stderr,"ERROR: Unable to allocate padding. Aborting.\n");
+	SealFatal();
+	}
+    SealCleanupPush(free,Pad);
     }
+  Iov[n].iov_base = Pad;
+  Iov[n].iov_len = InsertOffset - Prefix;
+  FromIn[n++] = false;
+  Iov[n].iov_base = block->Value;
+  Iov[n].iov_len = block->ValueLen;
+  FromIn[n++] = false;
+  Iov[n].iov_base = MmapIn->mem + Prefix;
+  Iov[n].iov_len = MmapIn->memsize - Prefix;
+  FromIn[n++] = true;
 
-  // Append signature block and update offsets
-  SealFileWrite(Fout, block->ValueLen, block->Value);
+  // Update offsets
   v = SealGetIarray(Rec,"@s");
   v[0] += InsertOffset;
   v[1] += InsertOffset;
 
-  // Store everything else
-  if (InsertOffset < MmapIn->memsize)
+  // Hash everything before the signature?
+  b = SealGetText(Rec,"b");
+  if (b && !strncmp(b,"F~S",3) && ((b[3]==',') || !b[3]))
+    {
+    da = SealGetText(Rec,"da");
+    if (!da || !strcmp(da,"sha256")) { md = EVP_sha256(); } // default
+    else if (!strcmp(da,"sha224")) { md = EVP_sha224(); }
+    else if (!strcmp(da,"sha384")) { md = EVP_sha384(); }
+    else if (!strcmp(da,"sha512")) { md = EVP_sha512(); }
+    // else: SealDigest() will report it
+    }
+  if (md && (Ctx = EVP_MD_CTX_new()) && EVP_DigestInit(Ctx,md))
+    {
+    SealCleanupPush(_SealMDCtxCleanup,Ctx);
+    for(i=0, Hashed=0; (i < n) && (Hashed < v[0]); i++)
+      {
+      Len = Iov[i].iov_len;
+      if (Hashed + Len > v[0]) { Len = v[0] - Hashed; }
+      if (Len > 0) { EVP_DigestUpdate(Ctx,Iov[i].iov_base,Len); }
+      Hashed += Len;
+      }
+    SealStatInc(SEAL_COUNT_HASHED,Hashed);
+    }
+
+  // In-place: the input is the output; only write past the prefix
+  if (SealGetText(Rec,"@inplace"))
     {
-    SealFileWrite(Fout, MmapIn->memsize - InsertOffset, MmapIn->mem + InsertOffset);
+    SealInPlaceWrite(fname,MmapIn,Iov,HeaderPos,Prefix);
     }
+  else
+    {
+    // Open file for writing!
+    Fout = SealFileOpen(fname,"w+b"); // returns handle or aborts
+    if (!Fout)
+	{
+	fprintf(stderr,"ERROR: Cannot create file (%s). Aborting.\n",fname);
+	SealFatal();
+	}
 
-  SealFileClose(Fout);
+    // Write it!
+    CanCopy = !MmapIn->IsAlloc; // heap copies (pipes) have no file to copy from
+    for(i=0; i < n; i=j)
+      {
+      // Input data: let the kernel copy it
+      if (CanCopy && FromIn[i] && (Iov[i].iov_len > 0))
+	{
+	if (_SealInsertCopy(fileno(Fout),fileno(MmapIn->fp),(byte*)Iov[i].iov_base - MmapIn->mem,Iov+i)) { j=i+1; continue; }
+	CanCopy=false; // write the rest
+	}
+      // Everything else: write as many parts at once as possible
+      for(j=i+1; (j < n) && !(CanCopy && FromIn[j]); j++) ;
+      _SealInsertWritev(fileno(Fout),Iov+i,j-i);
+      }
+    SealFileClose(Fout);
+    }
+  SealCleanupPop(Pad);
+  free(Pad);
 
   // Prepare mmap
   MmapOut = MmapFile(fname,PROT_WRITE);
+  if (!MmapOut)
+    {
+    fprintf(stderr,"ERROR: Unable to reopen the signed file (%s). Aborting.\n",fname);
+    SealFatal();
+    }
+  if (Ctx)
+    {
+    SealDigestSeed(MmapOut,md,Ctx,v[0]);
+    SealCleanupPop(Ctx);
+    EVP_MD_CTX_free(Ctx);
+    }
+  SealStatStop(SEAL_PHASE_INSERT,Start);
   return(MmapOut);
 } /* SealInsert() */
 
+/**************************************
+ Batch remote signing.
+ With a remote signer, most of the time is spent waiting for
+ the reply.  With 'batch' > 1, SealSign() only computes the
+ digest and queues it.  The output file is complete except for
+ the signature placeholder.  When 'batch' digests are queued
+ (or at SealSignFlush()), they are all signed with one request
+ and the signatures are written into the files.
+ The queue is shared by all threads.
+
+ Pipelining: with 'pipeline' > 0, full batches are handed to
+ that many signer threads instead of being signed by the caller.
+ While a request waits for the signer, the caller goes on to
+ read, insert, and digest the next file.  The hand-off queue
+ is bounded (one waiting batch per signer thread), so a slow
+ signer eventually stalls the callers instead of queuing the
+ whole run in memory.
+
+ Only files processed as jobs (jobs.cpp) are queued.  The job
+ holds the file's output until the signature is written and
+ synced, so results stay in order and never report a signature
+ that is not in the file.  If a signature never arrives, the
+ output is removed (or restored, if signed in place).
+ **************************************/
+typedef struct sealpending
+  {
+  struct sealpending *Next;
+  struct sealpending *NextUnsigned; // see Unsigned
+  sealfield *Sig; // signing parameters with '@digest' and file-relative '@s'
+  sealsignfixup Fixup;
+  sealjob *Job; // holds the file's results
+  long Num; // record number, reported once it is written
+  } sealpending;
+
+#pragma GCC visibility push(hidden)
+static pthread_mutex_t PendingLock = PTHREAD_MUTEX_INITIALIZER;
+static sealpending *Pending=NULL;
+static sealpending **PendingTail=&Pending;
+static size_t PendingCount=0;
+static int PendingThreads=0; // 'pipeline' of the queued signatures
+static bool NoBatch=false; // signer does not support batches
+static sealpending *Unsigned=NULL; // every queued output without its signature
+static pthread_once_t UnsignedOnce = PTHREAD_ONCE_INIT;
+
+typedef struct sealbatch
+  {
+  struct sealbatch *Next;
+  sealpending *List;
+  size_t Count;
+  } sealbatch;
+
+static struct
+  {
+  pthread_mutex_t Lock;
+  pthread_cond_t Ready; // signer threads wait for batches
+  pthread_cond_t Room; // callers wait for space in the queue
+  pthread_t *Thread;
+  int Threads; // number of signer threads; 0 = not started
+  sealbatch *Head, **Tail;
+  int Queued; // batches waiting for a signer thread
+  bool Finished; // no more batches are coming
+  } Pipe = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/**************************************
+ _SealSignPatch(): Write the signature ('@signatureenc') into the file.
+ Then apply any format-specific fixups (e.g., checksums).
+ Aborts if the signature does not fit.
+ **************************************/
+void	_SealSignPatch	(sealfield *Sig, mmapfile *MmapOut, sealsignfixup Fixup)
+{
+  sealfield *sig;
+  size_t *s;
+
+  // Signature is ready-to-go in '@signatureenc'
+  // Size is already pre-computed, so it will fit for overwriting.
+  // Copy signature into record.
+  sig = SealSearch(Sig,"@signatureenc");
+
+  // Idiot checking: signature size must not change!
+  s = SealGetIarray(Sig,"@s");
+  if (!sig || (sig->ValueLen + s[0] != s[1]))
+	{
+	fprintf(stderr,"ERROR: signature size changed while writing. Aborting.\n");
+	SealFatal();
+	}
+
+  // Update file with new signature
+  memcpy(MmapOut->mem + s[0], sig->Value, sig->ValueLen);
+  SealDigestFree(MmapOut); // file changed; saved digests are stale
+  if (Fixup) { Fixup(Sig,MmapOut); }
+  SealInPlaceCommit(Sig,MmapOut); // in-place: the file is complete
+} /* _SealSignPatch() */
+
+/**************************************
+ _SealSignAbandon(): At exit, remove outputs that never got their
+ signatures (e.g., the remote signer failed).
+ An in-place file keeps its journal; signing it again restores it.
+ **************************************/
+void	_SealSignAbandon	()
+{
+  sealpending *P;
+  const char *Name;
+
+  pthread_mutex_lock(&PendingLock);
+  for(P=Unsigned; P; P=P->NextUnsigned)
+    {
+    Name = SealGetText(P->Sig,"@FilenameOut");
+    if (SealGetText(P->Sig,"@inplace"))
+      {
+      fprintf(stderr,"ERROR: '%s' was not signed; sign it again to restore it.\n",Name);
+      }
+    else
+      {
+      unlink(Name);
+      fprintf(stderr,"ERROR: '%s' was not signed; removed it.\n",Name);
+      }
+    }
+  Unsigned=NULL;
+  pthread_mutex_unlock(&PendingLock);
+} /* _SealSignAbandon() */
+
+/**************************************
+ _SealSignRegister(): Call _SealSignAbandon() at exit.
+ **************************************/
+void	_SealSignRegister	()
+{
+  atexit(_SealSignAbandon);
+} /* _SealSignRegister() */
+
+/**************************************
+ _SealSignDone(): A queued signature is written (Error is NULL)
+ or has failed.  A failed output is removed (an in-place file
+ keeps its journal).  Then the file's job gets its result.
+ **************************************/
+void	_SealSignDone	(sealpending *P, const char *Error)
+{
+  sealpending **U;
+  const char *Filename;
+  char Msg[256];
+  char *Text;
+
+  pthread_mutex_lock(&PendingLock);
+  for(U=&Unsigned; *U; U=&(*U)->NextUnsigned)
+    {
+    if (*U == P) { *U = P->NextUnsigned; break; }
+    }
+  pthread_mutex_unlock(&PendingLock);
+
+  Filename = SealGetText(P->Sig,"@FilenameOut");
+  if (Error && SealGetText(P->Sig,"@inplace"))
+    {
+    snprintf(Msg,sizeof(Msg),"%s; sign '%s' again to restore it",Error,Filename);
+    Error = Msg;
+    }
+  else if (Error)
+    {
+    unlink(Filename);
+    snprintf(Msg,sizeof(Msg),"%s; removed '%s'",Error,Filename);
+    Error = Msg;
+    }
+  Text = SealResultLater(P->Num,SealSignName(P->Sig),Error);
+  SealJobsRelease(P->Job,Text);
+  free(Text);
+} /* _SealSignDone() */
+
+/**************************************
+ _SealSignBatch(): Sign a list of queued digests and patch the files.
+ **************************************/
+void	_SealSignBatch	(sealpending *List, size_t Count)
+{
+  sealfield **Parms, *sig;
+  sealpending *P;
+  mmapfile *MmapOut;
+  sealarena *Arena;
+  const char *Error;
+  size_t i, *s;
+  bool Single;
+
+  Parms = (sealfield**)calloc(Count,sizeof(sealfield*));
+  if (!Parms)
+    {
+    fprintf(stderr,"ERROR: Unable to allocate signing batch. Aborting.\n");
+    SealFatal();
+    }
+
+  // The queue outlives every file, so it never uses a per-file arena
+  Arena = SealArenaUse(NULL);
+  for(i=0, P=List; P; i++, P=P->Next) { Parms[i] = P->Sig; }
+  pthread_mutex_lock(&PendingLock);
+  Single = NoBatch;
+  pthread_mutex_unlock(&PendingLock);
+  if (Single || !SealSignURLBatch(Parms,Count))
+    {
+    // Signer does not support batches; one at a time from now on
+    pthread_mutex_lock(&PendingLock);
+    if (!NoBatch)
+      {
+      fprintf(stderr,"WARNING: Remote signer did not sign the batch; signing one at a time.\n");
+      NoBatch=true;
+      }
+    pthread_mutex_unlock(&PendingLock);
+    for(i=0; i < Count; i++) { Parms[i] = SealSignURL(Parms[i]); }
+    }
+
+  for(i=0, P=List; P; i++, P=P->Next)
+    {
+    P->Sig = Parms[i];
+    Error = NULL;
+    sig = SealSearch(P->Sig,"@signatureenc");
+    s = SealGetIarray(P->Sig,"@s");
+    MmapOut = NULL;
+    if (!sig || (sig->ValueLen + s[0] != s[1])) { Error = "no signature from the remote signer"; }
+    else if (!(MmapOut = MmapFile(SealGetText(P->Sig,"@FilenameOut"),PROT_WRITE))) { Error = "cannot reopen the output"; }
+    else
+      {
+      _SealSignPatch(P->Sig,MmapOut,P->Fixup);
+      // Results are reported as done; make it so (in-place already synced)
+      if (!SealGetText(P->Sig,"@inplace") && msync(MmapOut->mem,MmapOut->memsize,MS_SYNC))
+	{
+	Error = "cannot sync the output";
+	}
+      MmapFree(MmapOut);
+      }
+    _SealSignDone(P,Error);
+    }
+  SealArenaUse(Arena);
+
+  while(List)
+    {
+    P = List;
+    List = P->Next;
+    SealFree(P->Sig);
+    free(P);
+    }
+  free(Parms);
+} /* _SealSignBatch() */
+
+/**************************************
+ _SealPipeWorker(): Signer thread for pipelined batches.
+ **************************************/
+void *	_SealPipeWorker	(void *unused)
+{
+  sealbatch *B;
+
+  pthread_mutex_lock(&Pipe.Lock);
+  while(1)
+    {
+    while(!Pipe.Head && !Pipe.Finished)
+      {
+      pthread_cond_wait(&Pipe.Ready,&Pipe.Lock);
+      }
+    if (!Pipe.Head) { break; } // finished and nothing left
+    B = Pipe.Head;
+    Pipe.Head = B->Next;
+    if (!Pipe.Head) { Pipe.Tail = &Pipe.Head; }
+    Pipe.Queued--;
+    pthread_cond_signal(&Pipe.Room);
+    pthread_mutex_unlock(&Pipe.Lock);
+
+    _SealSignBatch(B->List,B->Count);
+    free(B);
+
+    pthread_mutex_lock(&Pipe.Lock);
+    }
+  pthread_mutex_unlock(&Pipe.Lock);
+  SealStatsFile(NULL,0); // --stats: signer round trips from this thread
+  return(NULL);
+} /* _SealPipeWorker() */
+
+/**************************************
+ _SealPipeAdd(): Hand a batch to the signer threads.
+ Starts Threads signer threads on first use.
+ Blocks while the hand-off queue is full.
+ **************************************/
+void	_SealPipeAdd	(sealpending *List, size_t Count, int Threads)
+{
+  sealbatch *B;
+  int t;
+
+  B = (sealbatch*)calloc(1,sizeof(sealbatch));
+  if (!B)
+    {
+    fprintf(stderr,"ERROR: Unable to queue signing batch. Aborting.\n");
+    SealFatal();
+    }
+  B->List = List;
+  B->Count = Count;
+
+  pthread_mutex_lock(&Pipe.Lock);
+  if (!Pipe.Thread)
+    {
+    Pipe.Thread = (pthread_t*)calloc(Threads,sizeof(pthread_t));
+    if (!Pipe.Thread)
+      {
+      fprintf(stderr,"ERROR: Unable to allocate signer threads. Aborting.\n");
+      pthread_mutex_unlock(&Pipe.Lock);
+      SealFatal();
+      }
+    Pipe.Head = NULL;
+    Pipe.Tail = &Pipe.Head;
+    for(t=0; t < Threads; t++)
+      {
+      if (pthread_create(&Pipe.Thread[t],NULL,_SealPipeWorker,NULL))
+	{
+	fprintf(stderr,"ERROR: Unable to start signer thread. Aborting.\n");
+	pthread_mutex_unlock(&Pipe.Lock);
+	SealFatal();
+	}
+      }
+    Pipe.Threads = Threads;
+    }
+
+  while(Pipe.Queued >= Pipe.Threads) // full? Wait for a signer
+    {
+    pthread_cond_wait(&Pipe.Room,&Pipe.Lock);
+    }
+  *Pipe.Tail = B;
+  Pipe.Tail = &B->Next;
+  Pipe.Queued++;
+  pthread_cond_signal(&Pipe.Ready);
+  pthread_mutex_unlock(&Pipe.Lock);
+} /* _SealPipeAdd() */
+
+/**************************************
+ _SealSignKick(): Send the queued digests now, even if the batch
+ is not full.  (A job is waiting for one of them.)
+ **************************************/
+void	_SealSignKick	()
+{
+  sealpending *List;
+  size_t Count;
+  int Threads;
+
+  pthread_mutex_lock(&PendingLock);
+  List = Pending; Count = PendingCount; Threads = PendingThreads;
+  Pending=NULL; PendingTail=&Pending; PendingCount=0;
+  pthread_mutex_unlock(&PendingLock);
+  if (List && (Threads > 0)) { _SealPipeAdd(List,Count,Threads); }
+  else if (List) { _SealSignBatch(List,Count); }
+} /* _SealSignKick() */
+#pragma GCC visibility pop
+
+/**************************************
+ SealSignDeferred(): How many files may wait for a queued signature.
+ With a remote signer and 'batch' > 1 or 'pipeline' > 0, files
+ are done before their signatures are written: up to one batch
+ in the queue, and two per signer thread (waiting and in flight).
+ Returns: 0 if signatures are never queued.
+ **************************************/
+size_t	SealSignDeferred	(sealfield *Args)
+{
+  long Batch, Threads;
+
+  if (SealGetCindex(Args,"@mode",0)!='S') { return(0); }
+  Batch = atol(SealGetText(Args,"batch") ? SealGetText(Args,"batch") : "1");
+  Threads = atol(SealGetText(Args,"pipeline") ? SealGetText(Args,"pipeline") : "0");
+  if ((Batch <= 1) && (Threads <= 0)) { return(0); }
+  if (Batch < 1) { Batch=1; }
+  if (Threads < 0) { Threads=0; }
+  return((size_t)(Batch * (2*Threads + 1)));
+} /* SealSignDeferred() */
+
+/**************************************
+ SealSignFlush(): Sign everything in the batch queue.
+ Waits for any pipelined batches and stops the signer threads.
+ Must be called before exiting.
+ **************************************/
+void	SealSignFlush	()
+{
+  int t;
+
+  _SealSignKick();
+
+  if (!Pipe.Thread) { return; } // never pipelined
+  pthread_mutex_lock(&Pipe.Lock);
+  Pipe.Finished = true;
+  pthread_cond_broadcast(&Pipe.Ready);
+  pthread_mutex_unlock(&Pipe.Lock);
+  for(t=0; t < Pipe.Threads; t++)
+    {
+    pthread_join(Pipe.Thread[t],NULL);
+    }
+  free(Pipe.Thread); Pipe.Thread=NULL;
+  Pipe.Threads = 0;
+  Pipe.Finished = false;
+} /* SealSignFlush() */
+
 /**************************************
  SealSign(): Sign a file.
  Insert a signature!
@@ -92,60 +670,103 @@ mmapfile *	SealInsert	(sealfield *Rec, mmapfile *MmapIn, size_t InsertOffset)
    '@s' contains start and end of signature relative to file.
    Rec contains everything needed to compute the digest and signature:
      'da', 'b', 's', and 'p' arguments.
+ Fixup (optional) is called after the signature is written.
+ With remote batch or pipelined signing, the signature (and Fixup)
+ may be applied later; see SealSignFlush().  The record is reported
+ in the file's results once the signature is written.
  Returns: true on success, false on failure (with error to stderr)
  **************************************/
-bool	SealSign	(sealfield *Rec, mmapfile *MmapOut)
+bool	SealSign	(sealfield *Rec, mmapfile *MmapOut, sealsignfixup Fixup)
 {
-  const char *fname;
-  sealfield *sig, *sigparm;
+  const char *fname, *Name;
+  sealfield *sigparm;
+  sealpending *P, *List=NULL;
+  sealarena *Arena;
+  sealjob *Job=NULL;
   size_t *s, *p;
+  size_t Count=0;
+  char *Str;
+  int Threads;
 
   if (!MmapOut) { return(false); } // not signing
   fname = SealGetText(Rec,"@FilenameOut");
   if (!fname || !fname[0]) { return(NULL); } // not signing
+  Name = SealSignName(Rec);
 
   // Check if file is finalized (abort if it is)
   if (SealGetCindex(Rec,"@sflags",1)=='f')
 	{
 	fprintf(stderr,"ERROR: File is finalized; cannot sign. Aborting.\n");
-	exit(1);
+	SealFatal();
 	}
 
   // Compute new digest
-  sigparm = SealClone(Rec);
-  sigparm = SealDigest(sigparm,MmapOut);
-
-  // Sign it (this creates '@signatureenc')
-  switch(SealGetCindex(sigparm,"@mode",0)) // sign it
+  Str = SealGetText(Rec,"batch");
+  Threads = atoi(SealGetText(Rec,"pipeline") ? SealGetText(Rec,"pipeline") : "0");
+  if (SealSignDeferred(Rec) && (Job = SealJobsHold(_SealSignKick,SealResultJson ? SealResultMerge : NULL)))
     {
-    case 'S': sigparm = SealSignURL(sigparm); break;
-    case 's': sigparm = SealSignLocal(sigparm); break;
-    default: break; // never happens
+    // Queue it; the queue is not part of any per-file arena
+    Arena = SealArenaUse(NULL);
+    sigparm = SealClone(Rec);
+    sigparm = SealDigest(sigparm,MmapOut);
+    SealArenaUse(Arena);
+
+    P = (sealpending*)calloc(1,sizeof(sealpending));
+    if (!P)
+      {
+      fprintf(stderr,"ERROR: Unable to queue signature. Aborting.\n");
+      SealFatal();
+      }
+    P->Sig = sigparm;
+    P->Fixup = Fixup;
+    P->Job = Job;
+    P->Num = (long)SealGetIindex(Rec,"@s",2) + 1;
+
+    // The job reports it once it is written (see _SealSignDone)
+    if (SealResultJson) { SealResultAdded(P->Num,Name); }
+    pthread_once(&UnsignedOnce,_SealSignRegister);
+    pthread_mutex_lock(&PendingLock);
+    P->NextUnsigned = Unsigned;
+    Unsigned = P;
+    *PendingTail = P;
+    PendingTail = &P->Next;
+    PendingCount++;
+    PendingThreads = Threads;
+    if (PendingCount >= (size_t)(Str ? atol(Str) : 1)) // full: take the batch
+      {
+      List = Pending; Count = PendingCount;
+      Pending=NULL; PendingTail=&Pending; PendingCount=0;
+      }
+    pthread_mutex_unlock(&PendingLock);
+    if (List && (Threads > 0)) { _SealPipeAdd(List,Count,Threads); }
+    else if (List) { _SealSignBatch(List,Count); }
     }
+  else
+    {
+    sigparm = SealClone(Rec);
+    sigparm = SealDigest(sigparm,MmapOut);
 
-  // Signature is ready-to-go in '@signatureenc'
-  // Size is already pre-computed, so it will fit for overwriting.
-  // Copy signature into record.
-  sig = SealSearch(sigparm,"@signatureenc");
+    // Sign it (this creates '@signatureenc')
+    switch(SealGetCindex(sigparm,"@mode",0)) // sign it
+      {
+      case 'S': sigparm = SealSignURL(sigparm); break;
+      case 's': sigparm = SealSignLocal(sigparm); break;
+      default: break; // never happens
+      }
+    _SealSignPatch(sigparm,MmapOut,Fixup);
+    SealFree(sigparm);
+    }
 
-  // Idiot checking: signature size must not change!
   s = SealGetIarray(Rec,"@s");
   p = SealGetIarray(Rec,"@p");
-  if (!sig || (sig->ValueLen + s[0] != s[1]))
-	{
-	fprintf(stderr,"ERROR: signature size changed while writing. Aborting.\n");
-	exit(1);
-	}
-
-  // Update file with new signature
-  memcpy(MmapOut->mem + s[0], sig->Value, sig->ValueLen);
   p[0] = s[0]; // rotate positions
   p[1] = s[1];
   p[2] = s[2];
   Rec = SealIncIindex(Rec,"@s",2,1); // increase number of signatures
-  SealFree(sigparm);
 
-  printf(" Signature record #%ld added: %s\n",(long)SealGetIindex(Rec,"@s",2),fname);
+  if (Job) { return(true); } // reported when written
+  if (SealResultJson) { SealResultAdded((long)SealGetIindex(Rec,"@s",2),Name); }
+  else { SealPrintf(" Signature record #%ld added%s%s\n",(long)SealGetIindex(Rec,"@s",2),Name[0] ? ": " : "",Name); }
   return(true);
 } /* SealSign() */
 
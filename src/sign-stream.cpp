@@ -0,0 +1,472 @@
+/************************************************
+ SEAL: implemented in C
+ See LICENSE
+
+ Streaming signatures for live recordings.
+ (NOTES.txt option C: compute as you go and append the signature.)
+
+ The output is written once, front to back, and never re-read.
+ Every byte is hashed as it is written.  Periodically ('interim'
+ seconds), a SEAL record is appended at the next chunk/element
+ boundary:
+   First record:  b='F~S,s~s+3'
+   Later records: b='P~S,s~s+3' (overlaps the previous signature)
+ When the stream ends, a final record closes the file:
+   b='P~S,s~f' (or b='F~S,s~f' if there were no interim records)
+ If the recording is interrupted, everything up to the last
+ interim record can still be validated.
+
+ RIFF stores the total size in bytes 4-8, and it grows with
+ every chunk.  So the record whose range covers it skips it:
+   b='F~F+4,F+8~S,...'
+ Records go in the last top-level RIFF chunk:
+   - AVI (OpenDML) continues in "RIFF" "AVIX" chunks.  Only the
+     size of the chunk holding the record is updated.  But every
+     top-level size is skipped (a recorder may patch them), e.g.:
+     b='F~F+4,F+8~F+N+4,F+N+8~S,...'
+   - RF64/BW64 keep the 32-bit size as 0xFFFFFFFF; the 64-bit
+     size in "ds64" (bytes 20-28) is skipped and updated instead.
+ A plain RIFF chunk cannot be larger than 4 GB; the stream is
+ not signed past that.  (Use RF64.)
+ The RIFF size is updated after every record.
+
+ Supported formats: RIFF (including RF64/BW64) and Matroska.
+ Records are only inserted between chunks/elements.
+ Matroska elements with an unknown size (a live Segment or
+ Cluster) are entered, so records can go between their children.
+ ************************************************/
+// C headers
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "seal.hpp"
+#include "files.hpp"
+#include "formats.hpp"
+#include "sign.hpp"
+#include "results.hpp"
+
+// For openssl 3.x
+#include <openssl/evp.h>
+
+#define RIFF_UNKNOWN	UINT64_MAX // the RIFF chunk is still growing
+
+struct sealstream
+  {
+  sealfield *Args; // signing parameters (private copy)
+  FILE *fp; // output file
+  int Format; // 'R' = RIFF, 'M' = Matroska, '@' = not known yet, 0 = unsupported
+  uint64_t Pos; // bytes written
+  const EVP_MD *md;
+  EVP_MD_CTX *Ctx; // digest of every byte since RangeStart
+  uint64_t RangeStart; // where the next record's range begins
+  long Records; // number of records written
+  long Interim; // seconds between interim records (0 = final only)
+  time_t LastSign; // when the last record was written
+
+  // Tracking chunk/element boundaries
+  uint64_t Next; // offset of the next chunk/element header
+  uint64_t HdrPos; // offset of the partial header
+  byte Hdr[16]; // partial header
+  int HdrLen;
+  bool Lost; // unknown size; no more boundaries
+
+  // RIFF: the top-level chunk that records go in
+  uint64_t Riff; // offset of its header
+  uint64_t RiffEnd; // end, from its size (or RIFF_UNKNOWN)
+  bool RF64; // RF64/BW64: the real sizes are in ds64
+  byte Ds64[16]; // RF64: ds64's RIFF and data sizes
+  uint64_t SkipPos; // size field to leave out of the digest
+  int SkipLen;
+  };
+
+#pragma GCC visibility push(hidden)
+/**************************************
+ _SealStreamHeader(): Add one byte to a partial header.
+ When the header is complete, sets the next boundary.
+ **************************************/
+void	_SealStreamHeader	(sealstream *Stream, byte c)
+{
+  uint64_t Size;
+  int IdLen,SizeLen,i;
+  bool Unknown;
+
+  if (Stream->HdrLen==0) { Stream->HdrPos = Stream->Pos; }
+  Stream->Hdr[Stream->HdrLen++] = c;
+
+  if (Stream->Format=='R')
+    {
+    // Top level: "RIFF" size type (the first, or an AVIX sequel)
+    if ((Stream->HdrPos==0) || (Stream->HdrPos==Stream->RiffEnd))
+      {
+      if (Stream->HdrLen < 4) { return; }
+      if ((Stream->HdrPos==0) || !memcmp(Stream->Hdr,"RIFF",4))
+	{
+	if (Stream->HdrLen==5) // the size is next; it changes with every record
+	  {
+	  char Skip[64];
+	  Stream->Riff = Stream->HdrPos;
+	  Stream->SkipPos = Stream->RF64 ? 20 : Stream->HdrPos+4; // RF64: the size in ds64
+	  Stream->SkipLen = Stream->RF64 ? 8 : 4;
+	  snprintf(Skip,sizeof(Skip),"~F+%llu,F+%llu",(unsigned long long)Stream->SkipPos,
+		(unsigned long long)(Stream->SkipPos+Stream->SkipLen));
+	  Stream->Args = SealAddText(Stream->Args,"@streamrange",Skip);
+	  }
+	if (Stream->HdrLen < 12) { return; }
+	Size = (uint32_t)readle32(Stream->Hdr+4);
+	if (Stream->RF64 || (Size==0) || (Size==0xffffffff)) { Stream->RiffEnd = RIFF_UNKNOWN; } // still recording
+	else { Stream->RiffEnd = Stream->HdrPos + 8 + Size + (Size & 1); }
+	Size = 0; // header only; the chunks follow
+	goto Found;
+	}
+      Stream->RiffEnd = RIFF_UNKNOWN; // not a sequel; the size was a placeholder
+      }
+
+    // Chunk: name size
+    if (Stream->HdrLen < 8) { return; }
+    Size = (uint32_t)readle32(Stream->Hdr+4);
+    if (Stream->RF64 && (Stream->HdrPos==12) && (memcmp(Stream->Hdr,"ds64",4) || (Size < 28)))
+      {
+      SealPrintf("ERROR: RF64 stream without a ds64 chunk; output will not be signed.\n");
+      Stream->Format=0;
+      Stream->HdrLen=0;
+      return;
+      }
+    if (Size==0xffffffff)
+      {
+      if (Stream->RF64 && !memcmp(Stream->Hdr,"data",4) && readle64(Stream->Ds64+8)) { Size = readle64(Stream->Ds64+8); }
+      else { Stream->Lost=true; } // placeholder for "still recording"
+      }
+    Size += (Size & 1); // chunks are padded to an even size
+    }
+  else // Matroska: variable-length id, then variable-length size
+    {
+    for(IdLen=1; (IdLen <= 4) && !(Stream->Hdr[0] & (0x80 >> (IdLen-1))); IdLen++) ;
+    if (IdLen > 4) { Stream->Lost=true; Stream->HdrLen=0; return; } // not EBML
+    if (Stream->HdrLen <= IdLen) { return; }
+    for(SizeLen=1; (SizeLen <= 8) && !(Stream->Hdr[IdLen] & (0x80 >> (SizeLen-1))); SizeLen++) ;
+    if (SizeLen > 8) { Stream->Lost=true; Stream->HdrLen=0; return; } // not EBML
+    if (Stream->HdrLen < IdLen+SizeLen) { return; }
+
+    // All bits set means "unknown size"
+    Size = Stream->Hdr[IdLen] & (0xff >> SizeLen);
+    Unknown = (Size == (uint64_t)(0xff >> SizeLen));
+    for(i=1; i < SizeLen; i++)
+      {
+      Size = (Size << 8) | Stream->Hdr[IdLen+i];
+      if (Stream->Hdr[IdLen+i] != 0xff) { Unknown=false; }
+      }
+    if (Unknown) { Size=0; } // enter it; the children follow
+    }
+
+Found:
+  Stream->Next = Stream->HdrPos + Stream->HdrLen + Size;
+  Stream->HdrLen=0;
+} /* _SealStreamHeader() */
+
+/**************************************
+ _SealStreamAtBoundary(): Can a record be inserted here?
+ **************************************/
+bool	_SealStreamAtBoundary	(sealstream *Stream)
+{
+  if (!Stream->Format || (Stream->Format=='@') || Stream->Lost) { return(false); }
+  if (Stream->HdrLen || (Stream->Pos==0)) { return(false); }
+  if (Stream->RF64 && (Stream->Pos <= 12)) { return(false); } // ds64 must come first
+  return(Stream->Pos == Stream->Next);
+} /* _SealStreamAtBoundary() */
+
+/**************************************
+ _SealStreamOut(): Write bytes to the file and digest them.
+ The RIFF size that the next record updates is not digested.
+ **************************************/
+void	_SealStreamOut	(sealstream *Stream, size_t Len, const byte *Data)
+{
+  uint64_t Pos, Skip0, Skip1;
+  size_t i;
+
+  SealFileWrite(Stream->fp,Len,(byte*)Data);
+  Pos = Stream->Pos;
+  Stream->Pos += Len;
+
+  // RF64: keep ds64's sizes (bytes 20-36) for the "data" chunk
+  if (Stream->RF64 && (Pos < 36))
+    {
+    for(i=0; (i < Len) && (Pos+i < 36); i++)
+      {
+      if (Pos+i >= 20) { Stream->Ds64[Pos+i-20] = Data[i]; }
+      }
+    }
+
+  // Leave out any part of the size field
+  Skip0 = (Stream->SkipPos > Pos) ? Stream->SkipPos : Pos;
+  Skip1 = Stream->SkipPos + Stream->SkipLen;
+  if (Skip1 > Pos+Len) { Skip1 = Pos+Len; }
+  if (Stream->SkipLen && (Skip0 < Skip1))
+    {
+    EVP_DigestUpdate(Stream->Ctx,Data,Skip0-Pos);
+    EVP_DigestUpdate(Stream->Ctx,Data+(Skip1-Pos),Pos+Len-Skip1);
+    }
+  else if (Len > 0) { EVP_DigestUpdate(Stream->Ctx,Data,Len); }
+} /* _SealStreamOut() */
+#pragma GCC visibility pop
+
+/**************************************
+ SealStreamOpen(): Start a streaming signature.
+ Args must have everything needed for signing ('@mode',
+ '@sigsize', ...) and the output name in '@FilenameOut'.
+ Returns: stream, or NULL if not signing.
+ **************************************/
+sealstream *	SealStreamOpen	(sealfield *Args)
+{
+  sealstream *Stream;
+  const char *fname, *da;
+
+  fname = SealGetText(Args,"@FilenameOut");
+  if (!fname || !fname[0]) { return(NULL); } // not signing
+
+  Stream = (sealstream*)calloc(1,sizeof(sealstream));
+  if (!Stream)
+    {
+    fprintf(stderr,"ERROR: Unable to allocate stream. Aborting.\n");
+    SealFatal();
+    }
+
+  da = SealGetText(Args,"da");
+  if (!da || !strcmp(da,"sha256")) { Stream->md = EVP_sha256(); } // default
+  else if (!strcmp(da,"sha224")) { Stream->md = EVP_sha224(); }
+  else if (!strcmp(da,"sha384")) { Stream->md = EVP_sha384(); }
+  else if (!strcmp(da,"sha512")) { Stream->md = EVP_sha512(); }
+  else
+    {
+    fprintf(stderr,"ERROR: Unknown digest algorithm for streaming (da=%s). Aborting.\n",da);
+    SealFatal();
+    }
+  Stream->Ctx = EVP_MD_CTX_new();
+  if (!Stream->Ctx || !EVP_DigestInit(Stream->Ctx,Stream->md))
+    {
+    fprintf(stderr,"ERROR: Unable to start the stream digest. Aborting.\n");
+    SealFatal();
+    }
+
+  Stream->Args = SealClone(Args);
+  Stream->Args = SealSetText(Stream->Args,"@streamrange","F"); // the first range starts the file
+  Stream->fp = SealFileOpen(fname,"w+b"); // returns handle or aborts
+  Stream->Format = '@';
+  Stream->Interim = atol(SealGetText(Args,"interim") ? SealGetText(Args,"interim") : "0");
+  Stream->LastSign = time(NULL);
+  return(Stream);
+} /* SealStreamOpen() */
+
+/**************************************
+ SealStreamWrite(): Write data to the stream.
+ The data is digested as it is written.
+ When an interim signature is due, it is added at the
+ next chunk/element boundary.
+ **************************************/
+void	SealStreamWrite	(sealstream *Stream, size_t Len, const byte *Data)
+{
+  size_t n;
+
+  if (!Stream) { return; }
+  while(Len > 0)
+    {
+    if (Stream->Format=='@') // identify the format from the magic bytes
+      {
+      Stream->Hdr[Stream->HdrLen++] = Data[0];
+      if (Stream->HdrLen==4)
+	{
+	if (!memcmp(Stream->Hdr,"RIFF",4)) { Stream->Format='R'; }
+	else if (!memcmp(Stream->Hdr,"RF64",4) || !memcmp(Stream->Hdr,"BW64",4)) { Stream->Format='R'; Stream->RF64=true; }
+	else if (!memcmp(Stream->Hdr,"\x1A\x45\xDF\xA3",4)) { Stream->Format='M'; }
+	else
+	  {
+	  SealPrintf("ERROR: Unsupported stream format; output will not be signed.\n");
+	  Stream->Format=0;
+	  Stream->HdrLen=0;
+	  }
+	Stream->HdrPos=0; // the magic starts the first header
+	}
+      n = 1;
+      }
+    else if (!Stream->Format || Stream->Lost) { n = Len; } // nothing to track
+    else if (Stream->HdrLen || (Stream->Pos == Stream->Next))
+      {
+      _SealStreamHeader(Stream,Data[0]);
+      n = 1;
+      }
+    else // copy everything up to the next header
+      {
+      n = Stream->Next - Stream->Pos;
+      if (n > Len) { n = Len; }
+      }
+    _SealStreamOut(Stream,n,Data);
+    Data += n; Len -= n;
+
+    // Time for an interim signature?
+    if ((Stream->Interim > 0) && _SealStreamAtBoundary(Stream) &&
+	(time(NULL) - Stream->LastSign >= Stream->Interim))
+      {
+      SealStreamSign(Stream,false);
+      }
+    }
+} /* SealStreamWrite() */
+
+/**************************************
+ SealStreamSign(): Append a SEAL record to the stream.
+ If IsFinal, then this is the last record (b ends with 's~f').
+ Returns: true on success, false if it cannot sign here.
+ **************************************/
+bool	SealStreamSign	(sealstream *Stream, bool IsFinal)
+{
+  sealfield *Args, *sigparm, *block, *sig;
+  const char *Name;
+  size_t *s, *p;
+  size_t i;
+  uint64_t RiffEnd=0;
+  unsigned int mdsize;
+  EVP_MD_CTX *Ctx;
+
+  if (!Stream || !Stream->Format || (Stream->Format=='@')) { return(false); }
+  if (!IsFinal && !_SealStreamAtBoundary(Stream)) { return(false); }
+  Args = Stream->Args;
+
+  // Set the range: from the start (or the previous signature), skipping any RIFF sizes
+  Args = SealCopy(Args,"b","@streamrange");
+  Args = SealAddText(Args,"b","~S");
+  if (IsFinal) { Args = SealAddText(Args,"b",",s~f"); }
+  else { Args = SealAddText(Args,"b",",s~s+3"); } // +3 for '"/>'
+
+  // Build the block with a placeholder signature
+  Args = SealRecord(Args);
+  if (Stream->Format=='R')
+    {
+    Args = Seal_RIFFblock(Args);
+    if (SealGetSize(Args,"@BLOCK") & 1) { Args = SealAddBin(Args,"@BLOCK",1,(byte*)""); } // pad
+    }
+  else { Args = Seal_Matroskablock(Args); }
+  block = SealSearch(Args,"@BLOCK");
+  s = SealGetIarray(Args,"@s"); // relative to the block
+
+  // RIFF: where the chunk holding the record will end
+  if ((Stream->Format=='R') && !Stream->RF64)
+    {
+    if (IsFinal || (Stream->RiffEnd==RIFF_UNKNOWN)) { RiffEnd = Stream->Pos + block->ValueLen; } // ends with the file
+    else { RiffEnd = Stream->RiffEnd + block->ValueLen; }
+    if (RiffEnd - Stream->Riff - 8 > 0xffffffff)
+      {
+      SealPrintf("ERROR: RIFF chunk would be larger than 4 GB; cannot sign the rest of the stream (use RF64).\n");
+      Stream->Format=0; // no more records
+      return(false);
+      }
+    }
+
+  // Finish the digest: stream so far + block up to the signature + after the signature
+  Ctx = EVP_MD_CTX_new();
+  if (!Ctx || !EVP_MD_CTX_copy_ex(Ctx,Stream->Ctx))
+    {
+    fprintf(stderr,"ERROR: Unable to copy the stream digest. Aborting.\n");
+    SealFatal();
+    }
+  EVP_DigestUpdate(Ctx,block->Value,s[0]);
+  EVP_DigestUpdate(Ctx,block->Value+s[1],IsFinal ? block->ValueLen-s[1] : 3);
+  mdsize = EVP_MD_size(Stream->md);
+  sigparm = SealClone(Args);
+  sigparm = SealAlloc(sigparm,"@digest",mdsize,'b');
+  EVP_DigestFinal(Ctx,SealGetBin(sigparm,"@digest"),&mdsize);
+  EVP_MD_CTX_free(Ctx);
+
+  // Sign it (this creates '@signatureenc')
+  switch(SealGetCindex(sigparm,"@mode",0))
+    {
+    case 'S': sigparm = SealSignURL(sigparm); break;
+    case 's': sigparm = SealSignLocal(sigparm); break;
+    default: break; // never happens
+    }
+
+  // Idiot checking: signature size must not change!
+  sig = SealSearch(sigparm,"@signatureenc");
+  if (!sig || (sig->ValueLen + s[0] != s[1]))
+	{
+	fprintf(stderr,"ERROR: signature size changed while streaming. Aborting.\n");
+	SealFatal();
+	}
+  memcpy(block->Value + s[0], sig->Value, sig->ValueLen);
+  SealFree(sigparm);
+
+  // Write the block; the next range starts at this signature
+  SealFileWrite(Stream->fp,block->ValueLen,block->Value);
+  EVP_DigestInit(Stream->Ctx,Stream->md);
+  EVP_DigestUpdate(Stream->Ctx,block->Value+s[0],block->ValueLen-s[0]);
+  s[0] += Stream->Pos; // make '@s' relative to the file
+  s[1] += Stream->Pos;
+  Stream->RangeStart = s[0];
+  Stream->Pos += block->ValueLen;
+  Stream->Next = Stream->Pos; // still at a boundary
+  Stream->Records++;
+  Stream->LastSign = time(NULL);
+
+  p = SealGetIarray(Args,"@p");
+  for(i=0; i < 3; i++) { p[i] = s[i]; } // rotate positions
+  Args = SealSetIindex(Args,"@s",2,Stream->Records); // SealRecord() only keeps '@s' [0] and [1]
+  Args = SealSetText(Args,"@streamrange","P"); // overlap signatures
+  Stream->SkipLen = 0; // already left out of this range
+
+  // RIFF: update the size of the chunk holding the record
+  if (Stream->Format=='R')
+    {
+    byte Size[8];
+    if (Stream->RF64) { writele64(Size,Stream->Pos - 8); } // ds64
+    else
+      {
+      if (Stream->RiffEnd != RIFF_UNKNOWN) { Stream->RiffEnd = RiffEnd; }
+      writele32(Size,(uint32_t)(RiffEnd - Stream->Riff - 8));
+      }
+    if (fseeko(Stream->fp,Stream->RF64 ? 20 : Stream->Riff+4,SEEK_SET) ||
+	(fwrite(Size,Stream->RF64 ? 8 : 4,1,Stream->fp) != 1) ||
+	fseeko(Stream->fp,0,SEEK_END))
+	{
+	fprintf(stderr,"ERROR: Unable to update the RIFF size while streaming. Aborting.\n");
+	SealFatal();
+	}
+    }
+  fflush(Stream->fp); // make the record visible to readers
+  Stream->Args = Args;
+
+  Name = SealSignName(Args);
+  if (SealResultJson) { SealResultAdded((long)SealGetIindex(Args,"@s",2),Name); }
+  else { SealPrintf(" Signature record #%ld added%s%s\n",(long)SealGetIindex(Args,"@s",2),Name[0] ? ": " : "",Name); }
+  return(true);
+} /* SealStreamSign() */
+
+/**************************************
+ SealStreamClose(): Finish the stream and free it.
+ If IsFinal, then appends the final SEAL record.
+ **************************************/
+void	SealStreamClose	(sealstream *Stream, bool IsFinal)
+{
+  if (!Stream) { return; }
+  if (IsFinal && (Stream->Format=='@'))
+    {
+    if (Stream->Pos==0) // nothing to copy or sign
+      {
+      SealPrintf("ERROR: Empty stream; nothing to sign.\n");
+      unlink(SealGetText(Stream->Args,"@FilenameOut"));
+      }
+    else { SealPrintf("ERROR: Unsupported stream format; output will not be signed.\n"); }
+    }
+  else if (IsFinal && Stream->Format)
+    {
+    if (Stream->Lost || Stream->HdrLen || (Stream->Pos != Stream->Next))
+      {
+      SealPrintf("WARNING: Stream ended inside a chunk; the final record may not be found.\n");
+      }
+    SealStreamSign(Stream,true);
+    }
+  SealFileClose(Stream->fp);
+  EVP_MD_CTX_free(Stream->Ctx);
+  SealFree(Stream->Args);
+  free(Stream);
+} /* SealStreamClose() */
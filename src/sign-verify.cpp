@@ -7,11 +7,14 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h> // memset
+#include <pthread.h> // for caches shared by parallel jobs
+#include <sys/stat.h> // for prefetching
 
 // for DNS
 #include <netinet/in.h>
 #include <arpa/nameser.h>
 #include <resolv.h>
+#include <netdb.h> // h_errno values
 #include <ctype.h>
 
 // for OpenSSL v3
@@ -27,6 +30,9 @@
 #include "seal-parse.hpp"
 #include "sign.hpp"
 #include "files.hpp"
+#include "stats.hpp"
+#include "results.hpp"
+#include "formats.hpp"
 
 /********************************************************
  SealGetDNSfile(): Given a file that goes to DNS, use it.
@@ -67,19 +73,97 @@ sealfield *	SealGetDNSfile	(sealfield *Rec)
   return(Rec);
 } /* SealGetDNSfile() */
 
+#pragma GCC visibility push(hidden)
+/*****
+ DNS resolver state.
+ The state is not thread-safe, and res_ninit() rereads the
+ resolver configuration.  So each thread sets it up once and
+ keeps it for the rest of the run.
+ *****/
+typedef struct
+  {
+  struct __res_state State;
+  unsigned char Buffer[16384]; // DNS reply (should be overkill)
+  } sealresolver;
+static pthread_key_t ResolverKey;
+static pthread_once_t ResolverOnce = PTHREAD_ONCE_INIT;
+
+/*****
+ DNS prefetching.
+ A lookup is started as soon as a record is seen, and a few
+ threads wait on DNS while the file is hashed.
+ Upcoming files can be scanned ahead of time too, so their keys
+ are known before the files are verified.
+ Each prefetch is either a copy of the record fields used for
+ the lookup (Rec) or a file to scan for records (Filename).
+ *****/
+#define SEAL_DNS_PREFETCH 4 // lookups in flight
+typedef struct sealprefetch
+  {
+  sealfield *Rec;
+  char *Filename;
+  struct sealprefetch *Next;
+  } sealprefetch;
+static struct
+  {
+  pthread_mutex_t Lock;
+  pthread_cond_t Ready;
+  pthread_t Thread[SEAL_DNS_PREFETCH];
+  int Threads;
+  bool Stop;
+  sealprefetch *Head, *Tail;
+  } Prefetch = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+static __thread bool PrefetchOnly=false; // SealVerify() only starts lookups
+sealfield *	_SealDNSPrefetch	(sealfield *Rec, bool *Started);
+
 /********************************************************
- SealGetDNS(): Given a hostname, get the first matching key from DNS.
- Returns: Public key in '@public', revoke in '@revoke'.
- Errors are detailed in '@error'
+ _SealResolverFree(): Release a thread's resolver.
  ********************************************************/
-sealfield *	SealGetDNS	(sealfield *Rec)
+void	_SealResolverFree	(void *Ptr)
+{
+  sealresolver *R = (sealresolver*)Ptr;
+  if (!R) { return; }
+  res_nclose(&R->State);
+  free(R);
+} /* _SealResolverFree() */
+
+/********************************************************
+ _SealResolverInit(): Create the per-thread key (once).
+ ********************************************************/
+void	_SealResolverInit	()
+{
+  pthread_key_create(&ResolverKey,_SealResolverFree);
+} /* _SealResolverInit() */
+
+/********************************************************
+ _SealResolverGet(): Get this thread's resolver.
+ ********************************************************/
+sealresolver *	_SealResolverGet	()
+{
+  sealresolver *R;
+
+  pthread_once(&ResolverOnce,_SealResolverInit);
+  R = (sealresolver*)pthread_getspecific(ResolverKey);
+  if (R) { return(R); }
+
+  R = (sealresolver*)calloc(1,sizeof(sealresolver));
+  if (!R || (res_ninit(&R->State) < 0))
+    {
+    // Should never happen
+    fprintf(stderr,"ERROR: Unable to initialize DNS lookup. Aborting.\n");
+    SealFatal();
+    }
+  pthread_setspecific(ResolverKey,R);
+  return(R);
+} /* _SealResolverGet() */
+
+/********************************************************
+ _SealDNSKey(): Set the DNS cache key ('@dnscache').
+ ********************************************************/
+sealfield *	_SealDNSKey	(sealfield *Rec)
 {
-  char *Domain;
-  if (!Rec) { return(Rec); } // must be defined
   if (!SealSearch(Rec,"uid")) { Rec=SealSetText(Rec,"uid",""); } // default uid
   if (!SealSearch(Rec,"kv")) { Rec=SealSetText(Rec,"kv","1"); } // default key version
-
-  // For speed: Check if the same DNS key exists
   Rec = SealCopy(Rec,"@dnscache","seal");
   Rec = SealAddText(Rec,"@dnscache",":");
   Rec = SealAddText(Rec,"@dnscache",SealGetText(Rec,"d"));
@@ -89,50 +173,42 @@ sealfield *	SealGetDNS	(sealfield *Rec)
   Rec = SealAddText(Rec,"@dnscache",SealGetText(Rec,"ka"));
   Rec = SealAddText(Rec,"@dnscache",":");
   Rec = SealAddText(Rec,"@dnscache",SealGetText(Rec,"uid"));
-  if (!SealCmp(Rec,"@dnscache","@dnscachelast"))
-	{
-	return(Rec);
-	}
-
-  // Prepare for new DNS lookup
-  Rec = SealMove(Rec,"@dnscachelast","@dnscache");
-  Rec = SealDel(Rec,"@public");
-  Rec = SealDel(Rec,"@publicbin");
-  Rec = SealDel(Rec,"@revoke");
-  Domain = SealGetText(Rec,"d"); // must be defined
-  if (!Domain || !Domain[0])
-    {
-    Rec = SealSetText(Rec,"@error","no domain specified");
-    return(Rec);
-    }
+  return(Rec);
+} /* _SealDNSKey() */
 
-  // Do the DNS query!
+/********************************************************
+ _SealDNSLookup(): Ask DNS for the key named by '@dnscachelast'.
+ The caller must have claimed the key (SealDNSCacheClaim).
+ Sets '@public' and '@revoke' and caches the result.
+ ********************************************************/
+sealfield *	_SealDNSLookup	(sealfield *Rec)
+{
+  char *Domain;
   sealfield *vf, *Reply=NULL;
   sealfield *vBuf=NULL;
-  unsigned char Buffer[16384]; // permit 16K buffer for DNS reply (should be overkill)
+  sealresolver *Resolver;
+  unsigned char *Buffer; // DNS reply
   const char *s;
   int Txti; // DNS unparsed (input) TXT as offset into Buffer
   int size;
   ns_msg nsMsg;
   ns_rr rr; // dns response record
-  struct __res_state dnsstate;
   int MsgMax, count, c;
-
-  // Check for static file
-  Reply = SealGetDNSfile(Rec);
-  if (Reply) { return(Reply); }
+  bool Cacheable=true; // DNS server failures should not be cached
+  uint32_t TTL=SEAL_DNS_NEGTTL; // not found is cached briefly
 
   // Do DNS
-  memset(&dnsstate, 0, sizeof(dnsstate));
-  if (res_ninit(&dnsstate) < 0)
-    {
-    // Should never happen
-    fprintf(stderr,"ERROR: Unable to initialize DNS lookup. Aborting.\n");
-    exit(1);
-    }
-
-  memset(&Buffer, 0, 16384);
-  MsgMax = res_nquery(&dnsstate, Domain, C_IN, T_TXT, Buffer, 16384-1);
+  Domain = SealGetText(Rec,"d"); // must be defined
+  Resolver = _SealResolverGet();
+  Buffer = Resolver->Buffer;
+  memset(Buffer, 0, sizeof(Resolver->Buffer));
+  SealStatInc(SEAL_COUNT_DNSQUERY,1);
+  MsgMax = res_nquery(&Resolver->State, Domain, C_IN, T_TXT, Buffer, sizeof(Resolver->Buffer)-1);
+  if ((MsgMax < 0) && // only cache "does not exist", not server failures
+      (Resolver->State.res_h_errno != HOST_NOT_FOUND) && (Resolver->State.res_h_errno != NO_DATA))
+	{
+	Cacheable=false;
+	}
   if (MsgMax > 0) // found something!
     {
     /*****
@@ -266,16 +342,274 @@ sealfield *	SealGetDNS	(sealfield *Rec)
 	  }
 	Rec = SealSetText(Rec,"@revoke",(char*)vf->Value);
 	}
+      TTL = ns_rr_ttl(rr); // DNS says how long to trust it
       goto Done; // Found a result!
       } // foreach dns record
     } // if dns reply
 
 Done:
-  res_nclose(&dnsstate);
   if (Reply) { SealFree(Reply); }
+  if (Cacheable) { SealDNSCacheSet(Rec,SealGetText(Rec,"@dnscachelast"),TTL); }
+  return(Rec);
+} /* _SealDNSLookup() */
+
+/********************************************************
+ _SealPrefetchScan(): Find the records in a file and start
+ looking up their keys.
+ The file is walked by its format, exactly like verifying it,
+ so only the records that will be verified are looked up and
+ skipped data (clusters, 'movi') is never read.
+ SealVerify() starts each lookup and does nothing else.
+ Only regular files are scanned; pipes must be read once.
+ ********************************************************/
+void	_SealPrefetchScan	(sealfield *Args, const char *Filename)
+{
+  stat_t Stat;
+  mmapfile *Mmap;
+  sealarena *Arena, *Prev;
+
+  if (stat64(Filename,&Stat) || !S_ISREG(Stat.st_mode)) { return; }
+  Mmap = MmapOpen(Filename,PROT_READ);
+  if (!Mmap) { return; }
+  if (!MmapMap(Mmap,PROT_READ)) { MmapFree(Mmap); return; }
+
+  // The walk is repeated when the file is verified; count it then
+  SealStatsFile(NULL,0); // keep this thread's lookups
+  Arena = SealArenaNew();
+  Prev = SealArenaUse(Arena);
+  Args = SealClone(Args);
+  PrefetchOnly=true;
+  if (Seal_isPNG(Mmap)) { Args = Seal_PNG(Args,Mmap); }
+  else if (Seal_isJPEG(Mmap)) { Args = Seal_JPEG(Args,Mmap); }
+  else if (Seal_isRIFF(Mmap)) { Args = Seal_RIFF(Args,Mmap); }
+  else if (Seal_isMatroska(Mmap)) { Args = Seal_Matroska(Args,Mmap); }
+  PrefetchOnly=false;
+  SealArenaUse(Prev);
+  SealArenaFree(Arena);
+  MmapFree(Mmap);
+  SealStatsDiscard();
+} /* _SealPrefetchScan() */
+
+/********************************************************
+ _SealPrefetchWorker(): Thread that does queued lookups.
+ Runs until SealVerifyCacheFree() stops it.
+ ********************************************************/
+void *	_SealPrefetchWorker	(void *Arg)
+{
+  sealprefetch *P;
+  (void)Arg;
+
+  // Problems with scanned files are reported when they are verified
+  SealOut = fopen("/dev/null","w");
+
+  pthread_mutex_lock(&Prefetch.Lock);
+  while(1)
+    {
+    while(!Prefetch.Head && !Prefetch.Stop) { pthread_cond_wait(&Prefetch.Ready,&Prefetch.Lock); }
+    if (!Prefetch.Head) { break; } // stopped and nothing left
+    P = Prefetch.Head;
+    Prefetch.Head = P->Next;
+    if (!Prefetch.Head) { Prefetch.Tail=NULL; }
+    pthread_mutex_unlock(&Prefetch.Lock);
+
+    if (P->Filename)
+      {
+      _SealPrefetchScan(P->Rec,P->Filename);
+      free(P->Filename);
+      SealFree(P->Rec);
+      }
+    else
+      {
+      P->Rec = _SealDNSLookup(P->Rec);
+      SealDNSCacheRelease(SealGetText(P->Rec,"@dnscachelast"));
+      SealFree(P->Rec);
+      }
+    free(P);
+
+    pthread_mutex_lock(&Prefetch.Lock);
+    }
+  pthread_mutex_unlock(&Prefetch.Lock);
+  if (SealOut) { fclose(SealOut); SealOut=NULL; }
+  SealStatsFile(NULL,0); // --stats: lookups from this thread
+  return(NULL);
+} /* _SealPrefetchWorker() */
+
+/********************************************************
+ _SealPrefetchAdd(): Queue a prefetch; start threads as needed.
+ ********************************************************/
+void	_SealPrefetchAdd	(sealfield *Rec, const char *Filename)
+{
+  sealprefetch *P;
+
+  P = (sealprefetch*)calloc(1,sizeof(sealprefetch));
+  if (!P) { fprintf(stderr,"ERROR: Unable to allocate memory. Aborting.\n"); SealFatal(); }
+  P->Rec = Rec;
+  if (Filename) { P->Filename = strdup(Filename); }
+
+  pthread_mutex_lock(&Prefetch.Lock);
+  if (Prefetch.Tail) { Prefetch.Tail->Next = P; }
+  else { Prefetch.Head = P; }
+  Prefetch.Tail = P;
+  if (Prefetch.Threads < SEAL_DNS_PREFETCH)
+    {
+    if (pthread_create(&Prefetch.Thread[Prefetch.Threads],NULL,_SealPrefetchWorker,NULL))
+      {
+      fprintf(stderr,"ERROR: Unable to start DNS lookup thread. Aborting.\n");
+      pthread_mutex_unlock(&Prefetch.Lock);
+      SealFatal();
+      }
+    Prefetch.Threads++;
+    }
+  pthread_cond_signal(&Prefetch.Ready);
+  pthread_mutex_unlock(&Prefetch.Lock);
+} /* _SealPrefetchAdd() */
+
+/********************************************************
+ _SealDNSPrefetch(): Start looking up a record's public key.
+ Sets Started to true if a lookup was queued; SealGetDNS()
+ will wait for it.  Nothing is queued when the key is already
+ known, already being looked up, or comes from a file.
+ ********************************************************/
+sealfield *	_SealDNSPrefetch	(sealfield *Rec, bool *Started)
+{
+  sealfield *Job;
+  sealarena *Arena;
+  const char *Domain;
+
+  *Started=false;
+  if (SealSearch(Rec,"@pubkeyfile")) { return(Rec); }
+  Domain = SealGetText(Rec,"d");
+  if (!Domain || !Domain[0]) { return(Rec); }
+  Rec = _SealDNSKey(Rec);
+  if (!SealCmp(Rec,"@dnscache","@dnscachelast")) { return(Rec); } // same as last record
+  if (!SealDNSCacheClaim(SealGetText(Rec,"@dnscache"),false)) { return(Rec); }
+
+  // The lookup outlives this file, so copy it to the heap
+  Arena = SealArenaUse(NULL);
+  Job = SealCopy2(NULL,"seal",Rec,"seal");
+  Job = SealCopy2(Job,"d",Rec,"d");
+  Job = SealCopy2(Job,"kv",Rec,"kv");
+  Job = SealCopy2(Job,"ka",Rec,"ka");
+  Job = SealCopy2(Job,"uid",Rec,"uid");
+  Job = SealCopy2(Job,"@dnscachelast",Rec,"@dnscache");
+  SealArenaUse(Arena);
+  _SealPrefetchAdd(Job,NULL);
+  *Started=true;
+  return(Rec);
+} /* _SealDNSPrefetch() */
+
+/********************************************************
+ _SealDNSClaimCleanup(): Release a claimed DNS key after a recovered fatal error.
+ ********************************************************/
+void	_SealDNSClaimCleanup	(void *Key)
+{
+  SealDNSCacheRelease((const char*)Key);
+  free(Key);
+} /* _SealDNSClaimCleanup() */
+#pragma GCC visibility pop
+
+// Per-thread: did any key lookup fail? (see SealDNSLookupFailed)
+static __thread bool DNSLookupFailed=false;
+
+/********************************************************
+ SealGetDNS(): Given a hostname, get the first matching key from DNS.
+ Returns: Public key in '@public', revoke in '@revoke'.
+ Errors are detailed in '@error'
+ ********************************************************/
+sealfield *	SealGetDNS	(sealfield *Rec)
+{
+  char *Domain, *Key;
+  sealfield *Reply;
+  bool Hit;
+
+  if (!Rec) { return(Rec); } // must be defined
+
+  // For speed: Check if the same DNS key exists
+  Rec = _SealDNSKey(Rec);
+  if (!SealCmp(Rec,"@dnscache","@dnscachelast"))
+	{
+	if (!SealSearch(Rec,"@public")) { DNSLookupFailed=true; }
+	return(Rec);
+	}
+
+  // Prepare for new DNS lookup
+  Rec = SealMove(Rec,"@dnscachelast","@dnscache");
+  Rec = SealDel(Rec,"@public");
+  Rec = SealDel(Rec,"@publicbin");
+  Rec = SealDel(Rec,"@revoke");
+  Domain = SealGetText(Rec,"d"); // must be defined
+  if (!Domain || !Domain[0])
+    {
+    Rec = SealSetText(Rec,"@error","no domain specified");
+    return(Rec);
+    }
+
+  // Check for static file
+  Reply = SealGetDNSfile(Rec);
+  if (Reply) { return(Reply); }
+
+  // Check the cache (shared across files and threads)
+  Key = strdup(SealGetText(Rec,"@dnscachelast"));
+  Rec = SealDNSCacheGet(Rec,Key,&Hit);
+  // Only one thread asks DNS for a key; the others wait for the answer
+  while(!Hit && !SealDNSCacheClaim(Key,true)) { Rec = SealDNSCacheGet(Rec,Key,&Hit); }
+  if (!Hit)
+    {
+    SealCleanupPush(_SealDNSClaimCleanup,Key); // other threads may be waiting
+    Rec = _SealDNSLookup(Rec);
+    SealCleanupPop(Key);
+    SealDNSCacheRelease(Key);
+    }
+  else { SealStatInc(SEAL_COUNT_DNSHIT,1); }
+  free(Key);
+
+  // Server failures and missing keys may be temporary
+  if (!SealSearch(Rec,"@public")) { DNSLookupFailed=true; }
   return(Rec);
 } /* SealGetDNS() */
 
+/********************************************************
+ SealDNSLookupFailed(): Did any DNS key lookup on this thread
+ fail (server failure or no key found) since the last call?
+ Resets the flag.
+ ********************************************************/
+bool	SealDNSLookupFailed	()
+{
+  bool Failed;
+  Failed = DNSLookupFailed;
+  DNSLookupFailed=false;
+  return(Failed);
+} /* SealDNSLookupFailed() */
+
+/********************************************************
+ SealDNSPrefetchFile(): Start looking up the keys for a file
+ that will be verified soon.
+ The file is scanned in the background; this never blocks.
+ ********************************************************/
+void	SealDNSPrefetchFile	(sealfield *Args, const char *Filename)
+{
+  char Key[2048];
+  char *Results;
+  sealfield *Job;
+  sealarena *Arena;
+
+  if (!Filename || SealSearch(Args,"@pubkeyfile")) { return; } // keys from a file
+  if (SealResultCacheKey(Args,Filename,Key,sizeof(Key)))
+    {
+    Results = SealResultCacheGet(Key);
+    if (Results) { free(Results); return; } // will not be verified
+    }
+
+  // The scan outlives this call, so copy the options to the heap.
+  // Options that read every byte are left to the real verification.
+  Arena = SealArenaUse(NULL);
+  Job = SealClone(Args);
+  Job = SealDel(Job,"deepscan");
+  Job = SealDel(Job,"crc");
+  SealArenaUse(Arena);
+  _SealPrefetchAdd(Job,Filename);
+} /* SealDNSPrefetchFile() */
+
 /********************************************************
  SealRotateRecords(): Before processing each record, rotate
  the previous '@s' to '@p'.
@@ -313,7 +647,7 @@ sealfield *	SealValidateDecodeParts	(sealfield *Rec)
     return(Rec);
     }
 
-  SigFormat = SealGetText(Rec,"sf"); // always defined
+  SigFormat = SealGetText(Rec,"sf"); // checked by SealVerifyFields()
 
   Sig = SealGetText(Rec,"s");
   if (!Sig)
@@ -476,6 +810,243 @@ sealfield *	SealValidateRevoke	(sealfield *Rec)
   return(Rec);
 } /* SealValidateRevoke() */
 
+/*****
+ Decoding a public key and building a verify context are
+ expensive compared to verifying one small file.
+ Usually every record in a batch uses the same few keys.
+
+ Decoded keys are cached for the whole process (shared by
+ every thread; an EVP_PKEY is read-only once loaded).
+ Verify contexts cannot be shared, so each thread keeps its
+ own small list of initialized contexts.
+ *****/
+#pragma GCC visibility push(hidden)
+typedef struct sealpubkey
+  {
+  char *KeyAlg; // 'ka'
+  byte *Der; // '@publicbin'
+  size_t DerLen;
+  EVP_PKEY *Key;
+  struct sealpubkey *Next;
+  } sealpubkey;
+static sealpubkey *PubKeyCache=NULL;
+static pthread_mutex_t PubKeyLock = PTHREAD_MUTEX_INITIALIZER;
+
+#define SEAL_VERIFYCTX_MAX 8 // contexts kept per thread
+typedef struct sealverifyctx
+  {
+  EVP_PKEY *Key;
+  const EVP_MD *md;
+  EVP_PKEY_CTX *Ctx;
+  struct sealverifyctx *Next;
+  } sealverifyctx;
+static pthread_key_t VerifyCtxKey;
+static pthread_once_t VerifyCtxOnce = PTHREAD_ONCE_INIT;
+
+/**************************************
+ _SealVerifyCtxFree(): Free a thread's list of verify contexts.
+ Called automatically when the thread exits.
+ **************************************/
+void	_SealVerifyCtxFree	(void *List)
+{
+  sealverifyctx *V, *Vnext;
+  for(V=(sealverifyctx*)List; V; V=Vnext)
+    {
+    Vnext = V->Next;
+    EVP_PKEY_CTX_free(V->Ctx);
+    free(V);
+    }
+} /* _SealVerifyCtxFree() */
+
+/**************************************
+ _SealVerifyCtxInit(): Create the per-thread key.
+ **************************************/
+void	_SealVerifyCtxInit	()
+{
+  pthread_key_create(&VerifyCtxKey,_SealVerifyCtxFree);
+} /* _SealVerifyCtxInit() */
+
+/**************************************
+ _SealVerifyCtxCleanup(): Free a new context after a recovered fatal error.
+ **************************************/
+void	_SealVerifyCtxCleanup	(void *Ctx)
+{
+  EVP_PKEY_CTX_free((EVP_PKEY_CTX*)Ctx);
+} /* _SealVerifyCtxCleanup() */
+
+/**************************************
+ _SealVerifyCtxAbort(): Report an OpenSSL context failure and abort.
+ **************************************/
+void	_SealVerifyCtxAbort	(const char *Msg)
+{
+  unsigned long e;
+  e = ERR_get_error();
+  fprintf(stderr,"%s (%s: %s)\n",Msg,ERR_lib_error_string(e),ERR_reason_error_string(e));
+  SealFatal();
+} /* _SealVerifyCtxAbort() */
+
+/**************************************
+ _SealPubKeyGet(): Get the decoded public key.
+ Decodes the DER once per key; cached for the process.
+ Returns: key (do not free!) or NULL if it cannot be decoded.
+ **************************************/
+EVP_PKEY *	_SealPubKeyGet	(const char *KeyAlg, sealfield *pubkey)
+{
+  sealpubkey *P;
+  EVP_PKEY *Key=NULL;
+  BIO *bio;
+
+  pthread_mutex_lock(&PubKeyLock);
+  for(P=PubKeyCache; P; P=P->Next)
+    {
+    if ((P->DerLen == pubkey->ValueLen) &&
+	!strcmp(P->KeyAlg,KeyAlg) &&
+	!memcmp(P->Der,pubkey->Value,P->DerLen))
+	{
+	Key = P->Key;
+	break;
+	}
+    }
+  pthread_mutex_unlock(&PubKeyLock);
+  if (Key) { return(Key); }
+
+  /* Use BIO to import the data */
+  bio = BIO_new_mem_buf(pubkey->Value, pubkey->ValueLen);
+  if (!bio) { return(NULL); }
+  /* Convert BIO to public key */
+  Key = d2i_PUBKEY_bio(bio, NULL);
+  BIO_free(bio); // done with BIO
+  if (!Key) { return(NULL); }
+
+  // Save it
+  P = (sealpubkey*)calloc(1,sizeof(sealpubkey));
+  P->KeyAlg = strdup(KeyAlg);
+  P->Der = (byte*)malloc(pubkey->ValueLen);
+  memcpy(P->Der,pubkey->Value,pubkey->ValueLen);
+  P->DerLen = pubkey->ValueLen;
+  P->Key = Key;
+  pthread_mutex_lock(&PubKeyLock);
+  P->Next = PubKeyCache;
+  PubKeyCache = P;
+  pthread_mutex_unlock(&PubKeyLock);
+  return(Key);
+} /* _SealPubKeyGet() */
+
+/**************************************
+ _SealVerifyCtxGet(): Get an initialized verify context for this thread.
+ Contexts are reused, so a repeated key goes straight to EVP_PKEY_verify().
+ Returns: context (do not free!).  Aborts on OpenSSL failures.
+ **************************************/
+EVP_PKEY_CTX *	_SealVerifyCtxGet	(EVP_PKEY *Key, const EVP_MD *md, const char *KeyAlg)
+{
+  sealverifyctx *List, *V, *Vprev=NULL;
+  EVP_PKEY_CTX *Ctx;
+  int Count=0;
+
+  pthread_once(&VerifyCtxOnce,_SealVerifyCtxInit);
+  List = (sealverifyctx*)pthread_getspecific(VerifyCtxKey);
+  for(V=List; V; Vprev=V, V=V->Next)
+    {
+    if ((V->Key == Key) && (V->md == md))
+      {
+      if (Vprev) // move to the front of the list
+	{
+	Vprev->Next = V->Next;
+	V->Next = List;
+	pthread_setspecific(VerifyCtxKey,V);
+	}
+      return(V->Ctx);
+      }
+    Count++;
+    }
+
+  // Prepare public key for verifying
+  Ctx = EVP_PKEY_CTX_new(Key,NULL);
+  if (!Ctx) // could happen if key is corrupt
+	{
+	_SealVerifyCtxAbort("Unable to create validation context.");
+	}
+  SealCleanupPush(_SealVerifyCtxCleanup,Ctx);
+  if (EVP_PKEY_verify_init(Ctx) != 1)
+	{
+	_SealVerifyCtxAbort("Unable to initialize validation context.");
+	}
+
+  // RSA needs padding
+  if (!strcmp(KeyAlg,"rsa"))
+    {
+    if (EVP_PKEY_CTX_set_rsa_padding(Ctx, RSA_PKCS1_PADDING) != 1)
+	{
+	_SealVerifyCtxAbort("Unable to initialize RSA validation.");
+	}
+    } // setup rsa padding
+
+  if (EVP_PKEY_CTX_set_signature_md(Ctx, md) != 1)
+	{
+	_SealVerifyCtxAbort("Unable to set digest for validation.");
+	}
+
+  // Drop the least-recently used context if the list is full
+  if (Count >= SEAL_VERIFYCTX_MAX)
+    {
+    for(Vprev=List; Vprev->Next->Next; Vprev=Vprev->Next) { ; }
+    _SealVerifyCtxFree(Vprev->Next);
+    Vprev->Next = NULL;
+    }
+
+  V = (sealverifyctx*)calloc(1,sizeof(sealverifyctx));
+  V->Key = Key;
+  V->md = md;
+  V->Ctx = Ctx;
+  V->Next = List;
+  pthread_setspecific(VerifyCtxKey,V);
+  SealCleanupPop(Ctx); // the thread owns it now
+  return(Ctx);
+} /* _SealVerifyCtxGet() */
+#pragma GCC visibility pop
+
+/********************************************************
+ SealVerifyCacheFree(): Release every cached public key.
+ Per-thread contexts are freed when each thread exits;
+ this also frees the calling thread's contexts.
+ Also waits for any DNS prefetches (and stops their threads).
+ ********************************************************/
+void	SealVerifyCacheFree	()
+{
+  sealpubkey *P;
+
+  int t;
+
+  // Finish any DNS prefetches
+  pthread_mutex_lock(&Prefetch.Lock);
+  Prefetch.Stop=true;
+  pthread_cond_broadcast(&Prefetch.Ready);
+  pthread_mutex_unlock(&Prefetch.Lock);
+  for(t=0; t < Prefetch.Threads; t++) { pthread_join(Prefetch.Thread[t],NULL); }
+  Prefetch.Threads=0;
+  Prefetch.Stop=false;
+
+  pthread_once(&ResolverOnce,_SealResolverInit);
+  _SealResolverFree(pthread_getspecific(ResolverKey));
+  pthread_setspecific(ResolverKey,NULL);
+
+  pthread_once(&VerifyCtxOnce,_SealVerifyCtxInit);
+  _SealVerifyCtxFree(pthread_getspecific(VerifyCtxKey));
+  pthread_setspecific(VerifyCtxKey,NULL);
+
+  pthread_mutex_lock(&PubKeyLock);
+  while(PubKeyCache)
+    {
+    P = PubKeyCache->Next;
+    EVP_PKEY_free(PubKeyCache->Key);
+    free(PubKeyCache->KeyAlg);
+    free(PubKeyCache->Der);
+    free(PubKeyCache);
+    PubKeyCache = P;
+    }
+  pthread_mutex_unlock(&PubKeyLock);
+} /* SealVerifyCacheFree() */
+
 /********************************************************
  SealValidateSig(): Given seal record with DNS results,
  and decoded binary signature, see if it validates!!!
@@ -490,7 +1061,6 @@ sealfield *	SealValidateSig	(sealfield *Rec)
   EVP_PKEY_CTX *PubKeyCtx=NULL;
   char *keyalg, *digestalg;
   sealfield *sigbin, *digestbin, *pubkey;
-  unsigned long e;
 
   /*****
    If you're calling this function, then we have:
@@ -506,14 +1076,14 @@ sealfield *	SealValidateSig	(sealfield *Rec)
    *****/
 
   digestalg = SealGetText(Rec,"da"); // SEAL's 'da' parameter
-  if (!strcmp(digestalg,"sha224")) { mdf = EVP_sha224; }
-  else if (!strcmp(digestalg,"sha256")) { mdf = EVP_sha256; }
+  if (!digestalg || !strcmp(digestalg,"sha256")) { mdf = EVP_sha256; } // default, as in SealDigest()
+  else if (!strcmp(digestalg,"sha224")) { mdf = EVP_sha224; }
   else if (!strcmp(digestalg,"sha384")) { mdf = EVP_sha384; }
   else if (!strcmp(digestalg,"sha512")) { mdf = EVP_sha512; }
   else
 	{
 	fprintf(stderr,"ERROR: Unsupported digest algorithm (da=%s).\n",digestalg);
-	exit(1);
+	SealFatal();
 	}
 
   // Prepare the public key
@@ -521,119 +1091,101 @@ sealfield *	SealValidateSig	(sealfield *Rec)
   if (!pubkey) // should never happen
     {
     Rec = SealSetText(Rec,"@error","no public key found");
-    goto Done;
+    return(Rec);
     }
 
   keyalg = SealGetText(Rec,"ka");
   if (!keyalg) // should never happen
     {
     Rec = SealSetText(Rec,"@error","no public key algorithm defined");
-    goto Done;
+    return(Rec);
     }
 
   sigbin = SealSearch(Rec,"@sigbin");
   if (!sigbin) // should never happen
     {
     Rec = SealSetText(Rec,"@error","no signature found");
-    goto Done;
+    return(Rec);
     }
 
   digestbin = SealSearch(Rec,"@digest");
   if (!digestbin) // should never happen
     {
     Rec = SealSetText(Rec,"@error","no digest found");
-    goto Done;
+    return(Rec);
     }
 
-  // Load public key into EVP_PKEY structure
-  {
-  /* Use BIO to import the data */
-  BIO *bio;
-  bio = BIO_new_mem_buf(pubkey->Value, pubkey->ValueLen);
-  if (!bio)
-	{
-	Rec = SealSetText(Rec,"@error","failed to load public key into memory");
-	goto Done;
-	}
-  /* Convert BIO to public key */
-  PubKey = d2i_PUBKEY_bio(bio, NULL);
-  BIO_free(bio); // done with BIO
-  }
-
+  // Load public key into EVP_PKEY structure (cached)
+  PubKey = _SealPubKeyGet(keyalg,pubkey);
   if (!PubKey)
 	{
 	Rec = SealSetText(Rec,"@error","failed to import public key");
-	goto Done;
-	}
-
-  // Prepare public key for verifying
-  PubKeyCtx = EVP_PKEY_CTX_new(PubKey,NULL);
-  if (!PubKeyCtx) // could happen if key is corrupt
-	{
-	fprintf(stderr,"Unable to create validation context.\n");
-	e = ERR_get_error();
-	Rec = SealAddText(Rec,"@error"," (");
-	Rec = SealAddText(Rec,"@error",ERR_lib_error_string(e));
-	Rec = SealAddText(Rec,"@error",": ");
-	Rec = SealAddText(Rec,"@error",ERR_reason_error_string(e));
-	Rec = SealAddText(Rec,"@error",")");
-	exit(1);
-	}
-  if (EVP_PKEY_verify_init(PubKeyCtx) != 1)
-	{
-	fprintf(stderr,"Unable to initialize validation context.\n");
-	e = ERR_get_error();
-	Rec = SealAddText(Rec,"@error"," (");
-	Rec = SealAddText(Rec,"@error",ERR_lib_error_string(e));
-	Rec = SealAddText(Rec,"@error",": ");
-	Rec = SealAddText(Rec,"@error",ERR_reason_error_string(e));
-	Rec = SealAddText(Rec,"@error",")");
-	exit(1);
-	}
-
-  // RSA needs padding
-  if (!strcmp(keyalg,"rsa"))
-    {
-    if (EVP_PKEY_CTX_set_rsa_padding(PubKeyCtx, RSA_PKCS1_PADDING) != 1)
-	{
-	fprintf(stderr,"Unable to initialize RSA validation.\n");
-	e = ERR_get_error();
-	Rec = SealAddText(Rec,"@error"," (");
-	Rec = SealAddText(Rec,"@error",ERR_lib_error_string(e));
-	Rec = SealAddText(Rec,"@error",": ");
-	Rec = SealAddText(Rec,"@error",ERR_reason_error_string(e));
-	Rec = SealAddText(Rec,"@error",")");
-	exit(1);
+	return(Rec);
 	}
-    } // setup rsa padding
 
-  if (EVP_PKEY_CTX_set_signature_md(PubKeyCtx, mdf()) != 1)
-	{
-	fprintf(stderr,"Unable to set digest for validation.\n");
-	e = ERR_get_error();
-	Rec = SealAddText(Rec,"@error"," (");
-	Rec = SealAddText(Rec,"@error",ERR_lib_error_string(e));
-	Rec = SealAddText(Rec,"@error",": ");
-	Rec = SealAddText(Rec,"@error",ERR_reason_error_string(e));
-	Rec = SealAddText(Rec,"@error",")");
-	exit(1);
-	}
+  // Prepare public key for verifying (cached per thread)
+  PubKeyCtx = _SealVerifyCtxGet(PubKey,mdf(),keyalg);
 
   // Check the signature!
-  sigbin = SealSearch(Rec,"@sigbin");
-  digestbin = SealSearch(Rec,"@digest");
   if (EVP_PKEY_verify(PubKeyCtx, sigbin->Value, sigbin->ValueLen, digestbin->Value, digestbin->ValueLen) != 1)
 	{
 	Rec = SealSetText(Rec,"@error","signature mismatch");
 	}
 
-Done:
-  // Free structures when done.
-  if (PubKeyCtx) { EVP_PKEY_CTX_free(PubKeyCtx); }
-  if (PubKey) { EVP_PKEY_free(PubKey); }
   return(Rec);
 } /* SealValidateSig() */
 
+// Per-thread tally of records checked (see SealVerifyCount)
+static __thread long VerifyValid=0;
+static __thread long VerifyInvalid=0;
+
+/********************************************************
+ SealVerifyCount(): Get and reset this thread's tally of
+ valid and invalid records from SealVerify().
+ ********************************************************/
+void	SealVerifyCount	(long *Valid, long *Invalid)
+{
+  if (Valid) { *Valid = VerifyValid; }
+  if (Invalid) { *Invalid = VerifyInvalid; }
+  VerifyValid = VerifyInvalid = 0;
+} /* SealVerifyCount() */
+
+/********************************************************
+ SealVerifyFields(): Make sure a parsed record has every
+ field that verification reads.
+ The record comes from the file, so nothing is defaulted.
+ Returns: true if the record can be verified.
+ Otherwise sets '@error' and returns false.
+ ********************************************************/
+bool	SealVerifyFields	(sealfield **Rec)
+{
+  /*****
+   Field names and the error when each is missing.
+   ('s' is reported by SealValidateDecodeParts.)
+   *****/
+  const char *Fields[] = {
+    "b", "no byte range (b=)",
+    "d", "no domain (d=)",
+    "sf", "no signature format (sf=)",
+    NULL
+    };
+  const char *Txt;
+  int f;
+
+  if (!*Rec) { return(false); }
+  if (SealSearch(*Rec,"@error")) { return(false); }
+  for(f=0; Fields[f]; f+=2)
+    {
+    Txt = SealGetText(*Rec,Fields[f]);
+    if (!Txt || !Txt[0])
+      {
+      *Rec = SealSetText(*Rec,"@error",Fields[f+1]);
+      return(false);
+      }
+    }
+  return(true);
+} /* SealVerifyFields() */
+
 /********************************************************
  SealVerify(): Given seal record, see if it validates.
  Generates output text!
@@ -649,36 +1201,71 @@ sealfield *	SealVerify	(sealfield *Rec, mmapfile *Mmap)
    If it's less than 1, then no signature was found.
    If it's 1, then check if it covers the start of the file.
    *****/
+  // Scanning ahead (_SealPrefetchScan): only start the key lookup
+  if (PrefetchOnly)
+    {
+    bool Started;
+    if (SealVerifyFields(&Rec)) { Rec = _SealDNSPrefetch(Rec,&Started); }
+    return(Rec);
+    }
+
   signum = SealGetIindex(Rec,"@s",2);
   if (signum < 1) // should never happen
     {
-    printf("WARNING: Invalid SEAL record count (%ld).\n",signum);
+    SealPrintf("WARNING: Invalid SEAL record count (%ld).\n",signum);
     return(Rec);
     }
 
   /* Compute current digest */
+  SealVerifyFields(&Rec);
   ErrorMsg = SealGetText(Rec,"@error");
 
   // Check for prepending: signatures should cover start of file
-  if (signum == 1)
+  if (ErrorMsg) { ; } // no byte range to check
+  else if (signum == 1)
     {
     if (!strchr(SealGetText(Rec,"b"),'F'))
 	{
-	printf("WARNING: SEAL record #%ld does not cover the start of file. Vulnerable to prepending attacks.\n",signum);
+	SealPrintf("WARNING: SEAL record #%ld does not cover the start of file. Vulnerable to prepending attacks.\n",signum);
 	}
     }
   else // if (signum > 1)
     {
     if (!strchr(SealGetText(Rec,"b"),'F') && !strchr(SealGetText(Rec,"b"),'P'))
 	{
-	printf("WARNING: SEAL record #%ld does not cover the previous signature. Vulnerable to insertion attacks.\n",signum);
+	SealPrintf("WARNING: SEAL record #%ld does not cover the previous signature. Vulnerable to insertion attacks.\n",signum);
 	}
     }
 
+  /*****
+   If the public key needs a DNS lookup, then start it now and
+   compute the digest while waiting for the answer.
+   Errors are still reported in the usual order (below).
+   *****/
+  Rec = SealDel(Rec,"@predigest");
+  if (!ErrorMsg)
+	{
+	bool Started;
+	Rec = _SealDNSPrefetch(Rec,&Started);
+	if (Started)
+	  {
+	  Rec = SealValidateDecodeParts(Rec);
+	  if (!SealSearch(Rec,"@error"))
+	    {
+	    Rec = SealDigest(Rec,Mmap);
+	    Rec = SealDoubleDigest(Rec);
+	    if (!SealSearch(Rec,"@error")) { Rec = SealSetText(Rec,"@predigest","1"); }
+	    }
+	  Rec = SealDel(Rec,"@error");
+	  }
+	}
+
   /* Get public key */
   if (!ErrorMsg)
 	{
+	double Start = SealStatStart();
 	Rec = SealGetDNS(Rec);
+	SealStatStop(SEAL_PHASE_DNS,Start); // includes waiting on a prefetch
 	ErrorMsg = SealGetText(Rec,"@error");
 	}
 
@@ -690,7 +1277,7 @@ sealfield *	SealVerify	(sealfield *Rec, mmapfile *Mmap)
 	}
 
   /* Compute digests */
-  if (!ErrorMsg)
+  if (!ErrorMsg && !SealSearch(Rec,"@predigest"))
 	{
 	// @sigdate set by SealValidateDecodeParts
 	Rec = SealDigest(Rec,Mmap);
@@ -708,20 +1295,28 @@ sealfield *	SealVerify	(sealfield *Rec, mmapfile *Mmap)
   /* Check if the decoded digest matches the known digest. */
   if (!ErrorMsg)
 	{
+	double Start = SealStatStart();
 	Rec = SealValidateSig(Rec);
+	SealStatStop(SEAL_PHASE_VERIFY,Start);
 	ErrorMsg = SealGetText(Rec,"@error");
 	}
 
   // Report any errors
-  if (ErrorMsg)
+  if (ErrorMsg) { VerifyInvalid++; }
+  else { VerifyValid++; }
+  if (SealResultJson) // collected; written when the file is done
+	{
+	SealResultVerified(Rec,signum,ErrorMsg);
+	}
+  else if (ErrorMsg)
 	{
-	printf("SEAL record #%ld is invalid: %s.\n",signum,ErrorMsg);
+	SealPrintf("SEAL record #%ld is invalid: %s.\n",signum,ErrorMsg);
 	}
   else
 	{
 	char *Txt;
 
-	printf("SEAL record #%ld is valid.\n",signum);
+	SealPrintf("SEAL record #%ld is valid.\n",signum);
 
 	if (Verbose)
 	  {
@@ -733,51 +1328,51 @@ sealfield *	SealVerify	(sealfield *Rec, mmapfile *Mmap)
 	    {
 	    rangeval = (const size_t*)(range->Value);
 	    MaxRange = range->ValueLen / sizeof(size_t);
-	    printf(" Signed bytes: ");
+	    SealPrintf(" Signed bytes: ");
 	    for(i=0; i < MaxRange; i++)
 	      {
-	      if (i%2) { printf("-%ld",(long)(rangeval[i])-1); } // end
+	      if (i%2) { SealPrintf("-%ld",(long)(rangeval[i])-1); } // end
 	      else // start
 	        {
-		if (i > 0) { printf(", "); }
-	        printf("%ld",(long)(rangeval[i]));
+		if (i > 0) { SealPrintf(", "); }
+	        SealPrintf("%ld",(long)(rangeval[i]));
 		}
 	      }
-	    printf("\n");
+	    SealPrintf("\n");
 	    }
 	  }
 
 	Txt = SealGetText(Rec,"@sigdate");
 	if (Txt && Txt[0])
 	  {
-	  printf(" Signed");
-	  printf(" %.4s-%.2s-%.2s",Txt,Txt+4,Txt+6);
-	  printf(" at %.2s:%.2s:%.2s",Txt+8,Txt+10,Txt+12);
-	  if (Txt[14]=='.') { printf("%s",Txt+14); }
-	  printf(" GMT\n");
+	  SealPrintf(" Signed");
+	  SealPrintf(" %.4s-%.2s-%.2s",Txt,Txt+4,Txt+6);
+	  SealPrintf(" at %.2s:%.2s:%.2s",Txt+8,Txt+10,Txt+12);
+	  if (Txt[14]=='.') { SealPrintf("%s",Txt+14); }
+	  SealPrintf(" GMT\n");
 	  }
 
 	Txt = SealGetText(Rec,"d");
-	printf(" Signed");
-	printf(" by %s",Txt);
+	SealPrintf(" Signed");
+	SealPrintf(" by %s",Txt);
 
 	Txt = SealGetText(Rec,"id");
 	if (Txt && Txt[0])
 	  {
-	  printf(" for %s",Txt);
+	  SealPrintf(" for %s",Txt);
 	  }
-	printf("\n");
+	SealPrintf("\n");
 
 	Txt = SealGetText(Rec,"copyright");
 	if (Txt && Txt[0])
 	  {
-	  printf(" Copyright: %s\n",Txt);
+	  SealPrintf(" Copyright: %s\n",Txt);
 	  }
 
 	Txt = SealGetText(Rec,"info");
 	if (Txt && Txt[0])
 	  {
-	  printf(" Comment: %s\n",Txt);
+	  SealPrintf(" Comment: %s\n",Txt);
 	  }
 	}
 
@@ -794,7 +1389,7 @@ bool	SealVerifyFinal	(sealfield *Rec)
   if (Rec) { return(false); }
   if (!SealGetCindex(Rec,"@sflags",1)) // signatures should cover end of file
 	{
-	printf("WARNING: SEAL records do not finalize the file. Data may be appended.\n");
+	SealPrintf("WARNING: SEAL records do not finalize the file. Data may be appended.\n");
 	return(false);
 	}
   return(true);
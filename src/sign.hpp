@@ -22,7 +22,9 @@ void	PrintDNSstring	(FILE *fp, const char *Label, sealfield *vf);
 // For key management
 #include <openssl/evp.h>
 void	SealFreePrivateKey	();
+EVP_PKEY *	SealReadPrivateKey	(sealfield *Args);
 EVP_PKEY *	SealLoadPrivateKey	(sealfield *Args);
+EVP_PKEY *	SealUsePrivateKey	(EVP_PKEY *Key);
 
 // Build a SEAL record
 sealfield *	SealRecord	(sealfield *Args);
@@ -30,23 +32,71 @@ sealfield *	SealRecord	(sealfield *Args);
 // Compute digest
 sealfield *	SealDigest	(sealfield *Rec, mmapfile *Mmap);
 sealfield *	SealDoubleDigest	(sealfield *Rec);
+void	SealDigestSeed	(mmapfile *Mmap, const EVP_MD *md, EVP_MD_CTX *Ctx, size_t End);
 
 // Sign (generic)
+const char *	SealSignName	(sealfield *Rec);
 mmapfile *	SealInsert	(sealfield *Rec, mmapfile *MmapIn, size_t InsertOffset);
-bool	SealSign	(sealfield *Rec, mmapfile *MmapOut);
+typedef void (*sealsignfixup)(sealfield *Rec, mmapfile *MmapOut); // after the signature is written
+bool	SealSign	(sealfield *Rec, mmapfile *MmapOut, sealsignfixup Fixup);
+size_t	SealSignDeferred	(sealfield *Args);
+void	SealSignFlush	();
+
+// Sign in place (-O inplace)
+#include <sys/uio.h>
+void	SealInPlaceWrite	(const char *Filename, mmapfile *MmapIn, struct iovec *Iov, size_t HeaderPos, size_t Prefix);
+void	SealInPlaceCommit	(sealfield *Rec, mmapfile *MmapOut);
+bool	SealInPlaceRecover	(const char *Filename);
+
+// Sign a stream (live recordings)
+typedef struct sealstream sealstream;
+sealstream *	SealStreamOpen	(sealfield *Args);
+void	SealStreamWrite	(sealstream *Stream, size_t Len, const byte *Data);
+bool	SealStreamSign	(sealstream *Stream, bool IsFinal);
+void	SealStreamClose	(sealstream *Stream, bool IsFinal);
 
 // Sign Local
 bool	SealIsLocal	(sealfield *Args);
+size_t	SealSignEncLen	(const char *sf, size_t SigLen, size_t DateLen);
 sealfield *	SealSignLocal	(sealfield *Args);
 
 // Sign Remote
 bool	SealIsURL	(sealfield *Args);
 sealfield *	SealSignURL	(sealfield *Args);
+sealfield *	SealSignURLSize	(sealfield *Args);
+bool	SealSignURLBatch	(sealfield **Parms, size_t Count);
+void	SealCurlFree	();
+
+// DNS cache (shared by all threads)
+#define SEAL_DNS_MAXTTL	86400 // never trust a cached key for more than a day
+#define SEAL_DNS_NEGTTL	300 // remember "no key found" for 5 minutes
+sealfield *	SealDNSCacheGet	(sealfield *Rec, const char *Key, bool *Hit);
+void	SealDNSCacheSet	(sealfield *Rec, const char *Key, uint32_t TTL);
+bool	SealDNSCacheClaim	(const char *Key, bool Wait);
+void	SealDNSCacheRelease	(const char *Key);
+void	SealDNSCacheLoad	(sealfield *Args);
+void	SealDNSCacheSave	(sealfield *Args);
+void	SealDNSCacheFree	();
+
+// Verification result cache (shared by all threads)
+#define SEAL_RESULT_TTL	86400 // revalidate cached results at least daily
+bool	SealResultCacheKey	(sealfield *Args, const char *Filename, char *Key, size_t KeyMax);
+char *	SealResultCacheGet	(const char *Key);
+void	SealResultCacheSet	(const char *Key, size_t Len, const char *Results, bool LookupFailed);
+void	SealResultCacheLoad	(sealfield *Args);
+void	SealResultCacheSave	(sealfield *Args);
+void	SealResultCacheFree	();
 
 // Verify
 sealfield *	SealGetDNS	(sealfield *Rec);
+bool	SealDNSLookupFailed	();
+#define SEAL_DNS_AHEAD	4 // files scanned ahead for their keys
+void	SealDNSPrefetchFile	(sealfield *Args, const char *Filename);
 sealfield *	SealRotateRecords	(sealfield *Rec);
+bool	SealVerifyFields	(sealfield **Rec);
 sealfield *	SealVerify	(sealfield *Rec, mmapfile *Mmap);
+void	SealVerifyCount	(long *Valid, long *Invalid);
+void	SealVerifyCacheFree	();
 bool	SealVerifyFinal	(sealfield *Rec);
 
 #endif
@@ -0,0 +1,254 @@
+/************************************************
+ SEAL: Run statistics.
+ See LICENSE
+
+ With --stats, sealtool times the phases of each file (mapping,
+ format detection, parsing, DNS, digests, signature checks,
+ inserting records, and remote signing) and counts the work done
+ (bytes hashed, DNS queries and cache hits, remote signer round
+ trips, and records per format).
+
+ Each thread collects into its own totals.  When a file finishes,
+ SealStatsFile() merges them into the run totals and records the
+ file's own numbers.  Helper threads (DNS prefetch, remote signer
+ pipeline) merge with a NULL filename when they exit.
+
+ The report is JSON, written to stderr at the end of the run so
+ it never mixes with the per-file results on stdout:
+   {
+   "run": { "files":N, "ms":wall, "phases":{...}, "counters":{...} },
+   "files": [ { "file":name, "ms":total, "phases":{...}, "counters":{...} }, ... ]
+   }
+ Each phase is { "ms":time, "calls":count }.
+ Per-file entries omit phases and counters that are zero.
+ Only the slowest STATS_FILES files are listed (slowest first),
+ so a long run's report (and memory) stays bounded.
+ ************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "seal.hpp"
+#include "stats.hpp"
+#include "cJSON/cJSON.h"
+
+bool SealStatsOn=false;
+
+#pragma GCC visibility push(hidden)
+typedef struct
+  {
+  double Time[SEAL_PHASE_MAX]; // nanoseconds
+  uint64_t Calls[SEAL_PHASE_MAX];
+  uint64_t Count[SEAL_COUNT_MAX];
+  } sealstats;
+
+static const char *StatsPhaseName[SEAL_PHASE_MAX] = {
+  "mmap", "detect", "parse", "dns", "digest", "verify", "insert", "signurl" };
+static const char *StatsCountName[SEAL_COUNT_MAX] = {
+  "bytes_hashed", "dns_queries", "dns_cache_hits", "curl_requests", "result_cache_hits",
+  "records_png", "records_jpeg", "records_riff", "records_matroska" };
+
+#define STATS_FILES 100 // files listed in the report
+
+typedef struct
+  {
+  char *Filename;
+  double Ms;
+  sealstats Stats;
+  } sealstatsfile;
+
+static __thread sealstats StatsThread; // current thread (and file)
+static sealstats StatsRun; // merged totals
+static uint64_t StatsFiles=0;
+static double StatsStart=0;
+static sealstatsfile StatsFileList[STATS_FILES]; // the slowest files
+static int StatsFileCount=0;
+static int StatsFileMin=0; // the fastest of the listed files
+static pthread_mutex_t StatsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/********************************************************
+ _SealStatsJson(): Convert totals to JSON.
+ If Sparse, then zero values are skipped.
+ ********************************************************/
+void	_SealStatsJson	(cJSON *Obj, sealstats *S, bool Sparse)
+{
+  cJSON *Phases, *Phase, *Counters;
+  int i;
+
+  Phases = cJSON_AddObjectToObject(Obj,"phases");
+  for(i=0; i < SEAL_PHASE_MAX; i++)
+    {
+    if (Sparse && !S->Calls[i]) { continue; }
+    Phase = cJSON_AddObjectToObject(Phases,StatsPhaseName[i]);
+    cJSON_AddNumberToObject(Phase,"ms",S->Time[i]/1e6);
+    cJSON_AddNumberToObject(Phase,"calls",(double)S->Calls[i]);
+    }
+  Counters = cJSON_AddObjectToObject(Obj,"counters");
+  for(i=0; i < SEAL_COUNT_MAX; i++)
+    {
+    if (Sparse && !S->Count[i]) { continue; }
+    cJSON_AddNumberToObject(Counters,StatsCountName[i],(double)S->Count[i]);
+    }
+} /* _SealStatsJson() */
+
+/********************************************************
+ _SealStatsKeep(): Add a file to the list if it is one of the
+ slowest.  Lock must be held by the caller.
+ ********************************************************/
+void	_SealStatsKeep	(const char *Filename, double Ms, sealstats *S)
+{
+  sealstatsfile *F;
+  int i;
+
+  if (StatsFileCount < STATS_FILES) { F = &StatsFileList[StatsFileCount++]; }
+  else if (Ms > StatsFileList[StatsFileMin].Ms) { F = &StatsFileList[StatsFileMin]; free(F->Filename); }
+  else { return; } // faster than every listed file
+  F->Filename = strdup(Filename);
+  F->Ms = Ms;
+  F->Stats = *S;
+
+  // Find the next one to replace
+  for(i=0; i < StatsFileCount; i++)
+    {
+    if (StatsFileList[i].Ms < StatsFileList[StatsFileMin].Ms) { StatsFileMin=i; }
+    }
+} /* _SealStatsKeep() */
+
+/********************************************************
+ _SealStatsSlower(): qsort() order for the report.
+ ********************************************************/
+int	_SealStatsSlower	(const void *A, const void *B)
+{
+  double a = ((const sealstatsfile*)A)->Ms, b = ((const sealstatsfile*)B)->Ms;
+  return((a < b) ? 1 : ((a > b) ? -1 : 0));
+} /* _SealStatsSlower() */
+#pragma GCC visibility pop
+
+/********************************************************
+ _SealStatNow(): Monotonic time in nanoseconds.
+ ********************************************************/
+double	_SealStatNow	()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return((double)ts.tv_sec*1e9 + (double)ts.tv_nsec);
+} /* _SealStatNow() */
+
+/********************************************************
+ _SealStatAdd(): Add the time since Start to a phase.
+ Use SealStatStop(); it skips this when --stats is off.
+ ********************************************************/
+void	_SealStatAdd	(sealphase Phase, double Start)
+{
+  StatsThread.Time[Phase] += _SealStatNow() - Start;
+  StatsThread.Calls[Phase]++;
+} /* _SealStatAdd() */
+
+/********************************************************
+ _SealStatInc(): Add to a counter.
+ Use SealStatInc(); it skips this when --stats is off.
+ ********************************************************/
+void	_SealStatInc	(sealcount Counter, uint64_t Num)
+{
+  StatsThread.Count[Counter] += Num;
+} /* _SealStatInc() */
+
+/********************************************************
+ SealStatsInit(): Enable statistics if 'stats' is set.
+ ********************************************************/
+void	SealStatsInit	(sealfield *Args)
+{
+  if (!SealGetText(Args,"stats")) { return; }
+  SealStatsOn=true;
+  StatsStart = _SealStatNow();
+  memset(&StatsRun,0,sizeof(StatsRun));
+  StatsFiles=0;
+  StatsFileCount=0;
+  StatsFileMin=0;
+} /* SealStatsInit() */
+
+/********************************************************
+ SealStatsFile(): Merge this thread's totals into the run.
+ If Filename is set, then record the file's own numbers;
+ Start is when the file began (from SealStatStart).
+ ********************************************************/
+void	SealStatsFile	(const char *Filename, double Start)
+{
+  double Ms=0;
+  int i;
+
+  if (!SealStatsOn) { return; }
+  if (Filename) { Ms = (_SealStatNow()-Start)/1e6; }
+
+  pthread_mutex_lock(&StatsLock);
+  for(i=0; i < SEAL_PHASE_MAX; i++)
+    {
+    StatsRun.Time[i] += StatsThread.Time[i];
+    StatsRun.Calls[i] += StatsThread.Calls[i];
+    }
+  for(i=0; i < SEAL_COUNT_MAX; i++) { StatsRun.Count[i] += StatsThread.Count[i]; }
+  if (Filename) { _SealStatsKeep(Filename,Ms,&StatsThread); StatsFiles++; }
+  pthread_mutex_unlock(&StatsLock);
+
+  memset(&StatsThread,0,sizeof(StatsThread));
+} /* SealStatsFile() */
+
+/********************************************************
+ SealStatsDiscard(): Drop this thread's unmerged totals.
+ For work that is repeated later (e.g., walking a file to
+ prefetch its keys), so it is not counted twice.
+ ********************************************************/
+void	SealStatsDiscard	()
+{
+  memset(&StatsThread,0,sizeof(StatsThread));
+} /* SealStatsDiscard() */
+
+/********************************************************
+ SealStatsPrint(): Write the JSON report.
+ Call after every thread has finished.
+ ********************************************************/
+void	SealStatsPrint	(FILE *fp)
+{
+  cJSON *Report, *Run, *Files, *File;
+  char *Str;
+  int i;
+
+  if (!SealStatsOn) { return; }
+  SealStatsFile(NULL,0); // anything done by the main thread outside of a file
+
+  Report = cJSON_CreateObject();
+  Run = cJSON_AddObjectToObject(Report,"run");
+  cJSON_AddNumberToObject(Run,"files",(double)StatsFiles);
+  cJSON_AddNumberToObject(Run,"ms",(_SealStatNow()-StatsStart)/1e6);
+  _SealStatsJson(Run,&StatsRun,false);
+  Files = cJSON_AddArrayToObject(Report,"files");
+  qsort(StatsFileList,StatsFileCount,sizeof(sealstatsfile),_SealStatsSlower);
+  for(i=0; i < StatsFileCount; i++)
+    {
+    File = cJSON_CreateObject();
+    cJSON_AddStringToObject(File,"file",StatsFileList[i].Filename);
+    cJSON_AddNumberToObject(File,"ms",StatsFileList[i].Ms);
+    _SealStatsJson(File,&StatsFileList[i].Stats,true);
+    cJSON_AddItemToArray(Files,File);
+    }
+
+  Str = cJSON_Print(Report);
+  if (Str) { fprintf(fp,"%s\n",Str); cJSON_free(Str); }
+  cJSON_Delete(Report);
+} /* SealStatsPrint() */
+
+/********************************************************
+ SealStatsFree(): Release the report.
+ ********************************************************/
+void	SealStatsFree	()
+{
+  int i;
+
+  for(i=0; i < StatsFileCount; i++) { free(StatsFileList[i].Filename); }
+  StatsFileCount=0;
+  SealStatsOn=false;
+} /* SealStatsFree() */
+
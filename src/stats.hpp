@@ -0,0 +1,66 @@
+/************************************************
+ SEAL: implemented in C
+ See LICENSE
+
+ Run statistics: phase timers and counters (--stats).
+ ************************************************/
+#ifndef STATS_HPP
+#define STATS_HPP
+
+// C headers
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "seal.hpp"
+
+// Timed phases
+typedef enum
+  {
+  SEAL_PHASE_MMAP=0, // open and map the file
+  SEAL_PHASE_DETECT, // identify the format
+  SEAL_PHASE_PARSE, // SealParse()
+  SEAL_PHASE_DNS, // waiting for public keys
+  SEAL_PHASE_DIGEST, // SealDigest()
+  SEAL_PHASE_VERIFY, // SealValidateSig()
+  SEAL_PHASE_INSERT, // SealInsert()
+  SEAL_PHASE_SIGNURL, // remote signer requests
+  SEAL_PHASE_MAX
+  } sealphase;
+
+// Counters
+typedef enum
+  {
+  SEAL_COUNT_HASHED=0, // bytes hashed
+  SEAL_COUNT_DNSQUERY, // DNS queries sent
+  SEAL_COUNT_DNSHIT, // public keys found in the cache
+  SEAL_COUNT_CURL, // remote signer round trips
+  SEAL_COUNT_RESULTHIT, // verification results reused (--verifycachefile)
+  SEAL_COUNT_REC_PNG, // SEAL records found, per format
+  SEAL_COUNT_REC_JPEG,
+  SEAL_COUNT_REC_RIFF,
+  SEAL_COUNT_REC_MATROSKA,
+  SEAL_COUNT_MAX
+  } sealcount;
+
+/*****
+ Every call is cheap when --stats is off: one test of SealStatsOn.
+ Statistics are collected per thread and merged when each file
+ finishes (SealStatsFile), so there is no locking on the hot path.
+ *****/
+extern bool SealStatsOn;
+double	_SealStatNow	();
+void	_SealStatAdd	(sealphase Phase, double Start);
+void	_SealStatInc	(sealcount Counter, uint64_t Num);
+
+static inline double	SealStatStart	() { return(SealStatsOn ? _SealStatNow() : 0); }
+static inline void	SealStatStop	(sealphase Phase, double Start) { if (SealStatsOn) { _SealStatAdd(Phase,Start); } }
+static inline void	SealStatInc	(sealcount Counter, uint64_t Num) { if (SealStatsOn) { _SealStatInc(Counter,Num); } }
+
+void	SealStatsInit	(sealfield *Args);
+void	SealStatsFile	(const char *Filename, double Start);
+void	SealStatsDiscard	();
+void	SealStatsPrint	(FILE *fp);
+void	SealStatsFree	();
+
+#endif